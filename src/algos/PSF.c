@@ -20,6 +20,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <float.h>
 #include <math.h>
 #include <gsl/gsl_statistics_double.h>
 #include <gsl/gsl_matrix.h>
@@ -44,6 +46,7 @@
 
 #define MAX_ITER_NO_ANGLE  10		//Number of iteration in the minimization with no angle
 #define MAX_ITER_ANGLE     10		//Number of iteration in the minimization with angle
+#define MAX_ITER_FAST      20		//Number of iteration in the fast minimization
 #define EPSILON            0.001
 
 const double radian_conversion = ((3600.0 * 180.0) / M_PI) / 1.0E3;
@@ -691,6 +694,244 @@ psf_star *psf_global_minimisation(gsl_matrix* z, double bg,
 	return psf;
 }
 
+/* Fast fit of the Gaussian without angle, for registration and star
+ * detection, where only the position, the FWHM and the roundness matter.
+ * The window is small, so the whole fit is done on the stack: initial values
+ * come from the moments of the window above the background, then a damped
+ * Gauss-Newton minimization is run with the 6x6 normal equations.
+ * Data z is NbRows x NbCols, row major, in the same layout as the gsl_matrix
+ * given to psf_global_minimisation(), of at most PSF_FAST_MAX_SIZE squared.
+ */
+
+/* model values and residuals of a row, in a vectorized loop */
+static void psf_fast_row(const float *z, int NbCols, double y, const double p[6],
+		double *e, double *res) {
+	double isx = 1.0 / p[4], isy = 1.0 / p[5];
+	double dy2 = SQR(y - p[3]) * isy;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+	for (int j = 0; j < NbCols; j++) {
+		double dx = j + 1 - p[2];
+		e[j] = exp(-(dx * dx * isx + dy2));
+		res[j] = p[0] + p[1] * e[j] - z[j];
+	}
+}
+
+static double psf_fast_cost(const float *z, int NbRows, int NbCols, const double p[6]) {
+	double e[PSF_FAST_MAX_SIZE], res[PSF_FAST_MAX_SIZE], cost = 0.0;
+	for (int i = 0; i < NbRows; i++) {
+		psf_fast_row(z + i * NbCols, NbCols, i + 1, p, e, res);
+		for (int j = 0; j < NbCols; j++)
+			cost += res[j] * res[j];
+	}
+	return cost;
+}
+
+/* returns the cost and fills the normal equations J^T.J and J^T.r */
+static double psf_fast_normal_equations(const float *z, int NbRows, int NbCols,
+		const double p[6], double jtj[6][6], double jtr[6]) {
+	double e[PSF_FAST_MAX_SIZE], res[PSF_FAST_MAX_SIZE], cost = 0.0;
+	memset(jtj, 0, 36 * sizeof(double));
+	memset(jtr, 0, 6 * sizeof(double));
+	for (int i = 0; i < NbRows; i++) {
+		double y = i + 1;
+		psf_fast_row(z + i * NbCols, NbCols, y, p, e, res);
+		for (int j = 0; j < NbCols; j++) {
+			double dx = j + 1 - p[2], dy = y - p[3];
+			double ae = p[1] * e[j];
+			double d[6] = { 1.0, e[j], ae * 2.0 * dx / p[4], ae * 2.0 * dy / p[5],
+				ae * dx * dx / SQR(p[4]), ae * dy * dy / SQR(p[5]) };
+			for (int k = 0; k < 6; k++) {
+				jtr[k] += d[k] * res[j];
+				for (int l = 0; l <= k; l++)
+					jtj[k][l] += d[k] * d[l];
+			}
+			cost += res[j] * res[j];
+		}
+	}
+	for (int k = 0; k < 6; k++)
+		for (int l = k + 1; l < 6; l++)
+			jtj[k][l] = jtj[l][k];
+	return cost;
+}
+
+/* Cholesky decomposition in place of the lower part, FALSE if not positive */
+static gboolean psf_fast_cholesky(double a[6][6]) {
+	for (int k = 0; k < 6; k++) {
+		double sum = a[k][k];
+		for (int l = 0; l < k; l++)
+			sum -= a[k][l] * a[k][l];
+		if (sum <= 0.0)
+			return FALSE;
+		a[k][k] = sqrt(sum);
+		for (int i = k + 1; i < 6; i++) {
+			double v = a[i][k];
+			for (int l = 0; l < k; l++)
+				v -= a[i][l] * a[k][l];
+			a[i][k] = v / a[k][k];
+		}
+	}
+	return TRUE;
+}
+
+static void psf_fast_solve(double l[6][6], const double b[6], double x[6]) {
+	double y[6];
+	for (int i = 0; i < 6; i++) {
+		double v = b[i];
+		for (int k = 0; k < i; k++)
+			v -= l[i][k] * y[k];
+		y[i] = v / l[i][i];
+	}
+	for (int i = 5; i >= 0; i--) {
+		double v = y[i];
+		for (int k = i + 1; k < 6; k++)
+			v -= l[k][i] * x[k];
+		x[i] = v / l[i][i];
+	}
+}
+
+/* initial values from the moments of the signal above the background */
+static gboolean psf_fast_init(const float *z, int NbRows, int NbCols, double bg, double p[6]) {
+	double sum = 0.0, sx = 0.0, sy = 0.0, maxi = -DBL_MAX;
+	for (int i = 0; i < NbRows; i++) {
+		for (int j = 0; j < NbCols; j++) {
+			double v = z[i * NbCols + j] - bg;
+			maxi = max(maxi, v);
+			if (v > 0.0) {
+				sum += v;
+				sx += v * (j + 1);
+				sy += v * (i + 1);
+			}
+		}
+	}
+	if (sum <= 0.0 || maxi <= 0.0)
+		return FALSE;
+	double x0 = sx / sum, y0 = sy / sum, vx = 0.0, vy = 0.0;
+	for (int i = 0; i < NbRows; i++) {
+		for (int j = 0; j < NbCols; j++) {
+			double v = z[i * NbCols + j] - bg;
+			if (v > 0.0) {
+				vx += v * SQR(j + 1 - x0);
+				vy += v * SQR(i + 1 - y0);
+			}
+		}
+	}
+	p[0] = bg;
+	p[1] = maxi;
+	p[2] = x0;
+	p[3] = y0;
+	// the model is exp(-dx^2 / SX), SX is twice the variance
+	p[4] = max(2.0 * vx / sum, 0.5);
+	p[5] = max(2.0 * vy / sum, 0.5);
+	return TRUE;
+}
+
+psf_star *psf_fast_minimisation(const float *z, int NbRows, int NbCols, double bg) {
+	const int n = NbRows * NbCols;
+	double p[6], jtj[6][6], jtr[6], a[6][6], delta[6], trial[6];
+	if (NbRows > PSF_FAST_MAX_SIZE || NbCols > PSF_FAST_MAX_SIZE || n <= 6)
+		return NULL;
+	if (!psf_fast_init(z, NbRows, NbCols, bg, p))
+		return NULL;
+
+	double lambda = 1e-3;
+	double cost = psf_fast_normal_equations(z, NbRows, NbCols, p, jtj, jtr);
+	for (int iter = 0; iter < MAX_ITER_FAST; iter++) {
+		gboolean accepted = FALSE, converged = TRUE;
+		while (!accepted && lambda < 1e10) {
+			memcpy(a, jtj, sizeof(a));
+			for (int k = 0; k < 6; k++)
+				a[k][k] += lambda * jtj[k][k];
+			if (!psf_fast_cholesky(a)) {
+				lambda *= 10.0;
+				continue;
+			}
+			psf_fast_solve(a, jtr, delta);
+			for (int k = 0; k < 6; k++)
+				trial[k] = p[k] - delta[k];
+			double trial_cost = (trial[1] > 0.0 && trial[4] > 0.0 && trial[5] > 0.0) ?
+				psf_fast_cost(z, NbRows, NbCols, trial) : DBL_MAX;
+			if (trial_cost < cost) {
+				accepted = TRUE;
+				lambda = max(lambda * 0.1, 1e-7);
+			} else {
+				lambda *= 10.0;
+			}
+		}
+		if (!accepted)
+			break;
+		// same test as gsl_multifit_test_delta(dx, x, 1e-4, 1e-4)
+		for (int k = 0; k < 6; k++)
+			if (fabs(delta[k]) >= 1e-4 + 1e-4 * fabs(trial[k]))
+				converged = FALSE;
+		memcpy(p, trial, sizeof(p));
+		cost = psf_fast_normal_equations(z, NbRows, NbCols, p, jtj, jtr);
+		if (converged)
+			break;
+	}
+
+	/* covariance diagonal, without scaling by the residuals as in
+	 * gsl_multifit_covar() */
+	double var[6] = { 0.0 };
+	memcpy(a, jtj, sizeof(a));
+	if (psf_fast_cholesky(a)) {
+		for (int k = 0; k < 6; k++) {
+			double unit[6] = { 0.0 }, col[6];
+			unit[k] = 1.0;
+			psf_fast_solve(a, unit, col);
+			var[k] = col[k];
+		}
+	}
+
+	if (p[4] <= 0.0 || p[5] <= 0.0)
+		return NULL;
+	psf_star *psf = new_psf_star();
+	if (!psf) {
+		PRINT_ALLOC_ERR;
+		return NULL;
+	}
+	psf->B = p[0];
+	psf->A = p[1];
+	psf->x0 = p[2];
+	psf->y0 = p[3];
+	psf->sx = p[4];
+	psf->sy = p[5];
+	psf->fwhmx = sqrt(p[4] / 2.) * 2 * sqrt(log(2.) * 2);
+	psf->fwhmy = sqrt(p[5] / 2.) * 2 * sqrt(log(2.) * 2);
+	psf->fwhmx_arcsec = -1.0;
+	psf->fwhmy_arcsec = -1.0;
+	psf->angle = 0;
+	psf->units = "px";
+	double intensity = 1.0;
+	for (int i = 0; i < n; i++)
+		intensity += z[i] - p[0];
+	psf->mag = -2.5 * log10(intensity);
+	psf->phot_is_valid = FALSE;
+	psf->rmse = sqrt(cost / n);
+	psf->B_err = sqrt(var[0]) / p[0];
+	psf->A_err = sqrt(var[1]) / p[1];
+	psf->x_err = sqrt(var[2]) / p[2];
+	psf->y_err = sqrt(var[3]) / p[3];
+	psf->sx_err = sqrt(var[4]) / p[4];
+	psf->sy_err = sqrt(var[5]) / p[5];
+	psf->ang_err = 0;
+	psf->xpos = 0;		// will be set by the peaker
+	psf->ypos = 0;
+
+	// same conventions and checks as psf_global_minimisation()
+	if (psf->sy > psf->sx) {
+		SWAP(psf->sx, psf->sy);
+		SWAP(psf->fwhmx, psf->fwhmy);
+	}
+	if (!isfinite(psf->fwhmx) || !isfinite(psf->fwhmy) ||
+			psf->fwhmx <= 0.0 || psf->fwhmy <= 0.0) {
+		free_psf(psf);
+		return NULL;
+	}
+	return psf;
+}
+
 void psf_display_result(psf_star *result, rectangle *area) {
 	char *buffer, *coordinates;
 	char *str;
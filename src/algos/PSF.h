@@ -6,6 +6,8 @@
 
 //in siril.h: typedef struct fwhm_struct psf_star;
 
+#define PSF_FAST_MAX_SIZE 64	// maximum size of the window for psf_fast_minimisation()
+
 struct fwhm_struct {
 	double B; /* average sky background value */
 	double A; /* amplitude */
@@ -45,6 +47,7 @@ struct PSF_data {
 double psf_get_fwhm(fits *fit, int layer, rectangle *selection, double *roundness);
 psf_star *psf_get_minimisation(fits *, int, rectangle *, gboolean, gboolean, gboolean);
 psf_star *psf_global_minimisation(gsl_matrix *, double, gboolean, gboolean, gboolean);
+psf_star *psf_fast_minimisation(const float *z, int NbRows, int NbCols, double bg);
 void psf_display_result(psf_star *, rectangle *);
 void fwhm_to_arcsec_if_needed(fits*, psf_star*);
 void fwhm_to_pixels(psf_star *result);
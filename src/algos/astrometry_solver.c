@@ -1625,7 +1625,7 @@ gpointer match_catalog(gpointer p) {
 	args->ret = 1;
 	int attempt = 1;
 	while (args->ret && attempt < NB_OF_MATCHING_TRY) {
-		args->ret = new_star_match(com.stars, cstars, n, nobj, scale_min,
+		args->ret = new_star_match(com.stars, cstars, NULL, n, nobj, scale_min,
 				scale_max, &H, args->for_photometry_cc,
 				FULLAFFINE_TRANSFORMATION, &star_list_A, &star_list_B);
 		if (attempt == 1) {
@@ -419,49 +419,36 @@ double BV_to_T(double BV) {
 }
 
 int equalize_cfa_fit_with_coeffs(fits *fit, float coeff1, float coeff2, int config) {
-	unsigned int row, col;
-	float tmp1, tmp2;
+	const int width = fit->rx;
+	/* offsets in the 2x2 cell of the two pixels to scale */
+	const int off1 = config == 0 ? 1 : 0;
+	const int off2 = config == 0 ? width : 1 + width;
 	if (fit->type == DATA_USHORT) {
 		WORD *data = fit->data;
-		for (row = 0; row < fit->ry - 1; row += 2) {
-			for (col = 0; col < fit->rx - 1; col += 2) {
-				if (config == 0) {
-					tmp1 = (float)data[1 + col + row * fit->rx] / coeff1;
-					data[1 + col + row * fit->rx] = round_to_WORD(tmp1);
-
-					tmp2 = (float)data[col + (1 + row) * fit->rx] / coeff2;
-					data[col + (1 + row) * fit->rx] = round_to_WORD(tmp2);
-
-				} else {
-					tmp1 = (float)data[col + row * fit->rx] / coeff1;
-					data[col + row * fit->rx] = round_to_WORD(tmp1);
-
-					tmp2 = (float)data[1 + col + (1 + row) * fit->rx] / coeff2;
-					data[1 + col + (1 + row) * fit->rx] = round_to_WORD(tmp2);
-
-				}
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static)
+#endif
+		for (int row = 0; row < fit->ry - 1; row += 2) {
+			WORD *line = data + (size_t) row * width;
+			for (int col = 0; col < width - 1; col += 2) {
+				float tmp1 = (float)line[col + off1] / coeff1;
+				line[col + off1] = round_to_WORD(tmp1);
+
+				float tmp2 = (float)line[col + off2] / coeff2;
+				line[col + off2] = round_to_WORD(tmp2);
 			}
 		}
 	}
 	else if (fit->type == DATA_FLOAT) {
 		float *data = fit->fdata;
-		for (row = 0; row < fit->ry - 1; row += 2) {
-			for (col = 0; col < fit->rx - 1; col += 2) {
-				if (config == 0) {
-					tmp1 = data[1 + col + row * fit->rx] / coeff1;
-					data[1 + col + row * fit->rx] = tmp1;
-
-					tmp2 = data[col + (1 + row) * fit->rx] / coeff2;
-					data[col + (1 + row) * fit->rx] = tmp2;
-
-				} else {
-					tmp1 = data[col + row * fit->rx] / coeff1;
-					data[col + row * fit->rx] = tmp1;
-
-					tmp2 = data[1 + col + (1 + row) * fit->rx] / coeff2;
-					data[1 + col + (1 + row) * fit->rx] = tmp2;
-
-				}
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static)
+#endif
+		for (int row = 0; row < fit->ry - 1; row += 2) {
+			float *line = data + (size_t) row * width;
+			for (int col = 0; col < width - 1; col += 2) {
+				line[col + off1] = line[col + off1] / coeff1;
+				line[col + off2] = line[col + off2] / coeff2;
 			}
 		}
 	}
@@ -85,8 +85,11 @@ static inline int FC(const size_t row, const size_t col, const uint32_t filters)
 /* width and height are sizes of the original image */
 static void super_pixel_ushort(const WORD *buf, WORD *newbuf, int width, int height,
 		sensor_pattern pattern) {
-	long i = 0;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static)
+#endif
 	for (int row = 0; row < height - 1; row += 2) {
+		long i = (long)(row / 2) * (width / 2) * 3;
 		for (int col = 0; col < width - 1; col += 2) {
 			float tmp;
 			switch (pattern) {
@@ -128,8 +131,11 @@ static void super_pixel_ushort(const WORD *buf, WORD *newbuf, int width, int hei
 /* width and height are sizes of the original image */
 static void super_pixel_float(const float *buf, float *newbuf, int width, int height,
 		sensor_pattern pattern) {
-	long i = 0;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static)
+#endif
 	for (int row = 0; row < height - 1; row += 2) {
+		long i = (long)(row / 2) * (width / 2) * 3;
 		for (int col = 0; col < width - 1; col += 2) {
 			float tmp;
 			switch (pattern) {
@@ -970,7 +976,50 @@ WORD *debayer_buffer(WORD *buf, int *width, int *height,
 		interpolation_method interpolation, sensor_pattern pattern, int bit_depth) {
 	if (USE_SIRIL_DEBAYER)
 		return debayer_buffer_siril(buf, width, height, interpolation, pattern, NULL, bit_depth);
-	return debayer_buffer_new_ushort(buf, width, height, interpolation, pattern, NULL, bit_depth);
+	return debayer_buffer_new_ushort(buf, width, height, interpolation, pattern, NULL, bit_depth, FALSE);
+}
+
+/* Interpolates only the channel layer of a CFA buffer in the area, for partial
+ * reads that need one plane: a pixel of this color keeps its value, the others
+ * get the average of the pixels of this color in their 3x3 neighbourhood,
+ * which is the bilinear demosaicing. The CFA buffer is top-down, its first
+ * pixel being the first of the pattern, out has the size of the area. */
+int debayer_plane_area(const WORD *cfa, int width, int height, sensor_pattern pattern,
+		int layer, const rectangle *area, WORD *out) {
+	int colors[2][2];
+
+	if (pattern < BAYER_FILTER_MIN || pattern > BAYER_FILTER_MAX || layer < 0 || layer > 2)
+		return -1;
+	for (int i = 0; i < 4; i++) {
+		char c = filter_pattern[pattern][i];
+		colors[i / 2][i % 2] = c == 'R' ? RLAYER : (c == 'G' ? GLAYER : BLAYER);
+	}
+
+	for (int y = 0; y < area->h; y++) {
+		const int cy = area->y + y;
+		const int y0 = max(cy - 1, 0), y1 = min(cy + 1, height - 1);
+		WORD *dst = out + (size_t)y * area->w;
+		for (int x = 0; x < area->w; x++) {
+			const int cx = area->x + x;
+			if (colors[cy & 1][cx & 1] == layer) {
+				dst[x] = cfa[(size_t)cy * width + cx];
+				continue;
+			}
+			const int x0 = max(cx - 1, 0), x1 = min(cx + 1, width - 1);
+			unsigned int sum = 0, n = 0;
+			for (int j = y0; j <= y1; j++) {
+				const WORD *row = cfa + (size_t)j * width;
+				for (int i = x0; i <= x1; i++) {
+					if (colors[j & 1][i & 1] == layer) {
+						sum += row[i];
+						n++;
+					}
+				}
+			}
+			dst[x] = n ? (sum + n / 2) / n : 0;
+		}
+	}
+	return 0;
 }
 
 float *debayer_buffer_superpixel_float(float *buf, int *width, int *height, sensor_pattern pattern) {
@@ -1082,7 +1131,8 @@ static int debayer_ushort(fits *fit, interpolation_method interpolation, sensor_
 				top_down = FALSE;
 			}
 		}
-		if (!top_down)
+		/* librtprocess reads the rows in reverse order instead */
+		if (!top_down && USE_SIRIL_DEBAYER)
 			fits_flip_top_to_bottom(fit); // TODO: kind of ugly but not easy with xtrans
 		retrieve_XTRANS_pattern(fit->bayer_pattern, xtrans);
 	} else {
@@ -1115,14 +1165,12 @@ static int debayer_ushort(fits *fit, interpolation_method interpolation, sensor_
 		}
 	} else {
 		// use librtprocess debayer
-		WORD *newbuf = debayer_buffer_new_ushort(buf, &width, &height, interpolation, pattern, xtrans, fit->bitpix);
+		WORD *newbuf = debayer_buffer_new_ushort(buf, &width, &height, interpolation, pattern, xtrans, fit->bitpix,
+				interpolation == XTRANS && !top_down);
 		if (!newbuf)
 			return 1;
 
 		fit_debayer_buffer(fit, newbuf);
-		if (interpolation == XTRANS && !top_down) {
-			fits_flip_top_to_bottom(fit);
-		}
 	}
 	/* we remove Bayer header because not needed now */
 	clear_Bayer_information(fit);
@@ -1144,21 +1192,19 @@ static int debayer_float(fits* fit, interpolation_method interpolation, sensor_p
 				top_down = FALSE;
 			}
 		}
-		if (!top_down)
-			fits_flip_top_to_bottom(fit); // TODO: kind of ugly but not easy with xtrans
 		retrieve_XTRANS_pattern(fit->bayer_pattern, xtrans);
 	} else {
 		retrieve_Bayer_pattern(fit, &pattern);
 	}
 
-	float *newbuf = debayer_buffer_new_float(buf, &width, &height, interpolation, pattern, xtrans);
+	/* for X-Trans, librtprocess reads the rows in reverse order instead of
+	 * flipping the image */
+	float *newbuf = debayer_buffer_new_float(buf, &width, &height, interpolation, pattern, xtrans,
+			interpolation == XTRANS && !top_down);
 	if (!newbuf)
 		return 1;
 
 	fit_debayer_buffer(fit, newbuf);
-	if (interpolation == XTRANS && !top_down) {
-		fits_flip_top_to_bottom(fit);
-	}
 	/* we remove Bayer header because not needed now */
 	clear_Bayer_information(fit);
 	return 0;
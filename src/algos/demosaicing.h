@@ -24,16 +24,20 @@ void clear_Bayer_information(fits *fit);
 void get_debayer_area(const rectangle *area, rectangle *debayer_area,
 		const rectangle *image_area, int *debayer_offset_x,
 		int *debayer_offset_y);
+int debayer_plane_area(const WORD *cfa, int width, int height, sensor_pattern pattern,
+		int layer, const rectangle *area, WORD *out);
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 /* from demosaicing_rtp.cpp */
 WORD *debayer_buffer_new_ushort(WORD *buf, int *width, int *height,
-		interpolation_method interpolation, sensor_pattern pattern, unsigned int xtrans[6][6], int bit_depth);
+		interpolation_method interpolation, sensor_pattern pattern, unsigned int xtrans[6][6], int bit_depth,
+		gboolean bottom_up);
 
 float *debayer_buffer_new_float(float *buf, int *width, int *height,
-		interpolation_method interpolation, sensor_pattern pattern, unsigned int xtrans[6][6]);
+		interpolation_method interpolation, sensor_pattern pattern, unsigned int xtrans[6][6],
+		gboolean bottom_up);
 #ifdef __cplusplus
 }
 #endif
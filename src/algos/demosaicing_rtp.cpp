@@ -71,8 +71,18 @@ static bool progress(double p) {
 	return true;
 }
 
+/* Sets the row pointers of an image of ry rows of rx pixels. When bottom_up is
+ * set, the rows of data are stored bottom-up and the pointers give them
+ * top-down, so that the X-Trans pattern can be applied without flipping the
+ * image before and after demosaicing. */
+static void set_row_pointers(float **rows, float *data, int rx, int ry, gboolean bottom_up) {
+	for (int i = 0; i < ry; i++)
+		rows[i] = data + (size_t)(bottom_up ? ry - 1 - i : i) * rx;
+}
+
 WORD *debayer_buffer_new_ushort(WORD *buf, int *width, int *height,
-		interpolation_method interpolation, sensor_pattern pattern, unsigned int xtrans[6][6], int bit_depth) {
+		interpolation_method interpolation, sensor_pattern pattern, unsigned int xtrans[6][6], int bit_depth,
+		gboolean bottom_up) {
 
 	// super-pixel is handled by siril code, not librtprocess
 	if (interpolation == BAYER_SUPER_PIXEL)
@@ -80,7 +90,7 @@ WORD *debayer_buffer_new_ushort(WORD *buf, int *width, int *height,
 
 	unsigned int cfarray[2][2];
 	float rgb_cam[3][4] = { 1.0f };	// our white balance: we don't care
-	int i, rx = *width, ry = *height;
+	int rx = *width, ry = *height;
 	long j, nbpixels = rx * ry;
 	long n = nbpixels * 3;
 	// 1. convert input data to float (memory size: 2 times original)
@@ -89,18 +99,19 @@ WORD *debayer_buffer_new_ushort(WORD *buf, int *width, int *height,
 		PRINT_ALLOC_ERR;
 		return NULL;
 	}
-	rawdata[0] = (float *)malloc(nbpixels * sizeof(float));
-	if (!rawdata[0]) {
+	float *rawbuf = (float *)malloc(nbpixels * sizeof(float));
+	if (!rawbuf) {
 		PRINT_ALLOC_ERR;
 		free(rawdata);
 		return NULL;
 	}
-	// TODO: vectorize!
+#ifdef _OPENMP
+#pragma omp parallel for simd num_threads(com.max_thread) schedule(static)
+#endif
 	for (j = 0; j < nbpixels; j++)
-		rawdata[0][j] = (float)buf[j];
+		rawbuf[j] = (float)buf[j];
 
-	for (i = 1; i < ry; i++)
-		rawdata[i] = rawdata[i - 1] + rx;
+	set_row_pointers(rawdata, rawbuf, rx, ry, bottom_up);
 
 	// 2. allocate the demosaiced image buffer (memory size: 6 times original)
 	float *newdata = (float *)malloc(n * sizeof(float));
@@ -111,19 +122,13 @@ WORD *debayer_buffer_new_ushort(WORD *buf, int *width, int *height,
 	}
 
 	float **red = (float **)malloc(ry * sizeof(float *));
-	red[0] = newdata;
-	for (i=1; i<ry; i++)
-		red[i] = red[i - 1] + rx;
+	set_row_pointers(red, newdata, rx, ry, bottom_up);
 
 	float **green = (float **)malloc(ry * sizeof(float *));
-	green[0] = red[0] + nbpixels;
-	for (i=1; i<ry; i++)
-		green[i] = green[i - 1] + rx;
+	set_row_pointers(green, newdata + nbpixels, rx, ry, bottom_up);
 
 	float **blue = (float **)malloc(ry * sizeof(float *));
-	blue[0] = green[0] + nbpixels;
-	for (i=1; i<ry; i++)
-		blue[i] = blue[i - 1] + rx;
+	set_row_pointers(blue, newdata + 2 * nbpixels, rx, ry, bottom_up);
 
 	// 3. process
 	siril_debug_print("calling librtprocess ushort (%d)\n", interpolation);
@@ -178,7 +183,7 @@ WORD *debayer_buffer_new_ushort(WORD *buf, int *width, int *height,
 			retval = markesteijn_demosaic(rx, ry, rawdata, red, green, blue, xtrans, rgb_cam, progress, 1, TRUE);
 			break;
 	}
-	free(rawdata[0]);
+	free(rawbuf);
 	free(rawdata);
 
 	// 4. get the result in WORD (memory size: 3 times original)
@@ -188,17 +193,19 @@ WORD *debayer_buffer_new_ushort(WORD *buf, int *width, int *height,
 		retval = RP_MEMORY_ERROR;
 	}
 	else {
+		/* here bit_depth can really be bit_depth (with SER files
+		 * OR bitpix (with FITS file) so we need to pay attention!!!!
+		 * But BYTE_IMG has the value of 8. So it should be fine.
+		 * The clamping is required because librtprocess often returns data
+		 * out of expected range */
+		const float maxval = bit_depth == BYTE_IMG ? UCHAR_MAX_SINGLE : USHRT_MAX_SINGLE;
+#ifdef _OPENMP
+#pragma omp parallel for simd num_threads(com.max_thread) schedule(static)
+#endif
 		for (j = 0; j < n; j++) {
-			/* here bit_depth can really be bit_depth (with SER files
-			 * OR bitpix (with FITS file) so we need to pay attention!!!!
-			 * But BYTE_IMG has the value of 8. So it should be fine. */
-			if (bit_depth == BYTE_IMG) {
-				newfitdata[j] = roundf_to_BYTE(newdata[j]);
-			} else {
-				newfitdata[j] = roundf_to_WORD(newdata[j]);
-			}
-			/* these rounding are required because librtprocess
-			 * often returns data out of expected range */
+			float v = newdata[j];
+			v = v < 0.f ? 0.f : (v > maxval ? maxval : v);
+			newfitdata[j] = (WORD)(v + 0.5f);
 		}
 	}
 
@@ -213,7 +220,8 @@ WORD *debayer_buffer_new_ushort(WORD *buf, int *width, int *height,
 // Warning: buf may be destroyed in case of failure, to avoid data duplication
 // freeing buf is left to the caller
 float *debayer_buffer_new_float(float *buf, int *width, int *height,
-		interpolation_method interpolation, sensor_pattern pattern, unsigned int xtrans[6][6]) {
+		interpolation_method interpolation, sensor_pattern pattern, unsigned int xtrans[6][6],
+		gboolean bottom_up) {
 
 	// super-pixel is handled by siril code, not librtprocess
 	if (interpolation == BAYER_SUPER_PIXEL)
@@ -221,7 +229,7 @@ float *debayer_buffer_new_float(float *buf, int *width, int *height,
 
 	unsigned int cfarray[2][2];
 	float rgb_cam[3][4] = { 1.0f };	// our white balance: we don't care
-	int i, rx = *width, ry = *height;
+	int rx = *width, ry = *height;
 	long j, nbpixels = rx * ry;
 	long n = nbpixels * 3;
 	// 1. prepare input data for librtprocess
@@ -230,17 +238,19 @@ float *debayer_buffer_new_float(float *buf, int *width, int *height,
 		PRINT_ALLOC_ERR;
 		return NULL;
 	}
-	rawdata[0] = buf; // no duplication, input will be overwritten
+	// no duplication, input will be overwritten
 	// TODO: do the following only for interpolations that need a conversion.
 	// AMaZE is in [0, 1] but also needs to be normalized to make sure we fit exactly in this range
-	// TODO: vectorize!
 
 	float min = FLT_MAX, max = -FLT_MAX, normvalue = 65535.0f, range, factor, invfactor;
 	if (interpolation == BAYER_AMAZE) normvalue = 1.f;
 
+#ifdef _OPENMP
+#pragma omp parallel for simd num_threads(com.max_thread) schedule(static) reduction(max:max) reduction(min:min)
+#endif
 	for (j = 0; j < nbpixels; j++) {
-		if (buf[j] > max) max = buf[j];
-		if (buf[j] < min) min = buf[j];
+		max = buf[j] > max ? buf[j] : max;
+		min = buf[j] < min ? buf[j] : min;
 	}
 	range = max - min;
 	if (range == 0.) {
@@ -252,6 +262,9 @@ float *debayer_buffer_new_float(float *buf, int *width, int *height,
 	invfactor  = 1. / factor;
 
 	// map values from [min,max] to [0,normvalue] (no clipping, no overflow)
+#ifdef _OPENMP
+#pragma omp parallel for simd num_threads(com.max_thread) schedule(static)
+#endif
 	for (j = 0; j < nbpixels; j++) {
 		buf[j] = (buf[j] - min) * factor;
 	}
@@ -259,8 +272,7 @@ float *debayer_buffer_new_float(float *buf, int *width, int *height,
 		fprintf(stdout, "****** before debayer, data is [%f, %f] (should be [0, 65535]) ******\n", 0., normvalue);
 #endif
 
-	for (i = 1; i < ry; i++)
-		rawdata[i] = rawdata[i - 1] + rx;
+	set_row_pointers(rawdata, buf, rx, ry, bottom_up);
 
 	// 2. allocate the demosaiced image buffer
 	float *newdata = (float *)malloc(n * sizeof(float));
@@ -271,19 +283,13 @@ float *debayer_buffer_new_float(float *buf, int *width, int *height,
 	}
 
 	float **red = (float **)malloc(ry * sizeof(float *));
-	red[0] = newdata;
-	for (i = 1; i < ry; i++)
-		red[i] = red[i - 1] + rx;
+	set_row_pointers(red, newdata, rx, ry, bottom_up);
 
 	float **green = (float **)malloc(ry * sizeof(float *));
-	green[0] = red[0] + nbpixels;
-	for (i = 1; i < ry; i++)
-		green[i] = green[i - 1] + rx;
+	set_row_pointers(green, newdata + nbpixels, rx, ry, bottom_up);
 
 	float **blue = (float **)malloc(ry * sizeof(float *));
-	blue[0] = green[0] + nbpixels;
-	for (i = 1; i < ry; i++)
-		blue[i] = blue[i - 1] + rx;
+	set_row_pointers(blue, newdata + 2 * nbpixels, rx, ry, bottom_up);
 
 	// 3. process
 	siril_debug_print("calling librtprocess float (%d)\n", interpolation);
@@ -343,19 +349,20 @@ float *debayer_buffer_new_float(float *buf, int *width, int *height,
 	// 4. convert back to siril range if needed
 	// TODO: do the following only for interpolations that needed a conversion
 
-#ifdef SIRIL_OUTPUT_DEBUG
-		float min2 = FLT_MAX, max2 = -FLT_MAX;
+#ifdef _OPENMP
+#pragma omp parallel for simd num_threads(com.max_thread) schedule(static)
 #endif
 	for (j = 0; j < n; j++) {
-		newdata[j] = newdata[j] * invfactor + min; 
+		newdata[j] = newdata[j] * invfactor + min;
+	}
 #ifdef SIRIL_OUTPUT_DEBUG
+	float min2 = FLT_MAX, max2 = -FLT_MAX;
+	for (j = 0; j < n; j++) {
 		if (newdata[j] > max2)
 			max2 = newdata[j];
 		if (newdata[j] < min2)
 			min2 = newdata[j];
-#endif
-		}
-#ifdef SIRIL_OUTPUT_DEBUG
+	}
 		fprintf(stdout, "****** after debayer, data is [%f, %f] (should be [0, 65535]) ******\n", min2 * normvalue, max2 * normvalue);
 #endif
 
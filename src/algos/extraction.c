@@ -18,44 +18,57 @@ static void update_sampling_information(fits *fit) {
 	fit->pixel_size_y *= 2;
 }
 
+/* offsets of the pixels of each color in a 2x2 cell of the CFA image, from
+ * the first pixel of the cell */
+struct cfa_cell {
+	int red, green[2], blue;
+};
+
+static int get_cfa_cell(sensor_pattern pattern, int rx, struct cfa_cell *cell) {
+	if (pattern < BAYER_FILTER_MIN || pattern > BAYER_FILTER_MAX) {
+		printf("Should not happen.\n");
+		return 1;
+	}
+	int nb_green = 0;
+	for (int i = 0; i < 4; i++) {
+		int offset = (i & 1) + (i >> 1) * rx;
+		switch (filter_pattern[pattern][i]) {
+		case 'R':
+			cell->red = offset;
+			break;
+		case 'G':
+			cell->green[nb_green++] = offset;
+			break;
+		default:
+			cell->blue = offset;
+		}
+	}
+	return 0;
+}
+
 int extractHa_ushort(fits *in, fits *Ha, sensor_pattern pattern) {
 	int width = in->rx / 2, height = in->ry / 2;
+	struct cfa_cell cell;
 
 	if (strlen(in->bayer_pattern) > 4) {
 		siril_log_message(_("Extract_Ha does not work on non-Bayer filter camera images!\n"));
 		return 1;
 	}
+	if (get_cfa_cell(pattern, in->rx, &cell))
+		return 1;
 	if (new_fit_image(&Ha, width, height, 1, DATA_USHORT)) {
 		return 1;
 	}
+	const WORD maxval = (in->bitpix == 8) ? UCHAR_MAX : USHRT_MAX;
 
-	int j = 0;
-
-	for (int row = 0; row < in->ry - 1; row += 2) {
-		for (int col = 0; col < in->rx - 1; col += 2) {
-			WORD c0 = in->data[col + row * in->rx];
-			WORD c1 = in->data[1 + col + row * in->rx];
-			WORD c2 = in->data[col + (1 + row) * in->rx];
-			WORD c3 = in->data[1 + col + (1 + row) * in->rx];
-
-			switch(pattern) {
-			case BAYER_FILTER_RGGB:
-				Ha->data[j] = (in->bitpix == 8) ? round_to_BYTE(c0) : c0;
-				break;
-			case BAYER_FILTER_BGGR:
-				Ha->data[j] = (in->bitpix == 8) ? round_to_BYTE(c3) : c3;
-				break;
-			case BAYER_FILTER_GRBG:
-				Ha->data[j] = (in->bitpix == 8) ? round_to_BYTE(c1) : c1;
-				break;
-			case BAYER_FILTER_GBRG:
-				Ha->data[j] = (in->bitpix == 8) ? round_to_BYTE(c2) : c2;
-				break;
-			default:
-				printf("Should not happen.\n");
-				return 1;
-			}
-			j++;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static)
+#endif
+	for (int row = 0; row < height; row++) {
+		const WORD *cfa = in->data + (size_t) 2 * row * in->rx;
+		WORD *ha = Ha->data + (size_t) row * width;
+		for (int col = 0; col < width; col++) {
+			ha[col] = min(cfa[2 * col + cell.red], maxval);
 		}
 	}
 
@@ -68,42 +81,26 @@ int extractHa_ushort(fits *in, fits *Ha, sensor_pattern pattern) {
 
 int extractHa_float(fits *in, fits *Ha, sensor_pattern pattern) {
 	int width = in->rx / 2, height = in->ry / 2;
+	struct cfa_cell cell;
 
 	if (strlen(in->bayer_pattern) > 4) {
 		siril_log_message(_("Extract_Ha does not work on non-Bayer filter camera images!\n"));
 		return 1;
 	}
+	if (get_cfa_cell(pattern, in->rx, &cell))
+		return 1;
 	if (new_fit_image(&Ha, width, height, 1, DATA_FLOAT)) {
 		return 1;
 	}
 
-	int j = 0;
-
-	for (int row = 0; row < in->ry - 1; row += 2) {
-		for (int col = 0; col < in->rx - 1; col += 2) {
-			float c0 = in->fdata[col + row * in->rx];
-			float c1 = in->fdata[1 + col + row * in->rx];
-			float c2 = in->fdata[col + (1 + row) * in->rx];
-			float c3 = in->fdata[1 + col + (1 + row) * in->rx];
-
-			switch(pattern) {
-			case BAYER_FILTER_RGGB:
-				Ha->fdata[j] = c0;
-				break;
-			case BAYER_FILTER_BGGR:
-				Ha->fdata[j] = c3;
-				break;
-			case BAYER_FILTER_GRBG:
-				Ha->fdata[j] = c1;
-				break;
-			case BAYER_FILTER_GBRG:
-				Ha->fdata[j] = c2;
-				break;
-			default:
-				printf("Should not happen.\n");
-				return 1;
-			}
-			j++;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static)
+#endif
+	for (int row = 0; row < height; row++) {
+		const float *cfa = in->fdata + (size_t) 2 * row * in->rx;
+		float *ha = Ha->fdata + (size_t) row * width;
+		for (int col = 0; col < width; col++) {
+			ha[col] = cfa[2 * col + cell.red];
 		}
 	}
 
@@ -186,37 +183,26 @@ void apply_extractHa_to_sequence(struct split_cfa_data *split_cfa_args) {
 
 int extractGreen_ushort(fits *in, fits *green, sensor_pattern pattern) {
 	int width = in->rx / 2, height = in->ry / 2;
+	struct cfa_cell cell;
 
 	if (strlen(in->bayer_pattern) > 4) {
 		siril_log_message(_("Extract_Green does not work on non-Bayer filter camera images!\n"));
 		return 1;
 	}
+	if (get_cfa_cell(pattern, in->rx, &cell))
+		return 1;
 	if (new_fit_image(&green, width, height, 1, DATA_USHORT))
 		return 1;
 
-	int j = 0;
-
-	for (int row = 0; row < in->ry - 1; row += 2) {
-		for (int col = 0; col < in->rx - 1; col += 2) {
-			WORD c0, c1, c2, c3;
-			switch(pattern) {
-			case BAYER_FILTER_RGGB:
-			case BAYER_FILTER_BGGR:
-				c1 = in->data[1 + col + row * in->rx];
-				c2 = in->data[col + (1 + row) * in->rx];
-				green->data[j] = (c1 + c2) / 2;
-				break;
-			case BAYER_FILTER_GRBG:
-			case BAYER_FILTER_GBRG:
-				c0 = in->data[col + row * in->rx];
-				c3 = in->data[1 + col + (1 + row) * in->rx];
-				green->data[j] = (c0 + c3) / 2;
-				break;
-			default:
-				printf("Should not happen.\n");
-				return 1;
-			}
-			j++;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static)
+#endif
+	for (int row = 0; row < height; row++) {
+		const WORD *cfa = in->data + (size_t) 2 * row * in->rx;
+		WORD *g = green->data + (size_t) row * width;
+		for (int col = 0; col < width; col++) {
+			const WORD *c = cfa + 2 * col;
+			g[col] = (c[cell.green[0]] + c[cell.green[1]]) / 2;
 		}
 	}
 
@@ -229,37 +215,26 @@ int extractGreen_ushort(fits *in, fits *green, sensor_pattern pattern) {
 
 int extractGreen_float(fits *in, fits *green, sensor_pattern pattern) {
 	int width = in->rx / 2, height = in->ry / 2;
+	struct cfa_cell cell;
 
 	if (strlen(in->bayer_pattern) > 4) {
 		siril_log_message(_("Extract_Green does not work on non-Bayer filter camera images!\n"));
 		return 1;
 	}
+	if (get_cfa_cell(pattern, in->rx, &cell))
+		return 1;
 	if (new_fit_image(&green, width, height, 1, DATA_FLOAT))
 		return 1;
 
-	int j = 0;
-
-	for (int row = 0; row < in->ry - 1; row += 2) {
-		for (int col = 0; col < in->rx - 1; col += 2) {
-			float c0, c1, c2, c3;
-			switch(pattern) {
-			case BAYER_FILTER_RGGB:
-			case BAYER_FILTER_BGGR:
-				c1 = in->fdata[1 + col + row * in->rx];
-				c2 = in->fdata[col + (1 + row) * in->rx];
-				green->fdata[j] = (c1 + c2) * 0.5f;
-				break;
-			case BAYER_FILTER_GRBG:
-			case BAYER_FILTER_GBRG:
-				c0 = in->fdata[col + row * in->rx];
-				c3 = in->fdata[1 + col + (1 + row) * in->rx];
-				green->fdata[j] = (c0 + c3) * 0.5f;
-				break;
-			default:
-				printf("Should not happen.\n");
-				return 1;
-			}
-			j++;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static)
+#endif
+	for (int row = 0; row < height; row++) {
+		const float *cfa = in->fdata + (size_t) 2 * row * in->rx;
+		float *g = green->fdata + (size_t) row * width;
+		for (int col = 0; col < width; col++) {
+			const float *c = cfa + 2 * col;
+			g[col] = (c[cell.green[0]] + c[cell.green[1]]) * 0.5f;
 		}
 	}
 
@@ -309,47 +284,32 @@ void apply_extractGreen_to_sequence(struct split_cfa_data *split_cfa_args) {
 
 int extractHaOIII_ushort(fits *in, fits *Ha, fits *OIII, sensor_pattern pattern) {
 	int width = in->rx / 2, height = in->ry / 2;
+	struct cfa_cell cell;
 
 	if (strlen(in->bayer_pattern) > 4) {
 		siril_log_message(_("Extract_Ha does not work on non-Bayer filter camera images!\n"));
 		return 1;
 	}
+	if (get_cfa_cell(pattern, in->rx, &cell))
+		return 1;
 	if (new_fit_image(&Ha, width, height, 1, DATA_USHORT) ||
 			new_fit_image(&OIII, width, height, 1, DATA_USHORT)) {
 		return 1;
 	}
+	const WORD maxval = (in->bitpix == 8) ? UCHAR_MAX : USHRT_MAX;
 
-	int j = 0;
-
-	for (int row = 0; row < in->ry - 1; row += 2) {
-		for (int col = 0; col < in->rx - 1; col += 2) {
-			WORD c0 = in->data[col + row * in->rx];
-			WORD c1 = in->data[1 + col + row * in->rx];
-			WORD c2 = in->data[col + (1 + row) * in->rx];
-			WORD c3 = in->data[1 + col + (1 + row) * in->rx];
-
-			switch(pattern) {
-			case BAYER_FILTER_RGGB:
-				Ha->data[j] = (in->bitpix == 8) ? round_to_BYTE(c0) : c0;
-				OIII->data[j] = (c1 + c2 + c3) / 3;
-				break;
-			case BAYER_FILTER_BGGR:
-				Ha->data[j] = (in->bitpix == 8) ? round_to_BYTE(c3) : c3;
-				OIII->data[j] = (c1 + c2 + c0) / 3;
-				break;
-			case BAYER_FILTER_GRBG:
-				Ha->data[j] = (in->bitpix == 8) ? round_to_BYTE(c1) : c1;
-				OIII->data[j] = (c0 + c2 + c3) / 3;
-				break;
-			case BAYER_FILTER_GBRG:
-				Ha->data[j] = (in->bitpix == 8) ? round_to_BYTE(c2) : c2;
-				OIII->data[j] = (c1 + c0 + c3) / 3;
-				break;
-			default:
-				printf("Should not happen.\n");
-				return 1;
-			}
-			j++;
+	/* both images are filled in the same pass on the CFA data */
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static)
+#endif
+	for (int row = 0; row < height; row++) {
+		const WORD *cfa = in->data + (size_t) 2 * row * in->rx;
+		WORD *ha = Ha->data + (size_t) row * width;
+		WORD *oiii = OIII->data + (size_t) row * width;
+		for (int col = 0; col < width; col++) {
+			const WORD *c = cfa + 2 * col;
+			ha[col] = min(c[cell.red], maxval);
+			oiii[col] = (c[cell.green[0]] + c[cell.green[1]] + c[cell.blue]) / 3;
 		}
 	}
 
@@ -365,47 +325,31 @@ int extractHaOIII_ushort(fits *in, fits *Ha, fits *OIII, sensor_pattern pattern)
 
 int extractHaOIII_float(fits *in, fits *Ha, fits *OIII, sensor_pattern pattern) {
 	int width = in->rx / 2, height = in->ry / 2;
+	struct cfa_cell cell;
 
 	if (strlen(in->bayer_pattern) > 4) {
 		siril_log_message(_("Extract_HaOIII does not work on non-Bayer filter camera images!\n"));
 		return 1;
 	}
+	if (get_cfa_cell(pattern, in->rx, &cell))
+		return 1;
 	if (new_fit_image(&Ha, width, height, 1, DATA_FLOAT) ||
 			new_fit_image(&OIII, width, height, 1, DATA_FLOAT)) {
 		return 1;
 	}
 
-	int j = 0;
-
-	for (int row = 0; row < in->ry - 1; row += 2) {
-		for (int col = 0; col < in->rx - 1; col += 2) {
-			float c0 = in->fdata[col + row * in->rx];
-			float c1 = in->fdata[1 + col + row * in->rx];
-			float c2 = in->fdata[col + (1 + row) * in->rx];
-			float c3 = in->fdata[1 + col + (1 + row) * in->rx];
-
-			switch(pattern) {
-			case BAYER_FILTER_RGGB:
-				Ha->fdata[j] = c0;
-				OIII->fdata[j] = (c1 + c2 + c3) / 3;
-				break;
-			case BAYER_FILTER_BGGR:
-				Ha->fdata[j] = c3;
-				OIII->fdata[j] = (c1 + c2 + c0) / 3;
-				break;
-			case BAYER_FILTER_GRBG:
-				Ha->fdata[j] = c1;
-				OIII->fdata[j] = (c0 + c2 + c3) / 3;
-				break;
-			case BAYER_FILTER_GBRG:
-				Ha->fdata[j] = c2;
-				OIII->fdata[j] = (c1 + c0 + c3) / 3;
-				break;
-			default:
-				printf("Should not happen.\n");
-				return 1;
-			}
-			j++;
+	/* both images are filled in the same pass on the CFA data */
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static)
+#endif
+	for (int row = 0; row < height; row++) {
+		const float *cfa = in->fdata + (size_t) 2 * row * in->rx;
+		float *ha = Ha->fdata + (size_t) row * width;
+		float *oiii = OIII->fdata + (size_t) row * width;
+		for (int col = 0; col < width; col++) {
+			const float *c = cfa + 2 * col;
+			ha[col] = c[cell.red];
+			oiii[col] = (c[cell.green[0]] + c[cell.green[1]] + c[cell.blue]) / 3;
 		}
 	}
 
@@ -419,156 +363,180 @@ int extractHaOIII_float(fits *in, fits *Ha, fits *OIII, sensor_pattern pattern)
 	return 0;
 }
 
-struct _double_split {
+struct _multi_split {
 	int index;
-	fits *ha;
-	fits *oiii;
+	fits *images[MAX_SPLIT_OUTPUTS];
 };
 
+/* Images of several outputs are passed from the image_hook to the save hook
+ * in a list, because it is unsupported by the generic arguments */
+static int add_to_save_list(struct generic_seq_args *args, int index, fits **images) {
+	struct split_cfa_data *cfa_args = (struct split_cfa_data *) args->user;
+	struct _multi_split *multi_data = malloc(sizeof(struct _multi_split));
+	if (!multi_data) {
+		PRINT_ALLOC_ERR;
+		return 1;
+	}
+	multi_data->index = index;
+	memcpy(multi_data->images, images, cfa_args->nb_outputs * sizeof(fits *));
+#ifdef _OPENMP
+	omp_set_lock(&args->lock);
+#endif
+	cfa_args->processed_images = g_list_append(cfa_args->processed_images, multi_data);
+#ifdef _OPENMP
+	omp_unset_lock(&args->lock);
+#endif
+	siril_debug_print("%s: processed images added to the save list (%d)\n", args->description, index);
+	return 0;
+}
+
+static void free_split_images(fits **images, int nb) {
+	for (int k = 0; k < nb; k++) {
+		if (images[k]) {
+			clearfits(images[k]);
+			free(images[k]);
+		}
+	}
+}
+
+static int alloc_split_images(fits **images, int nb) {
+	for (int k = 0; k < nb; k++) {
+		images[k] = calloc(1, sizeof(fits));
+		if (!images[k]) {
+			PRINT_ALLOC_ERR;
+			free_split_images(images, k);
+			return 1;
+		}
+	}
+	return 0;
+}
+
 int extractHaOIII_image_hook(struct generic_seq_args *args, int o, int i, fits *fit, rectangle *_) {
 	int ret = 1;
-	struct split_cfa_data *cfa_args = (struct split_cfa_data *) args->user;
+	fits *images[2];
 
 	sensor_pattern pattern = get_bayer_pattern(fit);
 
 	/* Demosaic and store images for write */
-	struct _double_split *double_data = malloc(sizeof(struct _double_split));
-	double_data->ha = calloc(1, sizeof(fits));
-	double_data->oiii = calloc(1, sizeof(fits));
-	double_data->index = o;
+	if (alloc_split_images(images, 2))
+		return 1;
 
 	if (fit->type == DATA_USHORT) {
-		ret = extractHaOIII_ushort(fit, double_data->ha, double_data->oiii, pattern);
+		ret = extractHaOIII_ushort(fit, images[0], images[1], pattern);
 	}
 	else if (fit->type == DATA_FLOAT) {
-		ret = extractHaOIII_float(fit, double_data->ha, double_data->oiii, pattern);
+		ret = extractHaOIII_float(fit, images[0], images[1], pattern);
 	}
 
-	if (ret) {
-		clearfits(double_data->ha);
-		clearfits(double_data->oiii);
-		free(double_data);
-	} else {
-#ifdef _OPENMP
-		omp_set_lock(&args->lock);
-#endif
-		cfa_args->processed_images = g_list_append(cfa_args->processed_images, double_data);
-#ifdef _OPENMP
-		omp_unset_lock(&args->lock);
-#endif
-		siril_debug_print("Ha-OIII: processed images added to the save list (%d)\n", o);
-	}
+	if (!ret)
+		ret = add_to_save_list(args, o, images);
+	if (ret)
+		free_split_images(images, 2);
 	return ret;
 }
 
-static int dual_prepare(struct generic_seq_args *args) {
+/* The outputs are created with the generic prepare hook, called once for each
+ * prefix, their writers being kept in the user data */
+static int multi_prepare(struct generic_seq_args *args) {
 	struct split_cfa_data *cfa_args = (struct split_cfa_data *) args->user;
-	// we call the generic prepare twice with different prefixes
-	args->new_seq_prefix = "Ha_";
-	if (seq_prepare_hook(args))
-		return 1;
-	// but we copy the result between each call
-	cfa_args->new_ser_ha = args->new_ser;
-	cfa_args->new_fitseq_ha = args->new_fitseq;
-
-	args->new_seq_prefix = "OIII_";
-	if (seq_prepare_hook(args))
-		return 1;
-	cfa_args->new_ser_oiii = args->new_ser;
-	cfa_args->new_fitseq_oiii = args->new_fitseq;
+	for (int k = 0; k < cfa_args->nb_outputs; k++) {
+		args->new_seq_prefix = cfa_args->prefixes[k];
+		if (seq_prepare_hook(args))
+			return 1;
+		// but we copy the result between each call
+		cfa_args->new_ser[k] = args->new_ser;
+		cfa_args->new_fitseq[k] = args->new_fitseq;
+	}
 
 	args->new_seq_prefix = NULL;
 	args->new_ser = NULL;
 	args->new_fitseq = NULL;
 
-	seqwriter_set_number_of_outputs(2);
+	seqwriter_set_number_of_outputs(cfa_args->nb_outputs);
 	return 0;
 }
 
-static int dual_finalize(struct generic_seq_args *args) {
+static int multi_finalize(struct generic_seq_args *args) {
 	struct split_cfa_data *cfa_args = (struct split_cfa_data *) args->user;
-	args->new_ser = cfa_args->new_ser_ha;
-	args->new_fitseq = cfa_args->new_fitseq_ha;
-	int retval = seq_finalize_hook(args);
-	cfa_args->new_ser_ha = NULL;
-	cfa_args->new_fitseq_ha = NULL;
-
-	args->new_ser = cfa_args->new_ser_oiii;
-	args->new_fitseq = cfa_args->new_fitseq_oiii;
-	retval = seq_finalize_hook(args) || retval;
-	cfa_args->new_ser_oiii = NULL;
-	cfa_args->new_fitseq_oiii = NULL;
+	int retval = 0;
+	for (int k = 0; k < cfa_args->nb_outputs; k++) {
+		args->new_ser = cfa_args->new_ser[k];
+		args->new_fitseq = cfa_args->new_fitseq[k];
+		retval = seq_finalize_hook(args) || retval;
+		cfa_args->new_ser[k] = NULL;
+		cfa_args->new_fitseq[k] = NULL;
+		g_free(cfa_args->prefixes[k]);
+		cfa_args->prefixes[k] = NULL;
+	}
+	args->new_ser = NULL;
+	args->new_fitseq = NULL;
 	seqwriter_set_number_of_outputs(1);
 	return retval;
 }
 
-static int dual_save(struct generic_seq_args *args, int out_index, int in_index, fits *fit) {
+static int multi_save(struct generic_seq_args *args, int out_index, int in_index, fits *fit) {
 	struct split_cfa_data *cfa_args = (struct split_cfa_data *) args->user;
-	struct _double_split *double_data = NULL;
-	// images are passed from the image_hook to the save in a list, because
-	// there are two, which is unsupported by the generic arguments
+	struct _multi_split *multi_data = NULL;
+	const int nb = cfa_args->nb_outputs;
 #ifdef _OPENMP
 	omp_set_lock(&args->lock);
 #endif
 	GList *list = cfa_args->processed_images;
 	while (list) {
-		if (((struct _double_split *)list->data)->index == out_index) {
-			double_data = list->data;
+		if (((struct _multi_split *)list->data)->index == out_index) {
+			multi_data = list->data;
 			break;
 		}
-		list = g_list_next(cfa_args->processed_images);
+		list = g_list_next(list);
 	}
-	if (double_data)
-		cfa_args->processed_images = g_list_remove(cfa_args->processed_images, double_data);
+	if (multi_data)
+		cfa_args->processed_images = g_list_remove(cfa_args->processed_images, multi_data);
 #ifdef _OPENMP
 	omp_unset_lock(&args->lock);
 #endif
-	if (!double_data) {
+	if (!multi_data) {
 		siril_log_color_message(_("Image %d not found for writing\n"), "red", in_index);
 		return 1;
 	}
 
-	siril_debug_print("Ha-OIII: images to be saved (%d)\n", out_index);
-	if (double_data->ha->naxes[0] == 0 || double_data->oiii->naxes[0] == 0) {
-		siril_debug_print("empty data\n");
-		return 1;
+	siril_debug_print("%s: images to be saved (%d)\n", args->description, out_index);
+	for (int k = 0; k < nb; k++) {
+		if (multi_data->images[k]->naxes[0] == 0) {
+			siril_debug_print("empty data\n");
+			free_split_images(multi_data->images, nb);
+			free(multi_data);
+			return 1;
+		}
 	}
 
-	int retval1, retval2;
+	int retval = 0;
 	if (args->force_ser_output || args->seq->type == SEQ_SER) {
-		retval1 = ser_write_frame_from_fit(cfa_args->new_ser_ha, double_data->ha, out_index);
-		retval2 = ser_write_frame_from_fit(cfa_args->new_ser_oiii, double_data->oiii, out_index);
-		clearfits(double_data->ha);
-		clearfits(double_data->oiii);
+		for (int k = 0; k < nb; k++)
+			retval = ser_write_frame_from_fit(cfa_args->new_ser[k], multi_data->images[k], out_index) || retval;
+		free_split_images(multi_data->images, nb);
 	} else if (args->force_fitseq_output || args->seq->type == SEQ_FITSEQ) {
-		retval1 = fitseq_write_image(cfa_args->new_fitseq_ha, double_data->ha, out_index);
-		retval2 = fitseq_write_image(cfa_args->new_fitseq_oiii, double_data->oiii, out_index);
-		// the two fits are freed by the writing thread
-		if (!retval1 && !retval2) {
+		for (int k = 0; k < nb; k++)
+			retval = fitseq_write_image(cfa_args->new_fitseq[k], multi_data->images[k], out_index) || retval;
+		// the fits are freed by the writing thread
+		if (!retval) {
 			/* special case because it's not done in the generic */
 			clearfits(fit);
 			free(fit);
 		}
 	} else {
-		char *dest = fit_sequence_get_image_filename_prefixed(args->seq, "Ha_", in_index);
-		if (fit->type == DATA_USHORT) {
-			retval1 = save1fits16(dest, double_data->ha, RLAYER);
-		} else {
-			retval1 = save1fits32(dest, double_data->ha, RLAYER);
-		}
-		free(dest);
-		dest = fit_sequence_get_image_filename_prefixed(args->seq, "OIII_", in_index);
-		if (fit->type == DATA_USHORT) {
-			retval2 = save1fits16(dest, double_data->oiii, RLAYER);
-		} else {
-			retval2 = save1fits32(dest, double_data->oiii, RLAYER);
+		for (int k = 0; k < nb; k++) {
+			char *dest = fit_sequence_get_image_filename_prefixed(args->seq, cfa_args->prefixes[k], in_index);
+			if (multi_data->images[k]->type == DATA_USHORT) {
+				retval = save1fits16(dest, multi_data->images[k], RLAYER) || retval;
+			} else {
+				retval = save1fits32(dest, multi_data->images[k], RLAYER) || retval;
+			}
+			free(dest);
 		}
-		free(dest);
-		clearfits(double_data->ha);
-		clearfits(double_data->oiii);
+		free_split_images(multi_data->images, nb);
 	}
-	free(double_data);
-	return retval1 || retval2;
+	free(multi_data);
+	return retval;
 }
 
 void apply_extractHaOIII_to_sequence(struct split_cfa_data *split_cfa_args) {
@@ -576,9 +544,9 @@ void apply_extractHaOIII_to_sequence(struct split_cfa_data *split_cfa_args) {
 	args->seq = split_cfa_args->seq;
 	args->filtering_criterion = seq_filter_included;
 	args->nb_filtered_images = split_cfa_args->seq->selnum;
-	args->prepare_hook = dual_prepare;
-	args->finalize_hook = dual_finalize;
-	args->save_hook = dual_save;
+	args->prepare_hook = multi_prepare;
+	args->finalize_hook = multi_finalize;
+	args->save_hook = multi_save;
 	args->image_hook = extractHaOIII_image_hook;
 	args->description = _("Extract Ha and OIII");
 	args->has_output = TRUE;
@@ -588,6 +556,9 @@ void apply_extractHaOIII_to_sequence(struct split_cfa_data *split_cfa_args) {
 	args->user = split_cfa_args;
 
 	split_cfa_args->fit = NULL;	// not used here
+	split_cfa_args->nb_outputs = 2;
+	split_cfa_args->prefixes[0] = g_strdup("Ha_");
+	split_cfa_args->prefixes[1] = g_strdup("OIII_");
 
 	start_in_new_thread(generic_sequence_worker, args);
 }
@@ -605,22 +576,21 @@ int split_cfa_ushort(fits *in, fits *cfa0, fits *cfa1, fits *cfa2, fits *cfa3) {
 			new_fit_image(&cfa3, width, height, 1, DATA_USHORT)) {
 		return 1;
 	}
+	const WORD maxval = (in->bitpix == 8) ? UCHAR_MAX : USHRT_MAX;
 
-	int j = 0;
-
-	for (int row = 0; row < in->ry - 1; row += 2) {
-		for (int col = 0; col < in->rx - 1; col += 2) {
-			/* not c0, c1, c2 and c3 because of the read orientation */
-			WORD c1 = in->data[col + row * in->rx];
-			WORD c3 = in->data[1 + col + row * in->rx];
-			WORD c0 = in->data[col + (1 + row) * in->rx];
-			WORD c2 = in->data[1 + col + (1 + row) * in->rx];
-
-			cfa0->data[j] = (in->bitpix == 8) ? round_to_BYTE(c0) : c0;
-			cfa1->data[j] = (in->bitpix == 8) ? round_to_BYTE(c1) : c1;
-			cfa2->data[j] = (in->bitpix == 8) ? round_to_BYTE(c2) : c2;
-			cfa3->data[j] = (in->bitpix == 8) ? round_to_BYTE(c3) : c3;
-			j++;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static)
+#endif
+	for (int row = 0; row < height; row++) {
+		/* not c0, c1, c2 and c3 because of the read orientation */
+		const WORD *c1 = in->data + (size_t) 2 * row * in->rx;
+		const WORD *c0 = c1 + in->rx;
+		const size_t j = (size_t) row * width;
+		for (int col = 0; col < width; col++) {
+			cfa0->data[j + col] = min(c0[2 * col], maxval);
+			cfa1->data[j + col] = min(c1[2 * col], maxval);
+			cfa2->data[j + col] = min(c0[2 * col + 1], maxval);
+			cfa3->data[j + col] = min(c1[2 * col + 1], maxval);
 		}
 	}
 
@@ -652,21 +622,19 @@ int split_cfa_float(fits *in, fits *cfa0, fits *cfa1, fits *cfa2, fits *cfa3) {
 		return 1;
 	}
 
-	int j = 0;
-
-	for (int row = 0; row < in->ry - 1; row += 2) {
-		for (int col = 0; col < in->rx - 1; col += 2) {
-			/* not c0, c1, c2 and c3 because of the read orientation */
-			float c1 = in->fdata[col + row * in->rx];
-			float c3 = in->fdata[1 + col + row * in->rx];
-			float c0 = in->fdata[col + (1 + row) * in->rx];
-			float c2 = in->fdata[1 + col + (1 + row) * in->rx];
-
-			cfa0->fdata[j] = c0;
-			cfa1->fdata[j] = c1;
-			cfa2->fdata[j] = c2;
-			cfa3->fdata[j] = c3;
-			j++;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static)
+#endif
+	for (int row = 0; row < height; row++) {
+		/* not c0, c1, c2 and c3 because of the read orientation */
+		const float *c1 = in->fdata + (size_t) 2 * row * in->rx;
+		const float *c0 = c1 + in->rx;
+		const size_t j = (size_t) row * width;
+		for (int col = 0; col < width; col++) {
+			cfa0->fdata[j + col] = c0[2 * col];
+			cfa1->fdata[j + col] = c1[2 * col];
+			cfa2->fdata[j + col] = c0[2 * col + 1];
+			cfa3->fdata[j + col] = c1[2 * col + 1];
 		}
 	}
 
@@ -686,36 +654,22 @@ int split_cfa_float(fits *in, fits *cfa0, fits *cfa1, fits *cfa2, fits *cfa3) {
 
 int split_cfa_image_hook(struct generic_seq_args *args, int o, int i, fits *fit, rectangle *_) {
 	int ret = 1;
-	struct split_cfa_data *cfa_args = (struct split_cfa_data *) args->user;
+	fits *images[4];
 
-	fits f_cfa0 = { 0 }, f_cfa1 = { 0 }, f_cfa2 = { 0 }, f_cfa3 = { 0 };
-
-	gchar *cfa0 = g_strdup_printf("%s0_%s%05d%s", cfa_args->seqEntry, cfa_args->seq->seqname, o, com.pref.ext);
-	gchar *cfa1 = g_strdup_printf("%s1_%s%05d%s", cfa_args->seqEntry, cfa_args->seq->seqname, o, com.pref.ext);
-	gchar *cfa2 = g_strdup_printf("%s2_%s%05d%s", cfa_args->seqEntry, cfa_args->seq->seqname, o, com.pref.ext);
-	gchar *cfa3 = g_strdup_printf("%s3_%s%05d%s", cfa_args->seqEntry, cfa_args->seq->seqname, o, com.pref.ext);
+	if (alloc_split_images(images, 4))
+		return 1;
 
 	if (fit->type == DATA_USHORT) {
-		if (!(ret = split_cfa_ushort(fit, &f_cfa0, &f_cfa1, &f_cfa2, &f_cfa3))) {
-			ret = save1fits16(cfa0, &f_cfa0, RLAYER) ||
-				save1fits16(cfa1, &f_cfa1, RLAYER) ||
-				save1fits16(cfa2, &f_cfa2, RLAYER) ||
-				save1fits16(cfa3, &f_cfa3, RLAYER);
-		}
+		ret = split_cfa_ushort(fit, images[0], images[1], images[2], images[3]);
 	}
 	else if (fit->type == DATA_FLOAT) {
-		if (!(ret = split_cfa_float(fit, &f_cfa0, &f_cfa1, &f_cfa2, &f_cfa3))) {
-			ret = save1fits32(cfa0, &f_cfa0, RLAYER) ||
-				save1fits32(cfa1, &f_cfa1, RLAYER) ||
-				save1fits32(cfa2, &f_cfa2, RLAYER) ||
-				save1fits32(cfa3, &f_cfa3, RLAYER);
-		}
+		ret = split_cfa_float(fit, images[0], images[1], images[2], images[3]);
 	}
 
-	g_free(cfa0); g_free(cfa1);
-	g_free(cfa2); g_free(cfa3);
-	clearfits(&f_cfa0); clearfits(&f_cfa1);
-	clearfits(&f_cfa2); clearfits(&f_cfa3);
+	if (!ret)
+		ret = add_to_save_list(args, o, images);
+	if (ret)
+		free_split_images(images, 4);
 	return ret;
 }
 
@@ -723,12 +677,21 @@ void apply_split_cfa_to_sequence(struct split_cfa_data *split_cfa_args) {
 	struct generic_seq_args *args = create_default_seqargs(split_cfa_args->seq);
 	args->filtering_criterion = seq_filter_included;
 	args->nb_filtered_images = split_cfa_args->seq->selnum;
+	args->prepare_hook = multi_prepare;
+	args->finalize_hook = multi_finalize;
+	args->save_hook = multi_save;
 	args->image_hook = split_cfa_image_hook;
 	args->description = _("Split CFA");
-	args->new_seq_prefix = split_cfa_args->seqEntry;
+	args->has_output = TRUE;
+	args->output_type = get_data_type(args->seq->bitpix);
+	args->upscale_ratio = 1.42;	// sqrt(2), for memory management
+	args->new_seq_prefix = NULL;
 	args->user = split_cfa_args;
 
 	split_cfa_args->fit = NULL;	// not used here
+	split_cfa_args->nb_outputs = 4;
+	for (int k = 0; k < 4; k++)
+		split_cfa_args->prefixes[k] = g_strdup_printf("%s%d_", split_cfa_args->seqEntry, k);
 
 	start_in_new_thread(generic_sequence_worker, args);
 }
@@ -6,17 +6,19 @@
 #include "io/ser.h"
 #include "io/fits_sequence.h"
 
+#define MAX_SPLIT_OUTPUTS 4
+
 struct split_cfa_data {
 	fits *fit;
 	sequence *seq;
 	const gchar *seqEntry;	// not used for Ha-OIII split
 
-	/* below: internal algorithm usage */
-	struct ser_struct *new_ser_ha;
-	fitseq *new_fitseq_ha;
-
-	struct ser_struct *new_ser_oiii;
-	fitseq *new_fitseq_oiii;
+	/* below: internal algorithm usage, for the extractions that have
+	 * several output sequences */
+	int nb_outputs;
+	gchar *prefixes[MAX_SPLIT_OUTPUTS];
+	struct ser_struct *new_ser[MAX_SPLIT_OUTPUTS];
+	fitseq *new_fitseq[MAX_SPLIT_OUTPUTS];
 
 	GList *processed_images;
 };
@@ -125,9 +125,17 @@ char get_pixel_type(rectangle af, int x, int y, af_pixel_matrix *af_matrix) {
 	}
 }
 
-static int subtract_fudge(fits *fit, rectangle af, float fudge, af_pixel_matrix *af_matrix, char af_type ) {
-	int width = fit->rx;
-	int height = fit->ry;
+/* index of the pixel (x, y) of the X-Trans pattern, rows being read
+ * bottom-up if the image is not stored in the order of the pattern */
+static inline size_t pattern_index(fits *fit, int x, int y, gboolean read_bottom_up) {
+	return x + (size_t) (read_bottom_up ? fit->ry - 1 - y : y) * fit->rx;
+}
+
+static int subtract_fudge(fits *fit, rectangle af, float fudge, af_pixel_matrix *af_matrix,
+		char af_type, gboolean read_bottom_up) {
+	/* only the pixels of the AF rectangle can be AF pixels */
+	int xend = min(af.x + af.w, fit->rx - 1);
+	int yend = min(af.y + af.h, fit->ry - 1);
 
 	if (fit->type == DATA_USHORT) {
 		WORD *buf = fit->pdata[RLAYER];
@@ -135,10 +143,11 @@ static int subtract_fudge(fits *fit, rectangle af, float fudge, af_pixel_matrix
 
 		unsigned long total_fudgew = 0, total_pixels = 0;
 
-		for (unsigned int y = 0; y < height; y++) {
-			for (unsigned int x = 0; x < width; x++) {
+		for (int y = max(af.y, 0); y <= yend; y++) {
+			for (int x = max(af.x, 0); x <= xend; x++) {
 				if (get_pixel_type(af, x, y, af_matrix) == af_type) {
 					// This is an auto focus pixel.  Subtract the fudge.
+					size_t i = pattern_index(fit, x, y, read_bottom_up);
 
 					// Randomly add a 1 to some pixels to bring the average correction close to the computed value.
 					WORD fudgew_rand = rand() / (float) RAND_MAX >= fudge - (float) fudgew ? fudgew : fudgew + 1;
@@ -148,10 +157,10 @@ static int subtract_fudge(fits *fit, rectangle af, float fudge, af_pixel_matrix
 					total_pixels += 1;
 
 					// Prevent driving the unsigned pixel negative.  Not a worry for normal use cases.
-					if (fudgew_rand >= buf[x + y * width]) {
-						buf[x + y * width] = 0;
+					if (fudgew_rand >= buf[i]) {
+						buf[i] = 0;
 					} else {
-						buf[x + y * width] -= fudgew_rand;
+						buf[i] -= fudgew_rand;
 					}
 				}
 			}
@@ -164,11 +173,14 @@ static int subtract_fudge(fits *fit, rectangle af, float fudge, af_pixel_matrix
 	} else if (fit->type == DATA_FLOAT) {
 		float *buf = fit->fpdata[RLAYER];
 
-		for (unsigned int y = 0; y < height; y++) {
-			for (unsigned int x = 0; x < width; x++) {
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static)
+#endif
+		for (int y = max(af.y, 0); y <= yend; y++) {
+			for (int x = max(af.x, 0); x <= xend; x++) {
 				if (get_pixel_type(af, x, y, af_matrix) == af_type) {
 					// This is an auto focus pixel.  Subtract the fudge.
-					buf[x + y * width] -= fudge;
+					buf[pattern_index(fit, x, y, read_bottom_up)] -= fudge;
 				}
 			}
 		}
@@ -212,12 +224,12 @@ int fix_xtrans_ac(fits *fit) {
 	}
 
 
-	// Flip the image so the xtrans pattern makes sense.
+	// The xtrans pattern is given top-down: the rows are read bottom-up
+	// instead of flipping the image if it is not stored this way.
 	// This matches logic in demosaicing.c.
 	read_bottom_up = (com.pref.debayer.use_bayer_header
 			&& !g_strcmp0(fit->row_order, "BOTTOM-UP"))
 			|| (!com.pref.debayer.top_down);
-	if (read_bottom_up) { fits_flip_top_to_bottom(fit); }
 
 
 	// Struct for holding computations.
@@ -258,80 +270,58 @@ int fix_xtrans_ac(fits *fit) {
 		return 1;
 	}
 
-	// Loop through sample rectangle and count/sum AF and non-AF pixels.
-	for (unsigned int y = sam.y; y <= (sam.y + sam.h); y++) {
-		for (unsigned int x = sam.x; x <= (sam.x + sam.w); x++) {
-			double pixel = fit->type == DATA_FLOAT ?
-							(double) fbuf[x + y * fit->rx] :
-							(double) buf[x + y * fit->rx];
+	// Loop through sample rectangle and count/sum green pixels by AF type.
+	// A pixel of an AF type is a non-AF pixel for the three other types.
+	double gsum = 0.0, sum0 = 0.0, sum1 = 0.0, sum2 = 0.0, sum3 = 0.0;
+	long gcount = 0L, count0 = 0L, count1 = 0L, count2 = 0L, count3 = 0L;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static) \
+	reduction(+:gsum, sum0, sum1, sum2, sum3, gcount, count0, count1, count2, count3)
+#endif
+	for (int y = sam.y; y <= (sam.y + sam.h); y++) {
+		for (int x = sam.x; x <= (sam.x + sam.w); x++) {
+			size_t i = pattern_index(fit, x, y, read_bottom_up);
+			double pixel = fit->type == DATA_FLOAT ? (double) fbuf[i] : (double) buf[i];
 
 			switch (get_pixel_type(af, x, y, &af_matrix)) {
 			case 'G': // This is a Green (non-AF) pixel.
-				af_types[0].nfcount++;
-				af_types[1].nfcount++;
-				af_types[2].nfcount++;
-				af_types[3].nfcount++;
-				af_types[0].nfsum += pixel;
-				af_types[1].nfsum += pixel;
-				af_types[2].nfsum += pixel;
-				af_types[3].nfsum += pixel;
+				gsum += pixel;
+				gcount++;
 				break;
 			case '0':
-				af_types[0].afcount++;
-				af_types[1].nfcount++;
-				af_types[2].nfcount++;
-				af_types[3].nfcount++;
-				af_types[0].afsum += pixel;
-				af_types[1].nfsum += pixel;
-				af_types[2].nfsum += pixel;
-				af_types[3].nfsum += pixel;
+				sum0 += pixel;
+				count0++;
 				break;
 			case '1':
-				af_types[0].nfcount++;
-				af_types[1].afcount++;
-				af_types[2].nfcount++;
-				af_types[3].nfcount++;
-				af_types[0].nfsum += pixel;
-				af_types[1].afsum += pixel;
-				af_types[2].nfsum += pixel;
-				af_types[3].nfsum += pixel;
+				sum1 += pixel;
+				count1++;
 				break;
 			case '2':
-				af_types[0].nfcount++;
-				af_types[1].nfcount++;
-				af_types[2].afcount++;
-				af_types[3].nfcount++;
-				af_types[0].nfsum += pixel;
-				af_types[1].nfsum += pixel;
-				af_types[2].afsum += pixel;
-				af_types[3].nfsum += pixel;
+				sum2 += pixel;
+				count2++;
 				break;
 			case '3':
-				af_types[0].nfcount++;
-				af_types[1].nfcount++;
-				af_types[2].nfcount++;
-				af_types[3].afcount++;
-				af_types[0].nfsum += pixel;
-				af_types[1].nfsum += pixel;
-				af_types[2].nfsum += pixel;
-				af_types[3].afsum += pixel;
+				sum3 += pixel;
+				count3++;
 				break;
-			// case '-': // If we want to include R and B.
-		 	// 	af_types[0].nfcount++;
-		 	// 	af_types[1].nfcount++;
-		 	// 	af_types[2].nfcount++;
-		 	// 	af_types[3].nfcount++;
-		 	// 	af_types[0].nfsum += pixel;
-		 	// 	af_types[1].nfsum += pixel;
-		 	// 	af_types[2].nfsum += pixel;
-		 	// 	af_types[3].nfsum += pixel;
-		 	// 	break;
+			// case '-': // If we want to include R and B, count them in gsum.
 			default:
 				break;
 			}
 		}
 	}
 
+	const double afsums[4] = { sum0, sum1, sum2, sum3 };
+	const long afcounts[4] = { count0, count1, count2, count3 };
+	const double total_sum = gsum + sum0 + sum1 + sum2 + sum3;
+	const long total_count = gcount + count0 + count1 + count2 + count3;
+	for (int f = 0; f < 4; f++) {
+		af_types[f].afsum = afsums[f];
+		af_types[f].afcount = afcounts[f];
+		af_types[f].nfsum = total_sum - afsums[f];
+		af_types[f].nfcount = total_count - afcounts[f];
+	}
+
 	for (int f = 0; f < 4; f++) {
 
 		// Make sure we have a valid sample.
@@ -361,10 +351,7 @@ int fix_xtrans_ac(fits *fit) {
 	siril_debug_print("XTRANS Best Type %c .... %.10f\n", best_af_type, best_fudge);
 
 	// Stay FIT, Subtract the fudge!
-	subtract_fudge(fit, af, best_fudge, &af_matrix, best_af_type);
-
-	// Flip the image back.
-	if (read_bottom_up) { fits_flip_top_to_bottom(fit); }
+	subtract_fudge(fit, af, best_fudge, &af_matrix, best_af_type, read_bottom_up);
 
 	invalidate_stats_from_fit(fit);
 
@@ -26,6 +26,7 @@
 #include "core/OS_utils.h"
 #include "algos/statistics.h"
 #include "algos/siril_wcs.h"
+#include "algos/warp.h"
 #include "core/undo.h"
 #include "core/processing.h"
 #include "gui/utils.h"
@@ -604,6 +605,14 @@ int crop_image_hook(struct generic_seq_args *args, int o, int i, fits *fit,
 		rectangle *_) {
 	struct crop_sequence_data *c_args = (struct crop_sequence_data*) args->user;
 
+	/* the area is given on the reference frame: images registered without
+	 * output sequence are aligned on it first */
+	if (seq_frame_needs_warp(args->seq, c_args->reglayer, i)) {
+		Homography H;
+		seq_get_frame_transform(args->seq, c_args->reglayer, i, &H);
+		if (warp_image(fit, fit->rx, fit->ry, &H, FALSE, WARP_DEFAULT_INTERPOLATION))
+			return 1;
+	}
 	return crop(fit, &(c_args->area));
 }
 
@@ -623,6 +632,7 @@ gpointer crop_sequence(struct crop_sequence_data *crop_sequence_data) {
 	args->new_seq_prefix = crop_sequence_data->prefix;
 	args->load_new_sequence = TRUE;
 	args->user = crop_sequence_data;
+	crop_sequence_data->reglayer = get_registration_layer(crop_sequence_data->seq);
 
 	start_in_new_thread(generic_sequence_worker, args);
 
@@ -8,6 +8,7 @@ struct crop_sequence_data {
 	sequence *seq;
 	rectangle area;
 	const char *prefix;
+	int reglayer;	// layer of the stored transformations, set by crop_sequence()
 	int retvalue;
 };
 
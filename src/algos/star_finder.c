@@ -162,6 +162,7 @@ void init_peaker_default() {
 	com.starfinder_conf.adjust = TRUE;
 	com.starfinder_conf.sigma = 1.0;
 	com.starfinder_conf.roundness = 0.5;
+	com.starfinder_conf.fast_fit = FALSE;
 }
 
 void on_toggle_radius_adjust_toggled(GtkToggleButton *togglebutton, gpointer user_data) {
@@ -221,6 +222,119 @@ void confirm_peaker_GUI() {
  */
 static int minimize_candidates(fits *image, star_finder_params *sf, starc *candidates, int nb_candidates, int layer, psf_star ***retval, gboolean limit_nbstars);
 
+/* candidates found in a band of rows of the filtered image */
+struct candidate_band {
+	starc *candidates;
+	int nb, allocated;
+};
+
+static int add_candidate(struct candidate_band *band, int x, int y, float mag_est, float bg) {
+	if (band->nb == band->allocated) {
+		int size = band->allocated ? band->allocated * 2 : 256;
+		starc *tmp = realloc(band->candidates, size * sizeof(starc));
+		if (!tmp) {
+			PRINT_ALLOC_ERR;
+			return 1;
+		}
+		band->candidates = tmp;
+		band->allocated = size;
+	}
+	band->candidates[band->nb].x = x;
+	band->candidates[band->nb].y = y;
+	band->candidates[band->nb].mag_est = mag_est;
+	band->candidates[band->nb].bg = bg;
+	band->nb++;
+	return 0;
+}
+
+/* Scans rows y0 to y1 (excluded) of the upside-down smoothed image for local
+ * maxima. The threshold test is first done on the whole row in a vectorized
+ * loop, the costly neighbourhood tests are only run on the pixels passing it. */
+static void find_candidates_in_rows(float **smooth_image, int y0, int y1, int areaX0, int areaX1,
+		int r, float threshold, float norm, double locthreshold, struct candidate_band *band) {
+	int boxsize = (2 * r + 1) * (2 * r + 1);
+	int width = areaX1 - areaX0;
+	if (width <= 2 * r)
+		return;
+	BYTE *above = malloc(width);
+	if (!above) {
+		PRINT_ALLOC_ERR;
+		return;
+	}
+
+	for (int y = y0; y < y1 && band->nb < MAX_STARS; y++) {
+		const float *row = smooth_image[y] + areaX0;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+		for (int i = 0; i < width; i++)
+			above[i] = (row[i] > threshold) & (row[i] < norm);
+
+		for (int x = r + areaX0; x < areaX1 - r; x++) {
+			if (!above[x - areaX0])
+				continue;
+			float pixel = smooth_image[y][x];
+			gboolean bingo = TRUE;
+			float neighbor;
+			double mean = 0., meanhigh = 0.;
+			int count = 0;
+			// making sure the central pixel is a local max compared to all neighbors in the search box
+			for (int yy = y - r; yy <= y + r && bingo; yy++) {
+				for (int xx = x - r; xx <= x + r; xx++) {
+					if (xx == x && yy == y)
+						continue;
+					neighbor = smooth_image[yy][xx];
+					if (neighbor > pixel) {
+						bingo = FALSE;
+						break;
+					} else if (neighbor == pixel) {
+						if ((xx <= x && yy <= y) || (xx > x && yy < y)) {
+							bingo = FALSE;
+							break;
+						}
+					}
+					mean += neighbor;
+					count ++;
+				}
+			}
+			if (count < boxsize - 1)
+				continue;
+			x += r; //no other local max can be found in the next r pixels band
+
+			count = 0;
+			for (int yy = y - 1; yy <= y + 1 && bingo; yy++) {
+				for (int xx = x - r - 1; xx <= x - r + 1; xx++) { // x corrected by the anticipated shift
+					if (xx == x - r && yy == y) {
+						continue;
+					}
+					neighbor = smooth_image[yy][xx];
+					if (neighbor <= threshold) {
+						bingo = FALSE;
+						break;
+					}
+					meanhigh += neighbor;
+					count++;
+				}
+			}
+			if (count < 8)
+				continue;
+			mean = (mean - meanhigh) / (boxsize - 9); // (boxsize - 1) pix in mean and 8 pix in meanhigh
+			/* trying to remove false positives in nebs
+			mean of 9 central pixels must be above mean of the whole search box excluding them
+			i.e, an approximation of the local background, by a significant amount
+			*/
+			meanhigh = (meanhigh + pixel) / 9;
+			if (meanhigh - mean <= locthreshold)
+				continue;
+
+			// x corrected by the anticipated shift, using local background
+			if (add_candidate(band, x - r, y, meanhigh, mean) || band->nb == MAX_STARS)
+				break;
+		}
+	}
+	free(above);
+}
+
 psf_star **peaker(fits *fit, int layer, star_finder_params *sf, int *nb_stars, rectangle *area, gboolean showtime, gboolean limit_nbstars) {
 	int nx = fit->rx;
 	int ny = fit->ry;
@@ -302,87 +416,45 @@ psf_star **peaker(fits *fit, int layer, star_finder_params *sf, int *nb_stars, r
 	sf->adj_radius = sf->adjust ? sf->radius / res : sf->radius;
 	siril_log_message("Adjusted radius: %d\n", sf->adj_radius);
 	int r = sf->adj_radius;
-	int boxsize = (2 * r + 1)*(2 * r + 1);
 	double locthreshold = sf->sigma * 5.0 * bgnoise;
 
-	/* Search for candidate stars in the filtered image */
-	for (int y = r + areaY0; y < areaY1 - r; y++) {
-		for (int x = r + areaX0; x < areaX1 - r; x++) {
-			float pixel = smooth_image[y][x];
-			if (pixel > threshold && pixel < norm) {
-				gboolean bingo = TRUE;
-				float neighbor;
-				double mean = 0., meanhigh = 0.;
-				int count = 0;
-				// making sure the central pixel is a local max compared to all neighbors in the search box
-				for (int yy = y - r; yy <= y + r; yy++) {
-					for (int xx = x - r; xx <= x + r; xx++) {
-						if (xx == x && yy == y)
-							continue;
-						neighbor = smooth_image[yy][xx];
-						if (neighbor > pixel) {
-							bingo = FALSE;
-							break;
-						} else if (neighbor == pixel) {
-							if ((xx <= x && yy <= y) || (xx > x && yy < y)) {
-								bingo = FALSE;
-								break;
-							}
-						}
-						if (!bingo) break;
-						mean += neighbor;
-						count ++;
-					}
-				}
-				if (count < boxsize - 1) {
-					bingo = FALSE;
-					continue;
-				}
-				x += r; //no other local max can be found in the next r pixels band
-
-				count = 0;
-				for (int yy = y - 1; yy <= y + 1; yy++) {
-					for (int xx = x - r - 1; xx <= x - r + 1; xx++) { // x corrected by the anticipated shift
-						if (xx == x - r && yy == y) {
-							continue;
-						}
-						neighbor = smooth_image[yy][xx]; 
-						if (neighbor <= threshold) {
-							bingo = FALSE;
-							break;
-						}
-						if (!bingo) break;
-						meanhigh += neighbor;
-						count++;
-					}
-				}
-				if (count < 8) {
-					bingo = FALSE;
-					continue;
-				}
-				mean = (mean - meanhigh) / (boxsize - 9); // (boxsize - 1) pix in mean and 8 pix in meanhigh
-				/* trying to remove false positives in nebs
-				mean of 9 central pixels must be above mean of the whole search box excluding them
-				i.e, an approximation of the local background, by a significant amount
-				*/
-				meanhigh = (meanhigh + pixel) / 9;
-				if (meanhigh - mean <= locthreshold) { 
-					bingo = FALSE;
-					continue;
-				}
-
-				if (bingo && nbstars < MAX_STARS) {
-					candidates[nbstars].x = x - r; // x corrected by the anticipated shift
-					candidates[nbstars].y = y;
-					candidates[nbstars].mag_est = meanhigh;
-					candidates[nbstars].bg = mean; //using local background
-					nbstars++;
-					if (nbstars == MAX_STARS) break;
-				}
-			}
+	/* Search for candidate stars in the filtered image, by bands of rows.
+	 * The local maximum test reads the neighbouring rows of the whole image,
+	 * so a candidate belongs to the band of its row only, and concatenating
+	 * the bands in order gives the same list as a single scan. */
+	int first_row = r + areaY0, end_row = areaY1 - r;
+	int nb_bands = 0;
+	if (end_row > first_row) {
+		nb_bands = min(com.max_thread * 4, end_row - first_row);
+		if (nb_bands < 1)
+			nb_bands = 1;
+	}
+	struct candidate_band *bands = calloc(max(nb_bands, 1), sizeof(struct candidate_band));
+	if (!bands) {
+		clearfits(&smooth_fit);
+		free(smooth_image);
+		free(candidates);
+		PRINT_ALLOC_ERR;
+		return NULL;
+	}
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(dynamic)
+#endif
+	for (int band = 0; band < nb_bands; band++) {
+		int y0 = first_row + (int)((gint64)(end_row - first_row) * band / nb_bands);
+		int y1 = first_row + (int)((gint64)(end_row - first_row) * (band + 1) / nb_bands);
+		find_candidates_in_rows(smooth_image, y0, y1, areaX0, areaX1, r,
+				threshold, norm, locthreshold, &bands[band]);
+	}
+	for (int band = 0; band < nb_bands; band++) {
+		int n = min(bands[band].nb, MAX_STARS - nbstars);
+		if (n > 0) {
+			memcpy(candidates + nbstars, bands[band].candidates, n * sizeof(starc));
+			nbstars += n;
 		}
-		if (nbstars == MAX_STARS) break;
+		free(bands[band].candidates);
 	}
+	free(bands);
 	clearfits(&smooth_fit);
 	siril_debug_print("Candidates for stars: %d\n", nbstars);
 
@@ -403,15 +475,67 @@ psf_star **peaker(fits *fit, int layer, star_finder_params *sf, int *nb_stars, r
 	return results;
 }
 
-/* returns number of stars found, result is in parameters */
+static psf_star *fit_candidate(gsl_matrix *z, fits *image, WORD **image_ushort, float **image_float,
+		starc *candidate, int radius, int layer, star_finder_params *sf) {
+	int x = candidate->x, y = candidate->y;
+	int ii, jj, i, j;
+	psf_star *cur_star;
+	if (sf->fast_fit && 2 * radius <= PSF_FAST_MAX_SIZE) {
+		/* same layout as z, on the stack */
+		float window[PSF_FAST_MAX_SIZE * PSF_FAST_MAX_SIZE];
+		int size = 2 * radius;
+		for (jj = 0, j = y - radius; j < y + radius; j++, jj++) {
+			for (ii = 0, i = x - radius; i < x + radius; i++, ii++) {
+				window[ii * size + jj] = image->type == DATA_USHORT ?
+					(float)image_ushort[j][i] : image_float[j][i];
+			}
+		}
+		cur_star = psf_fast_minimisation(window, size, size, candidate->bg);
+	} else {
+		/* FILL z */
+		if (image->type == DATA_USHORT) {
+			for (jj = 0, j = y - radius; j < y + radius; j++, jj++) {
+				for (ii = 0, i = x - radius; i < x + radius;
+						i++, ii++) {
+					gsl_matrix_set(z, ii, jj, (double)image_ushort[j][i]);
+				}
+			}
+		} else {
+			for (jj = 0, j = y - radius; j < y + radius; j++, jj++) {
+				for (ii = 0, i = x - radius; i < x + radius;
+						i++, ii++) {
+					gsl_matrix_set(z, ii, jj, (double)image_float[j][i]);
+				}
+			}
+		}
+		cur_star = psf_global_minimisation(z, candidate->bg, FALSE, FALSE, FALSE);
+	}
+
+	if (cur_star) {
+		if (is_star(cur_star, sf)) {
+			//fwhm_to_arcsec_if_needed(image, cur_star);	// should we do this here?
+			cur_star->layer = layer;
+			cur_star->xpos = (x - radius) + cur_star->x0 - 1.0;
+			cur_star->ypos = (y - radius) + cur_star->y0 - 1.0;
+			return cur_star;
+		}
+		free_psf(cur_star);
+	}
+	return NULL;
+}
+
+/* returns number of stars found, result is in parameters.
+ * Candidates are fitted in parallel, each thread with its own data matrix.
+ * They are processed by batches in order of brightness so that the number of
+ * stars can be limited to the brightest as in a sequential fit, the results
+ * of a batch being compacted in candidate order. */
 static int minimize_candidates(fits *image, star_finder_params *sf, starc *candidates, int nb_candidates, int layer, psf_star ***retval, gboolean limit_nbstars) {
 	int radius = sf->adj_radius;
 	int nx = image->rx;
 	int ny = image->ry;
-	gsl_matrix *z = gsl_matrix_alloc(radius * 2, radius * 2);
 	WORD **image_ushort = NULL;
 	float **image_float = NULL;
-	gint nbstars = 0;
+	int nbstars = 0;
 
 	if (image->type == DATA_USHORT) {
 		image_ushort = malloc(ny * sizeof(WORD *));
@@ -426,55 +550,57 @@ static int minimize_candidates(fits *image, star_finder_params *sf, starc *candi
 	else return 0;
 
 	psf_star **results = new_fitted_stars(nb_candidates);
-	if (!results) {
+	int nb_threads = com.max_thread;
+	gsl_matrix **z = calloc(nb_threads, sizeof(gsl_matrix *));
+	int batch_size = limit_nbstars ? max(256, 16 * nb_threads) : nb_candidates;
+	psf_star **batch = calloc(max(batch_size, 1), sizeof(psf_star *));
+	if (!results || !z || !batch) {
 		PRINT_ALLOC_ERR;
+		free(results);
+		free(z);
+		free(batch);
+		free(image_ushort);
+		free(image_float);
 		return 0;
 	}
+	for (int i = 0; i < nb_threads; i++)
+		z[i] = gsl_matrix_alloc(radius * 2, radius * 2);
 
 	//sorting candidates by starc.mean values as an estimator of mag
 	qsort(candidates, nb_candidates, sizeof(starc), star_cmp);
 
-	for (int candidate = 0; candidate < nb_candidates; candidate++) {
-		int x = candidates[candidate].x, y = candidates[candidate].y;
-		int ii, jj, i, j;
-		/* FILL z */
-		if (image->type == DATA_USHORT) {
-			for (jj = 0, j = y - radius; j < y + radius; j++, jj++) {
-				for (ii = 0, i = x - radius; i < x + radius;
-						i++, ii++) {
-					gsl_matrix_set(z, ii, jj, (double)image_ushort[j][i]);
-				}
-			}
-		} else {
-			for (jj = 0, j = y - radius; j < y + radius; j++, jj++) {
-				for (ii = 0, i = x - radius; i < x + radius;
-						i++, ii++) {
-					gsl_matrix_set(z, ii, jj, (double)image_float[j][i]);
-				}
-			}
+	for (int first = 0; first < nb_candidates; first += batch_size) {
+		int nb = min(batch_size, nb_candidates - first);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nb_threads) schedule(dynamic, 16)
+#endif
+		for (int candidate = 0; candidate < nb; candidate++) {
+			int thread = 0;
+#ifdef _OPENMP
+			thread = omp_get_thread_num();
+#endif
+			batch[candidate] = fit_candidate(z[thread], image, image_ushort, image_float,
+					&candidates[first + candidate], radius, layer, sf);
 		}
 
-		psf_star *cur_star = psf_global_minimisation(z, candidates[candidate].bg, FALSE, FALSE, FALSE);
-		if (cur_star) {
-			if (is_star(cur_star, sf)) {
-				//fwhm_to_arcsec_if_needed(image, cur_star);	// should we do this here?
-				cur_star->layer = layer;
-				int result_index = g_atomic_int_add(&nbstars, 1);
-				cur_star->xpos = (x - radius) + cur_star->x0 - 1.0;
-				cur_star->ypos = (y - radius) + cur_star->y0 - 1.0;
-				results[result_index] = cur_star;
-				//fprintf(stdout, "%03d: %11f %11f %f\n",
-				//		result_index, cur_star->xpos, cur_star->ypos, cur_star->mag);
-			}
-			else free_psf(cur_star);
-			if ((nbstars >= MAX_STARS_FITTED) && limit_nbstars) break;
+		for (int candidate = 0; candidate < nb; candidate++) {
+			if (!batch[candidate])
+				continue;
+			if (limit_nbstars && nbstars >= MAX_STARS_FITTED)
+				free_psf(batch[candidate]);
+			else results[nbstars++] = batch[candidate];
 		}
+		if (limit_nbstars && nbstars >= MAX_STARS_FITTED)
+			break;
 	}
 
 	results[nbstars] = NULL;
 	if (retval)
 		*retval = results;
-	gsl_matrix_free(z);
+	for (int i = 0; i < nb_threads; i++)
+		gsl_matrix_free(z[i]);
+	free(z);
+	free(batch);
 	if (image_ushort) free(image_ushort);
 	if (image_float) free(image_float);
 	return nbstars;
@@ -466,12 +466,12 @@ imstats* statistics(sequence *seq, int image_index, fits *fit, int layer, rectan
 }
 
 int compute_means_from_flat_cfa_ushort(fits *fit, float mean[4]) {
-	int row, col, c, i = 0;
 	WORD *data;
-	unsigned int width, height;
-	unsigned int startx, starty;
+	int width, height;
+	int startx, starty;
+	double sum0 = 0.0, sum1 = 0.0, sum2 = 0.0, sum3 = 0.0;
+	long i = 0;
 
-	mean[0] = mean[1] = mean[2] = mean[3] = 0.0;
 	data = fit->data;
 	width = fit->rx;
 	height = fit->ry;
@@ -490,19 +490,24 @@ int compute_means_from_flat_cfa_ushort(fits *fit, float mean[4]) {
 			width - 1 - startx, height - 1 - starty);
 
 	/* Compute mean of each channel */
-	for (row = starty; row < height - 1 - starty; row += 2) {
-		for (col = startx; col < width - 1 - startx; col += 2) {
-			mean[0] += (float) data[col + row * width];
-			mean[1] += (float) data[1 + col + row * width];
-			mean[2] += (float) data[col + (1 + row) * width];
-			mean[3] += (float) data[1 + col + (1 + row) * width];
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static) reduction(+:sum0, sum1, sum2, sum3, i)
+#endif
+	for (int row = starty; row < height - 1 - starty; row += 2) {
+		const WORD *line = data + (size_t) row * width;
+		for (int col = startx; col < width - 1 - startx; col += 2) {
+			sum0 += (float) line[col];
+			sum1 += (float) line[1 + col];
+			sum2 += (float) line[col + width];
+			sum3 += (float) line[1 + col + width];
 			i++;
 		}
 	}
 
-	for (c = 0; c < 4; c++) {
-		mean[c] /= (float) i;
-	}
+	mean[0] = (float) (sum0 / i);
+	mean[1] = (float) (sum1 / i);
+	mean[2] = (float) (sum2 / i);
+	mean[3] = (float) (sum3 / i);
 	return 0;
 }
 
@@ -0,0 +1,484 @@
+/*
+ * This file is part of Siril, an astronomy image processor.
+ * Copyright (C) 2005-2011 Francois Meyer (dulle at free.fr)
+ * Copyright (C) 2012-2021 team free-astro (see more in AUTHORS file)
+ * Reference site is https://free-astro.org/index.php/Siril
+ *
+ * Siril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Siril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Siril. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Planar warp engine: applies a homography to the channels of a fits
+ * directly, without converting them to interleaved OpenCV matrices.
+ * It reproduces the behaviour of OpenCV's warpPerspective() with a
+ * transparent border: sub-pixel positions are quantized to 1/WARP_TAB_SIZE
+ * pixel and the kernel weights are read from tables computed once, pixels
+ * whose position falls outside the source image are set to 0. Like OpenCV,
+ * only the pixel the position falls in is tested, the taps of kernels that
+ * partly leave the image are clamped to its border where OpenCV reflects
+ * them, which only changes the last pixels of the edges.
+ * For each output row, the source offsets and table indices are computed
+ * once in a vectorized loop and used for all channels. The kernels are
+ * vectorized over the row with gathers, one function per number of taps,
+ * and the pixels of the border are computed afterwards.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <float.h>
+
+#include "core/siril.h"
+#include "core/proto.h"
+#include "algos/statistics.h"
+#include "algos/warp.h"
+
+#define WARP_TAB_BITS 5
+#define WARP_TAB_SIZE (1 << WARP_TAB_BITS)
+
+static float linear_tab[WARP_TAB_SIZE][2];
+static float cubic_tab[WARP_TAB_SIZE][4];
+static float lanczos_tab[WARP_TAB_SIZE][8];
+
+static void init_tables() {
+	static gsize initialized = 0;
+	if (!g_once_init_enter(&initialized))
+		return;
+	const float A = -0.75f;	// same cubic kernel as OpenCV
+	for (int i = 0; i < WARP_TAB_SIZE; i++) {
+		float x = (float)i / WARP_TAB_SIZE;
+		linear_tab[i][0] = 1.f - x;
+		linear_tab[i][1] = x;
+
+		cubic_tab[i][0] = ((A * (x + 1.f) - 5.f * A) * (x + 1.f) + 8.f * A) * (x + 1.f) - 4.f * A;
+		cubic_tab[i][1] = ((A + 2.f) * x - (A + 3.f)) * x * x + 1.f;
+		cubic_tab[i][2] = ((A + 2.f) * (1.f - x) - (A + 3.f)) * (1.f - x) * (1.f - x) + 1.f;
+		cubic_tab[i][3] = 1.f - cubic_tab[i][0] - cubic_tab[i][1] - cubic_tab[i][2];
+
+		double sum = 0.0, w[8];
+		for (int k = 0; k < 8; k++) {
+			double d = x + 3.0 - k;
+			if (fabs(d) < 1e-9)
+				w[k] = 1.0;
+			else w[k] = 4.0 * sin(M_PI * d) * sin(M_PI * d / 4.0) / (M_PI * M_PI * d * d);
+			sum += w[k];
+		}
+		for (int k = 0; k < 8; k++)
+			lanczos_tab[i][k] = (float)(w[k] / sum);
+	}
+	g_once_init_leave(&initialized, 1);
+}
+
+static int get_taps(opencv_interpolation interpolation) {
+	switch (interpolation) {
+	case OPENCV_NEAREST:
+		return 1;
+	case OPENCV_CUBIC:
+		return 4;
+	case OPENCV_LANCZOS4:
+		return 8;
+	default:	// area is not available for warping, OpenCV uses linear
+		return 2;
+	}
+}
+
+/* the weights of the sub-pixel position i start at i * taps in the table */
+static const float *get_weights(opencv_interpolation interpolation) {
+	switch (interpolation) {
+	case OPENCV_CUBIC:
+		return &cubic_tab[0][0];
+	case OPENCV_LANCZOS4:
+		return &lanczos_tab[0][0];
+	default:
+		return &linear_tab[0][0];
+	}
+}
+
+static void mat3_mul(double a[3][3], double b[3][3], double r[3][3]) {
+	double tmp[3][3];
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 3; j++)
+			tmp[i][j] = a[i][0] * b[0][j] + a[i][1] * b[1][j] + a[i][2] * b[2][j];
+	memcpy(r, tmp, sizeof(tmp));
+}
+
+static void mat3_inverse(double a[3][3], double r[3][3]) {
+	double det = a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1])
+		- a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0])
+		+ a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+	double idet = det != 0.0 ? 1.0 / det : 0.0;
+	r[0][0] = (a[1][1] * a[2][2] - a[1][2] * a[2][1]) * idet;
+	r[0][1] = (a[0][2] * a[2][1] - a[0][1] * a[2][2]) * idet;
+	r[0][2] = (a[0][1] * a[1][2] - a[0][2] * a[1][1]) * idet;
+	r[1][0] = (a[1][2] * a[2][0] - a[1][0] * a[2][2]) * idet;
+	r[1][1] = (a[0][0] * a[2][2] - a[0][2] * a[2][0]) * idet;
+	r[1][2] = (a[0][2] * a[1][0] - a[0][0] * a[1][2]) * idet;
+	r[2][0] = (a[1][0] * a[2][1] - a[1][1] * a[2][0]) * idet;
+	r[2][1] = (a[0][1] * a[2][0] - a[0][0] * a[2][1]) * idet;
+	r[2][2] = (a[0][0] * a[1][1] - a[0][1] * a[1][0]) * idet;
+}
+
+/* The homography H works on coordinates with the Y axis going down, images
+ * are stored bottom-up: unless the data is read top-down, the Y axis is
+ * flipped on both sides, then the matrix is inverted to map the output pixels
+ * to the source */
+void warp_init_transform(warp_transform *t, Homography *H, int src_rx, int src_ry,
+		int dst_rx, int dst_ry, gboolean upscale2x, gboolean top_down) {
+	double h[3][3] = {
+		{ H->h00, H->h01, H->h02 },
+		{ H->h10, H->h11, H->h12 },
+		{ H->h20, H->h21, H->h22 } };
+	if (upscale2x) {
+		double s[3][3] = { { 2.0, 0.0, 0.0 }, { 0.0, 2.0, 0.0 }, { 0.0, 0.0, 1.0 } };
+		mat3_mul(s, h, h);
+	}
+	if (!top_down) {
+		double f1[3][3] = { { 1.0, 0.0, 0.0 }, { 0.0, -1.0, src_ry - 1.0 }, { 0.0, 0.0, 1.0 } };
+		double f2[3][3] = { { 1.0, 0.0, 0.0 }, { 0.0, -1.0, dst_ry - 1.0 }, { 0.0, 0.0, 1.0 } };
+		mat3_mul(h, f1, h);
+		mat3_mul(f2, h, h);	// f2 is its own inverse
+	}
+	mat3_inverse(h, t->m);
+	t->src_rx = src_rx;
+	t->src_ry = src_ry;
+	t->dst_rx = dst_rx;
+	t->dst_ry = dst_ry;
+}
+
+#define WARP_OUTSIDE -1	// the position is outside the source
+#define WARP_BORDER -2	// the kernel partly leaves the source
+
+/* per row scratch: offset of the first tap in the source, or WARP_OUTSIDE or
+ * WARP_BORDER, the position of the first tap relative to the rows available,
+ * and the offsets of the weights in the tables. All are int for the gathers
+ * of the vectorized kernels, offsets that do not fit are marked WARP_BORDER */
+struct warp_row {
+	double *sx, *sy;
+	int *ofs;
+	int *ix, *iy;
+	int src_h;
+	int *tx, *ty;
+};
+
+static int alloc_warp_row(struct warp_row *row, int width) {
+	row->sx = malloc(width * sizeof(double));
+	row->sy = malloc(width * sizeof(double));
+	row->ofs = malloc(width * sizeof(int));
+	row->ix = malloc(width * sizeof(int));
+	row->iy = malloc(width * sizeof(int));
+	row->tx = malloc(width * sizeof(int));
+	row->ty = malloc(width * sizeof(int));
+	if (!row->sx || !row->sy || !row->ofs || !row->ix || !row->iy || !row->tx || !row->ty) {
+		PRINT_ALLOC_ERR;
+		return 1;
+	}
+	return 0;
+}
+
+static void free_warp_row(struct warp_row *row) {
+	free(row->sx);
+	free(row->sy);
+	free(row->ofs);
+	free(row->ix);
+	free(row->iy);
+	free(row->tx);
+	free(row->ty);
+}
+
+/* the source rows available are src_y0 to src_y0 + src_h - 1 */
+static void prepare_row(const warp_transform *t, opencv_interpolation interpolation,
+		int y, int src_y0, int src_h, struct warp_row *row) {
+	int width = t->dst_rx;
+	const double (*m)[3] = t->m;
+	double bx = m[0][1] * y + m[0][2];
+	double by = m[1][1] * y + m[1][2];
+	double bw = m[2][1] * y + m[2][2];
+	double *sx = row->sx, *sy = row->sy;
+	double scale = interpolation == OPENCV_NEAREST ? 1.0 : WARP_TAB_SIZE;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+	for (int x = 0; x < width; x++) {
+		double w = m[2][0] * x + bw;
+		w = w != 0.0 ? scale / w : 0.0;
+		sx[x] = (m[0][0] * x + bx) * w;
+		sy[x] = (m[1][0] * x + by) * w;
+	}
+
+	int taps = get_taps(interpolation), before = (taps - 1) / 2;
+	row->src_h = src_h;
+	for (int x = 0; x < width; x++) {
+		/* out of range positions would overflow the conversion */
+		if (fabs(sx[x]) > (double)INT_MAX / 2 || fabs(sy[x]) > (double)INT_MAX / 2) {
+			row->ofs[x] = WARP_OUTSIDE;
+			continue;
+		}
+		int X = (int)lrint(sx[x]), Y = (int)lrint(sy[x]);
+		int ix, iy;
+		if (interpolation == OPENCV_NEAREST) {
+			ix = X;
+			iy = Y;
+			row->tx[x] = row->ty[x] = 0;
+		} else {
+			ix = (X >> WARP_TAB_BITS) - before;
+			iy = (Y >> WARP_TAB_BITS) - before;
+			row->tx[x] = (X & (WARP_TAB_SIZE - 1)) * taps;
+			row->ty[x] = (Y & (WARP_TAB_SIZE - 1)) * taps;
+		}
+		row->ix[x] = ix;
+		row->iy[x] = iy - src_y0;
+		long ofs = (long)(iy - src_y0) * t->src_rx + ix;
+		if (ix >= 0 && iy >= src_y0 && ix + taps <= t->src_rx && iy + taps <= src_y0 + src_h
+				&& ofs + (long)(taps - 1) * t->src_rx + taps <= INT_MAX)
+			row->ofs[x] = (int)ofs;
+		else if (ix + before < 0 || iy + before < src_y0 ||
+				ix + before >= t->src_rx || iy + before >= src_y0 + src_h)
+			row->ofs[x] = WARP_OUTSIDE;
+		else row->ofs[x] = WARP_BORDER;
+	}
+}
+
+#ifdef _OPENMP
+#define WARP_SIMD _Pragma("omp simd")
+#else
+#define WARP_SIMD
+#endif
+
+/* pixels whose kernel is not entirely in the source, or too far in it for
+ * an int offset: 0 outside, taps clamped to the border of the source
+ * otherwise, which does not change the others */
+#define APPLY_BORDER(type) \
+static void apply_border_##type(const type *src, int src_rx, opencv_interpolation interpolation, \
+		const struct warp_row *row, int width, float *out) { \
+	int taps = get_taps(interpolation); \
+	for (int x = 0; x < width; x++) { \
+		if (row->ofs[x] >= 0) \
+			continue; \
+		if (row->ofs[x] == WARP_OUTSIDE) { \
+			out[x] = 0.f; \
+			continue; \
+		} \
+		const float *wx = get_weights(interpolation) + row->tx[x]; \
+		const float *wy = get_weights(interpolation) + row->ty[x]; \
+		float value = 0.f; \
+		for (int j = 0; j < taps; j++) { \
+			int Y = max(0, min(row->src_h - 1, row->iy[x] + j)); \
+			const type *line = src + (long)Y * src_rx; \
+			float sum = 0.f; \
+			for (int i = 0; i < taps; i++) \
+				sum += wx[i] * (float)line[max(0, min(src_rx - 1, row->ix[x] + i))]; \
+			value += wy[j] * sum; \
+		} \
+		out[x] = value; \
+	} \
+}
+
+/* kernels with a constant number of taps, vectorized over the row with
+ * gathers: pixels of the border read the first pixels of the source and are
+ * computed again by apply_border(), the source is at least taps x taps */
+#define APPLY_TAPS(type, taps, tab) \
+static void apply_row_##type##_##taps(const type *src, int src_rx, \
+		const struct warp_row *row, int width, float *out) { \
+	const int *ofs = row->ofs, *tx = row->tx, *ty = row->ty; \
+	const float *w = &tab[0][0]; \
+	WARP_SIMD \
+	for (int x = 0; x < width; x++) { \
+		int o = ofs[x] >= 0 ? ofs[x] : 0; \
+		float value = 0.f; \
+		for (int j = 0; j < taps; j++) { \
+			float sum = 0.f; \
+			for (int i = 0; i < taps; i++) \
+				sum += w[tx[x] + i] * (float)src[o + j * src_rx + i]; \
+			value += w[ty[x] + j] * sum; \
+		} \
+		out[x] = value; \
+	} \
+}
+
+#define APPLY_ROW(type) \
+APPLY_BORDER(type) \
+APPLY_TAPS(type, 2, linear_tab) \
+APPLY_TAPS(type, 4, cubic_tab) \
+APPLY_TAPS(type, 8, lanczos_tab) \
+static void apply_row_##type(const type *src, int src_rx, opencv_interpolation interpolation, \
+		const struct warp_row *row, int width, float *out) { \
+	int taps = get_taps(interpolation); \
+	if (row->src_h >= taps && src_rx >= taps) { \
+		const int *ofs = row->ofs; \
+		switch (interpolation) { \
+		case OPENCV_NEAREST: \
+			WARP_SIMD \
+			for (int x = 0; x < width; x++) \
+				out[x] = (float)src[ofs[x] >= 0 ? ofs[x] : 0]; \
+			break; \
+		case OPENCV_CUBIC: \
+			apply_row_##type##_4(src, src_rx, row, width, out); \
+			break; \
+		case OPENCV_LANCZOS4: \
+			apply_row_##type##_8(src, src_rx, row, width, out); \
+			break; \
+		default: \
+			apply_row_##type##_2(src, src_rx, row, width, out); \
+		} \
+	} \
+	apply_border_##type(src, src_rx, interpolation, row, width, out); \
+}
+
+APPLY_ROW(WORD)
+APPLY_ROW(float)
+
+static void apply_row(fits *image, int layer, opencv_interpolation interpolation,
+		const struct warp_row *row, int width, float *out) {
+	if (image->type == DATA_USHORT)
+		apply_row_WORD(image->pdata[layer], image->rx, interpolation, row, width, out);
+	else apply_row_float(image->fpdata[layer], image->rx, interpolation, row, width, out);
+}
+
+/* gives the rows of the source that are needed to compute nb_rows rows of the
+ * output starting at first_row. A straight line stays straight with a
+ * homography, so the extreme positions are reached on the corners */
+void warp_source_rows(const warp_transform *t, opencv_interpolation interpolation,
+		int first_row, int nb_rows, int *src_y0, int *src_h) {
+	const double (*m)[3] = t->m;
+	double xs[2] = { 0.0, t->dst_rx - 1.0 };
+	double ys[2] = { first_row, first_row + nb_rows - 1.0 };
+	double ymin = DBL_MAX, ymax = -DBL_MAX;
+	for (int i = 0; i < 2; i++) {
+		for (int j = 0; j < 2; j++) {
+			double w = m[2][0] * xs[i] + m[2][1] * ys[j] + m[2][2];
+			if (w <= 0.0) {	// the line goes through infinity
+				ymin = 0.0;
+				ymax = t->src_ry;
+				continue;
+			}
+			double y = (m[1][0] * xs[i] + m[1][1] * ys[j] + m[1][2]) / w;
+			ymin = min(ymin, y);
+			ymax = max(ymax, y);
+		}
+	}
+	int margin = get_taps(interpolation) / 2 + 1;
+	int y0 = (int)max(floor(ymin) - margin, 0.0);
+	int y1 = (int)min(ceil(ymax) + margin, t->src_ry - 1.0);
+	*src_y0 = y0;
+	*src_h = y1 >= y0 ? y1 - y0 + 1 : 0;
+}
+
+/* warps nb_rows rows of a channel, starting at first_row of the output, from
+ * the rows src_y0 to src_y0 + src_h - 1 of the source stored in src, as given
+ * by warp_source_rows(). The output has the type of the input and the width
+ * given to warp_init_transform() */
+int warp_rows(const void *src, data_type type, int src_y0, int src_h,
+		const warp_transform *t, opencv_interpolation interpolation,
+		int first_row, int nb_rows, void *dest) {
+	struct warp_row row = { 0 };
+	float *buffer = NULL;
+	int width = t->dst_rx;
+	init_tables();
+	if (alloc_warp_row(&row, width) || !(buffer = malloc(width * sizeof(float)))) {
+		free_warp_row(&row);
+		return 1;
+	}
+	for (int y = first_row; y < first_row + nb_rows; y++) {
+		size_t start = (size_t)(y - first_row) * width;
+		prepare_row(t, interpolation, y, src_y0, src_h, &row);
+		if (type == DATA_USHORT) {
+			WORD *out = (WORD *)dest + start;
+			apply_row_WORD(src, t->src_rx, interpolation, &row, width, buffer);
+			for (int x = 0; x < width; x++)
+				out[x] = roundf_to_WORD(buffer[x]);
+		} else {
+			apply_row_float(src, t->src_rx, interpolation, &row, width,
+					(float *)dest + start);
+		}
+	}
+	free_warp_row(&row);
+	free(buffer);
+	return 0;
+}
+
+/* transforms the image with the homography, in place. The result is width x
+ * height, which must already be doubled for the 2x upscale */
+int warp_image(fits *image, unsigned int width, unsigned int height, Homography *H,
+		gboolean upscale2x, opencv_interpolation interpolation) {
+	warp_transform t;
+	int nb_layers = image->naxes[2];
+	size_t ndata = (size_t)width * height;
+	void *newdata;
+	int retval = 0;
+
+	init_tables();
+	warp_init_transform(&t, H, image->rx, image->ry, width, height, upscale2x, FALSE);
+	if (image->type == DATA_USHORT)
+		newdata = malloc(ndata * nb_layers * sizeof(WORD));
+	else newdata = malloc(ndata * nb_layers * sizeof(float));
+	if (!newdata) {
+		PRINT_ALLOC_ERR;
+		return 1;
+	}
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(com.max_thread) reduction(|:retval)
+#endif
+	{
+		struct warp_row row = { 0 };
+		float *buffer = malloc(width * sizeof(float));
+		gboolean ok = !alloc_warp_row(&row, width) && buffer;
+		// all threads go through the loop, even without their buffers
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+		for (int y = 0; y < (int)height; y++) {
+			if (!ok)
+				continue;
+			prepare_row(&t, interpolation, y, 0, image->ry, &row);
+			for (int layer = 0; layer < nb_layers; layer++) {
+				size_t start = layer * ndata + (size_t)y * width;
+				if (image->type == DATA_USHORT) {
+					WORD *out = (WORD *)newdata + start;
+					apply_row(image, layer, interpolation, &row, width, buffer);
+					for (unsigned int x = 0; x < width; x++)
+						out[x] = roundf_to_WORD(buffer[x]);
+				} else {
+					apply_row(image, layer, interpolation, &row, width,
+							(float *)newdata + start);
+				}
+			}
+		}
+		retval |= !ok;
+		free_warp_row(&row);
+		free(buffer);
+	}
+	if (retval) {
+		free(newdata);
+		return 1;
+	}
+
+	if (image->type == DATA_USHORT) {
+		free(image->data);
+		image->data = newdata;
+		for (int layer = 0; layer < 3; layer++)
+			image->pdata[layer] = image->data + (nb_layers == 3 ? layer * ndata : 0);
+	} else {
+		free(image->fdata);
+		image->fdata = newdata;
+		for (int layer = 0; layer < 3; layer++)
+			image->fpdata[layer] = image->fdata + (nb_layers == 3 ? layer * ndata : 0);
+	}
+	image->rx = width;
+	image->ry = height;
+	image->naxes[0] = image->rx;
+	image->naxes[1] = image->ry;
+	invalidate_stats_from_fit(image);
+	return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef SRC_ALGOS_WARP_H_
+#define SRC_ALGOS_WARP_H_
+
+#include "core/siril.h"
+
+/* interpolation used to apply the transformations stored in a sequence when
+ * its images are read, the one of the register command */
+#define WARP_DEFAULT_INTERPOLATION OPENCV_LINEAR
+
+/* Homography applied by the warp engine, expressed in memory coordinates:
+ * it gives the position in the source image of a pixel of the output image */
+typedef struct {
+	double m[3][3];
+	int src_rx, src_ry;
+	int dst_rx, dst_ry;
+} warp_transform;
+
+void warp_init_transform(warp_transform *t, Homography *H, int src_rx, int src_ry,
+		int dst_rx, int dst_ry, gboolean upscale2x, gboolean top_down);
+
+void warp_source_rows(const warp_transform *t, opencv_interpolation interpolation,
+		int first_row, int nb_rows, int *src_y0, int *src_h);
+int warp_rows(const void *src, data_type type, int src_y0, int src_h,
+		const warp_transform *t, opencv_interpolation interpolation,
+		int first_row, int nb_rows, void *dest);
+
+int warp_image(fits *image, unsigned int width, unsigned int height, Homography *H,
+		gboolean upscale2x, opencv_interpolation interpolation);
+
+#endif /* SRC_ALGOS_WARP_H_ */
@@ -929,7 +929,7 @@ int process_merge(int nb) {
 				for (unsigned int frame = 0; frame < seqs[i]->number; frame++) {
 					seqwriter_wait_for_memory();
 					fits *fit = calloc(1, sizeof(fits));
-					if (ser_read_frame(seqs[i]->ser_file, frame, fit, FALSE, com.pref.debayer.open_debayer)) {
+					if (ser_read_frame(seqs[i]->ser_file, frame, fit, FALSE, com.pref.debayer.open_debayer, -1)) {
 						siril_log_message(_("Failed to read frame %d from input sequence `%s'\n"), frame, word[i + 1]);
 						retval = 1;
 						seqwriter_release_memory();
@@ -1238,6 +1238,7 @@ int process_set_findstar(int nb) {
 	if (sigma >= 0.05 && roundness >= 0 && roundness <= 0.9) {
 		com.starfinder_conf.sigma = sigma;
 		com.starfinder_conf.roundness = roundness;
+		com.starfinder_conf.fast_fit = nb > 3 && !g_strcmp0(word[3], "-fast");
 	} else {
 		siril_log_message(_("Wrong parameter values. Sigma must be >= 0.05 and roundness between 0 and 0.9.\n"));
 		retval = 1;
@@ -1713,9 +1714,7 @@ int process_findhot(int nb){
 		siril_log_message(_("find_hot must be applied on an one-channel master-dark frame"));
 		return 1;
 	}
-	GError *error = NULL;
 	long icold, ihot;
-	gchar type;
 	double sig[2];
 
 	sig[0] = g_ascii_strtod(word[2], NULL);
@@ -1725,45 +1724,11 @@ int process_findhot(int nb){
 	siril_log_message(_("%ld cold and %ld hot pixels\n"), icold, ihot);
 
 	gchar *filename = g_strdup_printf("%s.lst", word[1]);
-	GFile *file = g_file_new_for_path(filename);
+	int retval = save_deviant_pixels(filename, dev, icold + ihot, gfit.ry);
 	g_free(filename);
-
-	GOutputStream *output_stream = (GOutputStream*) g_file_replace(file, NULL, FALSE,
-			G_FILE_CREATE_NONE, NULL, &error);
-
-	if (output_stream == NULL) {
-		if (error != NULL) {
-			g_warning("%s\n", error->message);
-			g_clear_error(&error);
-			fprintf(stderr, "Cannot open file: %s\n", filename);
-		}
-		g_object_unref(file);
-		return 1;
-	}
-
-	for (int i = 0; i < icold + ihot; i++) {
-		int y = gfit.ry - (int) dev[i].p.y - 1;  /* FITS is stored bottom to top */
-		if (dev[i].type == HOT_PIXEL)
-			type = 'H';
-		else
-			type = 'C';
-		gchar *buffer = g_strdup_printf("P %d %d %c\n", (int) dev[i].p.x, y, type);
-		if (!g_output_stream_write_all(output_stream, buffer, strlen(buffer), NULL, NULL, &error)) {
-			g_warning("%s\n", error->message);
-			g_free(buffer);
-			g_clear_error(&error);
-			g_object_unref(output_stream);
-			g_object_unref(file);
-			return 1;
-		}
-		g_free(buffer);
-	}
-
 	free(dev);
-	g_object_unref(output_stream);
-	g_object_unref(file);
 
-	return 0;
+	return retval;
 }
 
 int process_fix_xtrans(int nb) {
@@ -3147,6 +3112,8 @@ int process_register(int nb) {
 			} else if (!strcmp(word[i], "-norot")) {
 				reg_args->translation_only = TRUE;
 				reg_args->type = SHIFT_TRANSFORMATION; //using most rigid model as default if -norot
+			} else if (!strcmp(word[i], "-noout")) {
+				reg_args->no_output = TRUE;
 			} else if (g_str_has_prefix(word[i], "-transf=")) {
 				char *current = word[i], *value;
 				value = current + 8;
@@ -3213,10 +3180,17 @@ int process_register(int nb) {
 		}
 	}
 
+	if (reg_args->no_output && reg_args->x2upscale) {
+		siril_log_message(_("Option -noout is not compatible with -drizzle, aborting.\n"));
+		free(reg_args);
+		free(method);
+		return 1;
+	}
+
 	// testing free space
 	if (reg_args->x2upscale ||
 			(method->method_ptr == register_star_alignment &&
-			 !reg_args->translation_only)) {
+			 !reg_args->translation_only && !reg_args->no_output)) {
 		// first, remove the files that we are about to create
 		remove_prefixed_sequence_files(reg_args->seq, reg_args->prefix);
 
@@ -3250,6 +3224,132 @@ int process_register(int nb) {
 	return 0;
 }
 
+int process_apstack(int nb) {
+	if (get_thread_run()) {
+		PRINT_ANOTHER_THREAD_RUNNING;
+		return 1;
+	}
+
+	sequence *seq = load_sequence(word[1], NULL);
+	if (!seq)
+		return 1;
+
+	struct ap_stack_args *args = calloc(1, sizeof(struct ap_stack_args));
+	if (!args) {
+		PRINT_ALLOC_ERR;
+		free_sequence(seq, TRUE);
+		return 1;
+	}
+	args->seq = seq;
+	args->box_size = 64;
+	args->min_brightness = 0.1f;
+	args->keep_percent = 25.0;
+	args->output_overwrite = TRUE;
+	args->layer = (seq->nb_layers == 3) ? 1 : 0;
+	// use the layer of the global registration when there is one
+	for (int layer = 0; seq->regparam && layer < seq->nb_layers; layer++) {
+		if (seq->regparam[layer]) {
+			args->layer = layer;
+			break;
+		}
+	}
+
+	for (int i = 2; i < nb; i++) {
+		if (word[i]) {
+			char *current = word[i], *value;
+			if (g_str_has_prefix(current, "-box=")) {
+				value = current + 5;
+				int size = g_ascii_strtoll(value, NULL, 10);
+				if (size < 16 || size > 512 || (size & (size - 1))) {
+					siril_log_message(_("Box size must be a power of 2 between 16 and 512, aborting.\n"));
+					goto failure;
+				}
+				args->box_size = size;
+			} else if (g_str_has_prefix(current, "-keep=")) {
+				value = current + 6;
+				double keep = g_ascii_strtod(value, NULL);
+				if (keep <= 0.0 || keep > 100.0) {
+					siril_log_message(_("The percentage of frames to keep must be in ]0, 100], aborting.\n"));
+					goto failure;
+				}
+				args->keep_percent = keep;
+			} else if (g_str_has_prefix(current, "-minbright=")) {
+				value = current + 11;
+				double bright = g_ascii_strtod(value, NULL);
+				if (bright < 0.0 || bright >= 1.0) {
+					siril_log_message(_("The brightness threshold must be in [0, 1[, aborting.\n"));
+					goto failure;
+				}
+				args->min_brightness = (float)bright;
+			} else if (g_str_has_prefix(current, "-out=")) {
+				value = current + 5;
+				if (value[0] == '\0') {
+					siril_log_message(_("Missing argument to %s, aborting.\n"), current);
+					goto failure;
+				}
+				g_free(args->output_filename);
+				args->output_filename = g_strdup(value);
+			} else {
+				siril_log_message(_("Unknown parameter %s, aborting.\n"), current);
+				goto failure;
+			}
+		}
+	}
+	if (!args->output_filename)
+		args->output_filename = g_strdup_printf("%s_apstacked%s", seq->seqname, com.pref.ext);
+
+	set_cursor_waiting(TRUE);
+	ap_stack(args);
+	return 0;
+
+failure:
+	free_sequence(seq, TRUE);
+	g_free(args->output_filename);
+	free(args);
+	return 1;
+}
+
+/* parses the value of the -bias= option of preprocess and makemaster: the file
+ * name of a master bias, loaded in bias, or a synthetic offset given as
+ * =level or =multiplier*$OFFSET, stored in the [0, 1] range in level */
+static int parse_bias_option(const char *value, fits **bias, float *level) {
+	gchar *expression = g_shell_unquote(value, NULL);
+	if (expression && expression[0] == '=') {
+		int offsetlevel = evaluateoffsetlevel(expression + 1);
+		if (!offsetlevel) {
+			siril_log_message(_("The offset value could not be parsed from expression: %s, aborting.\n"), expression + 1);
+			g_free(expression);
+			return 1;
+		}
+		g_free(expression);
+		siril_log_message(_("Synthetic offset: Level = %d\n"), offsetlevel);
+		int maxlevel = (gfit.orig_bitpix == BYTE_IMG) ? UCHAR_MAX : USHRT_MAX;
+		if ((offsetlevel > maxlevel) || (offsetlevel < -maxlevel) ) {   // not excluding all neg values here to allow defining a pedestal
+			siril_log_message(_("The offset value is out of allowable bounds [-%d,%d], aborting.\n"), maxlevel, maxlevel);
+			return 1;
+		}
+		*level = (float)offsetlevel * INV_USHRT_MAX_SINGLE; //converting to [0 1] to use with soper
+		return 0;
+	}
+	g_free(expression);
+
+	if (*bias) {
+		clearfits(*bias);
+		free(*bias);
+	}
+	*bias = calloc(1, sizeof(fits));
+	if (!*bias) {
+		PRINT_ALLOC_ERR;
+		return 1;
+	}
+	if (readfits(value, *bias, NULL, !com.pref.force_to_16bit)) {
+		free(*bias);
+		*bias = NULL;
+		return 1;
+	}
+	return 0;
+}
+
 // parse normalization and filters from the stack command line, starting at word `first'
 static int parse_stack_command_line(struct stacking_configuration *arg, int first, gboolean norm_allowed, gboolean out_allowed) {
 	while (word[first]) {
@@ -3266,6 +3366,50 @@ static int parse_stack_command_line(struct stacking_configuration *arg, int firs
 			} else{
 				arg->apply_weight = TRUE;
 			}
+		} else if (!strcmp(current, "-rejmaps")) {
+			if (arg->method != stack_mean_with_rejection) {
+				siril_log_message(_("Rejection maps can only be created with rejection stacking, ignoring.\n"));
+			} else {
+				arg->create_rejmaps = TRUE;
+			}
+		} else if (!strcmp(current, "-weightmap")) {
+			if (arg->method != stack_mean_with_rejection) {
+				siril_log_message(_("Weight maps can only be created with average stacking, ignoring.\n"));
+			} else {
+				arg->create_weightmap = TRUE;
+			}
+		} else if (g_str_has_prefix(current, "-workers=")) {
+			if (arg->method != stack_mean_with_rejection && arg->method != stack_median) {
+				siril_log_message(_("Only median and average stacking can be distributed, ignoring.\n"));
+			} else {
+				value = current + 9;
+				gchar *end;
+				arg->nb_workers = g_ascii_strtoull(value, &end, 10);
+				if (end == value || arg->nb_workers < 1) {
+					siril_log_message(_("Could not parse argument `%s' to the option `%s', aborting.\n"), value, current);
+					return 1;
+				}
+			}
+		} else if (g_str_has_prefix(current, "-preview=")) {
+			if (arg->method != stack_mean_with_rejection && arg->method != stack_median) {
+				siril_log_message(_("Only median and average stacking have a preview mode, ignoring.\n"));
+			} else {
+				value = current + 9;
+				gchar *end;
+				arg->decimation = g_ascii_strtoull(value, &end, 10);
+				if (end == value || arg->decimation < 2 || arg->decimation > 8) {
+					siril_log_message(_("The binning factor of the preview must be between 2 and 8, aborting.\n"));
+					return 1;
+				}
+			}
+		} else if (g_str_has_prefix(current, "-band=")) {
+			if (arg->method != stack_mean_with_rejection && arg->method != stack_median) {
+				siril_log_message(_("Only median and average stacking can be restricted to a band, ignoring.\n"));
+			} else if (sscanf(current + 6, "%d,%d", &arg->band_start, &arg->band_height) != 2 ||
+					arg->band_start < 0 || arg->band_height < 1) {
+				siril_log_message(_("Could not parse argument `%s' to the option `%s', aborting.\n"), current + 6, current);
+				return 1;
+			}
 		} else if (g_str_has_prefix(current, "-norm=")) {
 			if (!norm_allowed) {
 				siril_log_message(_("Normalization options are not allowed in this context, ignoring.\n"));
@@ -3349,6 +3493,12 @@ static int parse_stack_command_line(struct stacking_configuration *arg, int firs
 		} else if (g_str_has_prefix(current, "-filter-incl") ||
 				g_str_has_prefix(current, "-filter-included")) {
 			arg->filter_included = TRUE;
+		} else if (g_str_has_prefix(current, "-bias=")) {
+			if (!arg->calibrate) {
+				siril_log_message(_("A master bias can only be subtracted when creating a master with makemaster, ignoring.\n"));
+			} else if (parse_bias_option(current + 6, &arg->bias, &arg->bias_level)) {
+				return 1;
+			}
 		} else if (g_str_has_prefix(current, "-out=")) {
 			if (out_allowed) {
 				value = current + 5;
@@ -3371,6 +3521,24 @@ static int parse_stack_command_line(struct stacking_configuration *arg, int firs
 	return 0;
 }
 
+/* the stacking options of the command from word first, passed to the
+ * processes of a distributed stacking, without those managed by the
+ * coordinator */
+static gchar *get_stack_worker_options(int first) {
+	GString *options = g_string_new(NULL);
+	for (int i = first; word[i]; i++) {
+		if (g_str_has_prefix(word[i], "-workers=") || g_str_has_prefix(word[i], "-band=") ||
+				g_str_has_prefix(word[i], "-out="))
+			continue;
+		if (options->len)
+			g_string_append_c(options, ' ');
+		if (strchr(word[i], ' '))
+			g_string_append_printf(options, "\"%s\"", word[i]);
+		else g_string_append(options, word[i]);
+	}
+	return g_string_free(options, FALSE);
+}
+
 static int stack_one_seq(struct stacking_configuration *arg) {
 	int retval = -1;
 	sequence *seq = readseqfile(arg->seqfile);
@@ -3405,11 +3573,35 @@ static int stack_one_seq(struct stacking_configuration *arg) {
 		args.output_norm = arg->output_norm;
 		args.reglayer = args.seq->nb_layers == 1 ? 0 : 1;
 		args.apply_weight = arg->apply_weight;
+		args.create_rejmaps = arg->create_rejmaps;
+		args.create_weightmap = arg->create_weightmap;
+		args.band_start = arg->band_start;
+		args.band_height = arg->band_height;
+		args.decimation = arg->decimation;
+		args.bias = arg->bias;
+		args.bias_level = arg->bias_level;
+		if (args.decimation > 1 && seq->upscale_at_stacking > 1.05) {
+			siril_log_message(_("Up-scaling is disabled for the preview stacking\n"));
+			seq->upscale_at_stacking = 1.0;
+		}
+		if (arg->nb_workers > 1 && arg->worker_options) {
+			if (args.decimation > 1) {
+				siril_log_message(_("Preview stacking is not distributed, stacking in this process\n"));
+			} else if (seq->upscale_at_stacking > 1.05) {
+				siril_log_message(_("Stacking with up-scaling cannot be distributed, stacking in this process\n"));
+			} else if (args.bias || args.bias_level != 0.f) {
+				siril_log_message(_("Master creation is not distributed, stacking in this process\n"));
+			} else {
+				args.nb_workers = arg->nb_workers;
+				args.worker_command = g_strdup_printf("stack \"%s\" %s", seq->seqname, arg->worker_options);
+			}
+		}
 
 		// manage filters
 		if (convert_stack_data_to_filter(arg, &args) ||
 				setup_filtered_data(&args)) {
 			free_sequence(seq, TRUE);
+			g_free(args.worker_command);
 			return 1;
 		}
 		args.description = describe_filter(seq, args.filtering_criterion, args.filtering_parameter);
@@ -3418,6 +3610,7 @@ static int stack_one_seq(struct stacking_configuration *arg) {
 		if (error) {
 			siril_log_color_message(error, "red");
 			free_sequence(seq, TRUE);
+			g_free(args.worker_command);
 			return 1;
 		}
 
@@ -3425,8 +3618,8 @@ static int stack_one_seq(struct stacking_configuration *arg) {
 			char filename[256];
 			char *suffix = g_str_has_suffix(seq->seqname, "_") ||
 				g_str_has_suffix(seq->seqname, "-") ? "" : "_";
-			snprintf(filename, 256, "%s%sstacked%s",
-					seq->seqname, suffix, com.pref.ext);
+			snprintf(filename, 256, "%s%s%s%s", seq->seqname, suffix,
+					args.decimation > 1 ? "preview" : "stacked", com.pref.ext);
 			arg->result_file = strdup(filename);
 		}
 
@@ -3437,6 +3630,7 @@ static int stack_one_seq(struct stacking_configuration *arg) {
 		free_sequence(seq, TRUE);
 		free(args.image_indices);
 		free(args.description);
+		g_free(args.worker_command);
 
 		if (!retval) {
 			struct noise_data noise_args = { .fit = &gfit, .verbose = FALSE, .use_idle = FALSE };
@@ -3444,6 +3638,17 @@ static int stack_one_seq(struct stacking_configuration *arg) {
 			if (savefits(arg->result_file, &gfit))
 				siril_log_color_message(_("Could not save the stacking result %s\n"),
 						"red", arg->result_file);
+			/* a master flat made by makemaster: its profile is cached
+			 * for the calibration */
+			else if (arg->calibrate && args.band_height == 0 &&
+					(args.normalize == MULTIPLICATIVE ||
+					 args.normalize == MULTIPLICATIVE_SCALING))
+				cache_flat_profile(arg->result_file, &gfit);
+			save_stacking_maps(&args, arg->result_file);
+			/* bands stacked by a worker: the merging process reports rejection */
+			if (args.band_height > 0 && args.method == stack_mean_with_rejection)
+				save_rejection_counts(&args, arg->result_file);
+			free_stacking_maps(&args);
 			++arg->number_of_loaded_sequences;
 		}
 		else if (!get_thread_run()) return -1;
@@ -3490,12 +3695,66 @@ static gpointer stackall_worker(gpointer garg) {
 	gettimeofday(&t_end, NULL);
 	show_time(arg->t_start, t_end);
 	g_dir_close(dir);
+	g_free(arg->worker_options);
 	free(arg);
 	com.script = was_in_script;
 	siril_add_idle(end_generic, NULL);
 	return NULL;
 }
 
+/* parses { med | median | rej | mean } [rejection type] [sigma low] [sigma high]
+ * starting at word `first', returns the index of the first optional argument or
+ * -1 on error */
+static int parse_block_stack_method(struct stacking_configuration *arg, int first) {
+	if (!strcmp(word[first], "med") || !strcmp(word[first], "median")) {
+		arg->method = stack_median;
+		return first + 1;
+	}
+	if (strcmp(word[first], "rej") && strcmp(word[first], "mean")) {
+		siril_log_color_message(_("Stacking method type '%s' is invalid\n"), "red", word[first]);
+		return -1;
+	}
+
+	int shift = 1;
+	const char *type = word[first + 1] ? word[first + 1] : "";
+	if (!strcmp(type, "p") || !strcmp(type, "percentile")) {
+		arg->type_of_rejection = PERCENTILE;
+	} else if (!strcmp(type, "s") || !strcmp(type, "sigma")) {
+		arg->type_of_rejection = SIGMA;
+	} else if (!strcmp(type, "a") || !strcmp(type, "mad")) {
+		arg->type_of_rejection = MAD;
+	} else if (!strcmp(type, "m") || !strcmp(type, "median")) {
+		arg->type_of_rejection = SIGMEDIAN;
+	} else if (!strcmp(type, "l") || !strcmp(type, "linear")) {
+		arg->type_of_rejection = LINEARFIT;
+	} else if (!strcmp(type, "w") || !strcmp(type, "winsorized")) {
+		arg->type_of_rejection = WINSORIZED;
+	} else if (!strcmp(type, "g") || !strcmp(type, "generalized")) {
+		arg->type_of_rejection = GESDT;
+	} else {
+		arg->type_of_rejection = WINSORIZED;
+		shift = 0;
+	}
+	if (!word[first + 1 + shift] || !word[first + 2 + shift]
+			|| (arg->sig[0] = g_ascii_strtod(word[first + 1 + shift], NULL)) < 0.0
+			|| (arg->sig[1] = g_ascii_strtod(word[first + 2 + shift], NULL)) < 0.0) {
+		siril_log_color_message(_("The average stacking with rejection requires two extra arguments: sigma low and high.\n"), "red");
+		return -1;
+	}
+	if ((arg->type_of_rejection == GESDT)
+			&& (arg->sig[0] > 1.0 || (arg->sig[1] > 1.0))) {
+		siril_log_color_message(_("Extra parameters of GESDT rejection algorithm must be between 0 and 1, default is 0.3 and 0.05.\n"), "red");
+		return -1;
+	}
+	if ((arg->type_of_rejection == PERCENTILE)
+			&& (arg->sig[0] > 1.0 || (arg->sig[1] > 1.0))) {
+		siril_log_color_message(_("Extra parameters of percentile rejection algorithm must be between 0 and 1, default is 0.2 and 0.1.\n"), "red");
+		return -1;
+	}
+	arg->method = stack_mean_with_rejection;
+	return first + 3 + shift;
+}
+
 int process_stackall(int nb) {
 	struct stacking_configuration *arg;
 
@@ -3519,54 +3778,16 @@ int process_stackall(int nb) {
 			arg->method = stack_addmax;
 		} else if (!strcmp(word[1], "min")) {
 			arg->method = stack_addmin;
-		} else if (!strcmp(word[1], "med") || !strcmp(word[1], "median")) {
-			arg->method = stack_median;
-			allow_norm = TRUE;
-		} else if (!strcmp(word[1], "rej") || !strcmp(word[1], "mean")) {
-			int shift = 1;
-			if (!strcmp(word[3], "p") || !strcmp(word[3], "percentile")) {
-				arg->type_of_rejection = PERCENTILE;
-			} else if (!strcmp(word[3], "s") || !strcmp(word[3], "sigma")) {
-				arg->type_of_rejection = SIGMA;
-			} else if (!strcmp(word[3], "a") || !strcmp(word[3], "mad")) {
-				arg->type_of_rejection = MAD;
-			} else if (!strcmp(word[3], "m") || !strcmp(word[3], "median")) {
-				arg->type_of_rejection = SIGMEDIAN;
-			} else if (!strcmp(word[3], "l") || !strcmp(word[3], "linear")) {
-				arg->type_of_rejection = LINEARFIT;
-			} else if (!strcmp(word[3], "w") || !strcmp(word[3], "winsorized")) {
-				arg->type_of_rejection = WINSORIZED;
-			} else if (!strcmp(word[3], "g") || !strcmp(word[3], "generalized")) {
-				arg->type_of_rejection = GESDT;
-			} else {
-				arg->type_of_rejection = WINSORIZED;
-				shift = 0;
-			}
-			if (!word[2 + shift] || !word[3 + shift] || (arg->sig[0] = g_ascii_strtod(word[2 + shift], NULL)) < 0.0
-					|| (arg->sig[1] = g_ascii_strtod(word[3 + shift], NULL)) < 0.0) {
-				siril_log_color_message(_("The average stacking with rejection requires two extra arguments: sigma low and high.\n"), "red");
-				goto failure;
-			}
-			if (((arg->type_of_rejection == GESDT))
-					&& (arg->sig[0] > 1.0 || (arg->sig[1] > 1.0))) {
-				siril_log_color_message(_("Extra parameters of GESDT rejection algorithm must be between 0 and 1, default is 0.3 and 0.05.\n"), "red");
-				goto failure;
-			}
-			if (((arg->type_of_rejection == PERCENTILE))
-					&& (arg->sig[0] > 1.0 || (arg->sig[1] > 1.0))) {
-				siril_log_color_message(_("Extra parameters of percentile rejection algorithm must be between 0 and 1, default is 0.2 and 0.1.\n"), "red");
+		} else {
+			start_arg_opt = parse_block_stack_method(arg, 1);
+			if (start_arg_opt < 0)
 				goto failure;
-			}
-			arg->method = stack_mean_with_rejection;
-			start_arg_opt = 4 + shift;
 			allow_norm = TRUE;
 		}
-		else {
-			siril_log_color_message(_("Stacking method type '%s' is invalid\n"), "red", word[2]);
-			goto failure;
-		}
 		if (parse_stack_command_line(arg, start_arg_opt, allow_norm, FALSE))
 			goto failure;
+		if (arg->nb_workers > 1)
+			arg->worker_options = get_stack_worker_options(1);
 	}
 	set_cursor_waiting(TRUE);
 
@@ -3604,6 +3825,11 @@ static gpointer stackone_worker(gpointer garg) {
 
 	g_free(arg->result_file);
 	g_free(arg->seqfile);
+	g_free(arg->worker_options);
+	if (arg->bias) {
+		clearfits(arg->bias);
+		free(arg->bias);
+	}
 	free(arg);
 	com.script = was_in_script;
 	siril_add_idle(end_generic, NULL);
@@ -3637,55 +3863,267 @@ int process_stackone(int nb) {
 			arg->method = stack_addmax;
 		} else if (!strcmp(word[2], "min")) {
 			arg->method = stack_addmin;
-		} else if (!strcmp(word[2], "med") || !strcmp(word[2], "median")) {
-			arg->method = stack_median;
-			allow_norm = TRUE;
-		} else if (!strcmp(word[2], "rej") || !strcmp(word[2], "mean")) {
-			int shift = 1;
-			if (!strcmp(word[3], "p") || !strcmp(word[3], "percentile")) {
-				arg->type_of_rejection = PERCENTILE;
-			} else if (!strcmp(word[3], "s") || !strcmp(word[3], "sigma")) {
-				arg->type_of_rejection = SIGMA;
-			} else if (!strcmp(word[3], "a") || !strcmp(word[3], "mad")) {
-				arg->type_of_rejection = MAD;
-			} else if (!strcmp(word[3], "m") || !strcmp(word[3], "median")) {
-				arg->type_of_rejection = SIGMEDIAN;
-			} else if (!strcmp(word[3], "l") || !strcmp(word[3], "linear")) {
-				arg->type_of_rejection = LINEARFIT;
-			} else if (!strcmp(word[3], "w") || !strcmp(word[3], "winsorized")) {
-				arg->type_of_rejection = WINSORIZED;
-			} else if (!strcmp(word[3], "g") || !strcmp(word[3], "generalized")) {
-				arg->type_of_rejection = GESDT;
-			} else {
-				arg->type_of_rejection = WINSORIZED;
-				shift = 0;
-			}
-			if (!word[3 + shift] || !word[4 + shift] || (arg->sig[0] = g_ascii_strtod(word[3 + shift], NULL)) < 0.0
-					|| (arg->sig[1] = g_ascii_strtod(word[4 + shift], NULL)) < 0.0) {
-				siril_log_color_message(_("The average stacking with rejection requires two extra arguments: sigma low and high.\n"), "red");
-				goto failure;
-			}
-			if (((arg->type_of_rejection == GESDT))
-					&& (arg->sig[0] > 1.0 || (arg->sig[1] > 1.0))) {
-				siril_log_color_message(_("Extra parameters of GESDT rejection algorithm must be between 0 and 1, default is 0.3 and 0.05.\n"), "red");
-				goto failure;
-			}
-			if (((arg->type_of_rejection == PERCENTILE))
-					&& (arg->sig[0] > 1.0 || (arg->sig[1] > 1.0))) {
-				siril_log_color_message(_("Extra parameters of percentile rejection algorithm must be between 0 and 1, default is 0.2 and 0.1.\n"), "red");
+		} else {
+			start_arg_opt = parse_block_stack_method(arg, 2);
+			if (start_arg_opt < 0)
 				goto failure;
-			}
-			arg->method = stack_mean_with_rejection;
-			start_arg_opt = 5 + shift;
 			allow_norm = TRUE;
 		}
-		else {
-			siril_log_color_message(_("Stacking method type '%s' is invalid\n"), "red", word[2]);
-			goto failure;
-		}
 		if (parse_stack_command_line(arg, start_arg_opt, allow_norm, TRUE))
 			goto failure;
+		if (arg->nb_workers > 1)
+			arg->worker_options = get_stack_worker_options(2);
+	}
+	set_cursor_waiting(TRUE);
+	gettimeofday(&arg->t_start, NULL);
+
+	start_in_new_thread(stackone_worker, arg);
+	return 0;
+
+failure:
+	g_free(arg->result_file);
+	g_free(arg->seqfile);
+	free(arg);
+	return 1;
+}
+
+static void free_sessions(sequence **seqs, int nb) {
+	for (int s = 0; s < nb; s++)
+		if (seqs[s])
+			free_sequence(seqs[s], TRUE);
+	free(seqs);
+}
+
+/* stacks the images of all sequences of the configuration in one pass, their
+ * registration data must be relative to the same reference image, which is
+ * the reference image of the first sequence */
+static int stack_multi_seq(struct stacking_configuration *arg) {
+	int nb_sessions = arg->nb_seqfiles, total = 0, retval = 1;
+	struct stacking_args args = { 0 };
+	gchar *error = NULL;
+	sequence **seqs = calloc(nb_sessions, sizeof(sequence *));
+	int **session_indices = calloc(nb_sessions, sizeof(int *));
+	int *first = malloc((nb_sessions + 1) * sizeof(int));
+	if (!seqs || !session_indices || !first) {
+		PRINT_ALLOC_ERR;
+		free(seqs);
+		free(session_indices);
+		free(first);
+		return ST_ALLOC_ERROR;
+	}
+
+	for (int s = 0; s < nb_sessions; s++) {
+		struct stacking_args session_args = { 0 };
+		seqs[s] = load_sequence(arg->seqfiles[s], NULL);
+		if (!seqs[s])
+			goto end;
+		if (s > 0 && (seqs[s]->rx != seqs[0]->rx || seqs[s]->ry != seqs[0]->ry ||
+					seqs[s]->nb_layers != seqs[0]->nb_layers)) {
+			siril_log_color_message(_("Sequence %s does not have the same image size as %s, they cannot be stacked together\n"),
+					"red", seqs[s]->seqname, seqs[0]->seqname);
+			goto end;
+		}
+		/* registration data are only used as shifts relative to the shared
+		 * reference, up-scaling is not possible across sessions */
+		seqs[s]->upscale_at_stacking = 1.0;
+
+		session_args.seq = seqs[s];
+		session_args.ref_image = sequence_find_refimage(seqs[s]);
+		if (convert_stack_data_to_filter(arg, &session_args) ||
+				setup_filtered_data(&session_args)) {
+			free(session_args.image_indices);
+			goto end;
+		}
+		char *description = describe_filter(seqs[s], session_args.filtering_criterion,
+				session_args.filtering_parameter);
+		siril_log_message(_("Session %d, sequence %s: %s"), s + 1, seqs[s]->seqname, description);
+		free(description);
+
+		if (s == 0)
+			args.ref_image = session_args.ref_image;
+		session_indices[s] = session_args.image_indices;
+		first[s] = total;
+		total += session_args.nb_images_to_stack;
+	}
+	first[nb_sessions] = total;
+
+	args.image_indices = malloc(total * sizeof(int));
+	if (!args.image_indices) {
+		PRINT_ALLOC_ERR;
+		goto end;
+	}
+	for (int s = 0; s < nb_sessions; s++)
+		memcpy(args.image_indices + first[s], session_indices[s],
+				(first[s + 1] - first[s]) * sizeof(int));
+
+	args.seq = seqs[0];
+	args.sessions = seqs;
+	args.nb_sessions = nb_sessions;
+	args.session_first_frame = first;
+	args.nb_images_to_stack = total;
+	args.filtering_criterion = seq_filter_all;
+	if (arg->method == stack_mean_with_rejection && (arg->sig[0] != 0.0 || arg->sig[1] != 0.0)) {
+		args.sig[0] = arg->sig[0];
+		args.sig[1] = arg->sig[1];
+		args.type_of_rejection = arg->type_of_rejection;
+	} else {
+		args.type_of_rejection = NO_REJEC;
+		siril_log_message(_("Not using rejection for stacking\n"));
+	}
+	args.normalize = arg->force_no_norm ? NO_NORM : arg->norm;
+	args.method = arg->method;
+	args.output_norm = arg->output_norm;
+	args.reglayer = args.seq->nb_layers == 1 ? 0 : 1;
+	args.apply_weight = arg->apply_weight;
+	args.create_rejmaps = arg->create_rejmaps;
+	args.create_weightmap = arg->create_weightmap;
+	args.band_start = arg->band_start;
+	args.band_height = arg->band_height;
+	args.decimation = arg->decimation;
+	args.description = strdup(_("Multi-session stacking\n"));
+	args.use_32bit_output = evaluate_stacking_should_output_32bits(args.method,
+			args.seq, args.nb_images_to_stack, &error);
+	if (error) {
+		siril_log_color_message(error, "red");
+		goto end;
+	}
+	if (!arg->result_file) {
+		char filename[256];
+		char *suffix = g_str_has_suffix(args.seq->seqname, "_") ||
+			g_str_has_suffix(args.seq->seqname, "-") ? "" : "_";
+		snprintf(filename, 256, "%s%smulti_%s%s", args.seq->seqname, suffix,
+				args.decimation > 1 ? "preview" : "stacked", com.pref.ext);
+		arg->result_file = strdup(filename);
+	}
+	siril_log_message(_("Stacking %d images from %d sequences\n"), total, nb_sessions);
+
+	main_stack(&args);
+
+	retval = args.retval;
+	clean_end_stacking(&args);
+
+	if (!retval) {
+		struct noise_data noise_args = { .fit = &gfit, .verbose = FALSE, .use_idle = FALSE };
+		noise(&noise_args);
+		if (savefits(arg->result_file, &gfit))
+			siril_log_color_message(_("Could not save the stacking result %s\n"),
+					"red", arg->result_file);
+		save_stacking_maps(&args, arg->result_file);
+		free_stacking_maps(&args);
+	}
+
+end:
+	for (int s = 0; s < nb_sessions; s++)
+		free(session_indices[s]);
+	free(session_indices);
+	free(first);
+	free(args.image_indices);
+	free(args.description);
+	free_sessions(seqs, nb_sessions);
+	return retval;
+}
+
+static gpointer stackmulti_worker(gpointer garg) {
+	struct timeval t_end;
+	struct stacking_configuration *arg = (struct stacking_configuration *)garg;
+	gboolean was_in_script = com.script;
+	com.script = TRUE;
+
+	int retval = stack_multi_seq(arg);
+
+	if (retval == ST_ALLOC_ERROR) {
+		siril_log_message(_("It looks like there is a memory allocation error, change memory settings and try to fix it.\n"));
+	} else if (!retval) {
+		siril_log_message(_("Stacked %d sequences successfully.\n"), arg->nb_seqfiles);
 	}
+
+	gettimeofday(&t_end, NULL);
+	show_time(arg->t_start, t_end);
+
+	g_free(arg->result_file);
+	g_strfreev(arg->seqfiles);
+	free(arg);
+	com.script = was_in_script;
+	siril_add_idle(end_generic, NULL);
+	return GINT_TO_POINTER(retval);
+}
+
+int process_stackmulti(int nb) {
+	struct stacking_configuration *arg;
+	int method_word = 1;
+
+	// stackmulti seq1 seq2 [seq3 ...] { med | median } [-nonorm, norm=] [-filter-incl[uded]] [-out=result_filename]
+	// stackmulti seq1 seq2 [seq3 ...] { rej | mean } [rejection type] sigma_low sigma_high [-nonorm, norm=] [-filter-*] [-weighted] [-rejmaps] [-weightmap] [-out=result_filename]
+	while (word[method_word] && strcmp(word[method_word], "med") && strcmp(word[method_word], "median")
+			&& strcmp(word[method_word], "rej") && strcmp(word[method_word], "mean"))
+		method_word++;
+	if (!word[method_word]) {
+		siril_log_color_message(_("Missing stacking type, only median and average with rejection can be used for multi-session stacking\n"), "red");
+		return 1;
+	}
+	if (method_word < 3) {
+		siril_log_color_message(_("At least two sequences are required for multi-session stacking\n"), "red");
+		return 1;
+	}
+
+	arg = calloc(1, sizeof(struct stacking_configuration));
+	arg->f_fwhm = -1.f; arg->f_fwhm_p = -1.f; arg->f_round = -1.f;
+	arg->f_round_p = -1.f; arg->f_quality = -1.f; arg->f_quality_p = -1.f;
+	arg->filter_included = FALSE; arg->norm = NO_NORM; arg->force_no_norm = FALSE;
+	arg->apply_weight = FALSE;
+	arg->nb_seqfiles = method_word - 1;
+	arg->seqfiles = g_new0(gchar *, arg->nb_seqfiles + 1);
+	for (int s = 0; s < arg->nb_seqfiles; s++)
+		arg->seqfiles[s] = g_strdup(word[s + 1]);
+
+	int start_arg_opt = parse_block_stack_method(arg, method_word);
+	if (start_arg_opt < 0 || parse_stack_command_line(arg, start_arg_opt, TRUE, TRUE))
+		goto failure;
+	if (arg->nb_workers > 1)
+		siril_log_message(_("Multi-session stacking cannot be distributed, ignoring -workers.\n"));
+
+	set_cursor_waiting(TRUE);
+	gettimeofday(&arg->t_start, NULL);
+
+	start_in_new_thread(stackmulti_worker, arg);
+	return 0;
+
+failure:
+	g_free(arg->result_file);
+	g_strfreev(arg->seqfiles);
+	free(arg);
+	return 1;
+}
+
+/* creates a master frame from the raw calibration frames of a sequence: the
+ * frames are optionally calibrated by a master bias while they are read by the
+ * median or average stacking, no calibrated sequence is written */
+int process_makemaster(int nb) {
+	struct stacking_configuration *arg;
+
+	// makemaster sequencename { med | median | rej | mean } [rejection type] [sigma low] [sigma high] [-bias=filename] [-nonorm, norm=] [-out=result_filename]
+	arg = calloc(1, sizeof(struct stacking_configuration));
+	arg->f_fwhm = -1.f; arg->f_fwhm_p = -1.f; arg->f_round = -1.f;
+	arg->f_round_p = -1.f; arg->f_quality = -1.f; arg->f_quality_p = -1.f;
+	arg->filter_included = FALSE; arg->norm = NO_NORM; arg->force_no_norm = FALSE;
+	arg->apply_weight = FALSE;
+	arg->calibrate = TRUE;
+
+	sequence *seq = load_sequence(word[1], &arg->seqfile);
+	if (!seq)
+		goto failure;
+
+	int start_arg_opt = parse_block_stack_method(arg, 2);
+	if (start_arg_opt < 0 || parse_stack_command_line(arg, start_arg_opt, TRUE, TRUE))
+		goto failure;
+	if (arg->nb_workers > 1 || arg->decimation > 1) {
+		siril_log_message(_("Master creation is neither distributed nor previewed, ignoring -workers and -preview.\n"));
+		arg->nb_workers = 0;
+		arg->decimation = 0;
+	}
+	if (!arg->bias && arg->bias_level == 0.f)
+		siril_log_message(_("No master bias given, frames are stacked without calibration\n"));
+
 	set_cursor_waiting(TRUE);
 	gettimeofday(&arg->t_start, NULL);
 
@@ -3693,6 +4131,10 @@ int process_stackone(int nb) {
 	return 0;
 
 failure:
+	if (arg->bias) {
+		clearfits(arg->bias);
+		free(arg->bias);
+	}
 	g_free(arg->result_file);
 	g_free(arg->seqfile);
 	free(arg);
@@ -3720,38 +4162,11 @@ int process_preprocess(int nb) {
 	for (i = 2; i < nb; i++) {
 		if (word[i]) {
 			if (g_str_has_prefix(word[i], "-bias=")) {
-				gchar *expression = g_shell_unquote(word[i] + 6, NULL);
-				if (expression[0] == '=') {
-					int offsetlevel = evaluateoffsetlevel(expression+1);
-					if (!offsetlevel) {
-						siril_log_message(_("The offset value could not be parsed from expression: %s, aborting.\n"), expression +1);
-						g_free(expression);
-						retvalue = 1;
-						break;
-					} else {
-						g_free(expression);
-						siril_log_message(_("Synthetic offset: Level = %d\n"), offsetlevel);
-						int maxlevel = (gfit.orig_bitpix == BYTE_IMG) ? UCHAR_MAX : USHRT_MAX;
-						if ((offsetlevel > maxlevel) || (offsetlevel < -maxlevel) ) {   // not excluding all neg values here to allow defining a pedestal
-							siril_log_message(_("The offset value is out of allowable bounds [-%d,%d], aborting.\n"), maxlevel, maxlevel);
-							retvalue = 1;
-							break;
-						} else {
-							args->bias_level = (float)offsetlevel * INV_USHRT_MAX_SINGLE; //converting to [0 1] to use with soper
-							args->use_bias = TRUE;
-						}
-					}
-				} else {
-					g_free(expression);
-					args->bias = calloc(1, sizeof(fits));
-					if (!readfits(word[i] + 6, args->bias, NULL, !com.pref.force_to_16bit)) {
-						args->use_bias = TRUE;
-					} else {
-						retvalue = 1;
-						free(args->bias);
-						break;
-					}
+				if (parse_bias_option(word[i] + 6, &args->bias, &args->bias_level)) {
+					retvalue = 1;
+					break;
 				}
+				args->use_bias = TRUE;
 			} else if (g_str_has_prefix(word[i], "-dark=")) {
 				args->dark = calloc(1, sizeof(fits));
 				if (!readfits(word[i] + 6, args->dark, NULL, !com.pref.force_to_16bit)) {
@@ -3766,6 +4181,7 @@ int process_preprocess(int nb) {
 				args->flat = calloc(1, sizeof(fits));
 				if (!readfits(word[i] + 6, args->flat, NULL, !com.pref.force_to_16bit)) {
 					args->use_flat = TRUE;
+					args->flat_filename = g_strdup(word[i] + 6);
 				} else {
 					retvalue = 1;
 					free(args->flat);
@@ -3780,6 +4196,16 @@ int process_preprocess(int nb) {
 					break;
 				}
 				args->ppprefix = strdup(value);
+			} else if (g_str_has_prefix(word[i], "-bpm=")) {
+				free(args->dev);
+				args->dev = load_deviant_pixels(word[i] + 5, seq->rx, seq->ry,
+						&args->icold, &args->ihot);
+				if (!args->dev) {
+					siril_log_message(_("No bad pixel could be loaded from %s, aborting.\n"), word[i] + 5);
+					retvalue = 1;
+					break;
+				}
+				args->use_cosmetic_correction = TRUE;
 			} else if (!strcmp(word[i], "-opt")) {
 				args->use_dark_optim = TRUE;
 			} else if (!strcmp(word[i], "-fix_xtrans")) {
@@ -3797,6 +4223,8 @@ int process_preprocess(int nb) {
 	}
 
 	if (retvalue) {
+		free(args->dev);
+		g_free(args->flat_filename);
 		free(args);
 		return -1;
 	}
@@ -7,6 +7,7 @@
 
 int	process_addmax(int nb);
 int	process_asinh(int nb);
+int	process_apstack(int nb);
 
 int	process_bg(int nb);
 int	process_bgnoise(int nb);
@@ -60,6 +61,7 @@ int	process_log(int nb);
 int	process_ls(int nb);
 #endif
 
+int	process_makemaster(int nb);
 int	process_merge(int nb);
 int	process_mirrorx(int nb);
 int	process_mirrory(int nb);
@@ -124,6 +126,7 @@ int	process_split_cfa(int nb);
 int	process_stat(int nb);
 int	process_stackall(int nb);
 int	process_stackone(int nb);
+int	process_stackmulti(int nb);
 
 int	process_thresh(int nb);
 int	process_threshlo(int nb);
@@ -4,6 +4,7 @@
 #define STR_NONE ""
 
 #define STR_ADDMAX N_("Computes a new image IMG with IMG_1 and IMG_2. The pixel of IMG_1 is replaced by the pixel at the same coordinates of IMG_2 if the intensity of 2 is greater than 1")
+#define STR_APSTACK N_("Stacks the sequence \"sequencename\" with multiple alignment points, for planetary images. Boxes of <b>-box</b> pixels (a power of 2) are placed on the parts of the reference image brighter than <b>-minbright</b> times its maximum, located in each frame around its global registration and the <b>-keep</b> percent best frames are stacked for each box. The result is saved as <b>-out</b>, or sequencename_apstacked by default")
 #define STR_ASINH N_("ASINH command stretches the image for show faint objects, while simultaneously, preserve the structure of bright objects of the field")
 
 #define STR_BG N_("Returns the background level of the image loaded in memory")
@@ -38,7 +39,7 @@
 #define STR_FILL2 N_("Same command as FILL but this is a symmetric fill of a region defined by the mouse. Used to process an image in the Fourier (FFT) domain")
 #define STR_FIND_COSME N_("Applies an automatic detection of cold and hot pixels following the thresholds written in arguments")
 #define STR_FIND_COSME_CFA N_("Same command as FIND_COSME but for monochromatic CFA images")
-#define STR_FIND_HOT N_("Provides a list file \"filename\" (format text) in the working directory which contains the coordinates of the pixels which have an intensity \"hot_sigma\" times higher and \"cold_sigma\" lower than standard deviation. We generally use this command on a master-dark file")
+#define STR_FIND_HOT N_("Provides a list file \"filename\" (format text) in the working directory which contains the coordinates of the pixels which have an intensity \"hot_sigma\" times higher and \"cold_sigma\" lower than standard deviation. We generally use this command on a master-dark file. The list can then be given to PREPROCESS with the \"-bpm=\" option")
 #define STR_FINDSTAR N_("Detects stars having a level greater than a threshold computed by Siril. The algorithm is based on the publication of Mighell, K. J. 1999, in ASP Conf. Ser., Vol. 172, Astronomical Data Analysis Software and Systems VIII, eds. D. M. Mehringer, R. L. Plante, and D. A. Roberts (San Francisco: ASP), 317. After that, a PSF is applied and Siril rejects all detected structures that don't fulfill a set of prescribed detection criteria. Finally, a circle is drawn around detected stars. See also the command CLEARSTAR")
 #define STR_FIXBANDING N_("Tries to remove the canon banding. Argument \"amount\" define the amount of correction. \"Sigma\" defines a protection level of the algorithm, higher sigma gives higher protection")
 #define STR_FIXXTRANS N_("Fixes the Fujifilm X-Trans Auto Focus pixels. Indeed, because of the phase detection auto focus system, the photosites used for auto focus get a little less light than the surrounding photosites. The camera compensates for this and increases the values from these specific photosites giving a visible square in the middle of the dark/bias frames")
@@ -62,6 +63,7 @@
 #define STR_LOG N_("Computes and applies a logarithmic scale to the current image")
 #define STR_LS N_("Lists files and directories in the working directory")
 
+#define STR_MAKEMASTER N_("Creates a master frame from the raw calibration frames of the \"sequencename\" sequence, with a median or average with rejection stacking. With \"-bias=\", the master bias is subtracted from the frames while they are read for stacking, no calibrated sequence being written. A uniform level can be given instead of an image, like for the PREPROCESS command, with -bias=\"=256\". This is typically used to create a master flat in a single step: with a multiplicative normalization, the profile of the flat used by PREPROCESS is then saved next to it. The result is named \"-out=\" or after the sequence. See STACK command for the description of the other options")
 #define STR_MERGE N_("Merges several sequences into one")
 #define STR_MIRRORX N_("Rotates the image around a vertical axis")
 #define STR_MIRRORY N_("Rotates the image around an horizontal axis")
@@ -73,10 +75,10 @@
 
 #define STR_OFFSET N_("Adds the constant \"value\" to the current image. This constant can take a negative value. As Siril uses unsigned FITS files, if the intensity of the pixel become negative its value is replaced by 0 and by 65535 (for a 16-bit file) if the pixel intensity overflows")
 
-#define STR_PREPROCESS N_("Preprocesses the sequence \"sequencename\" using bias, dark and flat given in argument. For bias, a uniform level can be specified instead of an image, by entering a quoted expression starting with an = sign, such as -bias=\"=256\" or -bias=\"=64*$OFFSET\". It is possible to specify if images are CFA for cosmetic correction purposes with the option \"-cfa\" and also to demosaic images at the end of the process with \"-debayer\". The \"-fix_xtrans\" option is dedicated to X-Trans files by applying a correction on darks and biases to remove an ugly square pattern and the \"-equalize_cfa\" option equalizes the mean intensity of RGB layers of the CFA flat master. It is also possible to optimize the dark subtraction with \"-opt\". The output sequence name starts with the prefix \"pp_\" unless otherwise specified with option \"-prefix=\". If \"-fitseq\" is provided, the output sequence will be a FITS sequence (single file).\n\nNote that only hot pixels are corrected in cosmetic correction process")
+#define STR_PREPROCESS N_("Preprocesses the sequence \"sequencename\" using bias, dark and flat given in argument. For bias, a uniform level can be specified instead of an image, by entering a quoted expression starting with an = sign, such as -bias=\"=256\" or -bias=\"=64*$OFFSET\". It is possible to specify if images are CFA for cosmetic correction purposes with the option \"-cfa\" and also to demosaic images at the end of the process with \"-debayer\". The \"-fix_xtrans\" option is dedicated to X-Trans files by applying a correction on darks and biases to remove an ugly square pattern and the \"-equalize_cfa\" option equalizes the mean intensity of RGB layers of the CFA flat master. It is also possible to optimize the dark subtraction with \"-opt\". The output sequence name starts with the prefix \"pp_\" unless otherwise specified with option \"-prefix=\". If \"-fitseq\" is provided, the output sequence will be a FITS sequence (single file).\n\nNote that only hot pixels are corrected in cosmetic correction process, unless a list of bad pixels created by FIND_HOT is given with \"-bpm=\": its hot and cold pixels are then corrected instead of the ones detected in the dark")
 #define STR_PSF N_("Performs a PSF (Point Spread Function) on the selected star")
 
-#define STR_REGISTER N_("Performs geometric transforms on images of the sequence given in argument so that they may be superimposed on the reference image. Using stars for registration, this algorithm only works with deepsky images.\n\nThe output sequence name starts with the prefix <b>\"r_\"</b> unless otherwise specified with <b>-prefix=</b> option.\nThe option <b>-drizzle</b> activates the sub-pixel stacking, either by up-scaling by 2 the images created in the rotated sequence or by setting a flag that will proceed to the up-scaling during stacking if <b>-norot</b> is passed.\nThe option <b>-transf=</b> specifies the use of either <b>\"shift\"</b>, <b>\"affine\"</b> or <b>\"homography\"</b> transformations respectively, homography being the default unless <b>-norot</b> is passed, which uses shift as default.\nThe option <b>-minpairs=</b> will specify the minimum number of star pairs a frame must have with the reference frame, otherwise the frame will be dropped.\nThe registration is done on the green layer for RGB images unless specified by <b>-layer=</b> option (0, 1 or 2 for R, G and B respectively).\n")
+#define STR_REGISTER N_("Performs geometric transforms on images of the sequence given in argument so that they may be superimposed on the reference image. Using stars for registration, this algorithm only works with deepsky images.\n\nThe output sequence name starts with the prefix <b>\"r_\"</b> unless otherwise specified with <b>-prefix=</b> option.\nThe option <b>-noout</b> only stores the transformations in the sequence file, without creating the registered sequence: they are applied when stacking or exporting the sequence. It cannot be used with <b>-drizzle</b>.\nThe option <b>-drizzle</b> activates the sub-pixel stacking, either by up-scaling by 2 the images created in the rotated sequence or by setting a flag that will proceed to the up-scaling during stacking if <b>-norot</b> is passed.\nThe option <b>-transf=</b> specifies the use of either <b>\"shift\"</b>, <b>\"affine\"</b> or <b>\"homography\"</b> transformations respectively, homography being the default unless <b>-norot</b> is passed, which uses shift as default.\nThe option <b>-minpairs=</b> will specify the minimum number of star pairs a frame must have with the reference frame, otherwise the frame will be dropped.\nThe registration is done on the green layer for RGB images unless specified by <b>-layer=</b> option (0, 1 or 2 for R, G and B respectively).\n")
 #define STR_RELOADSCRIPTS N_("Rescans the scripts folders and updates scripts menu")
 #define STR_REQUIRES N_("This function returns an error if the version of Siril is older than the one passed in argument")
 #define STR_RESAMPLE N_("Resamples image with a factor \"factor\"")
@@ -114,15 +116,16 @@
 #define STR_SETCOMPRESS N_("Defines if images are compressed or not: 0 means no compression. If compression is enabled, the type must be explicitly written in the option \"-type=\" (\"rice\", \"gzip1\", \"gzip2\"). Associated to the compression, the quantization value must follow [0, 256]. For example, \"setcompress 1 -type=rice 16\" set the rice compression with a quantization of 16")
 #define STR_SETCPU N_("Defines the number of processing threads used for calculation. Can be as high as the number of virtual threads existing on the system, which is the number of CPU cores or twice this number if hyperthreading (Intel HT) is available")
 #define STR_SETEXT N_("Sets the extension used and recognized by sequences. The argument \"extension\" can be \"fit\", \"fts\" or \"fits\"")
-#define STR_SETFINDSTAR N_("Defines thresholds above the noise and star roundness for stars detection with FINDSTAR and REGISTER commands. \"Sigma\" must be greater or equal to 0.05 and \"roundness\" between 0 and 0.9")
+#define STR_SETFINDSTAR N_("Defines thresholds above the noise and star roundness for stars detection with FINDSTAR and REGISTER commands. \"Sigma\" must be greater or equal to 0.05 and \"roundness\" between 0 and 0.9. With \"-fast\", FINDSTAR and REGISTER fit the stars with a fast PSF model, which gives their position, FWHM and roundness but not an accurate photometry")
 #define STR_SETMAG N_("Calibrates the magnitude by selecting a star and giving the known apparent magnitude. All PSF computations will return the calibrated apparent magnitude afterwards, instead of an apparent magnitude relative to ADU values. To reset the magnitude constant see UNSETMAG")
 #define STR_SETMAGSEQ N_("This command is only valid after having run SEQPSF or its graphical counterpart (select the area around a star and launch the PSF analysis for the sequence, it will appear in the graphs). This command has the same goal as SETMAG but recomputes the reference magnitude for each image of the sequence where the reference star has been found. When running the command, the last star that has been analysed will be considered as the reference star. Displaying the magnitude plot before typing the command makes it easy to understand. To reset the reference star and magnitude offset, see UNSETMAGSEQ")
 #define STR_SETMEM N_("Sets a new ratio of free memory on memory used for stacking. Value should be between 0.05 and 2, depending on other activities of the machine. A higher ratio should allow siril to stack faster, but setting the ratio of memory used for stacking above 1 will require the use of on-disk memory, which is very slow and unrecommended")
 #define STR_SETREF N_("Sets the reference image of the sequence given in first argument")
 #define STR_SPLIT N_("Splits the color image into three distinct files (one for each color) and save them in \"r\" \"g\" and \"b\" file")
 #define STR_SPLIT_CFA N_("Splits the CFA image into four distinct files (one for each channel) and save them in files")
-#define STR_STACK N_("Stacks the \"sequencename\" sequence, using options. The allowed types are: sum, max, min, med or median.\nTypes rej or mean require the use of additional arguments for rejection type and sigma values. The rejection type is one of {p[ercentile] | s[igma] | m[edian] | w[insorized] | l[inear] | g[eneralized] | [m]a[d]} for Percentile, Sigma, Median, Winsorized, Linear-Fit, Generalized Extreme Studentized Deviate Test or k-MAD clipping. If omitted, the default (Winsorized) is used. The \"sigma low\" and \"high\" parameters of rejection are mandatory.\nDifferent types of normalization are allowed: \"-norm=add\" for addition, \"-norm=mul\" for multiplicative. Options \"-norm=addscale\" and \"-norm=mulscale\" apply same normalization but with scale operations. \"-nonorm\" is the option to disable normalization. \"-weighted\" is an option to add larger weights to frames with lower background noise. Finally, \"-output_norm\" applies a normalization at the end of the stacking to rescale result in the [0, 1] range.\nIf no argument other than the sequence name is provided, sum stacking is assumed.\nResult image's name can be set with the \"-out=\" option.\nStacked images can be selected based on some filters, like manual selection or best FWHM, with some of the \"-filter-*\" options.\nSee the command reference for the complete documentation on this command")
+#define STR_STACK N_("Stacks the \"sequencename\" sequence, using options. The allowed types are: sum, max, min, med or median.\nTypes rej or mean require the use of additional arguments for rejection type and sigma values. The rejection type is one of {p[ercentile] | s[igma] | m[edian] | w[insorized] | l[inear] | g[eneralized] | [m]a[d]} for Percentile, Sigma, Median, Winsorized, Linear-Fit, Generalized Extreme Studentized Deviate Test or k-MAD clipping. If omitted, the default (Winsorized) is used. The \"sigma low\" and \"high\" parameters of rejection are mandatory.\nDifferent types of normalization are allowed: \"-norm=add\" for addition, \"-norm=mul\" for multiplicative. Options \"-norm=addscale\" and \"-norm=mulscale\" apply same normalization but with scale operations. \"-nonorm\" is the option to disable normalization. \"-weighted\" is an option to add larger weights to frames with lower background noise. With rejection stacking, \"-rejmaps\" saves the per-pixel low and high rejection counts and \"-weightmap\" saves the sum of the weights of the kept pixels, as extra images named after the result. Finally, \"-output_norm\" applies a normalization at the end of the stacking to rescale result in the [0, 1] range.\nMedian and average stacking can be split in horizontal bands stacked by \"n\" siril-cli processes with \"-workers=n\", bound to NUMA nodes in turn with numactl when the machine has several, the stacked bands being merged at the end. \"-band=start,height\" stacks only the rows from \"start\" for \"height\" rows, giving an image of this height.\nFor a quick look, \"-preview=factor\" stacks the images binned by factor x factor (2 to 8) with the same median or average with rejection, and estimates the SNR gain and rejection rates of the full resolution stacking; the result is named \"_preview\" by default.\nIf no argument other than the sequence name is provided, sum stacking is assumed.\nResult image's name can be set with the \"-out=\" option.\nStacked images can be selected based on some filters, like manual selection or best FWHM, with some of the \"-filter-*\" options.\nSee the command reference for the complete documentation on this command")
 #define STR_STACKALL N_("Opens all sequences in the CWD and stacks them with the optionally specified stacking type and filtering or with sum stacking. See STACK command for options description")
+#define STR_STACKMULTI N_("Stacks the images of several sequences, for example acquired during different nights, in a single median or average with rejection stacking. The registration data of all sequences must be relative to the same reference image, which is the reference image of the first sequence, and images must have the same size. Normalization is computed against this reference for all sequences. Filters apply to each sequence separately. See STACK command for options description")
 #define STR_STAT N_("Returns global statistics of the current image. If a selection is made, the command returns statistics within the selection")
 #define STR_SUBSKY N_("Computes the level of the local sky background thanks to a polynomial function of an order ''degree'' and subtracts it from the image. A synthetic image is then created and subtracted from the original one")
 
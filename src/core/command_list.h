@@ -23,6 +23,7 @@ struct {
 static command commands[] = {
 	/* name,	nbarg,	usage,		function pointer, definition, scriptable */
 	{"addmax", 1,	"addmax filename", process_addmax, STR_ADDMAX, FALSE},
+	{"apstack", 1, "apstack sequencename [-box=64] [-keep=25] [-minbright=0.1] [-out=result]", process_apstack, STR_APSTACK, TRUE},
 	{"asinh", 1,	"asinh stretch", process_asinh, STR_ASINH, TRUE},
 
 	{"bg", 0, "bg", process_bg, STR_BG, TRUE},
@@ -87,6 +88,7 @@ static command commands[] = {
 	{"ls", 0, "ls", process_ls, STR_LS, FALSE},
 #endif
 
+	{"makemaster", 2, "makemaster sequencename { med | median | rej | mean } [rejection type] [sigma low] [sigma high] [-bias=filename] [-nonorm, norm=] [-output_norm] [-out=result_filename] [-filter-incl[uded]] [-weighted] [-rejmaps] [-weightmap] [-band=start,height]", process_makemaster, STR_MAKEMASTER, TRUE},
 	{"merge", 3, "merge sequence1 sequence2 [sequence3 ...] output_sequence", process_merge, STR_MERGE, TRUE},
 	{"mirrorx", 0, "mirrorx", process_mirrorx, STR_MIRRORX, TRUE},
 	{"mirrory", 0, "mirrory", process_mirrory, STR_MIRRORY, TRUE},
@@ -98,10 +100,10 @@ static command commands[] = {
 
 	{"offset", 1, "offset value", process_offset, STR_OFFSET, TRUE},
 
-	{"preprocess", 1, "preprocess sequencename [-bias=filename] [-dark=filename] [-flat=filename] [-cfa] [-debayer] [-flip] [-equalize_cfa] [-opt] [-prefix=]", process_preprocess, STR_PREPROCESS, TRUE},
+	{"preprocess", 1, "preprocess sequencename [-bias=filename] [-dark=filename] [-flat=filename] [-bpm=filename] [-cfa] [-debayer] [-flip] [-equalize_cfa] [-opt] [-prefix=]", process_preprocess, STR_PREPROCESS, TRUE},
 	{"psf", 0, "psf", process_psf, STR_PSF, FALSE},
 
-	{"register", 1, "register sequence [-norot] [-drizzle] [-prefix=] [-minpairs=] [-transf=] [-layer=]", process_register, STR_REGISTER, TRUE},
+	{"register", 1, "register sequence [-norot] [-noout] [-drizzle] [-prefix=] [-minpairs=] [-transf=] [-layer=]", process_register, STR_REGISTER, TRUE},
 	{"reloadscripts", 0, "reloadscripts", process_reloadscripts, STR_RELOADSCRIPTS, FALSE},
 	{"requires", 1, "requires", process_requires, STR_REQUIRES, TRUE},
 	{"resample", 1, "resample factor", process_resample, STR_RESAMPLE, TRUE},
@@ -147,15 +149,16 @@ static command commands[] = {
 	{"setcpu", 1, "setcpu number", process_set_cpu, STR_SETCPU, TRUE},
 #endif
 	{"setext", 1, "setext extension", process_set_ext, STR_SETEXT, TRUE},
-	{"setfindstar", 2, "setfindstar sigma roundness", process_set_findstar, STR_SETFINDSTAR, TRUE},
+	{"setfindstar", 2, "setfindstar sigma roundness [-fast]", process_set_findstar, STR_SETFINDSTAR, TRUE},
 	{"setmag", 1, "setmag magnitude", process_set_mag, STR_SETMAG, FALSE},
 	{"setmagseq", 1, "setmagseq magnitude", process_set_mag_seq, STR_SETMAGSEQ, FALSE},
 	{"setmem", 1, "setmem ratio", process_set_mem, STR_SETMEM, TRUE},
 	{"setref", 2, "setref sequencename image_number", process_set_ref, STR_SETREF, TRUE},
 	{"split", 3, "split R G B", process_split, STR_SPLIT, TRUE},
 	{"split_cfa", 0, "split_cfa", process_split_cfa, STR_SPLIT_CFA, TRUE},
-	{"stack", 1, "stack sequencename [type] [rejection type] [sigma low] [sigma high] [-nonorm, norm=] [-output_norm] [-out=result_filename] [-filter-fwhm=value[%]] [-filter-wfwhm=value[%]] [-filter-round=value[%]] [-filter-quality=value[%]] [-filter-incl[uded]] [-weighted]", process_stackone, STR_STACK, TRUE},
-	{"stackall", 0, "stackall [type] [rejection type] [sigma low] [sigma high] [-nonorm, norm=] [-output_norm] [-filter-fwhm=value[%]] [-filter-wfwhm=value[%]] [-filter-round=value[%]] [-filter-quality=value[%]] [-filter-incl[uded]] [-weighted]", process_stackall, STR_STACKALL, TRUE},
+	{"stack", 1, "stack sequencename [type] [rejection type] [sigma low] [sigma high] [-nonorm, norm=] [-output_norm] [-out=result_filename] [-filter-fwhm=value[%]] [-filter-wfwhm=value[%]] [-filter-round=value[%]] [-filter-quality=value[%]] [-filter-incl[uded]] [-weighted] [-rejmaps] [-weightmap] [-workers=n] [-band=start,height] [-preview=factor]", process_stackone, STR_STACK, TRUE},
+	{"stackall", 0, "stackall [type] [rejection type] [sigma low] [sigma high] [-nonorm, norm=] [-output_norm] [-filter-fwhm=value[%]] [-filter-wfwhm=value[%]] [-filter-round=value[%]] [-filter-quality=value[%]] [-filter-incl[uded]] [-weighted] [-rejmaps] [-weightmap] [-workers=n] [-preview=factor]", process_stackall, STR_STACKALL, TRUE},
+	{"stackmulti", 3, "stackmulti seq1 seq2 [seq3 ...] { med | median | rej | mean } [rejection type] [sigma low] [sigma high] [-nonorm, norm=] [-output_norm] [-out=result_filename] [-filter-fwhm=value[%]] [-filter-wfwhm=value[%]] [-filter-round=value[%]] [-filter-quality=value[%]] [-filter-incl[uded]] [-weighted] [-rejmaps] [-weightmap] [-band=start,height] [-preview=factor]", process_stackmulti, STR_STACKMULTI, TRUE},
 	{"stat", 0, "stat", process_stat, STR_STAT, TRUE},
 	{"subsky", 1, "subsky degree", process_subsky, STR_SUBSKY, TRUE},
 
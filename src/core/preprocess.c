@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <glib/gstdio.h>
 
 #include "core/siril.h"
 #include "core/proto.h"
@@ -41,148 +42,372 @@
 
 #include "preprocess.h"
 
-#define SQUARE_SIZE 512
+/* Fused calibration of the images: all the operations with the master frames
+ * are done in a single pass over each row, in the order and with the rounding
+ * and clipping of the successive soper() and imoper() calls they replace:
+ *   out = (((raw - k * dark) - bias) - dark) / flat * normalisation
+ * the dark being subtracted only once, scaled by k if it was optimized.
+ */
 
-static float evaluateNoiseOfCalibratedImage(fits *fit, fits *dark,
-		float k, gboolean allow_32bit_output) {
-	long chan;
-	int ret = 0;
-	float noise = 0.f;
-	fits dark_tmp = { 0 }, fit_tmp = { 0 };
-	rectangle area = { 0 };
-
-	/* square of 512x512 in the center of the image */
-	int size = SQUARE_SIZE;
-	area.x = (fit->rx - size) / 2;
-	area.y = (fit->ry - size) / 2;
-	area.w = size;
-	area.h = size;
-
-	ret = copyfits(dark, &dark_tmp, CP_ALLOC | CP_COPYA | CP_FORMAT, -1);
-	if (!ret) ret = copyfits(fit, &fit_tmp, CP_ALLOC | CP_COPYA | CP_FORMAT, -1);
-
-	if (!ret) ret = soper(&dark_tmp, k, OPER_MUL, allow_32bit_output);
-	if (!ret) ret = imoper(&fit_tmp, &dark_tmp, OPER_SUB, allow_32bit_output);
-	if (ret) {
-		clearfits(&dark_tmp);
-		clearfits(&fit_tmp);
-		return -1.0;
-	}
-
-	for (chan = 0; chan < fit->naxes[2]; chan++) {
-		/* STATS_SIGMEAN computes mean and normvalue */
-		imstats *stat = statistics(NULL, -1, &fit_tmp, chan, &area, STATS_SIGMEAN, FALSE);
-		if (!stat) {
-			siril_log_message(_("Error: statistics computation failed.\n"));
-			return -1.0;
+/* value of pixels of a 16-bit image in [0, 1], like ushort_to_float_bitpix() */
+static float ushort_scale(fits *fit) {
+	return fit->orig_bitpix == BYTE_IMG ? INV_UCHAR_MAX_SINGLE : INV_USHRT_MAX_SINGLE;
+}
+
+static gboolean master_has_same_size(fits *raw, fits *master) {
+	if (memcmp(raw->naxes, master->naxes, sizeof raw->naxes)) {
+		siril_log_color_message(_("Images must have same dimensions.\n"), "red");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* returns the row starting at index start of a master frame in float, using
+ * buf to convert it if needed */
+static const float *master_row_float(fits *master, size_t start, int width, float *buf) {
+	if (master->type == DATA_FLOAT)
+		return master->fdata + start;
+	const WORD *src = master->data + start;
+	const float scale = ushort_scale(master);
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+	for (int x = 0; x < width; x++)
+		buf[x] = (float) src[x] * scale;
+	return buf;
+}
+
+static void calibrate_row_float(struct preprocessing_data *args, float k,
+		size_t start, int width, float *row, float *buf) {
+	if (args->use_dark && args->use_dark_optim) {
+		const float *dark = master_row_float(args->dark, start, width, buf);
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+		for (int x = 0; x < width; x++) {
+			float v = row[x] - dark[x] * k;
+			row[x] = v > 1.f ? 1.f : (v < -1.f ? 0.f : v);
+		}
+	}
+
+	if (args->use_bias) {
+		if (args->bias_level < FLT_MAX) {
+			const float level = args->bias_level;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+			for (int x = 0; x < width; x++)
+				row[x] -= level;
+		} else {
+			const float *bias = master_row_float(args->bias, start, width, buf);
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+			for (int x = 0; x < width; x++) {
+				float v = row[x] - bias[x];
+				row[x] = v > 1.f ? 1.f : (v < -1.f ? 0.f : v);
+			}
+		}
+	}
+
+	if (args->use_dark && !args->use_dark_optim) {
+		const float *dark = master_row_float(args->dark, start, width, buf);
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+		for (int x = 0; x < width; x++) {
+			float v = row[x] - dark[x];
+			row[x] = v > 1.f ? 1.f : (v < -1.f ? 0.f : v);
 		}
-		noise += stat->sigma / stat->normValue;
-		free_stats(stat);
 	}
-	clearfits(&dark_tmp);
-	clearfits(&fit_tmp);
 
+	if (args->use_flat) {
+		const float *flat = master_row_float(args->flat, start, width, buf);
+		const float norm = args->normalisation;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+		for (int x = 0; x < width; x++) {
+			float v = flat[x] == 0.f ? 0.f : row[x] / flat[x];
+			if (norm != 1.f)
+				v *= norm;
+			row[x] = v > 1.f ? 1.f : (v < -1.f ? 0.f : v);
+		}
+	}
+}
+
+static int calibrate_float(fits *raw, struct preprocessing_data *args, float k) {
+	const int width = raw->rx;
+	const int nb_rows = raw->ry * raw->naxes[2];
+	const size_t n = raw->naxes[0] * raw->naxes[1] * raw->naxes[2];
+	float *out = raw->type == DATA_FLOAT ? raw->fdata : malloc(n * sizeof(float));
+	gboolean alloc_error = FALSE;
+	if (!out) {
+		PRINT_ALLOC_ERR;
+		return 1;
+	}
+	const float scale = ushort_scale(raw);
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(com.max_thread) reduction(|:alloc_error)
+#endif
+	{
+		float *buf = malloc(width * sizeof(float));
+		alloc_error = !buf;
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+		for (int r = 0; r < nb_rows; r++) {
+			if (!buf) continue;
+			size_t start = (size_t) r * width;
+			float *row = out + start;
+			if (raw->type == DATA_USHORT) {
+				const WORD *src = raw->data + start;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+				for (int x = 0; x < width; x++)
+					row[x] = (float) src[x] * scale;
+			}
+			calibrate_row_float(args, k, start, width, row, buf);
+		}
+		free(buf);
+	}
+
+	if (alloc_error) {
+		PRINT_ALLOC_ERR;
+		if (out != raw->fdata)
+			free(out);
+		return 1;
+	}
+	if (raw->type == DATA_USHORT)
+		fit_replace_buffer(raw, out, DATA_FLOAT);
+	else invalidate_stats_from_fit(raw);
+	return 0;
+}
+
+/* value of a master pixel subtracted from a 16-bit image by imoper_to_ushort(),
+ * scaled by k the way soper() scales the dark */
+static int master_sub_value(fits *master, size_t i, gboolean scaled, float k, float norm) {
+	if (master->type == DATA_USHORT) {
+		WORD v = master->data[i];
+		return scaled ? roundf_to_WORD((float) v * k) : v;
+	}
+	float v = master->fdata[i];
+	if (scaled)
+		v *= k;
+	return roundf_to_int(v * norm);
+}
+
+static int calibrate_ushort(fits *raw, struct preprocessing_data *args, float k) {
+	if (raw->type != DATA_USHORT) {
+		siril_log_color_message(_("Image operations can only be kept 16 bits if first input images are 16 bits. Aborting.\n"), "red");
+		return 1;
+	}
+	const int width = raw->rx;
+	const int nb_rows = raw->ry * raw->naxes[2];
+	const float scale = ushort_scale(raw);
+	const float norm = raw->bitpix == BYTE_IMG ? UCHAR_MAX_SINGLE : USHRT_MAX_SINGLE;
+	const gboolean use_level = args->use_bias && args->bias_level < FLT_MAX;
+	const gboolean use_bias = args->use_bias && !use_level;
+	fits *dark = args->dark, *bias = args->bias, *flat = args->flat;
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static)
+#endif
+	for (int r = 0; r < nb_rows; r++) {
+		size_t start = (size_t) r * width;
+		WORD *row = raw->data + start;
+		for (int x = 0; x < width; x++) {
+			size_t i = start + x;
+			WORD a = row[x];
+			if (args->use_dark && args->use_dark_optim)
+				a = truncate_to_WORD((int) a - master_sub_value(dark, i, TRUE, k, norm));
+			if (use_level)
+				a = float_to_ushort_range((float) a * scale - args->bias_level);
+			else if (use_bias)
+				a = truncate_to_WORD((int) a - master_sub_value(bias, i, FALSE, k, norm));
+			if (args->use_dark && !args->use_dark_optim)
+				a = truncate_to_WORD((int) a - master_sub_value(dark, i, FALSE, k, norm));
+			if (args->use_flat) {
+				float b = flat->type == DATA_USHORT ? (float) flat->data[i] : flat->fdata[i];
+				if (b == 0.f)
+					a = 0;
+				else {
+					if (flat->type == DATA_FLOAT)
+						b *= norm;
+					float v = (float) a / b;
+					if (args->normalisation != 1.f)
+						v *= args->normalisation;
+					a = roundf_to_WORD(v);
+				}
+			}
+			row[x] = a;
+		}
+	}
+	invalidate_stats_from_fit(raw);
+	return 0;
+}
+
+/* calibrates raw with the master frames, k being the dark optimization
+ * coefficient, then applies the cosmetic correction on the result */
+static int preprocess(fits *raw, struct preprocessing_data *args, float k) {
+	int ret;
+
+	if ((args->use_bias && args->bias_level == FLT_MAX && !master_has_same_size(raw, args->bias))
+			|| (args->use_dark && !master_has_same_size(raw, args->dark))
+			|| (args->use_flat && !master_has_same_size(raw, args->flat)))
+		return 1;
+
+	if (args->allow_32bit_output && !com.pref.force_to_16bit)
+		ret = calibrate_float(raw, args, k);
+	else ret = calibrate_ushort(raw, args, k);
+	if (ret)
+		return ret;
+#ifdef SIRIL_OUTPUT_DEBUG
+	image_find_minmax(raw);
+	fprintf(stdout, "after calibration: min=%f, max=%f\n", raw->mini, raw->maxi);
+	invalidate_stats_from_fit(raw);
+#endif
+
+	/* the deviant pixels are corrected with their calibrated neighbours, so
+	 * this can only be done once all the rows have been processed */
+	if (args->use_cosmetic_correction && args->dev) {
+		cosmeticCorrection(raw, args->dev, args->icold + args->ihot, args->is_cfa);
+#ifdef SIRIL_OUTPUT_DEBUG
+		image_find_minmax(raw);
+		fprintf(stdout, "after cosmetic correction: min=%f, max=%f\n",
+				raw->mini, raw->maxi);
+		invalidate_stats_from_fit(raw);
+#endif
+	}
+	return 0;
+}
+
+/* Dark optimization: the noise of raw - k * dark is evaluated on a fixed
+ * random subsample of the pixels. For each channel, the variance of the
+ * calibrated pixels is a quadratic function of k, obtained from the first and
+ * second order moments of the two images computed in a single pass:
+ *   var(raw - k * dark) = var(raw) - 2k cov(raw, dark) + k^2 var(dark)
+ */
+#define DARK_OPTIM_SAMPLES 65536
+
+struct dark_moments {
+	double var_raw, cov, var_dark;
+};
+
+/* picks one random pixel in each of the strata of the image, this gives a
+ * sorted list of samples spread over the whole frame */
+static int init_dark_optim_samples(struct preprocessing_data *args) {
+	size_t nb_pixels = args->dark->naxes[0] * args->dark->naxes[1];
+	size_t nb = min(nb_pixels, DARK_OPTIM_SAMPLES);
+	if (!nb)
+		return 1;
+	args->dark_optim_samples = malloc(nb * sizeof(size_t));
+	if (!args->dark_optim_samples) {
+		PRINT_ALLOC_ERR;
+		return 1;
+	}
+	GRand *rand = g_rand_new_with_seed(42);
+	for (size_t i = 0; i < nb; i++) {
+		size_t first = i * nb_pixels / nb;
+		size_t last = (i + 1) * nb_pixels / nb;
+		args->dark_optim_samples[i] = first + g_rand_int_range(rand, 0, last - first);
+	}
+	g_rand_free(rand);
+	args->nb_dark_optim_samples = nb;
+	return 0;
+}
+
+static float sample_value(fits *fit, size_t i) {
+	if (fit->type == DATA_FLOAT)
+		return fit->fdata[i];
+	return (float) fit->data[i] * ushort_scale(fit);
+}
+
+static void compute_dark_moments(fits *raw, struct preprocessing_data *args,
+		int layer, struct dark_moments *m) {
+	size_t offset = (size_t) layer * raw->naxes[0] * raw->naxes[1];
+	size_t n = args->nb_dark_optim_samples;
+	double sr = 0.0, sd = 0.0, srr = 0.0, sdd = 0.0, srd = 0.0;
+
+	for (size_t s = 0; s < n; s++) {
+		size_t i = offset + args->dark_optim_samples[s];
+		double r = sample_value(raw, i);
+		double d = sample_value(args->dark, i);
+		sr += r;
+		sd += d;
+		srr += r * r;
+		sdd += d * d;
+		srd += r * d;
+	}
+	double mr = sr / n, md = sd / n;
+	m->var_raw = srr / n - mr * mr;
+	m->cov = srd / n - mr * md;
+	m->var_dark = sdd / n - md * md;
+}
+
+static float evaluateNoiseOfCalibratedImage(struct dark_moments *m, int nb_layers, float k) {
+	float noise = 0.f;
+	for (int chan = 0; chan < nb_layers; chan++) {
+		double var = m[chan].var_raw - 2.0 * k * m[chan].cov + (double) k * k * m[chan].var_dark;
+		noise += (float) sqrt(max(var, 0.0));
+	}
 	return noise;
 }
 
 #undef GR
 #define GR ((sqrtf(5.f) - 1.f) / 2.f)
 
-static float goldenSectionSearch(fits *raw, fits *dark, float a, float b,
-		float tol, gboolean allow_32bits) {
+static float goldenSectionSearch(struct dark_moments *m, int nb_layers,
+		float a, float b, float tol) {
 	float c, d;
 	float fc, fd;
 	int iter = 0;
 
 	c = b - GR * (b - a);
 	d = a + GR * (b - a);
-	fc = evaluateNoiseOfCalibratedImage(raw, dark, c, allow_32bits);
-	fd = evaluateNoiseOfCalibratedImage(raw, dark, d, allow_32bits);
+	fc = evaluateNoiseOfCalibratedImage(m, nb_layers, c);
+	fd = evaluateNoiseOfCalibratedImage(m, nb_layers, d);
 	if (fc == fd) return 1.f;
 	do {
 		siril_debug_print("Iter: %d (%1.2f, %1.2f)\n", ++iter, c, d);
-		if (fc < 0.f || fd < 0.f)
-			return -1.f;
 		if (fc < fd) {
 			b = d;
 			d = c;
 			fd = fc;
 			c = b - GR * (b - a);
-			fc = evaluateNoiseOfCalibratedImage(raw, dark, c, allow_32bits);
+			fc = evaluateNoiseOfCalibratedImage(m, nb_layers, c);
 		} else {
 			a = c;
 			c = d;
 			fc = fd;
 			d = a + GR * (b - a);
-			fd = evaluateNoiseOfCalibratedImage(raw, dark, d, allow_32bits);
+			fd = evaluateNoiseOfCalibratedImage(m, nb_layers, d);
 
 		}
 	} while (fabsf(c - d) > tol);
 	return ((b + a) * 0.5f);
 }
 
-static int preprocess(fits *raw, struct preprocessing_data *args) {
-	int ret = 0;
-
-	if (args->use_bias) {
-		if (args->bias_level < FLT_MAX) { // an offset level has been defined
-			ret = soper(raw, args->bias_level, OPER_SUB, args->allow_32bit_output);
-		} else ret = imoper(raw, args->bias, OPER_SUB, args->allow_32bit_output);
-	}
-
-	/* if dark optimization, the master-dark has already been subtracted */
-	if (!ret && args->use_dark && !args->use_dark_optim) {
-		ret = imoper(raw, args->dark, OPER_SUB, args->allow_32bit_output);
-#ifdef SIRIL_OUTPUT_DEBUG
-		image_find_minmax(raw);
-		fprintf(stdout, "after dark: min=%f, max=%f\n", raw->mini, raw->maxi);
-		invalidate_stats_from_fit(raw);
-#endif
-	}
-
-	if (!ret && args->use_flat) {
-		// return value is an error if there is an overflow, but it is usual
-		// for now, so don't treat as error
-		/*ret =*/ siril_fdiv(raw, args->flat, args->normalisation, args->allow_32bit_output);
-#ifdef SIRIL_OUTPUT_DEBUG
-		image_find_minmax(raw);
-		fprintf(stdout, "after flat: min=%f, max=%f\n", raw->mini, raw->maxi);
-		invalidate_stats_from_fit(raw);
-#endif
-	}
-
-	return ret;
-}
-
-static int darkOptimization(fits *raw, struct preprocessing_data *args) {
-	float k0;
+/* finds the coefficient k applied to the master-dark that minimizes the noise
+ * of the calibrated image */
+static int darkOptimization(fits *raw, struct preprocessing_data *args, float *k) {
+	struct dark_moments m[3];
 	float lo = 0.f, up = 2.f;
-	int ret = 0;
-	fits *dark = args->dark;
-	fits dark_tmp = { 0 };
 
-	if (memcmp(raw->naxes, dark->naxes, sizeof raw->naxes)) {
+	if (memcmp(raw->naxes, args->dark->naxes, sizeof raw->naxes)) {
 		siril_log_color_message(_("Images must have same dimensions\n"), "red");
 		return 1;
 	}
 
-	// TODO: avoid duplicating with soper+imoper together
-	if (copyfits(dark, &dark_tmp, CP_ALLOC | CP_COPYA | CP_FORMAT, 0))
-		return 1;
+	for (int chan = 0; chan < raw->naxes[2]; chan++)
+		compute_dark_moments(raw, args, chan, &m[chan]);
 
 	/* Minimization of background noise to find better k */
-	k0 = goldenSectionSearch(raw, &dark_tmp, lo, up, 0.001f, args->allow_32bit_output);
-	if (k0 < 0.f) {
-		ret = -1;
-	} else {
-		siril_log_message(_("Dark optimization: k0=%.3f\n"), k0);
-		/* Multiply coefficient to master-dark */
-		ret = soper(&dark_tmp, k0, OPER_MUL, args->allow_32bit_output);
-		if (!ret)
-			ret = imoper(raw, &dark_tmp, OPER_SUB, args->allow_32bit_output);
-	}
-	clearfits(&dark_tmp);
-	return ret;
+	*k = goldenSectionSearch(m, raw->naxes[2], lo, up, 0.001f);
+	siril_log_message(_("Dark optimization: k0=%.3f\n"), *k);
+	return 0;
 }
 
 static gint64 prepro_compute_size_hook(struct generic_seq_args *args, int nb_images) {
@@ -193,6 +418,154 @@ static gint64 prepro_compute_size_hook(struct generic_seq_args *args, int nb_ima
 	return size;
 }
 
+static gchar *get_flat_profile_filename(const char *flat_filename) {
+	char *basename = remove_ext_from_filename(flat_filename);
+	gchar *filename = g_strdup_printf("%s_profile.txt", basename);
+	free(basename);
+	return filename;
+}
+
+/* the profile of a flat, without the values */
+static int init_flat_profile(const char *flat_filename, fits *flat, struct flat_profile *profile) {
+	GStatBuf st;
+	memset(profile, 0, sizeof(struct flat_profile));
+	profile->rx = flat->rx;
+	profile->ry = flat->ry;
+	profile->nb_layers = flat->naxes[2];
+	if (!flat_filename || g_stat(flat_filename, &st))
+		return 1;
+	profile->file_time = st.st_mtime;
+	profile->file_size = st.st_size;
+	return 0;
+}
+
+/* mean of the centre of the first layer of the flat, where it is not
+ * affected by vignetting */
+static int compute_flat_level(fits *flat, double *level) {
+	const unsigned int width = flat->rx;
+	const unsigned int height = flat->ry;
+	const unsigned int startx = width / 3;
+	const unsigned int starty = height / 3;
+
+	rectangle selection = { startx, starty, width - 1 - startx, height - 1 - starty };
+
+	imstats *stat = statistics(NULL, -1, flat, RLAYER, &selection, STATS_BASIC, TRUE);
+	if (!stat) {
+		siril_log_message(_("Error: statistics computation failed.\n"));
+		return 1;
+	}
+	*level = stat->mean;
+	if (flat->type == DATA_USHORT)
+		*level /= USHRT_MAX_DOUBLE;
+	free_stats(stat);
+	return 0;
+}
+
+static int compute_flat_cfa_means(fits *flat, float mean[4]) {
+	if (compute_means_from_flat_cfa(flat, mean))
+		return 1;
+	if (flat->type == DATA_USHORT)
+		for (int i = 0; i < 4; i++)
+			mean[i] *= INV_USHRT_MAX_SINGLE;
+	return 0;
+}
+
+/* reads the profile saved for the flat, fails if there is none or if the
+ * flat file has changed since it was saved */
+int load_flat_profile(const char *flat_filename, fits *flat, struct flat_profile *profile) {
+	struct flat_profile current;
+	if (init_flat_profile(flat_filename, flat, &current))
+		return 1;
+	gchar *filename = get_flat_profile_filename(flat_filename);
+	gchar *content = NULL;
+	gboolean ok = g_file_get_contents(filename, &content, NULL, NULL);
+	g_free(filename);
+	if (!ok)
+		return 1;
+
+	struct flat_profile saved = { 0 };
+	gchar **lines = g_strsplit(content, "\n", -1);
+	for (int i = 0; lines[i]; i++) {
+		gchar **tokens = g_strsplit(g_strstrip(lines[i]), " ", -1);
+		int nb = g_strv_length(tokens);
+		if (nb == 3 && !strcmp(tokens[0], "file")) {
+			saved.file_time = g_ascii_strtoll(tokens[1], NULL, 10);
+			saved.file_size = g_ascii_strtoll(tokens[2], NULL, 10);
+		} else if (nb == 4 && !strcmp(tokens[0], "size")) {
+			saved.rx = g_ascii_strtoll(tokens[1], NULL, 10);
+			saved.ry = g_ascii_strtoll(tokens[2], NULL, 10);
+			saved.nb_layers = g_ascii_strtoll(tokens[3], NULL, 10);
+		} else if (nb == 5 && !strcmp(tokens[0], "cfa_means")) {
+			for (int c = 0; c < 4; c++)
+				saved.cfa_means[c] = (float)g_ascii_strtod(tokens[c + 1], NULL);
+			saved.has_cfa_means = TRUE;
+		} else if (nb == 2 && !strcmp(tokens[0], "level")) {
+			saved.level = g_ascii_strtod(tokens[1], NULL);
+			saved.has_level = TRUE;
+		} else if (nb == 2 && !strcmp(tokens[0], "equalized_level")) {
+			saved.equalized_level = g_ascii_strtod(tokens[1], NULL);
+			saved.has_equalized_level = TRUE;
+		}
+		g_strfreev(tokens);
+	}
+	g_strfreev(lines);
+	g_free(content);
+
+	if (saved.file_time != current.file_time || saved.file_size != current.file_size ||
+			saved.rx != current.rx || saved.ry != current.ry ||
+			saved.nb_layers != current.nb_layers)
+		return 1;
+	*profile = saved;
+	return 0;
+}
+
+int save_flat_profile(const char *flat_filename, struct flat_profile *profile) {
+	char value[G_ASCII_DTOSTR_BUF_SIZE];
+	GString *content = g_string_new(NULL);
+	g_string_append_printf(content, "file %" G_GINT64_FORMAT " %" G_GINT64_FORMAT "\n",
+			profile->file_time, profile->file_size);
+	g_string_append_printf(content, "size %d %d %d\n", profile->rx, profile->ry,
+			profile->nb_layers);
+	if (profile->has_cfa_means) {
+		g_string_append(content, "cfa_means");
+		for (int c = 0; c < 4; c++)
+			g_string_append_printf(content, " %s",
+					g_ascii_formatd(value, sizeof value, "%.9g", profile->cfa_means[c]));
+		g_string_append_c(content, '\n');
+	}
+	if (profile->has_level)
+		g_string_append_printf(content, "level %s\n",
+				g_ascii_formatd(value, sizeof value, "%.12g", profile->level));
+	if (profile->has_equalized_level)
+		g_string_append_printf(content, "equalized_level %s\n",
+				g_ascii_formatd(value, sizeof value, "%.12g", profile->equalized_level));
+
+	gchar *filename = get_flat_profile_filename(flat_filename);
+	GError *error = NULL;
+	int retval = 0;
+	if (!g_file_set_contents(filename, content->str, content->len, &error)) {
+		siril_log_message(_("Could not save the profile of the flat: %s\n"), error->message);
+		g_clear_error(&error);
+		retval = 1;
+	}
+	g_free(filename);
+	g_string_free(content, TRUE);
+	return retval;
+}
+
+/* computes and saves the profile of a master flat that has just been saved,
+ * so that its first use by the calibration does not have to */
+int cache_flat_profile(const char *flat_filename, fits *flat) {
+	struct flat_profile profile;
+	if (init_flat_profile(flat_filename, flat, &profile))
+		return 1;
+	if (flat->naxes[2] == 1 && !compute_flat_cfa_means(flat, profile.cfa_means))
+		profile.has_cfa_means = TRUE;
+	if (!compute_flat_level(flat, &profile.level))
+		profile.has_level = TRUE;
+	return save_flat_profile(flat_filename, &profile);
+}
+
 static int prepro_prepare_hook(struct generic_seq_args *args) {
 	struct preprocessing_data *prepro = args->user;
 
@@ -202,40 +575,41 @@ static int prepro_prepare_hook(struct generic_seq_args *args) {
 			return 1;
 	}
 
-	// precompute flat levels
+	// precompute flat levels, or get them from the profile cached with the flat
 	if (prepro->use_flat) {
+		struct flat_profile profile;
+		gboolean updated = FALSE;
+		if (!load_flat_profile(prepro->flat_filename, prepro->flat, &profile))
+			siril_log_message(_("Using the cached profile of the flat\n"));
+		else init_flat_profile(prepro->flat_filename, prepro->flat, &profile);
+
 		if (prepro->equalize_cfa) {
-			compute_grey_flat(prepro->flat);
+			if (!profile.has_cfa_means) {
+				if (compute_flat_cfa_means(prepro->flat, profile.cfa_means))
+					return 1;
+				profile.has_cfa_means = updated = TRUE;
+			}
+			compute_grey_flat_from_means(prepro->flat, profile.cfa_means);
 		}
 		if (prepro->autolevel) {
-			const unsigned int width = prepro->flat->rx;
-			const unsigned int height = prepro->flat->ry;
-
-			/* due to vignetting it is better to take an area in the
-			 * center of the flat image
-			 */
-			const unsigned int startx = width / 3;
-			const unsigned int starty = height / 3;
-
-			rectangle selection = { startx, starty, width - 1 - startx, height - 1 - starty };
-
-			imstats *stat = statistics(NULL, -1, prepro->flat, RLAYER, &selection, STATS_BASIC, FALSE);
-			if (!stat) {
-				siril_log_message(_("Error: statistics computation failed.\n"));
-				return 1;
+			/* the level of the flat once it has been equalized */
+			double *level = prepro->equalize_cfa ? &profile.equalized_level : &profile.level;
+			gboolean *has_level = prepro->equalize_cfa ? &profile.has_equalized_level : &profile.has_level;
+			if (!*has_level) {
+				if (compute_flat_level(prepro->flat, level))
+					return 1;
+				*has_level = updated = TRUE;
 			}
-			prepro->normalisation = stat->mean;
-			free_stats(stat);
 
-			// special cases for division factor, caused by how imoper works with many cases
-			if (DATA_USHORT == prepro->flat->type && prepro->allow_32bit_output)
-				prepro->normalisation *= INV_USHRT_MAX_SINGLE;
-			else if (DATA_FLOAT == prepro->flat->type && !prepro->allow_32bit_output)
-				prepro->normalisation *= USHRT_MAX_SINGLE;
+			// the division factor depends on how imoper works with each output type
+			prepro->normalisation = (float)(prepro->allow_32bit_output ?
+					*level : *level * USHRT_MAX_DOUBLE);
 
 			siril_log_message(_("Normalisation value auto evaluated: %.3f\n"),
 					prepro->normalisation);
 		}
+		if (updated && prepro->flat_filename)
+			save_flat_profile(prepro->flat_filename, &profile);
 	}
 
 	/** FIX XTRANS AC ISSUE **/
@@ -247,8 +621,17 @@ static int prepro_prepare_hook(struct generic_seq_args *args) {
 		fix_xtrans_ac(prepro->bias);
 	}
 
+	if (prepro->use_dark_optim && prepro->use_dark) {
+		if (init_dark_optim_samples(prepro))
+			return 1;
+	}
+
 	// proceed to cosmetic correction
-	if (prepro->use_cosmetic_correction && prepro->use_dark) {
+	if (prepro->use_cosmetic_correction && prepro->dev) {
+		/* loaded from a bad pixel list, no need to detect them in the dark */
+		siril_log_message(_("%ld bad pixels loaded from the list (%ld + %ld)\n"),
+				prepro->icold + prepro->ihot, prepro->icold, prepro->ihot);
+	} else if (prepro->use_cosmetic_correction && prepro->use_dark) {
 		if (strlen(prepro->dark->bayer_pattern) > 4) {
 			siril_log_color_message(_("Cosmetic correction cannot be applied on X-Trans files.\n"), "red");
 			prepro->use_cosmetic_correction = FALSE;
@@ -271,26 +654,15 @@ static int prepro_prepare_hook(struct generic_seq_args *args) {
 static int prepro_image_hook(struct generic_seq_args *args, int out_index, int in_index, fits *fit, rectangle *_) {
 	struct preprocessing_data *prepro = args->user;
 
-	/******/
+	float k = 1.f;
 	if (prepro->use_dark_optim && prepro->use_dark) {
-		if (darkOptimization(fit, prepro))
+		if (darkOptimization(fit, prepro, &k))
 			return 1;
 	}
 
-	if (preprocess(fit, prepro))
+	if (preprocess(fit, prepro, k))
 		return 1;
 
-	if (prepro->use_cosmetic_correction && prepro->use_dark
-			&& prepro->dark->naxes[2] == 1) {
-		cosmeticCorrection(fit, prepro->dev, prepro->icold + prepro->ihot, prepro->is_cfa);
-#ifdef SIRIL_OUTPUT_DEBUG
-		image_find_minmax(fit);
-		fprintf(stdout, "after cosmetic correction: min=%f, max=%f\n",
-				fit->mini, fit->maxi);
-		invalidate_stats_from_fit(fit);
-#endif
-	}
-
 	if (prepro->debayer) {
 		// debayering SER is now allowed - https://gitlab.com/free-astro/siril/-/issues/549	
 		if (!prepro->seq || prepro->seq->type == SEQ_REGULAR || prepro->seq->type == SEQ_FITSEQ || prepro->seq->type == SEQ_SER ) {
@@ -322,8 +694,12 @@ static void clear_preprocessing_data(struct preprocessing_data *prepro) {
 		clearfits(prepro->dark);
 	if (prepro->use_flat && prepro->flat)
 		clearfits(prepro->flat);
+	g_free(prepro->flat_filename);
+	prepro->flat_filename = NULL;
 	if (prepro->dev)
 		free(prepro->dev);
+	free(prepro->dark_optim_samples);
+	prepro->dark_optim_samples = NULL;
 }
 
 static int prepro_finalize_hook(struct generic_seq_args *args) {
@@ -586,6 +962,7 @@ static gboolean test_for_master_files(struct preprocessing_data *args) {
 					error = _("NOT USING FLAT: image dimensions are different");
 				} else {
 					args->use_flat = TRUE;
+					args->flat_filename = g_strdup(filename);
 				}
 
 			} else error = _("NOT USING FLAT: cannot open the file");
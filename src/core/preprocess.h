@@ -19,15 +19,33 @@ struct preprocessing_data {
 	double sigma[2];
 	long icold, ihot;
 	deviant_pixel *dev;
+	size_t *dark_optim_samples;	// pixels used to optimize the dark
+	size_t nb_dark_optim_samples;
 	gboolean is_cfa;
 	gboolean debayer;
 	gboolean equalize_cfa;
 	gboolean allow_32bit_output;
 	float normalisation;
+	gchar *flat_filename;	// where the flat profile is cached, NULL for none
 	int retval;
 	const char *ppprefix;	 // prefix for output files
 };
 
+/* what the calibration computes from a master flat before the images, cached
+ * next to the flat file while it does not change. Values are in [0, 1] */
+struct flat_profile {
+	gint64 file_time, file_size;	// of the flat file the profile is for
+	int rx, ry, nb_layers;
+	gboolean has_cfa_means, has_level, has_equalized_level;
+	float cfa_means[4];	// means of the 4 channels of the CFA
+	double level;		// mean of the centre, for the normalisation
+	double equalized_level;	// the same after the CFA equalization
+};
+
+int load_flat_profile(const char *flat_filename, fits *flat, struct flat_profile *profile);
+int save_flat_profile(const char *flat_filename, struct flat_profile *profile);
+int cache_flat_profile(const char *flat_filename, fits *flat);
+
 int preprocess_single_image(struct preprocessing_data *args);
 int evaluateoffsetlevel(const char* expression);
 void start_sequence_preprocessing(struct preprocessing_data *prepro);
@@ -212,7 +212,9 @@ gpointer generic_sequence_worker(gpointer p) {
 			  savefits(tmpfn, fit);*/
 		} else {
 			// image is obtained bottom to top here, while it's in natural order for partial images!
-			if (seq_read_frame(args->seq, input_idx, fit, args->force_float, thread_id)) {
+			if (seq_read_frame_layer(args->seq, input_idx, fit, args->force_float,
+						args->single_layer_for_full ? args->layer_for_full : -1,
+						thread_id)) {
 				abort = 1;
 				clearfits(fit);
 				free(fit);
@@ -28,6 +28,10 @@ struct generic_seq_args {
 	gboolean regdata_for_partial;
 	/** flag to get photometry data */
 	gboolean get_photometry_data_for_partial;
+	/** in case of full-frame reading, CFA SER frames are only demosaiced in
+	 *  layer_for_full, for processing that only uses it and writes no image */
+	gboolean single_layer_for_full;
+	int layer_for_full;
 
 	/** filtering the images from the sequence, maybe we don't want them all */
 	seq_image_filter filtering_criterion;
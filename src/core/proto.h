@@ -157,6 +157,7 @@ int off(fits *a, float level);
 double background(fits *fit, int reqlayer, rectangle *selection, gboolean multithread);
 void show_FITS_header(fits*);
 void compute_grey_flat(fits *fit);
+void compute_grey_flat_from_means(fits *fit, const float mean[4]);
 
 /****************** seqfile.h ******************/
 sequence* readseqfile(const char *name);
@@ -392,11 +392,16 @@ void show_FITS_header(fits *fit) {
 
 void compute_grey_flat(fits *fit) {
 	float mean[4];
-	float diag1, diag2, coeff1, coeff2;
-	int config;
 
 	/* compute means of 4 channels */
 	compute_means_from_flat_cfa(fit, mean);
+	compute_grey_flat_from_means(fit, mean);
+}
+
+/* equalizes the CFA channels of the flat, given the means of its 4 channels */
+void compute_grey_flat_from_means(fits *fit, const float mean[4]) {
+	float diag1, diag2, coeff1, coeff2;
+	int config;
 
 	/* compute coefficients */
 
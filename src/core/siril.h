@@ -293,9 +293,18 @@ struct imdata {
 	GDateTime *date_obs;/* date of the observation, processed and copied from the header */
 };
 
+typedef struct Homo {
+	double h00, h01, h02;
+	double h10, h11, h12;
+	double h20, h21, h22;
+	int pair_matched;
+	int Inliers;
+} Homography;
+
 /* registration data, exists once for each image and each layer */
 struct registration_data {
 	float shiftx, shifty;	// we could have a subpixel precision, but is it needed? saved
+	Homography H;		// full transformation to the reference frame, h22 == 0 when unset, saved
 	psf_star *fwhm_data;	// used in PSF/FWHM registration, not saved
 	float fwhm;		// copy of fwhm->fwhmx, used as quality indicator, saved data
 	float weighted_fwhm; // used to exclude spurious images.
@@ -540,6 +549,7 @@ struct star_finder_struct {
 	gboolean adjust;
 	double sigma;
 	double roundness;
+	gboolean fast_fit;	// fit candidates with psf_fast_minimisation(), enough for registration
 };
 
 struct save_config_struct {
@@ -723,14 +733,6 @@ struct image_stats {
 	atomic_int* _nb_refs;	// reference counting for data management
 };
 
-typedef struct Homo {
-	double h00, h01, h02;
-	double h10, h11, h12;
-	double h20, h21, h22;
-	int pair_matched;
-	int Inliers;
-} Homography;
-
 #if 0
 /* TODO: this structure aims to allow the composition of several 1-channel images and make
  * more easy the management of RGB compositing */
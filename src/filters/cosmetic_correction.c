@@ -39,20 +39,36 @@
 #include "algos/statistics.h"
 #include "algos/sorting.h"
 #include "algos/median_fast.h"
-#include "filters/median.h"
 #include "opencv/opencv.h"
 
 #include "cosmetic_correction.h"
 
-/* see also getMedian3x3 in algos/PSF.c */
-static float getMedian5x5_float(float *buf, const int xx, const int yy, const int w,
-		const int h, gboolean is_cfa) {
+static inline float pixel_value(const WORD *buf, const float *fbuf, size_t i) {
+	return fbuf ? fbuf[i] : (float) buf[i];
+}
+
+/* median of the 5x5 neighbours of the same CFA colour, centre excluded, using
+ * the median24 sorting network when the window is inside the image.
+ * see also getMedian3x3 in algos/PSF.c */
+static float get_median_neighbours(const WORD *buf, const float *fbuf,
+		const int xx, const int yy, const int w, const int h, gboolean is_cfa) {
 
 	const int step = is_cfa ? 2 : 1;
 	const int radius = 2 * step;
 
 	int n = 0;
 	float value[24];
+	if (yy >= radius && yy < h - radius && xx >= radius && xx < w - radius) {
+		for (int y = yy - radius; y <= yy + radius; y += step) {
+			for (int x = xx - radius; x <= xx + radius; x += step) {
+				if (x != xx || y != yy) {
+					value[n++] = pixel_value(buf, fbuf, x + (size_t) y * w);
+				}
+			}
+		}
+		return median24(value);
+	}
+
 	for (int y = yy - radius; y <= yy + radius; y += step) {
 		if (y >= 0 && y < h) {
 			for (int x = xx - radius; x <= xx + radius; x += step) {
@@ -60,7 +76,7 @@ static float getMedian5x5_float(float *buf, const int xx, const int yy, const in
 					// ^ limit to image bounds ^
 					// exclude centre pixel v
 					if (x != xx || y != yy) {
-						value[n++] = buf[x + y * w];
+						value[n++] = pixel_value(buf, fbuf, x + (size_t) y * w);
 					}
 				}
 			}
@@ -69,6 +85,28 @@ static float getMedian5x5_float(float *buf, const int xx, const int yy, const in
 	return quickmedian_float(value, n);
 }
 
+/* average of the 3x3 neighbours of the same CFA colour, centre excluded */
+static float get_average_neighbours(const WORD *buf, const float *fbuf,
+		const int xx, const int yy, const int w, const int h, gboolean is_cfa) {
+
+	const int step = is_cfa ? 2 : 1;
+	const int radius = step;
+
+	int n = 0;
+	float value = 0.f;
+	for (int y = yy - radius; y <= yy + radius; y += step) {
+		if (y >= 0 && y < h) {
+			for (int x = xx - radius; x <= xx + radius; x += step) {
+				if (x >= 0 && x < w && (x != xx || y != yy)) {
+					value += pixel_value(buf, fbuf, x + (size_t) y * w);
+					n++;
+				}
+			}
+		}
+	}
+	return value / n;
+}
+
 static WORD* getAverage3x3Line(WORD *buf, const int yy, const int w,
 		const int h, gboolean is_cfa) {
 	int step, radius, x, xx, y;
@@ -127,64 +165,14 @@ static float* getAverage3x3Line_float(float *buf, const int yy, const int w,
 	return cpyline;
 }
 
-static float getAverage3x3_float(float *buf, const int xx, const int yy,
-		const int w, const int h, gboolean is_cfa) {
-
-    const int step = is_cfa ? 2 : 1;
-    const int radius = step;
-
-    int n = -1;
-    float value = -buf[xx + yy * w];
-    for (int y = yy - radius; y <= yy + radius; y += step) {
-        if (y >= 0 && y < h) {
-            for (int x = xx - radius; x <= xx + radius; x += step) {
-                if (x >= 0 && x < w) {
-                    value += buf[x + y * w];
-                    n++;
-                }
-            }
-        }
-    }
-    return value / n;
-}
-
-static float getAverage3x3_ushort(WORD *buf, const int xx, const int yy,
-		const int w, const int h, gboolean is_cfa) {
-	int step, radius, x, y;
-	float value = 0.f;
-
-	if (is_cfa)
-		step = radius = 2;
-	else
-		step = radius = 1;
-
-	int n = 0;
-	for (y = yy - radius; y <= yy + radius; y += step) {
-		for (x = xx - radius; x <= xx + radius; x += step) {
-			if (y >= 0 && y < h) {
-				if (x >= 0 && x < w) {
-					if ((x != xx) || (y != yy)) {
-						value += (float) buf[x + y * w];
-						n++;
-					}
-				}
-			}
-		}
-	}
-	return value / n;
-}
-
 /* Gives a list of point p containing deviant pixel coordinates, to be freed by
- * caller.
+ * caller. The pixels are sorted by row then column.
  * If eval_only is true, the function only counts the deviant pixels and
  * returns NULL. It also returns NULL when no deviant pixel is found.
  * If cold == -1 or hot == -1, this is a flag to not compute cold or hot
  */
 deviant_pixel* find_deviant_pixels(fits *fit, double sig[2], long *icold,
 		long *ihot, gboolean eval_only) {
-	int x, y;
-	WORD *buf;
-	float *fbuf;
 	imstats *stat;
 	double sigma, median;
 	float thresHot, thresCold;
@@ -193,7 +181,7 @@ deviant_pixel* find_deviant_pixels(fits *fit, double sig[2], long *icold,
 	if (sig[0] == -1.0 && sig[1] == -1.0)
 		return NULL;
 
-	stat = statistics(NULL, -1, fit, RLAYER, NULL, STATS_BASIC, FALSE);
+	stat = statistics(NULL, -1, fit, RLAYER, NULL, STATS_BASIC, TRUE);
 	if (!stat) {
 		siril_log_message(_("Error: statistics computation failed.\n"));
 		return NULL;
@@ -216,36 +204,63 @@ deviant_pixel* find_deviant_pixels(fits *fit, double sig[2], long *icold,
 
 	free_stats(stat);
 
-	/** First we count deviant pixels **/
-	*icold = 0;
-	*ihot = 0;
-	buf = fit->pdata[RLAYER];
-	fbuf = fit->fpdata[RLAYER];
-	size_t i, nbpix = fit->naxes[0] * fit->naxes[1];
-	for (i = 0; i < nbpix; i++) {
-		float pixel = fit->type == DATA_FLOAT ? fbuf[i] : (float) buf[i];
-		if (pixel >= thresHot)
-			(*ihot)++;
-		else if (pixel <= thresCold)
-			(*icold)++;
+	/** First we count deviant pixels, row by row **/
+	const int width = fit->rx;
+	const int height = fit->ry;
+	const WORD *buf = fit->type == DATA_USHORT ? fit->pdata[RLAYER] : NULL;
+	const float *fbuf = fit->type == DATA_FLOAT ? fit->fpdata[RLAYER] : NULL;
+	long *row_start = malloc((height + 1) * sizeof(long));
+	if (!row_start) {
+		PRINT_ALLOC_ERR;
+		return NULL;
 	}
+	long nb_cold = 0L, nb_hot = 0L;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static) reduction(+:nb_cold, nb_hot)
+#endif
+	for (int y = 0; y < height; y++) {
+		const size_t row = (size_t) y * width;
+		long row_cold = 0L, row_hot = 0L;
+		for (int x = 0; x < width; x++) {
+			float pixel = pixel_value(buf, fbuf, row + x);
+			if (pixel >= thresHot)
+				row_hot++;
+			else if (pixel <= thresCold)
+				row_cold++;
+		}
+		row_start[y + 1] = row_cold + row_hot;
+		nb_cold += row_cold;
+		nb_hot += row_hot;
+	}
+	*icold = nb_cold;
+	*ihot = nb_hot;
 
-	if (eval_only) return NULL;
-
-	/** Second we store deviant pixels in p */
-	int n = (*icold) + (*ihot);
-	if (n <= 0)
+	/** Second we store deviant pixels in p, each row at its offset */
+	long n = nb_cold + nb_hot;
+	if (eval_only || n <= 0) {
+		free(row_start);
 		return NULL;
+	}
 	dev = malloc(n * sizeof(deviant_pixel));
 	if (!dev) {
 		PRINT_ALLOC_ERR;
+		free(row_start);
 		return NULL;
 	}
-	i = 0;
-	for (y = 0; y < fit->ry; y++) {
-		for (x = 0; x < fit->rx; x++) {
-			float pixel = fit->type == DATA_FLOAT ?
-							fbuf[x + y * fit->rx] : (float) buf[x + y * fit->rx];
+	row_start[0] = 0L;
+	for (int y = 0; y < height; y++)
+		row_start[y + 1] += row_start[y];
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static)
+#endif
+	for (int y = 0; y < height; y++) {
+		const size_t row = (size_t) y * width;
+		long i = row_start[y];
+		if (i == row_start[y + 1])
+			continue;
+		for (int x = 0; x < width; x++) {
+			float pixel = pixel_value(buf, fbuf, row + x);
 			if (pixel >= thresHot) {
 				dev[i].p.x = x;
 				dev[i].p.y = y;
@@ -259,35 +274,37 @@ deviant_pixel* find_deviant_pixels(fits *fit, double sig[2], long *icold,
 			}
 		}
 	}
+	free(row_start);
 	return dev;
 }
 
-int cosmeticCorrOnePoint(fits *fit, deviant_pixel dev, gboolean is_cfa) {
+/* new value of a deviant pixel computed from its neighbours: their median for
+ * a cold pixel, their average for a hot one */
+static float get_corrected_value(fits *fit, deviant_pixel dev, gboolean is_cfa) {
 	// Cosmetic correction, as developed here, is only used on 1-channel images
-	int width = fit->rx;
-	int height = fit->ry;
+	const WORD *buf = fit->type == DATA_USHORT ? fit->pdata[RLAYER] : NULL;
+	const float *fbuf = fit->type == DATA_FLOAT ? fit->fpdata[RLAYER] : NULL;
 	int x = (int) dev.p.x;
 	int y = (int) dev.p.y;
 
+	if (dev.type == COLD_PIXEL)
+		return get_median_neighbours(buf, fbuf, x, y, fit->rx, fit->ry, is_cfa);
+	return get_average_neighbours(buf, fbuf, x, y, fit->rx, fit->ry, is_cfa);
+}
+
+static void set_corrected_value(fits *fit, deviant_pixel dev, float value) {
+	size_t i = (int) dev.p.x + (size_t) ((int) dev.p.y) * fit->rx;
+
 	if (fit->type == DATA_USHORT) {
-		WORD *buf = fit->pdata[RLAYER];
-		WORD newpixel;
-		if (dev.type == COLD_PIXEL)
-			newpixel = get_median_ushort(buf, x, y, width, height, 2, is_cfa,
-					FALSE);
-		else
-			newpixel = round_to_WORD(getAverage3x3_ushort(buf, x, y, width, height, is_cfa));
-		buf[x + y * fit->rx] = newpixel;
+		fit->pdata[RLAYER][i] = dev.type == COLD_PIXEL ?
+				(WORD) value : round_to_WORD(value);
 	} else if (fit->type == DATA_FLOAT) {
-		float *buf = fit->fpdata[RLAYER];
-		float newpixel;
-		if (dev.type == COLD_PIXEL)
-			newpixel = get_median_float(buf, x, y, width, height, 2, is_cfa,
-					FALSE);
-		else
-			newpixel = getAverage3x3_float(buf, x, y, width, height, is_cfa);
-		buf[x + y * fit->rx] = newpixel;
+		fit->fpdata[RLAYER][i] = value;
 	}
+}
+
+int cosmeticCorrOnePoint(fits *fit, deviant_pixel dev, gboolean is_cfa) {
+	set_corrected_value(fit, dev, get_corrected_value(fit, dev, is_cfa));
 
 	// the caller should call invalidate_stats_from_fit(fit);
 	return 0;
@@ -326,14 +343,159 @@ int cosmeticCorrOneLine(fits *fit, deviant_pixel dev, gboolean is_cfa) {
 	return 1;
 }
 
+/* All new values are computed from the uncorrected image before being
+ * written, so that the deviant pixels can be processed in parallel and the
+ * result does not depend on their order. */
 int cosmeticCorrection(fits *fit, deviant_pixel *dev, int size, gboolean is_cfa) {
-	for (int i = 0; i < size; i++) {
-		cosmeticCorrOnePoint(fit, dev[i], is_cfa);
+	if (size <= 0)
+		return 0;
+	float *values = malloc(size * sizeof(float));
+	if (!values) {
+		PRINT_ALLOC_ERR;
+		return 1;
 	}
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static) if(size > 1000)
+#endif
+	for (int i = 0; i < size; i++)
+		values[i] = get_corrected_value(fit, dev[i], is_cfa);
+
+	for (int i = 0; i < size; i++)
+		set_corrected_value(fit, dev[i], values[i]);
+	free(values);
 	invalidate_stats_from_fit(fit);
 	return 0;
 }
 
+/* Saves the deviant pixels in a list file, using the format of the cosme
+ * files. It can be loaded with load_deviant_pixels() to calibrate images
+ * without detecting them again in the master dark. */
+int save_deviant_pixels(const char *filename, deviant_pixel *dev, long nb, int ry) {
+	GError *error = NULL;
+	GFile *file = g_file_new_for_path(filename);
+	GOutputStream *output_stream = (GOutputStream*) g_file_replace(file, NULL, FALSE,
+			G_FILE_CREATE_NONE, NULL, &error);
+
+	if (output_stream == NULL) {
+		if (error != NULL) {
+			g_warning("%s\n", error->message);
+			g_clear_error(&error);
+			fprintf(stderr, "Cannot open file: %s\n", filename);
+		}
+		g_object_unref(file);
+		return 1;
+	}
+
+	for (long i = 0; i < nb; i++) {
+		int y = ry - (int) dev[i].p.y - 1;  /* FITS is stored bottom to top */
+		gchar type = dev[i].type == HOT_PIXEL ? 'H' : 'C';
+		gchar *buffer = g_strdup_printf("P %d %d %c\n", (int) dev[i].p.x, y, type);
+		if (!g_output_stream_write_all(output_stream, buffer, strlen(buffer), NULL, NULL, &error)) {
+			g_warning("%s\n", error->message);
+			g_free(buffer);
+			g_clear_error(&error);
+			g_object_unref(output_stream);
+			g_object_unref(file);
+			return 1;
+		}
+		g_free(buffer);
+	}
+
+	g_object_unref(output_stream);
+	g_object_unref(file);
+	return 0;
+}
+
+static int compare_deviant_pixels(const void *a, const void *b) {
+	const deviant_pixel *da = (const deviant_pixel *) a;
+	const deviant_pixel *db = (const deviant_pixel *) b;
+	if (da->p.y != db->p.y)
+		return da->p.y < db->p.y ? -1 : 1;
+	if (da->p.x != db->p.x)
+		return da->p.x < db->p.x ? -1 : 1;
+	return 0;
+}
+
+/* Loads the pixels of a list file written by find_hot or save_deviant_pixels()
+ * for images of size rx x ry, sorted by row then column like the list of
+ * find_deviant_pixels(). Lines and columns of cosme files are not supported
+ * in this list and are ignored. Returns NULL on error or if there is no
+ * pixel, icold and ihot being set to 0 in this case. */
+deviant_pixel *load_deviant_pixels(const char *filename, int rx, int ry,
+		long *icold, long *ihot) {
+	GError *error = NULL;
+	GFile *file = g_file_new_for_path(filename);
+	GInputStream *input_stream = (GInputStream *)g_file_read(file, NULL, &error);
+	deviant_pixel *dev = NULL;
+	long nb = 0, alloc = 0, nb_cold = 0;
+	int i = 0, ignored = 0;
+	gchar *line;
+
+	*icold = 0L;
+	*ihot = 0L;
+	if (input_stream == NULL) {
+		if (error != NULL) {
+			g_clear_error(&error);
+			siril_log_message(_("File [%s] does not exist\n"), filename);
+		}
+		g_object_unref(file);
+		return NULL;
+	}
+
+	GDataInputStream *data_input = g_data_input_stream_new(input_stream);
+	while ((line = g_data_input_stream_read_line_utf8(data_input, NULL,
+				NULL, NULL))) {
+		double x, y;
+		char type = 'H';
+		++i;
+		if (line[0] != 'P') {
+			if (line[0] != '#' && line[0] != '\0')
+				ignored++;
+			g_free(line);
+			continue;
+		}
+		int nb_tokens = sscanf(line + 2, "%lf %lf %c", &x, &y, &type);
+		if ((nb_tokens != 2 && nb_tokens != 3) || x < 0 || x >= rx || y < 0 || y >= ry) {
+			siril_log_message(_("Bad pixel list format error at line %d: %s\n"), i, line);
+			g_free(line);
+			continue;
+		}
+		g_free(line);
+		if (nb == alloc) {
+			alloc = alloc ? alloc * 2 : 1024;
+			deviant_pixel *tmp = realloc(dev, alloc * sizeof(deviant_pixel));
+			if (!tmp) {
+				PRINT_ALLOC_ERR;
+				free(dev);
+				dev = NULL;
+				nb = 0;
+				break;
+			}
+			dev = tmp;
+		}
+		dev[nb].p.x = (int) x;
+		dev[nb].p.y = ry - (int) y - 1;  /* FITS are stored bottom to top */
+		dev[nb].type = type == 'C' ? COLD_PIXEL : HOT_PIXEL;
+		if (dev[nb].type == COLD_PIXEL)
+			nb_cold++;
+		nb++;
+	}
+	g_object_unref(data_input);
+	g_object_unref(input_stream);
+	g_object_unref(file);
+
+	if (ignored)
+		siril_log_message(_("%d lines or columns of the bad pixel list were ignored\n"), ignored);
+	if (nb == 0) {
+		free(dev);
+		return NULL;
+	}
+	qsort(dev, nb, sizeof(deviant_pixel), compare_deviant_pixels);
+	*icold = nb_cold;
+	*ihot = nb - nb_cold;
+	return dev;
+}
+
 /**** Autodetect *****/
 int cosmetic_image_hook(struct generic_seq_args *args, int o, int i, fits *fit,
 		rectangle *_) {
@@ -575,103 +737,82 @@ int autoDetect(fits *fit, int layer, double sig[2], long *icold, long *ihot,
 	const gboolean doCold = sig[0] != -1.0;
 	const float coldVal = doCold ? bkg - k : 0.0;
 	const float hotVal = doHot ? bkg + k1 : isFloat ? 1.f : 65535.f;
-	size_t n = fit->naxes[0] * fit->naxes[1] * sizeof(float); 
-	float *temp = malloc(n);
-	if (!temp) {
-		PRINT_ALLOC_ERR;
-		return 1;
-	}
-
 #ifndef _OPENMP
 	multithread = FALSE;
 #endif
 	if (com.max_thread == 1)
 		multithread = FALSE;
 
-	if (isFloat) {
-		if (multithread) {
-#ifdef _OPENMP
-#pragma omp parallel for num_threads(com.max_thread) if(multithread)
-#endif
-			for (int y = 0; y < height; y++) {
-				for (int x = 0; x < width; x++) {
-					temp[y * width + x] = fbuf[y * width + x];
-				}
-			}
-		} else {
-			// this should be faster in a single-threaded case
-			memcpy(temp, fbuf, width * height * sizeof(float));
-		}
-	} else {
-#ifdef _OPENMP
-#pragma omp parallel for num_threads(com.max_thread) if(multithread)
-#endif
-		for (int y = 0; y < height; y++) {
-			for (int x = 0; x < width; x++) {
-				temp[y * width + x] = (float) buf[y * width + x];
-			}
-		}
-	}
-	const int step = is_cfa ? 2 : 1;
-	const int radius = 2 * step;
+	const WORD *rbuf = isFloat ? NULL : buf;
+	const float *rfbuf = isFloat ? fbuf : NULL;
 
 	long icoldL = *icold;
 	long ihotL = *ihot;
+	gboolean alloc_error = FALSE;
 #ifdef _OPENMP
 #pragma omp parallel num_threads(com.max_thread) if(multithread)
 #endif
 	{
-		float medianin[24];
+		/* corrections are kept in a list of the thread and applied once
+		 * all threads have finished the detection on the original image */
+		struct { size_t index; float value; } *corr = NULL;
+		size_t nb_corr = 0, alloc_corr = 0;
 #ifdef _OPENMP
 #pragma omp for reduction(+:icoldL, ihotL) schedule(dynamic,16)
 #endif
 		for (int y = 0; y < height; y++) {
 			for (int x = 0; x < width; x++) {
-				const float pixel = temp[x + y * width];
+				const size_t index = x + (size_t) y * width;
+				const float pixel = pixel_value(rbuf, rfbuf, index);
 				if (!inInterval(pixel, coldVal, hotVal)) {
-					float m;
-					if (y >= radius && y < height - radius && x >= radius && x < width - radius) {
-						// use fast median24 network
-						int nbm = 0;
-						for (int i = -radius; i <= radius; i += step) {
-							for (int j = -radius; j <= radius; j += step) {
-								if (i != 0 || j != 0) {
-									medianin[nbm++] = temp[(y + i) * width + x + j];
-								}
-							}
-						}
-						m = median24(medianin);
-					} else {
-						m = getMedian5x5_float(temp, x, y, width, height, is_cfa);
-					}
+					const float m = get_median_neighbours(rbuf, rfbuf, x, y, width, height, is_cfa);
+					float value;
 
 					/* Hot autodetect */
 					if (doHot && pixel > hotVal && pixel > m + k4) {
-						const float a = getAverage3x3_float(temp, x, y, width, height, is_cfa);
-						if (a < m + k2) {
-							ihotL++;
-							if (isFloat) {
-								fbuf[x + y * width] = a * f0 + pixel * f1;
-							} else {
-								buf[x + y * width] = a * f0 + pixel * f1;
-							}
-						}
+						const float a = get_average_neighbours(rbuf, rfbuf, x, y, width, height, is_cfa);
+						if (a >= m + k2)
+							continue;
+						ihotL++;
+						value = a * f0 + pixel * f1;
 					} else if (doCold && pixel < coldVal && pixel + k < m) {
 						/* Cold autodetect */
 						icoldL++;
-						if (isFloat) {
-							fbuf[x + y * width] = m * f0 + pixel * f1;
-						} else {
-							buf[x + y * width] = m * f0 + pixel * f1;
+						value = m * f0 + pixel * f1;
+					} else continue;
+
+					if (nb_corr == alloc_corr) {
+						alloc_corr = alloc_corr ? alloc_corr * 2 : 1024;
+						void *tmp = realloc(corr, alloc_corr * sizeof(*corr));
+						if (!tmp) {
+							alloc_error = TRUE;
+							alloc_corr = nb_corr;
+							continue;
 						}
+						corr = tmp;
 					}
+					corr[nb_corr].index = index;
+					corr[nb_corr].value = value;
+					nb_corr++;
 				}
 			}
 		}
+		// implicit barrier of the omp for: the detection is complete
+		for (size_t i = 0; i < nb_corr; i++) {
+			if (isFloat) {
+				fbuf[corr[i].index] = corr[i].value;
+			} else {
+				buf[corr[i].index] = corr[i].value;
+			}
+		}
+		free(corr);
 	}
 	(*icold) = icoldL;
 	(*ihot) = ihotL;
-	free(temp);
+	if (alloc_error) {
+		PRINT_ALLOC_ERR;
+		return 1;
+	}
 
 	invalidate_stats_from_fit(fit);
 	return 0;
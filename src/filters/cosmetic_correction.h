@@ -35,6 +35,8 @@ struct deviant_struct {
 };
 
 deviant_pixel *find_deviant_pixels(fits *fit, double sig[2], long *icold, long *ihot, gboolean eval_only);
+int save_deviant_pixels(const char *filename, deviant_pixel *dev, long nb, int ry);
+deviant_pixel *load_deviant_pixels(const char *filename, int rx, int ry, long *icold, long *ihot);
 int autoDetect(fits *fit, int layer, double sig[2], long *icold, long *ihot,
 		double amount, gboolean is_cfa, gboolean multithread);
 void apply_cosmetic_to_sequence(struct cosmetic_data *cosme_args);
@@ -1667,12 +1667,15 @@ void on_min_entry_changed(GtkEditable *editable, gpointer user_data) {
 	}
 }
 
+/* also used for the regNoOutput toggle: neither creates a new sequence */
 void on_regTranslationOnly_toggled(GtkToggleButton *togglebutton, gpointer user_data) {
 	GtkWidget *Algo = lookup_widget("ComboBoxRegInter");
 	GtkWidget *Prefix = lookup_widget("regseqname_entry");
+	gboolean no_sequence = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(lookup_widget("regTranslationOnly")))
+		|| gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(lookup_widget("regNoOutput")));
 
-	gtk_widget_set_sensitive(Algo, !gtk_toggle_button_get_active(togglebutton));
-	gtk_widget_set_sensitive(Prefix, !gtk_toggle_button_get_active(togglebutton));
+	gtk_widget_set_sensitive(Algo, !no_sequence);
+	gtk_widget_set_sensitive(Prefix, !no_sequence);
 }
 
 void on_seqproc_entry_changed(GtkComboBox *widget, gpointer user_data) {
@@ -317,9 +317,10 @@ void on_spinbut_shift_value_change(GtkSpinButton *spinbutton, gpointer user_data
 	}
 
 	new_value = gtk_spin_button_get_value_as_int(spinbutton);
+	regdata *reg = &com.seq.regparam[current_layer][com.seq.current];
 	if (spinbutton == spin_shiftx)
-		com.seq.regparam[current_layer][com.seq.current].shiftx = (float) new_value;
-	else com.seq.regparam[current_layer][com.seq.current].shifty = (float) new_value;
+		set_shifts(&com.seq, com.seq.current, current_layer, (float) new_value, reg->shifty, FALSE);
+	else set_shifts(&com.seq, com.seq.current, current_layer, reg->shiftx, (float) new_value, FALSE);
 	writeseqfile(&com.seq);
 	update_seqlist();
 	fill_sequence_list(&com.seq, current_layer, FALSE);	// update list with new regparam
@@ -48,8 +48,10 @@
  * version 1 introduced roundness in regdata, 0.9.9
  * version 2 allowed regdata to be stored for CFA SER sequences, 0.9.11
  * version 3 introduced new weighted fwhm criteria, 0.99.0
+ * version 4 introduced the optional homography in regdata, for registration
+ * 	without output sequence
  */
-#define CURRENT_SEQFILE_VERSION 3	// to increment on format change
+#define CURRENT_SEQFILE_VERSION 4	// to increment on format change
 
 /* File format (lines starting with # are comments, lines that are (for all
  * something) need to be in all in sequence of this only type of line):
@@ -57,12 +59,27 @@
  * S sequence_name beg number selnum fixed reference_image [version]
  * L nb_layers
  * (for all images) I filenum incl [stats+] <- stats added at some point, removed in 0.9.9
- * (for all layers (x)) Rx regparam+
+ * (for all layers (x)) Rx regparam+ [homography]
  * TS | TA | TF (type for ser or film (avi) or fits)
  * U up-scale_ratio
  * (for all images (y) and layers (x)) Mx-y stats+
  */
 
+/* the homography is written only if it was computed, the line is then
+ * readable only by version 4 and later */
+static void write_regdata_line(FILE *seqfile, char layer, regdata *reg) {
+	fprintf(seqfile, "R%c %f %f %g %g %g %g", layer,
+			reg->shiftx, reg->shifty, reg->fwhm,
+			reg->weighted_fwhm, reg->roundness, reg->quality);
+	if (reg->H.h22 != 0.0) {
+		Homography *H = &reg->H;
+		fprintf(seqfile, " %.12g %.12g %.12g %.12g %.12g %.12g %.12g %.12g %.12g",
+				H->h00, H->h01, H->h02, H->h10, H->h11, H->h12,
+				H->h20, H->h21, H->h22);
+	}
+	fputc('\n', seqfile);
+}
+
 /* name is sequence filename, with or without .seq extension
  * It should always be used with seq_check_basic_data() because on first loading
  * of a .seq that was created from scan of the filesystem, number of layers and
@@ -289,17 +306,24 @@ sequence * readseqfile(const char *name){
 						goto error;
 					}
 				} else {
-					// version 3 with weighted_fwhm
-					if (sscanf(line+3, "%f %f %g %g %g %lg",
+					// version 3 with weighted_fwhm, version 4 with optional homography
+					Homography *H = &regparam[i].H;
+					nb_tokens = sscanf(line+3, "%f %f %g %g %g %lg %lg %lg %lg %lg %lg %lg %lg %lg %lg",
 								&(regparam[i].shiftx),
 								&(regparam[i].shifty),
 								&(regparam[i].fwhm),
 								&(regparam[i].weighted_fwhm),
 								&(regparam[i].roundness),
-								&(regparam[i].quality)) != 6) {
+								&(regparam[i].quality),
+								&H->h00, &H->h01, &H->h02,
+								&H->h10, &H->h11, &H->h12,
+								&H->h20, &H->h21, &H->h22);
+					if (nb_tokens != 6 && (nb_tokens != 15 || version < 4)) {
 						fprintf(stderr,"readseqfile: sequence file format error: %s\n",line);
 						goto error;
 					}
+					if (nb_tokens == 6)
+						memset(H, 0, sizeof(Homography));
 				}
 				++i;
 				break;
@@ -578,15 +602,8 @@ int writeseqfile(sequence *seq){
 	for (layer = 0; layer < seq->nb_layers; layer++) {
 		if (seq->regparam[layer]) {
 			for (i=0; i < seq->number; ++i) {
-				fprintf(seqfile, "R%c %f %f %g %g %g %g\n",
-						seq->cfa_opened_monochrome ? '*' : '0' + layer,
-						seq->regparam[layer][i].shiftx,
-						seq->regparam[layer][i].shifty,
-						seq->regparam[layer][i].fwhm,
-						seq->regparam[layer][i].weighted_fwhm,
-						seq->regparam[layer][i].roundness,
-						seq->regparam[layer][i].quality
-				       );
+				write_regdata_line(seqfile, seq->cfa_opened_monochrome ? '*' : '0' + layer,
+						&seq->regparam[layer][i]);
 			}
 		}
 		if (seq->stats && seq->stats[layer]) {
@@ -616,15 +633,8 @@ int writeseqfile(sequence *seq){
 	for (layer = 0; layer < 3; layer++) {
 		if (seq->regparam_bkp && seq->regparam_bkp[layer]) {
 			for (i=0; i < seq->number; ++i) {
-				fprintf(seqfile, "R%c %f %f %g %g %g %g\n",
-						seq->cfa_opened_monochrome ? '0' + layer : '*',
-						seq->regparam_bkp[layer][i].shiftx,
-						seq->regparam_bkp[layer][i].shifty,
-						seq->regparam_bkp[layer][i].fwhm,
-						seq->regparam_bkp[layer][i].weighted_fwhm,
-						seq->regparam_bkp[layer][i].roundness,
-						seq->regparam_bkp[layer][i].quality
-				       );
+				write_regdata_line(seqfile, seq->cfa_opened_monochrome ? '0' + layer : '*',
+						&seq->regparam_bkp[layer][i]);
 			}
 		}
 		if (seq->stats_bkp && seq->stats_bkp[layer]) {
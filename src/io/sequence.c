@@ -685,6 +685,13 @@ char *seq_get_image_filename(sequence *seq, int index, char *name_buf) {
  * Opens the file, reads data, closes the file.
  */
 int seq_read_frame(sequence *seq, int index, fits *dest, gboolean force_float, int thread_id) {
+	return seq_read_frame_layer(seq, index, dest, force_float, -1, thread_id);
+}
+
+/* same as seq_read_frame above, but CFA SER frames are only demosaiced in
+ * layer, for processing that only uses this one, giving a single-channel
+ * image. Other images are read entirely, layer -1 reads all layers. */
+int seq_read_frame_layer(sequence *seq, int index, fits *dest, gboolean force_float, int layer, int thread_id) {
 	char filename[256];
 	assert(index < seq->number);
 	switch (seq->type) {
@@ -698,7 +705,8 @@ int seq_read_frame(sequence *seq, int index, fits *dest, gboolean force_float, i
 			break;
 		case SEQ_SER:
 			assert(seq->ser_file);
-			if (ser_read_frame(seq->ser_file, index, dest, force_float, com.pref.debayer.open_debayer)) {
+			if (ser_read_frame(seq->ser_file, index, dest, force_float,
+					com.pref.debayer.open_debayer, layer)) {
 				siril_log_message(_("Could not load frame %d from SER sequence %s\n"),
 						index, seq->seqname);
 				return 1;
@@ -1369,11 +1377,68 @@ void check_or_allocate_regparam(sequence *seq, int layer) {
 }
 
 /* assign shift values for registration data of a sequence, depending on its type and sign */
+/* the shifts replace the transformation of the frame, if any */
 void set_shifts(sequence *seq, int frame, int layer, float shiftx, float shifty, gboolean data_is_top_down) {
 	if (seq->regparam[layer]) {
 		seq->regparam[layer][frame].shiftx = shiftx;
 		seq->regparam[layer][frame].shifty = data_is_top_down ? -shifty : shifty;
+		memset(&seq->regparam[layer][frame].H, 0, sizeof(Homography));
+	}
+}
+
+/* stores the transformation of a frame to the reference frame, computed on
+ * data of height ry, and the shifts of its translation part. It is stored as
+ * warp_image() uses it on data stored bottom-up: like for the shifts, the Y
+ * axis is flipped around it for top-down data */
+void set_transform(sequence *seq, int frame, int layer, Homography *H, int ry, gboolean data_is_top_down) {
+	if (!seq->regparam[layer])
+		return;
+	Homography T = *H;
+	if (data_is_top_down) {
+		/* F.H.F with F: y -> ry - 1 - y */
+		double c = ry - 1.0;
+		T.h01 = -H->h01;
+		T.h02 = H->h02 + c * H->h01;
+		T.h10 = -H->h10 + c * H->h20;
+		T.h11 = H->h11 - c * H->h21;
+		T.h12 = -H->h12 - c * H->h11 + c * (H->h22 + c * H->h21);
+		T.h20 = H->h20;
+		T.h21 = -H->h21;
+		T.h22 = H->h22 + c * H->h21;
+	}
+	set_shifts(seq, frame, layer, (float) T.h02, (float) -T.h12, FALSE);
+	seq->regparam[layer][frame].H = T;
+}
+
+/* gets the transformation of a frame to the reference frame of the sequence,
+ * as used by warp_image(): the homography if one was stored, the translation
+ * of the shifts otherwise */
+void seq_get_frame_transform(sequence *seq, int layer, int frame, Homography *H) {
+	regdata *reg = seq->regparam[layer] ? &seq->regparam[layer][frame] : NULL;
+	if (reg && reg->H.h22 != 0.0) {
+		*H = reg->H;
+		return;
 	}
+	memset(H, 0, sizeof(Homography));
+	H->h00 = H->h11 = H->h22 = 1.0;
+	if (reg) {
+		H->h02 = reg->shiftx;
+		H->h12 = -reg->shifty;
+	}
+}
+
+/* returns TRUE if the frame needs to be warped to be aligned, FALSE if its
+ * shifts are enough */
+gboolean seq_frame_needs_warp(sequence *seq, int layer, int frame) {
+	if (layer < 0 || !seq->regparam || !seq->regparam[layer])
+		return FALSE;
+	Homography *H = &seq->regparam[layer][frame].H;
+	if (H->h22 == 0.0)
+		return FALSE;
+	const double eps = 1e-9;
+	return fabs(H->h00 / H->h22 - 1.0) > eps || fabs(H->h01 / H->h22) > eps
+		|| fabs(H->h10 / H->h22) > eps || fabs(H->h11 / H->h22 - 1.0) > eps
+		|| fabs(H->h20) > eps || fabs(H->h21) > eps;
 }
 
 /* internal sequence are a set of 1-layer images already loaded elsewhere, and
@@ -14,6 +14,7 @@ int	seq_check_basic_data(sequence *seq, gboolean load_ref_into_gfit);
 int	set_seq(const char *);
 char *	seq_get_image_filename(sequence *seq, int index, char *name_buf);
 int	seq_read_frame(sequence *seq, int index, fits *dest, gboolean force_float, int thread_id);
+int	seq_read_frame_layer(sequence *seq, int index, fits *dest, gboolean force_float, int layer, int thread_id);
 int	seq_read_frame_part(sequence *seq, int layer, int index, fits *dest, const rectangle *area, gboolean do_photometry, int thread_id);
 int	seq_load_image(sequence *seq, int index, gboolean load_it);
 int64_t seq_compute_size(sequence *seq, int nb_frames, data_type type);
@@ -56,6 +57,9 @@ struct seqpsf_data {
 int	sequence_find_refimage(sequence *seq);
 void	check_or_allocate_regparam(sequence *seq, int layer);
 void	set_shifts(sequence *seq, int frame, int layer, float shiftx, float shifty, gboolean data_is_top_down);
+void	set_transform(sequence *seq, int frame, int layer, Homography *H, int ry, gboolean data_is_top_down);
+void	seq_get_frame_transform(sequence *seq, int layer, int frame, Homography *H);
+gboolean seq_frame_needs_warp(sequence *seq, int layer, int frame);
 sequence *create_internal_sequence(int size);
 void	internal_sequence_set(sequence *seq, int index, fits *fit);
 int	internal_sequence_find_index(sequence *seq, fits *fit);
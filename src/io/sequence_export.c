@@ -39,6 +39,7 @@
 #include "io/mp4_output.h"
 #endif
 #include "algos/geometry.h"
+#include "algos/warp.h"
 
 /* same order as in the combo box 'combo_export_preset' */
 typedef enum {
@@ -325,6 +326,19 @@ static gpointer export_sequence(gpointer ptr) {
 			goto free_and_reset_progress_bar;
 		}
 
+		/* transformations stored without registered sequence are applied
+		 * now, the shifts below are then zero */
+		if (reglayer != -1 && seq_frame_needs_warp(args->seq, reglayer, i)) {
+			Homography H;
+			seq_get_frame_transform(args->seq, reglayer, i, &H);
+			if (warp_image(&fit, fit.rx, fit.ry, &H, FALSE, WARP_DEFAULT_INTERPOLATION)) {
+				clearfits(&fit);
+				seqwriter_release_memory();
+				retval = -1;
+				goto free_and_reset_progress_bar;
+			}
+		}
+
 		/* destfit is allocated to the full size. Data will be copied from fit,
 		 * image buffers are duplicated. It will be cropped after the copy if
 		 * needed */
@@ -391,7 +405,8 @@ static gpointer export_sequence(gpointer ptr) {
 
 		int shiftx, shifty;
 		/* load registration data for current image */
-		if (reglayer != -1 && args->seq->regparam[reglayer]) {
+		if (reglayer != -1 && args->seq->regparam[reglayer]
+				&& !seq_frame_needs_warp(args->seq, reglayer, i)) {
 			shiftx = roundf_to_int(args->seq->regparam[reglayer][i].shiftx);
 			shifty = roundf_to_int(args->seq->regparam[reglayer][i].shifty);
 		} else {
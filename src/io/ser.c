@@ -701,8 +701,9 @@ int ser_metadata_as_fits(struct ser_struct *ser_file, fits *fit) {
 }
 
 /* reads a frame on an already opened SER sequence.
- * frame number starts at 0 */
-int ser_read_frame(struct ser_struct *ser_file, int frame_no, fits *fit, gboolean force_float, gboolean open_debayer) {
+ * frame number starts at 0. If layer is not -1, a CFA frame opened debayered
+ * is only interpolated in this layer, giving a single-channel image */
+int ser_read_frame(struct ser_struct *ser_file, int frame_no, fits *fit, gboolean force_float, gboolean open_debayer, int layer) {
 	int retval = 0, i, j, swap = 0;
 	gint64 offset, frame_size;
 	size_t read_size;
@@ -795,8 +796,8 @@ int ser_read_frame(struct ser_struct *ser_file, int frame_no, fits *fit, gboolea
 		fit->naxes[1] = fit->ry = ser_file->image_height;
 		fit->naxes[2] = 3;
 		/* Get Bayer informations from header if available */
-		sensor_pattern sensortmp;
-		sensortmp = com.pref.debayer.bayer_pattern;
+		sensor_pattern bayer_pattern;
+		bayer_pattern = com.pref.debayer.bayer_pattern;
 		if (com.pref.debayer.use_bayer_header) {
 			sensor_pattern bayer;
 			bayer = get_SER_Bayer_Pattern(type_ser);
@@ -810,16 +811,34 @@ int ser_read_frame(struct ser_struct *ser_file, int frame_no, fits *fit, gboolea
 								" from Bayer pattern in settings (%s). Overriding settings.\n"),
 								"salmon", filter_pattern[bayer], filter_pattern[com.pref.debayer.bayer_pattern]);
 					}
-					com.pref.debayer.bayer_pattern = bayer;
+					bayer_pattern = bayer;
 				}
 				user_warned = TRUE;
 			}
 		}
-		/* for performance consideration (and many others) we force the interpolation algorithm
-		 * to be BAYER_BILINEAR
-		 */
-		debayer(fit, BAYER_RCD, com.pref.debayer.bayer_pattern);
-		com.pref.debayer.bayer_pattern = sensortmp;
+		if (layer >= 0) {
+			/* processing that only uses one layer, like registration, gets
+			 * it with a bilinear interpolation of this layer only */
+			rectangle image_area = { 0, 0, fit->rx, fit->ry };
+			WORD *plane = malloc(frame_size * sizeof(WORD));
+			if (!plane) {
+				PRINT_ALLOC_ERR;
+				return -1;
+			}
+			if (debayer_plane_area(fit->data, fit->rx, fit->ry, bayer_pattern,
+						layer, &image_area, plane)) {
+				free(plane);
+				return -1;
+			}
+			free(fit->data);
+			fit->data = plane;
+			fit->naxis = 2;
+			fit->naxes[2] = 1;
+			fit->pdata[RLAYER] = fit->data;
+			fit->pdata[GLAYER] = fit->data;
+			fit->pdata[BLAYER] = fit->data;
+		}
+		else debayer(fit, BAYER_RCD, bayer_pattern);
 		break;
 	case SER_BGR:
 		swap = 2;
@@ -995,11 +1014,11 @@ static int read_area_from_image(struct ser_struct *ser_file, const int frame_no,
 /* read an area of an image in an opened SER sequence */
 int ser_read_opened_partial(struct ser_struct *ser_file, int layer,
 		int frame_no, WORD *buffer, const rectangle *area) {
-	int xoffset, yoffset, x, y;
+	int xoffset, yoffset;
 	ser_color type_ser;
-	WORD *rawbuf, *demosaiced_buf;
+	WORD *rawbuf;
 	rectangle debayer_area, image_area;
-	sensor_pattern sensortmp;
+	sensor_pattern pattern;
 
 	if (!ser_file || ser_file->file == NULL || frame_no < 0
 			|| frame_no >= ser_file->frame_count)
@@ -1022,12 +1041,11 @@ int ser_read_opened_partial(struct ser_struct *ser_file, int layer,
 	case SER_BAYER_GBRG:
 	case SER_BAYER_GRBG:
 		/* SER v2: RGB images obtained from demosaicing.
-		 * Original is monochrome, we demosaic it in an area slightly larger than the
-		 * requested area, giving 3 channels in form of RGBRGBRGB buffers, and finally
-		 * we extract one of the three channels and crop it to the requested area. */
+		 * Original is monochrome, we read an area slightly larger than the
+		 * requested area and interpolate only the requested channel in it. */
 
 		/* Get Bayer informations from header if available */
-		sensortmp = com.pref.debayer.bayer_pattern;
+		pattern = com.pref.debayer.bayer_pattern;
 		if (com.pref.debayer.use_bayer_header) {
 			sensor_pattern bayer;
 			bayer = get_SER_Bayer_Pattern(type_ser);
@@ -1041,7 +1059,7 @@ int ser_read_opened_partial(struct ser_struct *ser_file, int layer,
 								" from Bayer pattern in settings (%s). Overriding settings.\n"),
 								"salmon", filter_pattern[bayer], filter_pattern[com.pref.debayer.bayer_pattern]);
 					}
-					com.pref.debayer.bayer_pattern = bayer;
+					pattern = bayer;
 				}
 				user_warned = TRUE;
 			}
@@ -1055,7 +1073,6 @@ int ser_read_opened_partial(struct ser_struct *ser_file, int layer,
 			.w = ser_file->image_width, .h = ser_file->image_height };
 		get_debayer_area(area, &debayer_area, &image_area, &xoffset, &yoffset);
 
-		// allocating a buffer for WORD because it's going to be converted in-place
 		rawbuf = malloc(debayer_area.w * debayer_area.h * sizeof(WORD));
 		if (!rawbuf) {
 			PRINT_ALLOC_ERR;
@@ -1067,28 +1084,16 @@ int ser_read_opened_partial(struct ser_struct *ser_file, int layer,
 		}
 		ser_manage_endianess_and_depth(ser_file, rawbuf, debayer_area.w * debayer_area.h);
 
-		/* for performance consideration (and many others) we force the interpolation algorithm
-		 * to be BAYER_BILINEAR
-		 */
-		demosaiced_buf = debayer_buffer(rawbuf, &debayer_area.w,
-				&debayer_area.h, BAYER_BILINEAR, com.pref.debayer.bayer_pattern, ser_file->bit_pixel_depth);
-		free(rawbuf);
-		if (!demosaiced_buf)
-			return -1;
-
 		/* area is the destination area.
-		 * debayer_area is the demosaiced buf area.
+		 * debayer_area is the read area, always starting on the pattern.
 		 * xoffset and yoffset are the x,y offsets of area in the debayer area.
 		 */
-        const int nbpixels = debayer_area.w * debayer_area.h;
-		for (y = 0; y < area->h; y++) {
-			for (x = 0; x < area->w; x++) {
-				buffer[y*area->w + x] = demosaiced_buf[layer * nbpixels + (yoffset+y)*debayer_area.w + xoffset+x]; 
-			}
-		}
-
-		free(demosaiced_buf);
-		com.pref.debayer.bayer_pattern = sensortmp;
+		rectangle plane_area = { xoffset, yoffset, area->w, area->h };
+		int retval = debayer_plane_area(rawbuf, debayer_area.w, debayer_area.h,
+				pattern, layer, &plane_area, buffer);
+		free(rawbuf);
+		if (retval)
+			return -1;
 		break;
 
 	case SER_BGR:
@@ -1292,7 +1297,7 @@ GdkPixbuf* get_thumbnail_from_ser(char *filename, gchar **descr) {
 
 	/* here no need to debayer, for performance purposes
 	 * we just display monochrome display */
-	ser_read_frame(&ser, 0, &fit, FALSE, FALSE);
+	ser_read_frame(&ser, 0, &fit, FALSE, FALSE, -1);
 
 	for (i = 0; i < sz; i++) {
 		ima_data[i + 0] = (float)fit.pdata[RLAYER][i];
@@ -41,11 +41,13 @@
 
 #include <cassert>
 #include <iostream>
+#include <vector>
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include "core/siril.h"
 #include "core/proto.h"
 #include "opencv/ecc/ecc.h"
+#include "rt/gauss.h"
 
 #undef ECC_DEBUG
 
@@ -555,43 +557,124 @@ double findTransform_ECC(InputArray templateImage, InputArray inputImage,
 
 /* siril code starts here, code above is from opencv */
 
-int findTransform(fits *reference, fits *image, int layer,
+/* the coarsest level of the pyramid is not reduced below this size */
+#define ECC_PYRAMID_MIN_SIZE 64
+#define ECC_PYRAMID_MAX_LEVELS 4
+/* blur applied before decimating a level by 2 */
+#define ECC_PYRAMID_SIGMA 1.0
+
+struct ecc_pyramid_struct {
+	std::vector<Mat> levels;	// level 0 is the full resolution image
+};
+
+static Mat fits_layer_to_mat(fits *fit, int layer, bool copy) {
+	Mat out;
+	if (fit->type == DATA_USHORT) {
+		Mat(fit->ry, fit->rx, CV_16UC1, fit->pdata[layer]).convertTo(out,
+				CV_32FC1, 1.0 / USHRT_MAX_DOUBLE);
+	} else if (fit->type == DATA_FLOAT) {
+		out = Mat(fit->ry, fit->rx, CV_32FC1, fit->fpdata[layer]);
+		if (copy)
+			out = out.clone();
+	}
+	return out;
+}
+
+/* halves the size of an image, after a gaussian blur using the SIMD
+ * implementation of rt. The rt blur uses orphaned omp worksharing
+ * constructs, it is given its own team of one thread because this is run
+ * from the threads of the sequence processing. */
+static Mat pyramid_down(const Mat &src) {
+	Mat blurred(src.rows, src.cols, CV_32FC1);
+	std::vector<float *> src_rows(src.rows), dst_rows(src.rows);
+	for (int y = 0; y < src.rows; y++) {
+		src_rows[y] = (float *) src.ptr<float>(y);
+		dst_rows[y] = blurred.ptr<float>(y);
+	}
+#ifdef _OPENMP
+#pragma omp parallel num_threads(1)
+#endif
+	gaussianBlur(src_rows.data(), dst_rows.data(), src.cols, src.rows, ECC_PYRAMID_SIGMA);
+
+	Mat dst(src.rows / 2, src.cols / 2, CV_32FC1);
+	for (int y = 0; y < dst.rows; y++) {
+		const float *in = blurred.ptr<float>(2 * y);
+		float *out = dst.ptr<float>(y);
+		for (int x = 0; x < dst.cols; x++)
+			out[x] = in[2 * x];
+	}
+	return dst;
+}
+
+static void build_levels(std::vector<Mat> &levels, Mat level0, int nb_levels) {
+	levels.push_back(level0);
+	for (int i = 1; i < nb_levels; i++)
+		levels.push_back(pyramid_down(levels[i - 1]));
+}
+
+ecc_pyramid *new_ecc_pyramid(fits *reference, int layer) {
+	Mat ref = fits_layer_to_mat(reference, layer, true);
+	if (ref.empty())
+		return NULL;
+
+	int nb_levels = 1;
+	int size = min(ref.rows, ref.cols);
+	while (nb_levels < ECC_PYRAMID_MAX_LEVELS && size / 2 >= ECC_PYRAMID_MIN_SIZE) {
+		size /= 2;
+		nb_levels++;
+	}
+
+	ecc_pyramid *pyramid = new ecc_pyramid;
+	build_levels(pyramid->levels, ref, nb_levels);
+	return pyramid;
+}
+
+void free_ecc_pyramid(ecc_pyramid *pyramid) {
+	delete pyramid;
+}
+
+/* The translation is estimated on the coarsest level of the pyramids, where
+ * large shifts are only a few pixels and iterations are cheap, then refined
+ * on each finer level, starting from the previous estimate. */
+int findTransform(ecc_pyramid *reference, fits *image, int layer,
 		reg_ecc *reg_param) {
-	Mat *ref, *im;
-	Mat warp_matrix = Mat::eye(2, 3, CV_32F);
 	WARP_MODE warp_mode = WARP_MODE_TRANSLATION;
 	int number_of_iterations = 180;
 	double termination_eps = 0.002;
-	int retvalue = 0;
-
-	if (reference->type == DATA_USHORT) {
-		ref = new Mat(reference->ry, reference->rx, CV_16UC1, reference->pdata[layer]);
-		im = new Mat(image->ry, image->rx, CV_16UC1, image->pdata[layer]);
-		/* this conversion operation of the reference could be avoided since
-		 * it's the same for all tested images */
-		ref->convertTo(*ref, CV_32FC1, 1.0 / reference->stats[layer]->max);
-		im->convertTo(*im, CV_32FC1, 1.0 / image->stats[layer]->max);
-	}
-	else if (reference->type == DATA_FLOAT) {
-		ref = new Mat(reference->ry, reference->rx, CV_32FC1, reference->fpdata[layer]);
-		im = new Mat(image->ry, image->rx, CV_32FC1, image->fpdata[layer]);
-	} else return 1;
+	int nb_levels = reference->levels.size();
+	double ecc = -1.0;
+
+	Mat im = fits_layer_to_mat(image, layer, false);
+	if (im.empty() || im.size() != reference->levels[0].size())
+		return 1;
+	std::vector<Mat> levels;
+	build_levels(levels, im, nb_levels);
 
 	// Define termination criteria
 	TermCriteria criteria (TermCriteria::COUNT+TermCriteria::EPS, number_of_iterations, termination_eps);
 
-	double ecc = findTransform_ECC(*ref, *im, warp_matrix, warp_mode, criteria, noArray());
+	Mat warp_matrix = Mat::eye(2, 3, CV_32F);
+	for (int i = nb_levels - 1; i >= 0; i--) {
+		Mat previous = warp_matrix.clone();
+		ecc = findTransform_ECC(reference->levels[i], levels[i], warp_matrix, warp_mode, criteria, noArray());
+#ifdef ECC_DEBUG
+		std::cout << "level " << i << ": ecc = " << ecc << std::endl;
+#endif
+		/* a diverging coarse level should not spoil the next ones */
+		if (i > 0 && (cvIsNaN(ecc) || ecc <= 0.0))
+			warp_matrix = previous;
+		if (i > 0) {
+			warp_matrix.at<float>(0, 2) *= 2.f;
+			warp_matrix.at<float>(1, 2) *= 2.f;
+		}
+	}
 #ifdef ECC_DEBUG
-	std::cout << "ecc = " << ecc << std::endl;
 	std::cout << "result = " << std::endl << warp_matrix << std::endl;
 #endif
 	if (ecc > 0.8) {
 		reg_param->dx = warp_matrix.at<float>(0, 2);
 		reg_param->dy = warp_matrix.at<float>(1, 2);
+		return 0;
 	}
-	else retvalue = 1;
-
-	warp_matrix.release();
-	delete ref; delete im;
-	return retvalue;
+	return 1;
 }
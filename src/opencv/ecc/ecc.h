@@ -40,7 +40,12 @@ struct reg_ecc_struct {
 	float dy;
 };
 
-int findTransform(fits *reference, fits *image, int layer, reg_ecc *reg_param);
+/* reference image prepared for the coarse-to-fine alignment of images */
+typedef struct ecc_pyramid_struct ecc_pyramid;
+
+ecc_pyramid *new_ecc_pyramid(fits *reference, int layer);
+void free_ecc_pyramid(ecc_pyramid *pyramid);
+int findTransform(ecc_pyramid *reference, fits *image, int layer, reg_ecc *reg_param);
 
 #ifdef __cplusplus
 }
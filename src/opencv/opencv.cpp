@@ -322,15 +322,15 @@ void cvRotateImageRefPoint(fits *image, point center, double angle, int cropped,
 }
 
 
-int cvAffineTransformation(fits *image, pointf *refpoints, pointf *curpoints, int nb_points, gboolean upscale2x, int interpolation) {
+static Mat estimate_affine(int ry, pointf *refpoints, pointf *curpoints, int nb_points) {
 	// see https://docs.opencv.org/3.4/d4/d61/tutorial_warp_affine.html
 	std::vector<Point2f> ref;
 	std::vector<Point2f> cur;
 
 	/* build vectors with lists of 3 stars. */
 	for (int i = 0; i < nb_points; i++) {
-		ref.push_back(Point2f(refpoints[i].x, image->ry - refpoints[i].y - 1));
-		cur.push_back(Point2f(curpoints[i].x, image->ry - curpoints[i].y - 1));
+		ref.push_back(Point2f(refpoints[i].x, ry - refpoints[i].y - 1));
+		cur.push_back(Point2f(curpoints[i].x, ry - curpoints[i].y - 1));
 	}
 
 	Mat m = estimateAffinePartial2D(cur, ref);
@@ -339,8 +339,32 @@ int cvAffineTransformation(fits *image, pointf *refpoints, pointf *curpoints, in
 	/* test that m is not a zero matrix */
 	if (countNonZero(m) < 1) {
 		siril_log_color_message(_("Singular Matrix. Cannot compute Affine Transformation.\n"), "red");
-		return -1;
+		return Mat();
 	}
+	return m;
+}
+
+/* same as cvAffineTransformation but only returns the transformation */
+int cvGetAffineTransformation(int ry, pointf *refpoints, pointf *curpoints, int nb_points, Homography *H) {
+	Mat m = estimate_affine(ry, refpoints, curpoints, nb_points);
+	if (m.empty())
+		return -1;
+	H->h00 = m.at<double>(0, 0);
+	H->h01 = m.at<double>(0, 1);
+	H->h02 = m.at<double>(0, 2);
+	H->h10 = m.at<double>(1, 0);
+	H->h11 = m.at<double>(1, 1);
+	H->h12 = m.at<double>(1, 2);
+	H->h20 = 0.0;
+	H->h21 = 0.0;
+	H->h22 = 1.0;
+	return 0;
+}
+
+int cvAffineTransformation(fits *image, pointf *refpoints, pointf *curpoints, int nb_points, gboolean upscale2x, int interpolation) {
+	Mat m = estimate_affine(image->ry, refpoints, curpoints, nb_points);
+	if (m.empty())
+		return -1;
 
 	Mat in, out;
 	void *bgr = NULL;
@@ -359,18 +383,6 @@ int cvAffineTransformation(fits *image, pointf *refpoints, pointf *curpoints, in
 	return Mat_to_image(image, &in, &out, bgr, target_rx, target_ry);
 }
 
-static void convert_H_to_MatH(Homography *from, Mat &to) {
-	to.at<double>(0, 0) = from->h00;
-	to.at<double>(0, 1) = from->h01;
-	to.at<double>(0, 2) = from->h02;
-	to.at<double>(1, 0) = from->h10;
-	to.at<double>(1, 1) = from->h11;
-	to.at<double>(1, 2) = from->h12;
-	to.at<double>(2, 0) = from->h20;
-	to.at<double>(2, 1) = from->h21;
-	to.at<double>(2, 2) = from->h22;
-}
-
 static void convert_MatH_to_H(Mat from, Homography *to) {
 	to->h00 = from.at<double>(0, 0);
 	to->h01 = from.at<double>(0, 1);
@@ -460,43 +472,6 @@ unsigned char *cvCalculH(s_star *star_array_img,
 	return ret;
 }
 
-// transform an image using the homography.
-int cvTransformImage(fits *image, unsigned int width, unsigned int height, Homography Hom, gboolean upscale2x, int interpolation) {
-    Mat in, out;
-    void *bgr = NULL;
-    int target_rx = width, target_ry = height;
-    int source_ry = image->ry;
-
-    if (image_to_Mat(image, &in, &out, &bgr, target_rx, target_ry))
-        return 1;
-
-    Mat H = Mat(3, 3, CV_64FC1);
-    convert_H_to_MatH(&Hom, H);
-
-    if (upscale2x) {
-        Mat S = Mat::eye(3, 3, CV_64FC1);
-        S.at<double>(0,0) = 2.0;
-        S.at<double>(1,1) = 2.0;
-        H = S * H;
-    }
-
-    /* modify matrix for reverse Y axis */
-    Mat F1 = Mat::eye(3, 3, CV_64FC1);
-    F1.at<double>(1,1) = -1.0;
-    F1.at<double>(1,2) = source_ry - 1.0;
-
-    Mat F2 = Mat::eye(3, 3, CV_64FC1);
-    F2.at<double>(1,1) = -1.0;
-    F2.at<double>(1,2) = target_ry - 1.0;
-
-    H = F2.inv() * H * F1;
-
-    // OpenCV function
-    warpPerspective(in, out, H, Size(target_rx, target_ry), interpolation, BORDER_TRANSPARENT);
-
-    return Mat_to_image(image, &in, &out, bgr, target_rx, target_ry);
-}
-
 int cvUnsharpFilter(fits* image, double sigma, double amount) {
 	Mat in, out;
 	void *bgr = NULL;
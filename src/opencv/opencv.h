@@ -22,12 +22,13 @@ int cvRotateImage(fits *, point, double, int, int);
 int cvAffineTransformation(fits *image, pointf *refpoints, pointf *curpoints, int nb_points,
 		gboolean upscale2x, int interpolation);
 
+int cvGetAffineTransformation(int ry, pointf *refpoints, pointf *curpoints, int nb_points,
+		Homography *H);
+
 unsigned char *cvCalculH(s_star *star_array_img,
 		struct s_star *star_array_ref, int n, Homography *H, transformation_type type);
 
 
-int cvTransformImage(fits *image, unsigned int width, unsigned int height, Homography Hom, gboolean upscale2x, int interpolation);
-
 int cvUnsharpFilter(fits*, double, double);
 
 int cvClahe(fits *image, double clip_limit, int size);
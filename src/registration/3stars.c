@@ -47,6 +47,7 @@ static int results_size;
 
 // local functions
 static int rotate_images(struct registration_args *regargs, regdata *current_regdata);
+static int store_transforms(struct registration_args *regargs);
 
 static void set_registration_ready(gboolean ready) {
 	static GtkWidget *go_register = NULL;
@@ -230,75 +231,79 @@ int register_3stars(struct registration_args *regargs) {
 		current_regdata[i].weighted_fwhm = fwhm; // TODO: compute it with nb_stars
 	}
 
+	if (regargs->no_output)
+		return store_transforms(regargs);
 	return rotate_images(regargs, current_regdata);
 }
 
+/* fills the positions of the stars found in both the reference image and the
+ * image in_index, returns their number or 0 if they cannot be aligned */
+static int get_matching_stars(int refimage, int in_index, pointf *ref, pointf *cur) {
+	int nb_ref_stars = results[refimage].stars[2] ? 3 : 2;
+	int nb_stars = 0;
+	for (int s = 0; s < nb_ref_stars; s++) {
+		if (!results[in_index].stars[s])
+			continue;
+		ref[nb_stars].x = results[refimage].stars[s]->xpos;
+		ref[nb_stars].y = results[refimage].stars[s]->ypos;
+		cur[nb_stars].x = results[in_index].stars[s]->xpos;
+		cur[nb_stars].y = results[in_index].stars[s]->ypos;
+		nb_stars++;
+	}
+	return nb_stars >= 2 ? nb_stars : 0;
+}
+
+static void free_results() {
+	for (int i = 0; i < results_size; i++) {
+		for (int s = 0; s < 3; s++)
+			if (results[i].stars[s])
+				free(results[i].stars[s]);
+	}
+	free(results);
+	results = NULL;
+	reset_icons();
+	for (int i = 0; i < 3; i++)
+		unset_suggested(three_buttons[i]);
+	set_suggested(three_buttons[0]);
+	set_registration_ready(FALSE);
+}
+
+/* stores the transformations in the sequence instead of rotating the images */
+static int store_transforms(struct registration_args *regargs) {
+	int refimage = regargs->reference_image;
+	for (int i = 0; i < regargs->seq->number; i++) {
+		if (!regargs->process_all_frames && !regargs->seq->imgparam[i].incl)
+			continue;
+		Homography H = { 0 };
+		pointf ref[3], cur[3];
+		int nb_stars = get_matching_stars(refimage, i, ref, cur);
+		if (i == refimage) {
+			H.h00 = H.h11 = H.h22 = 1.0;
+		} else if (!nb_stars || cvGetAffineTransformation(regargs->seq->ry, ref, cur, nb_stars, &H)) {
+			siril_log_color_message(_("Cannot align image %d, excluding it\n"), "red",
+					regargs->seq->imgparam[i].filenum);
+			regargs->seq->imgparam[i].incl = FALSE;
+			continue;
+		}
+		set_transform(regargs->seq, i, regargs->layer, &H, regargs->seq->ry, FALSE);
+	}
+	fix_selnum(regargs->seq, FALSE);
+	free_results();
+	siril_log_message(_("Registration finished.\n"));
+	return 0;
+}
+
 /* image rotation sequence processing */
 static int affine_transform_hook(struct generic_seq_args *args, int out_index, int in_index, fits *fit, rectangle *area) {
 	struct star_align_data *sadata = args->user;
 	struct registration_args *regargs = sadata->regargs;
 	int refimage = regargs->reference_image;
 
-	int nb_stars = 3;
-	if (!results[refimage].stars[2])
-		nb_stars = 2;
-	if (nb_stars == 2 && (!results[in_index].stars[0] || !results[in_index].stars[1]))
+	pointf ref[3], cur[3];
+	int nb_stars = get_matching_stars(refimage, in_index, ref, cur);
+	if (!nb_stars)
 		return 1;
-	if (nb_stars == 2 || (nb_stars == 3 && results[in_index].stars[0] && results[in_index].stars[1] && results[in_index].stars[2])) {
-		if (regargs->x2upscale || in_index != refimage) {
-			pointf ref[3] = {
-				{ results[refimage].stars[0]->xpos, results[refimage].stars[0]->ypos },
-				{ results[refimage].stars[1]->xpos, results[refimage].stars[1]->ypos },
-				{ 0 }
-			};
-			if (nb_stars == 3) {
-				ref[2].x = results[refimage].stars[2]->xpos;
-				ref[2].y = results[refimage].stars[2]->ypos;
-			}
-			pointf cur[3] = {
-				{ results[in_index].stars[0]->xpos, results[in_index].stars[0]->ypos },
-				{ results[in_index].stars[1]->xpos, results[in_index].stars[1]->ypos },
-				{ 0 }
-			};
-			if (nb_stars == 3) {
-				cur[2].x = results[in_index].stars[2]->xpos;
-				cur[2].y = results[in_index].stars[2]->ypos;
-			}
-
-			if (cvAffineTransformation(fit, ref, cur, nb_stars, regargs->x2upscale, regargs->interpolation))
-				return 1;
-		}
-	}
-	else {
-		int in_stars = (results[in_index].stars[0] != NULL) +
-			(results[in_index].stars[1] != NULL) + (results[in_index].stars[2] != NULL);
-		if (in_stars != 2)
-			return 1;
-		pointf ref[2] = { 0 };
-		pointf cur[2] = { 0 };
-		int star = 0;
-		if (results[in_index].stars[0]) {
-			ref[star].x = results[refimage].stars[0]->xpos;
-			ref[star].y = results[refimage].stars[0]->ypos;
-			cur[star].x = results[in_index].stars[0]->xpos;
-			cur[star].y = results[in_index].stars[0]->ypos;
-			star++;
-		}
-		if (results[in_index].stars[1]) {
-			ref[star].x = results[refimage].stars[1]->xpos;
-			ref[star].y = results[refimage].stars[1]->ypos;
-			cur[star].x = results[in_index].stars[1]->xpos;
-			cur[star].y = results[in_index].stars[1]->ypos;
-			star++;
-		}
-		if (results[in_index].stars[2]) {
-			ref[star].x = results[refimage].stars[2]->xpos;
-			ref[star].y = results[refimage].stars[2]->ypos;
-			cur[star].x = results[in_index].stars[2]->xpos;
-			cur[star].y = results[in_index].stars[2]->ypos;
-			star++;
-		}
-
+	if (regargs->x2upscale || in_index != refimage) {
 		if (cvAffineTransformation(fit, ref, cur, nb_stars, regargs->x2upscale, regargs->interpolation))
 			return 1;
 	}
@@ -417,17 +422,6 @@ static int rotate_images(struct registration_args *regargs, regdata *current_reg
 
 	generic_sequence_worker(args);
 	
-	for (int i = 0; i < results_size; i++) {
-		for (int s = 0; s < 3; s++)
-			if (results[i].stars[s])
-				free(results[i].stars[s]);
-	}
-	free(results);
-	results = NULL;
-	reset_icons();
-	for (int i = 0; i < 3; i++)
-		unset_suggested(three_buttons[i]);
-	set_suggested(three_buttons[0]);
-	set_registration_ready(FALSE);
+	free_results();
 	return args->retval;
 }
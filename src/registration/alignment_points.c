@@ -0,0 +1,712 @@
+/*
+ * This file is part of Siril, an astronomy image processor.
+ * Copyright (C) 2005-2011 Francois Meyer (dulle at free.fr)
+ * Copyright (C) 2012-2021 team free-astro (see more in AUTHORS file)
+ * Reference site is https://free-astro.org/index.php/Siril
+ *
+ * Siril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Siril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Siril. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Multi-point (local) alignment and stacking for planetary sequences.
+ *
+ * The turbulence deforms the images locally, a single shift per frame is not
+ * enough to align them. A grid of alignment points (boxes overlapping by half
+ * their size) is placed on the bright parts of the reference frame. In a
+ * first pass over the sequence, each box is located in each frame around its
+ * globally registered position by phase correlation with the cached spectrum
+ * of the reference box, and a local quality is measured. The best frames are
+ * then selected for each box independently, and a second pass stacks the
+ * selected patches, shifted by their local shift and blended with a tent
+ * window. Pixels not covered by any box get the globally aligned mean.
+ * Both passes run on the generic sequence worker, so SER files are streamed.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include <fftw3.h>
+
+#include "core/siril.h"
+#include "core/proto.h"
+#include "core/processing.h"
+#include "gui/progress_and_log.h"
+#include "io/sequence.h"
+#include "io/image_format_fits.h"
+#include "registration/registration.h"
+
+struct ap_data {
+	struct ap_stack_args *apargs;
+	int rx, ry, nb_layers;
+	int size;		// box size, power of 2
+	unsigned int sqsize, spectrum_size;
+	int ref_image;
+
+	int nb_boxes;
+	int *box_x, *box_y;	// lower left corner of the boxes in the reference frame
+	fftwf_complex **ref_spectra;	// cached half spectra of the reference boxes
+	float *window;		// Hann window applied before correlation
+	float *blend;		// tent window used to blend the patches
+
+	/* analysis results, indexed by frame * nb_boxes + box */
+	float *shiftx, *shifty;	// local shift of the box, relative to the global one
+	float *quality;		// local quality, negative if the box was not measured
+	BYTE *selected;
+
+	int nb_threads;
+	float **real;		// per thread, box then correlation
+	fftwf_complex **spectrum;
+	fftwf_plan *forward, *backward;
+
+	/* stacking accumulators, per thread */
+	float **acc, **weights, **fallback, **fallback_count;
+	fits *result;
+};
+
+struct ap_rank {
+	float quality;
+	int frame;
+};
+
+static int compare_ap_rank(const void *a, const void *b) {
+	const struct ap_rank *ra = a, *rb = b;
+	if (ra->quality > rb->quality) return -1;
+	if (ra->quality < rb->quality) return 1;
+	return ra->frame - rb->frame;
+}
+
+static int get_thread_id() {
+#ifdef _OPENMP
+	return omp_get_thread_num();
+#else
+	return 0;
+#endif
+}
+
+static inline float ap_get_pixel(fits *fit, int layer, size_t i) {
+	if (fit->type == DATA_USHORT)
+		return (float)fit->pdata[layer][i] / USHRT_MAX_SINGLE;
+	return fit->fpdata[layer][i];
+}
+
+static void ap_global_shift(struct ap_data *apdata, int frame, int *gsx, int *gsy) {
+	sequence *seq = apdata->apargs->seq;
+	regdata *regparam = seq->regparam ? seq->regparam[apdata->apargs->layer] : NULL;
+	if (regparam) {
+		*gsx = round_to_int(regparam[frame].shiftx);
+		*gsy = round_to_int(regparam[frame].shifty);
+	} else {
+		*gsx = 0;
+		*gsy = 0;
+	}
+}
+
+/* position of a box in a frame from the global shift, FALSE if it falls
+ * outside the frame */
+static gboolean ap_box_origin(struct ap_data *apdata, int box, int gsx, int gsy,
+		int *x0, int *y0) {
+	*x0 = apdata->box_x[box] - gsx;
+	*y0 = apdata->box_y[box] - gsy;
+	return *x0 >= 0 && *y0 >= 0 && *x0 + apdata->size <= apdata->rx
+		&& *y0 + apdata->size <= apdata->ry;
+}
+
+static double ap_box_mean(struct ap_data *apdata, fits *fit, int x0, int y0) {
+	int layer = apdata->apargs->layer;
+	double sum = 0.0;
+	for (int v = 0; v < apdata->size; v++) {
+		size_t row = (size_t)(y0 + v) * apdata->rx + x0;
+		for (int u = 0; u < apdata->size; u++)
+			sum += ap_get_pixel(fit, layer, row + u);
+	}
+	return sum / apdata->sqsize;
+}
+
+/* copies the windowed and mean-subtracted box in dest, returns the local
+ * quality: gradient energy normalized by the squared mean level */
+static double ap_load_box(struct ap_data *apdata, fits *fit, int x0, int y0, float *dest) {
+	int layer = apdata->apargs->layer, size = apdata->size;
+	double mean = ap_box_mean(apdata, fit, x0, y0);
+	double gradient = 0.0;
+	for (int v = 0; v < size; v++) {
+		size_t row = (size_t)(y0 + v) * apdata->rx + x0;
+		for (int u = 0; u < size; u++) {
+			float pixel = ap_get_pixel(fit, layer, row + u);
+			dest[v * size + u] = (float)(pixel - mean) * apdata->window[v * size + u];
+			if (u < size - 1) {
+				float dx = ap_get_pixel(fit, layer, row + u + 1) - pixel;
+				gradient += dx * dx;
+			}
+			if (v < size - 1) {
+				float dy = ap_get_pixel(fit, layer, row + apdata->rx + u) - pixel;
+				gradient += dy * dy;
+			}
+		}
+	}
+	if (mean <= 0.0)
+		return 0.0;
+	return gradient / (apdata->sqsize * mean * mean);
+}
+
+/* cross-power spectrum in place: img = ref * conj(img) */
+static void ap_cross_power(const fftwf_complex *ref, fftwf_complex *img, unsigned int n) {
+	const float *a = (const float *)ref;
+	float *b = (float *)img;	// interleaved real and imaginary parts
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+	for (unsigned int i = 0; i < n; i++) {
+		float ar = a[2 * i], ai = a[2 * i + 1];
+		float br = b[2 * i], bi = b[2 * i + 1];
+		b[2 * i] = ar * br + ai * bi;
+		b[2 * i + 1] = ai * br - ar * bi;
+	}
+}
+
+/* vertex of the parabola through three samples, relative to the centre one */
+static float ap_parabolic_offset(float left, float centre, float right) {
+	float denom = left - 2.f * centre + right;
+	if (denom >= 0.f)
+		return 0.f;
+	return 0.5f * (left - right) / denom;
+}
+
+/* sub-pixel position of the maximum of the correlation, as a signed shift */
+static void ap_find_peak(const float *correl, int size, float *x, float *y) {
+	unsigned int peak = 0;
+	for (unsigned int i = 1; i < (unsigned int)(size * size); i++)
+		if (correl[i] > correl[peak])
+			peak = i;
+	int px = peak % size, py = peak / size;
+	int left = (px + size - 1) % size, right = (px + 1) % size;
+	int down = (py + size - 1) % size, up = (py + 1) % size;
+	float centre = correl[peak];
+	*x = px + ap_parabolic_offset(correl[py * size + left], centre, correl[py * size + right]);
+	*y = py + ap_parabolic_offset(correl[down * size + px], centre, correl[up * size + px]);
+	if (*x > size / 2)
+		*x -= size;
+	if (*y > size / 2)
+		*y -= size;
+}
+
+static void ap_free_fft(struct ap_data *apdata) {
+	if (apdata->forward) {
+		for (int i = 0; i < apdata->nb_threads; i++) {
+			if (apdata->forward[i])
+				fftwf_destroy_plan(apdata->forward[i]);
+			if (apdata->backward[i])
+				fftwf_destroy_plan(apdata->backward[i]);
+			if (apdata->real[i])
+				fftwf_free(apdata->real[i]);
+			if (apdata->spectrum[i])
+				fftwf_free(apdata->spectrum[i]);
+		}
+	}
+	free(apdata->forward);
+	free(apdata->backward);
+	free(apdata->real);
+	free(apdata->spectrum);
+	apdata->forward = NULL;
+	apdata->backward = NULL;
+	apdata->real = NULL;
+	apdata->spectrum = NULL;
+	if (apdata->ref_spectra) {
+		for (int b = 0; b < apdata->nb_boxes; b++)
+			if (apdata->ref_spectra[b])
+				fftwf_free(apdata->ref_spectra[b]);
+		free(apdata->ref_spectra);
+		apdata->ref_spectra = NULL;
+	}
+}
+
+static int ap_init_windows(struct ap_data *apdata) {
+	int size = apdata->size;
+	float *hann = malloc(size * sizeof(float));
+	float *tent = malloc(size * sizeof(float));
+	if (!hann || !tent) {
+		PRINT_ALLOC_ERR;
+		free(hann);
+		free(tent);
+		return 1;
+	}
+	for (int u = 0; u < size; u++) {
+		hann[u] = 0.5f - 0.5f * cosf(2.f * (float)M_PI * (u + 0.5f) / size);
+		tent[u] = 1.f - fabsf(2.f * (u + 0.5f) / size - 1.f);
+	}
+	for (int v = 0; v < size; v++) {
+		for (int u = 0; u < size; u++) {
+			apdata->window[v * size + u] = hann[u] * hann[v];
+			apdata->blend[v * size + u] = tent[u] * tent[v];
+		}
+	}
+	free(hann);
+	free(tent);
+	return 0;
+}
+
+/* places the alignment points on the bright parts of the reference frame,
+ * returns their number or -1 on allocation error */
+static int ap_place_boxes(struct ap_data *apdata, fits *ref) {
+	int layer = apdata->apargs->layer, size = apdata->size, step = size / 2;
+	int gsx, gsy;
+	ap_global_shift(apdata, apdata->ref_image, &gsx, &gsy);
+
+	float maxi = 0.f;
+	size_t npixels = (size_t)apdata->rx * apdata->ry;
+	for (size_t i = 0; i < npixels; i++)
+		maxi = max(maxi, ap_get_pixel(ref, layer, i));
+	double threshold = apdata->apargs->min_brightness * maxi;
+
+	int nx = (apdata->rx - size) / step + 1, ny = (apdata->ry - size) / step + 1;
+	if (nx < 1 || ny < 1)
+		return 0;
+	apdata->box_x = malloc(nx * ny * sizeof(int));
+	apdata->box_y = malloc(nx * ny * sizeof(int));
+	if (!apdata->box_x || !apdata->box_y) {
+		PRINT_ALLOC_ERR;
+		return -1;
+	}
+	apdata->nb_boxes = 0;
+	for (int j = 0; j < ny; j++) {
+		for (int i = 0; i < nx; i++) {
+			int b = apdata->nb_boxes, x0, y0;
+			apdata->box_x[b] = i * step + gsx;
+			apdata->box_y[b] = j * step + gsy;
+			if (!ap_box_origin(apdata, b, gsx, gsy, &x0, &y0))
+				continue;
+			if (ap_box_mean(apdata, ref, x0, y0) >= threshold)
+				apdata->nb_boxes++;
+		}
+	}
+	return apdata->nb_boxes;
+}
+
+static int ap_analysis_prepare_hook(struct generic_seq_args *args) {
+	struct ap_data *apdata = args->user;
+	fits ref = { 0 };
+	if (seq_read_frame(args->seq, apdata->ref_image, &ref, FALSE, -1)) {
+		siril_log_message(_("Could not load reference image\n"));
+		return 1;
+	}
+	apdata->rx = ref.rx;
+	apdata->ry = ref.ry;
+	apdata->nb_layers = ref.naxes[2];
+	apdata->sqsize = apdata->size * apdata->size;
+	apdata->spectrum_size = apdata->size * (apdata->size / 2 + 1);
+	apdata->window = malloc(apdata->sqsize * sizeof(float));
+	apdata->blend = malloc(apdata->sqsize * sizeof(float));
+	if (!apdata->window || !apdata->blend) {
+		PRINT_ALLOC_ERR;
+		clearfits(&ref);
+		return 1;
+	}
+	if (ap_init_windows(apdata)) {
+		clearfits(&ref);
+		return 1;
+	}
+
+	int nb_boxes = ap_place_boxes(apdata, &ref);
+	if (nb_boxes < 0) {
+		clearfits(&ref);
+		return 1;
+	}
+	if (!nb_boxes) {
+		siril_log_message(_("No alignment point could be placed on the reference image, "
+					"try a smaller box size or a lower brightness threshold\n"));
+		clearfits(&ref);
+		return 1;
+	}
+
+	size_t nb_results = (size_t)args->seq->number * apdata->nb_boxes;
+	apdata->shiftx = calloc(nb_results, sizeof(float));
+	apdata->shifty = calloc(nb_results, sizeof(float));
+	apdata->quality = malloc(nb_results * sizeof(float));
+	apdata->selected = calloc(nb_results, sizeof(BYTE));
+	apdata->nb_threads = args->max_thread;
+	apdata->real = calloc(apdata->nb_threads, sizeof(float *));
+	apdata->spectrum = calloc(apdata->nb_threads, sizeof(fftwf_complex *));
+	apdata->forward = calloc(apdata->nb_threads, sizeof(fftwf_plan));
+	apdata->backward = calloc(apdata->nb_threads, sizeof(fftwf_plan));
+	apdata->ref_spectra = calloc(apdata->nb_boxes, sizeof(fftwf_complex *));
+	if (!apdata->shiftx || !apdata->shifty || !apdata->quality || !apdata->selected ||
+			!apdata->real || !apdata->spectrum || !apdata->forward ||
+			!apdata->backward || !apdata->ref_spectra) {
+		PRINT_ALLOC_ERR;
+		clearfits(&ref);
+		return 1;
+	}
+	for (size_t i = 0; i < nb_results; i++)
+		apdata->quality[i] = -1.f;
+
+	/* boxes are small, estimated plans are good enough and avoid the
+	 * measurement for each box size */
+	for (int i = 0; i < apdata->nb_threads; i++) {
+		apdata->real[i] = fftwf_malloc(sizeof(float) * apdata->sqsize);
+		apdata->spectrum[i] = fftwf_malloc(sizeof(fftwf_complex) * apdata->spectrum_size);
+		if (!apdata->real[i] || !apdata->spectrum[i]) {
+			PRINT_ALLOC_ERR;
+			clearfits(&ref);
+			return 1;
+		}
+		apdata->forward[i] = fftwf_plan_dft_r2c_2d(apdata->size, apdata->size,
+				apdata->real[i], apdata->spectrum[i], FFTW_ESTIMATE);
+		apdata->backward[i] = fftwf_plan_dft_c2r_2d(apdata->size, apdata->size,
+				apdata->spectrum[i], apdata->real[i], FFTW_ESTIMATE);
+	}
+
+	int gsx, gsy;
+	ap_global_shift(apdata, apdata->ref_image, &gsx, &gsy);
+	for (int b = 0; b < apdata->nb_boxes; b++) {
+		int x0, y0;
+		apdata->ref_spectra[b] = fftwf_malloc(sizeof(fftwf_complex) * apdata->spectrum_size);
+		if (!apdata->ref_spectra[b]) {
+			PRINT_ALLOC_ERR;
+			clearfits(&ref);
+			return 1;
+		}
+		ap_box_origin(apdata, b, gsx, gsy, &x0, &y0);
+		ap_load_box(apdata, &ref, x0, y0, apdata->real[0]);
+		fftwf_execute(apdata->forward[0]);
+		memcpy(apdata->ref_spectra[b], apdata->spectrum[0],
+				sizeof(fftwf_complex) * apdata->spectrum_size);
+	}
+	clearfits(&ref);
+	siril_log_message(_("%d alignment points of %d pixels placed on the reference image\n"),
+			apdata->nb_boxes, apdata->size);
+	return 0;
+}
+
+static int ap_analysis_image_hook(struct generic_seq_args *args, int out_index, int in_index, fits *fit, rectangle *_) {
+	struct ap_data *apdata = args->user;
+	int thread = get_thread_id();
+	if (fit->rx != apdata->rx || fit->ry != apdata->ry) {
+		siril_log_message(_("Image %d has a different size than the reference image\n"), in_index + 1);
+		return 1;
+	}
+	int gsx, gsy;
+	ap_global_shift(apdata, in_index, &gsx, &gsy);
+	float max_shift = apdata->size / 4.f;
+	size_t offset = (size_t)in_index * apdata->nb_boxes;
+
+	for (int b = 0; b < apdata->nb_boxes; b++) {
+		int x0, y0;
+		if (!ap_box_origin(apdata, b, gsx, gsy, &x0, &y0))
+			continue;
+		double quality = ap_load_box(apdata, fit, x0, y0, apdata->real[thread]);
+		fftwf_execute(apdata->forward[thread]);
+		ap_cross_power(apdata->ref_spectra[b], apdata->spectrum[thread], apdata->spectrum_size);
+		fftwf_execute(apdata->backward[thread]);
+		float dx, dy;
+		ap_find_peak(apdata->real[thread], apdata->size, &dx, &dy);
+		if (fabsf(dx) > max_shift || fabsf(dy) > max_shift)
+			continue;
+		apdata->shiftx[offset + b] = dx;
+		apdata->shifty[offset + b] = dy;
+		apdata->quality[offset + b] = (float)quality;
+	}
+	return 0;
+}
+
+/* keeps the best frames for each box */
+static void ap_rank_boxes(struct ap_data *apdata, int nb_frames) {
+	double keep = apdata->apargs->keep_percent / 100.0;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static)
+#endif
+	for (int b = 0; b < apdata->nb_boxes; b++) {
+		struct ap_rank *ranks = malloc(nb_frames * sizeof(struct ap_rank));
+		if (!ranks)
+			continue;
+		int nb = 0;
+		for (int i = 0; i < nb_frames; i++) {
+			float quality = apdata->quality[(size_t)i * apdata->nb_boxes + b];
+			if (quality >= 0.f) {
+				ranks[nb].quality = quality;
+				ranks[nb].frame = i;
+				nb++;
+			}
+		}
+		qsort(ranks, nb, sizeof(struct ap_rank), compare_ap_rank);
+		int nb_kept = min(nb, max(1, round_to_int(keep * nb)));
+		for (int i = 0; i < nb_kept; i++)
+			apdata->selected[(size_t)ranks[i].frame * apdata->nb_boxes + b] = 1;
+		free(ranks);
+	}
+}
+
+static int ap_analysis_finalize_hook(struct generic_seq_args *args) {
+	struct ap_data *apdata = args->user;
+	ap_free_fft(apdata);
+	if (!args->retval)
+		ap_rank_boxes(apdata, args->seq->number);
+	return 0;
+}
+
+static void ap_free_accumulators(struct ap_data *apdata) {
+	for (int i = 0; i < apdata->nb_threads; i++) {
+		if (apdata->acc) free(apdata->acc[i]);
+		if (apdata->weights) free(apdata->weights[i]);
+		if (apdata->fallback) free(apdata->fallback[i]);
+		if (apdata->fallback_count) free(apdata->fallback_count[i]);
+	}
+	free(apdata->acc);
+	free(apdata->weights);
+	free(apdata->fallback);
+	free(apdata->fallback_count);
+	apdata->acc = NULL;
+	apdata->weights = NULL;
+	apdata->fallback = NULL;
+	apdata->fallback_count = NULL;
+}
+
+/* Each stacking thread has, in addition to the frame it reads, four full
+ * frame float accumulators: the weighted sum of the boxes and the globally
+ * aligned sum for each layer, and their weights. The result is allocated
+ * once, at the end. */
+static int ap_stack_compute_mem_limits(struct generic_seq_args *args, gboolean for_writer) {
+	struct ap_data *apdata = args->user;
+	unsigned int MB_per_orig_image, MB_per_scaled_image, MB_avail;
+	int limit = compute_nb_images_fit_memory(args->seq, 1.0, FALSE,
+			&MB_per_orig_image, &MB_per_scaled_image, &MB_avail);
+	guint64 npixels = (guint64)apdata->rx * apdata->ry;
+	unsigned int MB_per_accumulators = (unsigned int)((npixels * (2 * apdata->nb_layers + 2) *
+				sizeof(float)) / BYTES_IN_A_MB) + 1;
+	unsigned int MB_result = (unsigned int)((npixels * apdata->nb_layers * sizeof(float)) / BYTES_IN_A_MB) + 1;
+	unsigned int required = MB_per_orig_image + MB_per_accumulators;
+	if (limit > 0) {
+		limit = MB_avail > MB_result ? (MB_avail - MB_result) / required : 0;
+		if (limit > com.max_thread)
+			limit = com.max_thread;
+	}
+	if (limit == 0) {
+		gchar *mem_per_thread = g_format_size_full(required * BYTES_IN_A_MB, G_FORMAT_SIZE_IEC_UNITS);
+		gchar *mem_available = g_format_size_full(MB_avail * BYTES_IN_A_MB, G_FORMAT_SIZE_IEC_UNITS);
+
+		siril_log_color_message(_("%s: not enough memory to do this operation (%s required per thread, %s considered available)\n"),
+				"red", args->description, mem_per_thread, mem_available);
+
+		g_free(mem_per_thread);
+		g_free(mem_available);
+	}
+	return limit;
+}
+
+static int ap_stack_prepare_hook(struct generic_seq_args *args) {
+	struct ap_data *apdata = args->user;
+	size_t npixels = (size_t)apdata->rx * apdata->ry;
+	apdata->nb_threads = args->max_thread;
+	apdata->acc = calloc(apdata->nb_threads, sizeof(float *));
+	apdata->weights = calloc(apdata->nb_threads, sizeof(float *));
+	apdata->fallback = calloc(apdata->nb_threads, sizeof(float *));
+	apdata->fallback_count = calloc(apdata->nb_threads, sizeof(float *));
+	if (!apdata->acc || !apdata->weights || !apdata->fallback || !apdata->fallback_count) {
+		PRINT_ALLOC_ERR;
+		return 1;
+	}
+	for (int i = 0; i < apdata->nb_threads; i++) {
+		apdata->acc[i] = calloc(npixels * apdata->nb_layers, sizeof(float));
+		apdata->weights[i] = calloc(npixels, sizeof(float));
+		apdata->fallback[i] = calloc(npixels * apdata->nb_layers, sizeof(float));
+		apdata->fallback_count[i] = calloc(npixels, sizeof(float));
+		if (!apdata->acc[i] || !apdata->weights[i] || !apdata->fallback[i] ||
+				!apdata->fallback_count[i]) {
+			PRINT_ALLOC_ERR;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int ap_stack_image_hook(struct generic_seq_args *args, int out_index, int in_index, fits *fit, rectangle *_) {
+	struct ap_data *apdata = args->user;
+	int thread = get_thread_id();
+	int rx = apdata->rx, ry = apdata->ry, size = apdata->size;
+	size_t npixels = (size_t)rx * ry;
+	float *acc = apdata->acc[thread], *weights = apdata->weights[thread];
+	float *fallback = apdata->fallback[thread], *fallback_count = apdata->fallback_count[thread];
+	int gsx, gsy;
+	ap_global_shift(apdata, in_index, &gsx, &gsy);
+
+	/* globally aligned mean, for the parts not covered by the boxes */
+	for (int y = max(0, gsy); y < min(ry, ry + gsy); y++) {
+		for (int x = max(0, gsx); x < min(rx, rx + gsx); x++) {
+			size_t dst = (size_t)y * rx + x;
+			size_t src = (size_t)(y - gsy) * rx + x - gsx;
+			for (int layer = 0; layer < apdata->nb_layers; layer++)
+				fallback[layer * npixels + dst] += ap_get_pixel(fit, layer, src);
+			fallback_count[dst] += 1.f;
+		}
+	}
+
+	size_t offset = (size_t)in_index * apdata->nb_boxes;
+	for (int b = 0; b < apdata->nb_boxes; b++) {
+		if (!apdata->selected[offset + b])
+			continue;
+		float dx = apdata->shiftx[offset + b], dy = apdata->shifty[offset + b];
+		for (int v = 0; v < size; v++) {
+			int Y = apdata->box_y[b] + v;
+			float fy = Y - gsy - dy;
+			int iy = (int)floorf(fy);
+			if (iy < 0 || iy + 1 >= ry)
+				continue;
+			float ty = fy - iy;
+			for (int u = 0; u < size; u++) {
+				int X = apdata->box_x[b] + u;
+				float fx = X - gsx - dx;
+				int ix = (int)floorf(fx);
+				if (ix < 0 || ix + 1 >= rx)
+					continue;
+				float tx = fx - ix;
+				float w = apdata->blend[v * size + u];
+				size_t dst = (size_t)Y * rx + X;
+				size_t src = (size_t)iy * rx + ix;
+				for (int layer = 0; layer < apdata->nb_layers; layer++) {
+					float p00 = ap_get_pixel(fit, layer, src);
+					float p10 = ap_get_pixel(fit, layer, src + 1);
+					float p01 = ap_get_pixel(fit, layer, src + rx);
+					float p11 = ap_get_pixel(fit, layer, src + rx + 1);
+					float value = (1.f - ty) * ((1.f - tx) * p00 + tx * p10)
+						+ ty * ((1.f - tx) * p01 + tx * p11);
+					acc[layer * npixels + dst] += w * value;
+				}
+				weights[dst] += w;
+			}
+		}
+	}
+	return 0;
+}
+
+static int ap_stack_finalize_hook(struct generic_seq_args *args) {
+	struct ap_data *apdata = args->user;
+	if (!args->retval) {
+		if (new_fit_image(&apdata->result, apdata->rx, apdata->ry,
+					apdata->nb_layers, DATA_FLOAT)) {
+			args->retval = 1;
+		} else {
+			size_t npixels = (size_t)apdata->rx * apdata->ry;
+			float *out = apdata->result->fdata;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(com.max_thread) schedule(static)
+#endif
+			for (size_t i = 0; i < npixels; i++) {
+				float weight = 0.f, count = 0.f;
+				for (int t = 0; t < apdata->nb_threads; t++) {
+					weight += apdata->weights[t][i];
+					count += apdata->fallback_count[t][i];
+				}
+				for (int layer = 0; layer < apdata->nb_layers; layer++) {
+					size_t idx = layer * npixels + i;
+					float sum = 0.f;
+					if (weight > 0.f) {
+						for (int t = 0; t < apdata->nb_threads; t++)
+							sum += apdata->acc[t][idx];
+						out[idx] = sum / weight;
+					} else if (count > 0.f) {
+						for (int t = 0; t < apdata->nb_threads; t++)
+							sum += apdata->fallback[t][idx];
+						out[idx] = sum / count;
+					} else {
+						out[idx] = 0.f;
+					}
+				}
+			}
+		}
+	}
+	ap_free_accumulators(apdata);
+	return 0;
+}
+
+static int ap_run_pass(struct ap_data *apdata, gboolean analysis) {
+	sequence *seq = apdata->apargs->seq;
+	struct generic_seq_args *args = create_default_seqargs(seq);
+	args->filtering_criterion = seq_filter_included;
+	args->nb_filtered_images = seq->selnum;
+	if (analysis) {
+		args->prepare_hook = ap_analysis_prepare_hook;
+		args->image_hook = ap_analysis_image_hook;
+		args->finalize_hook = ap_analysis_finalize_hook;
+		args->description = _("Alignment points analysis");
+	} else {
+		args->compute_mem_limits_hook = ap_stack_compute_mem_limits;
+		args->prepare_hook = ap_stack_prepare_hook;
+		args->image_hook = ap_stack_image_hook;
+		args->finalize_hook = ap_stack_finalize_hook;
+		args->description = _("Alignment points stacking");
+	}
+	args->already_in_a_thread = TRUE;
+	args->user = apdata;
+	generic_sequence_worker(args);
+	int retval = args->retval;
+	free(args);
+	return retval;
+}
+
+static gpointer ap_stack_worker(gpointer p) {
+	struct ap_stack_args *apargs = (struct ap_stack_args *)p;
+	struct ap_data *apdata = calloc(1, sizeof(struct ap_data));
+	struct timeval t_start, t_end;
+
+	gettimeofday(&t_start, NULL);
+	if (!apdata) {
+		PRINT_ALLOC_ERR;
+		apargs->retval = 1;
+	} else {
+		apdata->apargs = apargs;
+		apdata->size = apargs->box_size;
+		apdata->ref_image = sequence_find_refimage(apargs->seq);
+		apargs->retval = ap_run_pass(apdata, TRUE);
+		if (!apargs->retval)
+			apargs->retval = ap_run_pass(apdata, FALSE);
+	}
+
+	if (!apargs->retval) {
+		if (!apargs->output_overwrite && g_file_test(apargs->output_filename, G_FILE_TEST_EXISTS)) {
+			siril_log_message(_("File %s already exists, not overwriting\n"),
+					apargs->output_filename);
+			apargs->retval = 1;
+		} else if (savefits(apargs->output_filename, apdata->result)) {
+			apargs->retval = 1;
+		} else {
+			gettimeofday(&t_end, NULL);
+			show_time(t_start, t_end);
+		}
+	}
+
+	if (apdata) {
+		ap_free_fft(apdata);
+		ap_free_accumulators(apdata);
+		free(apdata->box_x);
+		free(apdata->box_y);
+		free(apdata->window);
+		free(apdata->blend);
+		free(apdata->shiftx);
+		free(apdata->shifty);
+		free(apdata->quality);
+		free(apdata->selected);
+		if (apdata->result)
+			clearfits(apdata->result);
+		free(apdata->result);
+		free(apdata);
+	}
+	int retval = apargs->retval;
+	free_sequence(apargs->seq, TRUE);
+	g_free(apargs->output_filename);
+	free(apargs);
+	siril_add_idle(end_generic, NULL);
+	return GINT_TO_POINTER(retval);
+}
+
+void ap_stack(struct ap_stack_args *args) {
+	start_in_new_thread(ap_stack_worker, args);
+}
@@ -249,6 +249,19 @@ static int comet_align_image_hook(struct generic_seq_args *args, int out_index,
 
 	get_comet_shift(cadata->reference_date, fit->date_obs, velocity, &reg);
 
+	if (regargs->cumul && seq_frame_needs_warp(args->seq, regargs->layer, in_index)) {
+		/* the comet motion is added to the stored transformation */
+		Homography H = args->seq->regparam[regargs->layer][in_index].H;
+		H.h00 -= reg.x * H.h20;
+		H.h01 -= reg.x * H.h21;
+		H.h02 -= reg.x * H.h22;
+		H.h10 -= reg.y * H.h20;
+		H.h11 -= reg.y * H.h21;
+		H.h12 -= reg.y * H.h22;
+		set_transform(args->seq, in_index, regargs->layer, &H, fit->ry, FALSE);
+		return 0;
+	}
+
 	/* get_comet_shift does not car about orientation of image */
 	set_shifts(args->seq, in_index, regargs->layer, -reg.x, reg.y, FALSE);
 	return 0;
@@ -30,6 +30,7 @@
 #include "algos/star_finder.h"
 #include "algos/statistics.h"
 #include "algos/PSF.h"
+#include "algos/warp.h"
 #include "gui/image_display.h"
 #include "gui/PSF_list.h"
 #include "gui/progress_and_log.h"
@@ -53,6 +54,12 @@
 static void create_output_sequence_for_global_star(struct registration_args *args);
 static void print_alignment_results(Homography H, int filenum, float FWHMx, float FWHMy, char *units);
 
+/* the translation only and the transformation only modes store the
+ * registration data in the sequence instead of creating a new one */
+static gboolean has_output_sequence(struct registration_args *regargs) {
+	return !regargs->translation_only && !regargs->no_output;
+}
+
 static int get_min_requires_stars(transformation_type type) {
 	switch(type) {
 	case SHIFT_TRANSFORMATION:
@@ -87,7 +94,7 @@ int star_align_prepare_results(struct generic_seq_args *args) {
 	struct star_align_data *sadata = args->user;
 	struct registration_args *regargs = sadata->regargs;
 
-	if (!regargs->translation_only) {
+	if (has_output_sequence(regargs)) {
 		// allocate destination sequence data
 		regargs->imgparam = calloc(args->nb_filtered_images, sizeof(imgdata));
 		regargs->regparam = calloc(args->nb_filtered_images, sizeof(regdata));
@@ -153,7 +160,8 @@ static int star_align_prepare_hook(struct generic_seq_args *args) {
 	if (!sadata->current_regdata) return -2;
 	
 	/* first we're looking for stars in reference image */
-	if (seq_read_frame(args->seq, regargs->reference_image, &fit, FALSE, -1)) {
+	if (seq_read_frame_layer(args->seq, regargs->reference_image, &fit, FALSE,
+				args->single_layer_for_full ? args->layer_for_full : -1, -1)) {
 		siril_log_message(_("Could not load reference image\n"));
 		args->seq->regparam[regargs->layer] = NULL;
 		free(sadata->current_regdata);
@@ -162,11 +170,14 @@ static int star_align_prepare_hook(struct generic_seq_args *args) {
 
 	siril_log_color_message(_("Reference Image:\n"), "green");
 
+	/* the fast fit is used if it was chosen with setfindstar -fast */
+	sadata->sf = com.starfinder_conf;
+
 	if (regargs->matchSelection && regargs->selection.w > 0 && regargs->selection.h > 0) {
-		com.stars = peaker(&fit, regargs->layer, &com.starfinder_conf, &nb_stars, &regargs->selection, FALSE, TRUE);
+		com.stars = peaker(&fit, regargs->layer, &sadata->sf, &nb_stars, &regargs->selection, FALSE, TRUE);
 	}
 	else {
-		com.stars = peaker(&fit, regargs->layer, &com.starfinder_conf, &nb_stars, NULL, FALSE, TRUE);
+		com.stars = peaker(&fit, regargs->layer, &sadata->sf, &nb_stars, NULL, FALSE, TRUE);
 	}
 
 	siril_log_message(_("Found %d stars in reference, channel #%d\n"), nb_stars, regargs->layer);
@@ -189,7 +200,7 @@ static int star_align_prepare_hook(struct generic_seq_args *args) {
 	clearfits(&fit);
 
 	if (regargs->x2upscale) {
-		if (regargs->translation_only) {
+		if (!has_output_sequence(regargs)) {
 			args->seq->upscale_at_stacking = 2.0;
 		} else {
 			sadata->ref.x *= 2.0;
@@ -197,7 +208,7 @@ static int star_align_prepare_hook(struct generic_seq_args *args) {
 		}
 	}
 	else {
-		if (regargs->translation_only) {
+		if (!has_output_sequence(regargs)) {
 			args->seq->upscale_at_stacking = 1.0;
 		}
 	}
@@ -230,6 +241,15 @@ static int star_align_prepare_hook(struct generic_seq_args *args) {
 	} else {
 		sadata->fitted_stars = nb_stars;
 	}
+	/* triangles of the reference stars are the same for all frames, they
+	 * are formed once here and only read by the threads */
+	s_star *star_list;
+	int nb_ref_stars;
+	get_stars(sadata->refstars, sadata->fitted_stars, &nb_ref_stars, &star_list);
+	sadata->ref_triangles = atPrepareReference(nb_ref_stars, star_list,
+			AT_MATCH_NBRIGHT, AT_TRIANGLE_RADIUS);
+	free_stars(star_list);
+
 	FWHM_average(sadata->refstars, sadata->fitted_stars, &FWHMx, &FWHMy, &units);
 	siril_log_message(_("FWHMx:%*.2f %s\n"), 12, FWHMx, units);
 	siril_log_message(_("FWHMy:%*.2f %s\n"), 12, FWHMy, units);
@@ -255,7 +275,7 @@ static int star_align_image_hook(struct generic_seq_args *args, int out_index, i
 	Homography H = { 0 };
 	int filenum = args->seq->imgparam[in_index].filenum;	// for display purposes
 
-	if (regargs->translation_only) {
+	if (!has_output_sequence(regargs)) {
 		/* if "translation only", we choose to initialize all frames
 		 * to exclude status. If registration is ok, the status is
 		 * set to include */
@@ -269,10 +289,10 @@ static int star_align_image_hook(struct generic_seq_args *args, int out_index, i
 		}
 
 		if (regargs->matchSelection && regargs->selection.w > 0 && regargs->selection.h > 0) {
-			stars = peaker(fit, regargs->layer, &com.starfinder_conf, &nb_stars, &regargs->selection, FALSE, TRUE);
+			stars = peaker(fit, regargs->layer, &sadata->sf, &nb_stars, &regargs->selection, FALSE, TRUE);
 		}
 		else {
-			stars = peaker(fit, regargs->layer, &com.starfinder_conf, &nb_stars, NULL, FALSE, TRUE);
+			stars = peaker(fit, regargs->layer, &sadata->sf, &nb_stars, NULL, FALSE, TRUE);
 		}
 
 		siril_log_message(_("Found %d stars in image %d, channel #%d\n"), nb_stars, filenum, regargs->layer);
@@ -300,7 +320,7 @@ static int star_align_image_hook(struct generic_seq_args *args, int out_index, i
 		retvalue = 1;
 		s_star star_list_A, star_list_B;
 		while (retvalue && attempt < NB_OF_MATCHING_TRY){
-			retvalue = new_star_match(stars, sadata->refstars, nbpoints, nobj,
+			retvalue = new_star_match(stars, sadata->refstars, sadata->ref_triangles, nbpoints, nobj,
 					scale_min, scale_max, &H, FALSE, regargs->type,
 					&star_list_A, &star_list_B);
 			if (attempt == 1) {
@@ -359,8 +379,8 @@ static int star_align_image_hook(struct generic_seq_args *args, int out_index, i
 				* (((double) sadata->fitted_stars) - (double) H.Inliers)
 				/ (double) sadata->fitted_stars + FWHMx;
 
-		if (!regargs->translation_only) {
-			if (cvTransformImage(fit, sadata->ref.x, sadata->ref.y, H, regargs->x2upscale, regargs->interpolation)) {
+		if (has_output_sequence(regargs)) {
+			if (warp_image(fit, sadata->ref.x, sadata->ref.y, &H, regargs->x2upscale, regargs->interpolation)) {
 				free_fitted_stars(stars);
 				return 1;
 			}
@@ -369,13 +389,13 @@ static int star_align_image_hook(struct generic_seq_args *args, int out_index, i
 		free_fitted_stars(stars);
 	}
 	else {
-		if (regargs->x2upscale && !regargs->translation_only) {
+		if (regargs->x2upscale && has_output_sequence(regargs)) {
 			if (cvResizeGaussian(fit, fit->rx * 2, fit->ry * 2, OPENCV_NEAREST))
 				return 1;
 		}
 	}
 
-	if (!regargs->translation_only) {
+	if (has_output_sequence(regargs)) {
 		regargs->imgparam[out_index].filenum = args->seq->imgparam[in_index].filenum;
 		regargs->imgparam[out_index].incl = SEQUENCE_DEFAULT_INCLUDE;
 		regargs->regparam[out_index].fwhm = sadata->current_regdata[in_index].fwhm;	// not FWHMx because of the ref frame
@@ -388,6 +408,11 @@ static int star_align_image_hook(struct generic_seq_args *args, int out_index, i
 			regargs->regparam[out_index].fwhm *= 2.0;
 			regargs->regparam[out_index].weighted_fwhm *= 2.0;
 		}
+	} else if (regargs->no_output) {
+		if (in_index == regargs->reference_image)
+			H.h00 = H.h11 = H.h22 = 1.0;
+		set_transform(args->seq, in_index, regargs->layer, &H, fit->ry, fit->top_down);
+		args->seq->imgparam[out_index].incl = SEQUENCE_DEFAULT_INCLUDE;
 	} else {
 		set_shifts(args->seq, in_index, regargs->layer, (float) H.h02,
 				(float) -H.h12, fit->top_down);
@@ -406,6 +431,8 @@ int star_align_finalize_hook(struct generic_seq_args *args) {
 	fix_selnum(args->seq, FALSE);
 
 	free_fitted_stars(sadata->refstars);
+	atFreeReference(sadata->ref_triangles);
+	sadata->ref_triangles = NULL;
 
 	if (!args->retval) {
 		for (i = 0; i < args->nb_filtered_images; i++)
@@ -413,7 +440,7 @@ int star_align_finalize_hook(struct generic_seq_args *args) {
 				failed++;
 		regargs->new_total = args->nb_filtered_images - failed;
 
-		if (!regargs->translation_only) {
+		if (has_output_sequence(regargs)) {
 			if (failed) {
 				// regargs->imgparam and regargs->regparam may have holes caused by images
 				// that failed to be registered - compact them
@@ -460,7 +487,7 @@ int star_align_finalize_hook(struct generic_seq_args *args) {
 		siril_log_color_message(_("Total: %d failed, %d registered.\n"), "green", failed, regargs->new_total);
 
 		g_free(str);
-		if (!regargs->translation_only) {
+		if (has_output_sequence(regargs)) {
 			// explicit sequence creation to copy imgparam and regparam
 			create_output_sequence_for_global_star(regargs);
 			// will be loaded in the idle function if (load_new_sequence)
@@ -491,8 +518,8 @@ int star_align_compute_mem_limits(struct generic_seq_args *args, gboolean for_wr
 		 * the reference channel to act as input and output of the filter as float O(2m
 		 * as float).
 		 * Then, the image is rotated and upscaled by the generic function if enabled:
-		 * cvTransformImage is O(n) in mem for unscaled, O(nscaled)=O(4m) for
-		 * monochrome scaled and O(2nscaled)=O(21m) for color scaled
+		 * warp_image is O(n) in mem for unscaled, O(nscaled)=O(4m) for
+		 * monochrome scaled and at most O(2nscaled)=O(21m) for color scaled
 		 * All this is in addition to the image being already loaded, except for the
 		 * color scaled image.
 		 *
@@ -582,7 +609,10 @@ int register_star_alignment(struct registration_args *regargs) {
 	args->finalize_hook = star_align_finalize_hook;
 	args->stop_on_error = FALSE;
 	args->description = _("Global star registration");
-	args->has_output = !regargs->translation_only;
+	args->has_output = has_output_sequence(regargs);
+	/* without output, only the registration layer of CFA SER is needed */
+	args->single_layer_for_full = !args->has_output;
+	args->layer_for_full = regargs->layer;
 	args->output_type = get_data_type(args->seq->bitpix);
 	args->upscale_ratio = regargs->x2upscale ? 2.0 : 1.0;
 	args->new_seq_prefix = regargs->prefix;
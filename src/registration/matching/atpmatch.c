@@ -133,6 +133,11 @@
  *             statement in make_vote_matrix.
  *             June 26, 2010
  *           Michael Richmond
+ *
+ *           Store the star-star distances in a single flat array, and
+ *             look for matching triangles in a grid hash over the
+ *             (b/a, c/a) triangle space instead of a binary search on
+ *             (b/a) followed by a linear scan.
  */
 
 #include "core/siril.h"
@@ -183,6 +188,23 @@
  * the following are "private" functions, used internally only.
  */
 
+/*
+ * uniform grid hash over the (b/a, c/a) triangle space, used to find
+ * the candidate matches of a triangle.  Cells are at least "max_radius"
+ * wide, so all the matches of a triangle lie in the 3x3 cells around
+ * its own cell.  Triangles of a cell are stored contiguously, with
+ * their coordinates, in flat arrays.
+ */
+#define TRIANGLE_GRID_MAX_CELLS  1024   /* per axis */
+
+typedef struct triangle_grid {
+	int nx, ny;          /* number of cells along b/a and c/a */
+	double cell_size;    /* width of a cell in triangle space */
+	int *cell_start;     /* nx*ny + 1 offsets of the cells in "items" */
+	int *items;          /* indices of the triangles, grouped by cell */
+	double *ba, *ca;     /* coordinates of the triangles, in "items" order */
+} triangle_grid;
+
 /* this typedef is used several sorting routines */
 typedef int (*PFI)();
 
@@ -193,13 +215,12 @@ static void free_star_array(s_star *array);
 #ifdef DEBUG
 static void print_star_array(s_star *array, int num);
 #endif
-static double **calc_distances(s_star *star_array, int numstars);
-static void free_distances(double **array, int num);
+static double *calc_distances(s_star *star_array, int numstars);
 #ifdef DEBUG
-static void print_dist_matrix(double **matrix, int num);
+static void print_dist_matrix(double *matrix, int num);
 #endif
 static void set_triangle(s_triangle *triangle, s_star *star_array, int i, int j,
-		int k, double **dist_matrix);
+		int k, double *dist_matrix, int numstars);
 #ifdef DEBUG2
 static void print_triangle_array(s_triangle *t_array, int numtriangles,
 		s_star *star_array, int numstars);
@@ -213,16 +234,19 @@ static int compare_star_by_x(s_star *star1, s_star *star2);
 static void sort_star_by_match_id(s_star *array, int num);
 static int compare_star_by_match_id(s_star *star1, s_star *star2);
 static int fill_triangle_array(s_star *star_array, int numstars,
-		double **dist_matrix, int numtriangles, s_triangle *t_array);
+		double *dist_matrix, int numtriangles, s_triangle *t_array);
 static void sort_triangle_array(s_triangle *array, int num);
 static int compare_triangle(s_triangle *triangle1, s_triangle *triangle2);
-static int find_ba_triangle(s_triangle *array, int num, double ba0);
+static int build_triangle_grid(triangle_grid *grid, s_triangle *t_array,
+		int numtriangles, int nbright, double cell_size);
+static void free_triangle_grid(triangle_grid *grid);
 static void prune_triangle_array(s_triangle *t_array, int *numtriangles);
 static int **make_vote_matrix(s_star *star_array_A, int num_stars_A,
 		s_star *star_array_B, int num_stars_B, s_triangle *t_array_A,
-		int num_triangles_A, s_triangle *t_array_B, int num_triangles_B,
-		int nbright, double radius, double min_scale, double max_scale,
-		double rotation_deg, double tolerance_deg);
+		int num_triangles_A, s_triangle *t_array_B,
+		const triangle_grid *grid_B, int nbright, double radius,
+		double min_scale, double max_scale, double rotation_deg,
+		double tolerance_deg);
 #ifdef DEBUG
 static void print_vote_matrix(int **vote_matrix, int numcells);
 #endif
@@ -324,6 +348,11 @@ static int calc_trans_cubic(int nbright, s_star *star_array_A, int num_stars_A,
  * functions to perform actual tasks.  It mostly creates the proper
  * inputs and outputs for the smaller routines.
  *
+ * If "refB" is given, and was prepared from the same stars as the
+ * first "numB" stars of list B, with enough of them and a large
+ * enough radius, its triangles and grid are used instead of forming
+ * those of list B again.
+ *
  * RETURN:
  *    SH_SUCCESS         if all goes well
  *    SH_GENERIC_ERROR   if an error occurs
@@ -335,6 +364,8 @@ int atFindTrans(int numA, /* I: number of stars in list A */
 struct s_star *listA, /* I: match this set of objects with list B */
 int numB, /* I: number of stars in list B */
 struct s_star *listB, /* I: match this set of objects with list A */
+const s_match_reference *refB, /* I: if not NULL, triangles of list B */
+/*       prepared by atPrepareReference */
 double radius, /* I: max radius in triangle-space allowed for */
 /*       a pair of triangles to match */
 int nobj, /* I: max number of bright stars to use in creating */
@@ -370,6 +401,8 @@ TRANS *trans /* O: place into this TRANS structure's fields */
 	s_star *star_array_B;
 	s_triangle *triangle_array_A = NULL;
 	s_triangle *triangle_array_B = NULL;
+	triangle_grid grid_B = { 0 };
+	const triangle_grid *grid = &grid_B;
 
 	num_stars_A = numA;
 	num_stars_B = numB;
@@ -438,6 +471,27 @@ TRANS *trans /* O: place into this TRANS structure's fields */
 	/* this is a sanity check on the above checks */
 	g_assert((nbright >= start_pairs) && (nbright <= min));
 
+	/* the reference triangles can only be used if they cover this call */
+	if (refB != NULL && (numB > refB->num_stars || nbright > refB->nbright
+			|| radius > refB->radius)) {
+		refB = NULL;
+	}
+	if (refB != NULL) {
+		/*
+		 * the stars of the reference are sorted by magnitude, their
+		 * first numB must be the numB stars of list B
+		 */
+		for (i = 0; i < numB; i++) {
+			if (refB->star_array[i].match_id >= numB) {
+				refB = NULL;
+				break;
+			}
+		}
+	}
+	if (refB != NULL) {
+		copy_star_array(refB->star_array, star_array_B, numB);
+	}
+
 #ifdef DEBUG
 	printf("here comes star array A\n");
 	print_star_array(star_array_A, num_stars_A);
@@ -452,18 +506,38 @@ TRANS *trans /* O: place into this TRANS structure's fields */
 	triangle_array_A = stars_to_triangles(star_array_A, num_stars_A, nbright,
 			&num_triangles_A);
 	g_assert(triangle_array_A != NULL);
-	triangle_array_B = stars_to_triangles(star_array_B, num_stars_B, nbright,
-			&num_triangles_B);
-	g_assert(triangle_array_B != NULL);
+	if (refB == NULL) {
+		triangle_array_B = stars_to_triangles(star_array_B, num_stars_B,
+				nbright, &num_triangles_B);
+		g_assert(triangle_array_B != NULL);
+	}
 
 	/*
 	 * Now we prune the triangle arrays to eliminate those with
 	 * ratios (b/a) > AT_MATCH_RATIO,
 	 * since Valdes et al. say that this speeds things up and eliminates
 	 * lots of closely-packed triangles.
+	 *
+	 * The triangles of list B are placed in a grid over the triangle
+	 * space, to find quickly those matching the triangles of list A.
 	 */
 	prune_triangle_array(triangle_array_A, &num_triangles_A);
-	prune_triangle_array(triangle_array_B, &num_triangles_B);
+	if (refB == NULL) {
+		prune_triangle_array(triangle_array_B, &num_triangles_B);
+		if (build_triangle_grid(&grid_B, triangle_array_B, num_triangles_B,
+				nbright, radius) != SH_SUCCESS) {
+			shError("atFindTrans: build_triangle_grid fails");
+			free_star_array(star_array_A);
+			free_star_array(star_array_B);
+			shFree(triangle_array_A);
+			shFree(triangle_array_B);
+			return (SH_GENERIC_ERROR);
+		}
+	} else {
+		triangle_array_B = refB->triangles;
+		num_triangles_B = refB->num_triangles;
+		grid = refB->grid;
+	}
 #ifdef DEBUG2
 	printf("after pruning, here comes triangle array A\n");
 	print_triangle_array(triangle_array_A, num_triangles_A,
@@ -491,8 +565,13 @@ TRANS *trans /* O: place into this TRANS structure's fields */
 	 */
 	vote_matrix = make_vote_matrix(star_array_A, num_stars_A, star_array_B,
 			num_stars_B, triangle_array_A, num_triangles_A, triangle_array_B,
-			num_triangles_B, nbright, radius, min_scale, max_scale,
+			grid, nbright, radius, min_scale, max_scale,
 			rotation_deg, tolerance_deg);
+	if (refB == NULL) {
+		free_triangle_grid(&grid_B);
+		shFree(triangle_array_B);
+	}
+	triangle_array_B = NULL;
 
 	/*
 	 * having made the vote_matrix, we next need to pick the
@@ -587,6 +666,93 @@ TRANS *trans /* O: place into this TRANS structure's fields */
 	return (SH_SUCCESS);
 }
 
+/************************************************************************
+ * <AUTO EXTRACT>
+ *
+ * ROUTINE: atPrepareReference
+ *
+ * DESCRIPTION:
+ * Form once the triangles of a list of stars which will be matched
+ * against many other lists with atFindTrans, like the stars of the
+ * reference frame of a sequence.  The stars are sorted by magnitude,
+ * the triangles of the 'nbright' brightest ones are formed, pruned
+ * and placed in a grid for matches within "radius" in triangle space.
+ *
+ * The result is never modified by atFindTrans, so it can be shared
+ * by several threads.  It must be freed with atFreeReference.
+ *
+ * RETURN:
+ *    s_match_reference *      the prepared reference
+ *    NULL                     if an error occurs
+ *
+ * </AUTO>
+ */
+
+s_match_reference *atPrepareReference(int num, /* I: number of stars in list */
+s_star *list, /* I: reference list of stars */
+int nbright, /* I: max number of bright stars to use in creating */
+/*       triangles */
+double radius /* I: max radius in triangle-space of the matches */
+) {
+	s_match_reference *ref;
+
+	if (num < 3 || list == NULL) {
+		shError("atPrepareReference: only %d stars in list", num);
+		return (NULL);
+	}
+	if (nbright > num) {
+		nbright = num;
+	}
+
+	ref = (s_match_reference *) shMalloc(sizeof(s_match_reference));
+	ref->grid = (triangle_grid *) shMalloc(sizeof(triangle_grid));
+	ref->num_stars = num;
+	ref->nbright = nbright;
+	ref->radius = radius;
+
+	/* stars_to_triangles sorts the array by magnitude */
+	ref->star_array = list_to_array(num, list);
+	ref->triangles = stars_to_triangles(ref->star_array, num, nbright,
+			&ref->num_triangles);
+	prune_triangle_array(ref->triangles, &ref->num_triangles);
+	if (build_triangle_grid(ref->grid, ref->triangles, ref->num_triangles,
+			nbright, radius) != SH_SUCCESS) {
+		shFree(ref->grid);
+		ref->grid = NULL;
+		atFreeReference(ref);
+		return (NULL);
+	}
+	return (ref);
+}
+
+/************************************************************************
+ * <AUTO EXTRACT>
+ *
+ * ROUTINE: atFreeReference
+ *
+ * DESCRIPTION:
+ * Release a reference prepared by atPrepareReference.
+ *
+ * RETURN:
+ *    nothing
+ *
+ * </AUTO>
+ */
+
+void atFreeReference(s_match_reference *ref /* I: reference to release */
+) {
+	if (ref == NULL) {
+		return;
+	}
+	if (ref->grid != NULL) {
+		free_triangle_grid(ref->grid);
+		shFree(ref->grid);
+	}
+	free_star_array(ref->star_array);
+	shFree(ref->triangles);
+	shFree(ref);
+}
+
 int atPrepareHomography(int numA, /* I: number of stars in list A */
 		struct s_star *listA, /* I: match this set of objects with list B */
 		int numB, /* I: number of stars in list B */
@@ -1193,27 +1359,27 @@ print_star_array
  * ROUTINE: calc_distances
  *
  * DESCRIPTION:
- * Given an array of N='numstars' s_star structures, create a 2-D array
- * called "matrix" with NxN elements and fill it by setting
+ * Given an array of N='numstars' s_star structures, create a flat
+ * array called "matrix" with NxN elements and fill it by setting
  *
- *         matrix[i][j] = distance between stars i and j
+ *         matrix[i * N + j] = distance between stars i and j
  *
  * where 'i' and 'j' are the indices of their respective stars in
- * the 1-D array.
+ * the 1-D array.  The caller frees it with shFree.
  *
  * RETURN:
- *    double **array      pointer to array of pointers to each row of array
+ *    double *matrix      pointer to the first row of the array
  *    NULL                if something goes wrong.
  *
  * </AUTO>
  */
 
-static double **
+static double *
 calc_distances(s_star *star_array, /* I: array of s_stars */
 int numstars /* I: with this many elements */
 ) {
 	int i, j;
-	double **matrix;
+	double *matrix;
 	double dx, dy, dist;
 
 	if (numstars == 0) {
@@ -1221,11 +1387,8 @@ int numstars /* I: with this many elements */
 		return (NULL);
 	}
 
-	/* allocate the array, row-by-row */
-	matrix = (double **) shMalloc(numstars * sizeof(double *));
-	for (i = 0; i < numstars; i++) {
-		matrix[i] = (double *) shMalloc(numstars * sizeof(double));
-	}
+	/* allocate the array in a single block */
+	matrix = (double *) shMalloc(numstars * numstars * sizeof(double));
 
 	/* fill up the array */
 	for (i = 0; i < numstars - 1; i++) {
@@ -1233,45 +1396,19 @@ int numstars /* I: with this many elements */
 			dx = star_array[i].x - star_array[j].x;
 			dy = star_array[i].y - star_array[j].y;
 			dist = sqrt(dx * dx + dy * dy);
-			matrix[i][j] = (double) dist;
-			matrix[j][i] = (double) dist;
+			matrix[i * numstars + j] = dist;
+			matrix[j * numstars + i] = dist;
 		}
 	}
 	/* for safety's sake, let's fill the diagonal elements with zeros */
 	for (i = 0; i < numstars; i++) {
-		matrix[i][i] = 0.0;
+		matrix[i * numstars + i] = 0.0;
 	}
 
 	/* okay, we're done.  return a pointer to the array */
 	return (matrix);
 }
 
-/************************************************************************
- *
- *
- * ROUTINE: free_distances
- *
- * DESCRIPTION:
- * Given a 2-D array of "num"-by-"num" double elements, free up
- * each row of the array, then free the array itself.
- *
- * RETURN:
- *    nothing
- *
- * </AUTO>
- */
-
-static void free_distances(double **array, /* I: square array we'll free */
-int num /* I: number of elems in each row */
-) {
-	int i;
-
-	for (i = 0; i < num; i++) {
-		shFree(array[i]);
-	}
-	shFree(array);
-}
-
 /************************************************************************
  *
  *
@@ -1294,16 +1431,15 @@ int num /* I: number of elems in each row */
 static void
 print_dist_matrix
 (
-		double **matrix, /* I: pointer to start of 2-D square array */
+		double *matrix, /* I: pointer to start of 2-D square array */
 		int num /* I: number of rows and columns in the array */
 )
 {
 	int i, j;
 
 	for (i = 0; i < num; i++) {
-		g_assert(matrix[i] != NULL);
 		for (j = 0; j < num; j++) {
-			printf("%11.4e ", matrix[i][j]);
+			printf("%11.4e ", matrix[i * num + j]);
 		}
 		printf("\n");
 	}
@@ -1337,7 +1473,8 @@ s_star *star_array, /* use stars in this array as vertices */
 int s1, /* index in 'star_array' of one vertex */
 int s2, /* index in 'star_array' of one vertex */
 int s3, /* index in 'star_array' of one vertex */
-double **darray /* array of distances between stars */
+double *darray, /* array of distances between stars */
+int numstars /* number of rows and columns of 'darray' */
 ) {
 	static int id_number = 0;
 	double d12, d23, d13;
@@ -1368,9 +1505,9 @@ double **darray /* array of distances between stars */
 	 * for convenience.
 	 *
 	 */
-	d12 = darray[s1][s2];
-	d23 = darray[s2][s3];
-	d13 = darray[s1][s3];
+	d12 = darray[s1 * numstars + s2];
+	d23 = darray[s2 * numstars + s3];
+	d13 = darray[s1 * numstars + s3];
 
 	/* sanity check */
 	g_assert(d12 >= 0.0);
@@ -1546,7 +1683,7 @@ int nbright, /* I: use only the 'nbright' brightest stars */
 int *numtriangles /* O: number of triangles we create */
 ) {
 	int numt;
-	double **dist_matrix;
+	double *dist_matrix;
 	s_triangle *triangle_array;
 
 	/*
@@ -1573,7 +1710,7 @@ int *numtriangles /* O: number of triangles we create */
 
 	/*
 	 * calculate the distances between each pair of stars, placing them
-	 * into the newly-created 2D array called "dist_matrix".  Note that
+	 * into the newly-created flat 2D array called "dist_matrix".  Note that
 	 * we only need to include the first 'nbright' stars in the
 	 * distance calculations.
 	 */
@@ -1610,7 +1747,7 @@ int *numtriangles /* O: number of triangles we create */
 	 * now get rid of the "dist_matrix" array.  We won't need it
 	 * any more.
 	 */
-	free_distances(dist_matrix, nbright);
+	shFree(dist_matrix);
 
 	return (triangle_array);
 }
@@ -1815,7 +1952,7 @@ s_star *star2 /* I:  ... with THIS star  */
 
 static int fill_triangle_array(s_star *star_array, /* I: array of stars we use to form triangles */
 int numstars, /* I: use this many stars from the array */
-double **dist_matrix, /* I: numstars-by-numstars matrix of distances */
+double *dist_matrix, /* I: numstars-by-numstars matrix of distances */
 /*       between stars in the star_array */
 int numtriangles, /* I: number of triangles in the t_array */
 s_triangle *t_array /* O: we'll fill properties of triangles in  */
@@ -1832,7 +1969,8 @@ s_triangle *t_array /* O: we'll fill properties of triangles in  */
 			for (k = j + 1; k < numstars; k++) {
 
 				triangle = &(t_array[n]);
-				set_triangle(triangle, star_array, i, j, k, dist_matrix);
+				set_triangle(triangle, star_array, i, j, k, dist_matrix,
+						numstars);
 
 				n++;
 			}
@@ -1901,76 +2039,120 @@ s_triangle *triangle2 /* I:  ... with THIS triangle  */
 /************************************************************************
  *
  *
- * ROUTINE: find_ba_triangle
+ * ROUTINE: build_triangle_grid
  *
  * DESCRIPTION:
- * Given an array of "num" s_triangle structures, which have already
- * been sorted in order of increasing "ba" value, and given one
- * particular "ba" value ba0, return the index of the first triangle
- * in the array which has "ba" >= ba0.
- *
- * We use a binary search, on the "ba" element of each structure.
- *
- * If there is no such triangle, just return the index of the last
- * triangle in the list.
+ * Given an array of "numtriangles" s_triangle structures, place
+ * them into a uniform grid over the (b/a, c/a) triangle space, with
+ * cells of width at least "cell_size".  Triangles which have a vertex
+ * with index greater than "nbright" are left out.
  *
- * Calls the "compare_triangle" function, above.
+ * The triangles are distributed with a counting sort, so that each
+ * cell is a contiguous range of the flat "items", "ba" and "ca"
+ * arrays.  The grid must be released with "free_triangle_grid".
  *
  * RETURN:
- *    index of closest triangle in array         if all goes well
- *    index of last triangle in array            if nothing close
+ *    SH_SUCCESS           if all goes well
+ *    SH_GENERIC_ERROR     if error occurs
  *
  * </AUTO>
  */
 
-static int find_ba_triangle(s_triangle *array, /* I: array of structures which been sorted */
-int num, /* I: number of triangles in the array */
-double ba0 /* I: value of "ba" we seek */
+static int build_triangle_grid(triangle_grid *grid, /* O: grid to fill */
+s_triangle *t_array, /* I: array of triangles to place in the grid */
+int numtriangles, /* I: number of triangles in t_array */
+int nbright, /* I: ignore triangles with a vertex beyond this */
+double cell_size /* I: minimum width of a cell, in triangle space */
 ) {
-	int top, bottom, mid;
-
-#ifdef DEBUG2
-	printf("find_ba_triangle: looking for ba = %.2f\n", ba0);
-#endif
-
-	top = 0;
-	if ((bottom = num - 1) < 0) {
-		bottom = 0;
+	int i, c, n, gx, gy, ncells;
+	int *cells;
+	s_triangle *tri;
+
+	g_assert(grid != NULL);
+
+	/* both ratios lie in [0, 1] */
+	n = (cell_size > 0.0) ? (int) (1.0 / cell_size) : 1;
+	if (n < 1) {
+		n = 1;
+	}
+	if (n > TRIANGLE_GRID_MAX_CELLS) {
+		n = TRIANGLE_GRID_MAX_CELLS;
+	}
+	grid->nx = grid->ny = n;
+	grid->cell_size = 1.0 / n;
+	ncells = grid->nx * grid->ny;
+
+	grid->cell_start = (int *) calloc(ncells + 1, sizeof(int));
+	grid->items = (int *) shMalloc((numtriangles + 1) * sizeof(int));
+	grid->ba = (double *) shMalloc((numtriangles + 1) * sizeof(double));
+	grid->ca = (double *) shMalloc((numtriangles + 1) * sizeof(double));
+	cells = (int *) shMalloc((numtriangles + 1) * sizeof(int));
+	if (grid->cell_start == NULL) {
+		shError("build_triangle_grid: failed to allocate %d cells", ncells);
+		shFree(cells);
+		free_triangle_grid(grid);
+		return (SH_GENERIC_ERROR);
 	}
 
-	while (bottom - top > 2) {
-		mid = (top + bottom) / 2;
-#ifdef DEBUG2
-		printf(" array[%4d] ba=%.2f   array[%4d] ba=%.2f  array[%4d] ba=%.2f\n",
-				top, array[top].ba, mid, array[mid].ba,
-				bottom, array[bottom].ba);
-#endif
-		if (array[mid].ba < ba0) {
-			top = mid;
-		} else {
-			bottom = mid;
+	/* count the triangles of each cell */
+	for (i = 0; i < numtriangles; i++) {
+		tri = &(t_array[i]);
+		if ((tri->a_index >= nbright) || (tri->b_index >= nbright)
+				|| (tri->c_index >= nbright)) {
+			cells[i] = -1;
+			continue;
 		}
+		gx = MIN((int) (tri->ba / grid->cell_size), grid->nx - 1);
+		gy = MIN((int) (tri->ca / grid->cell_size), grid->ny - 1);
+		c = gy * grid->nx + gx;
+		cells[i] = c;
+		grid->cell_start[c + 1]++;
 	}
-#ifdef DEBUG2
-	printf(" array[%4d] ba=%.2f                       array[%4d] ba=%.2f\n",
-			top, array[top].ba, bottom, array[bottom].ba);
-#endif
 
-	/*
-	 * if we get here, then the item we seek is either "top" or "bottom"
-	 * (which may point to the same item in the array).
-	 */
-	if (array[top].ba < ba0) {
-#ifdef DEBUG2
-		printf(" returning array[%4d] ba=%.2f \n", bottom, array[bottom].ba);
-#endif
-		return (bottom);
-	} else {
-#ifdef DEBUG2
-		printf(" returning array[%4d] ba=%.2f \n", top, array[top].ba);
-#endif
-		return (top);
+	/* prefix sum, then place each triangle in its cell */
+	for (c = 0; c < ncells; c++) {
+		grid->cell_start[c + 1] += grid->cell_start[c];
+	}
+	for (i = 0; i < numtriangles; i++) {
+		if ((c = cells[i]) < 0) {
+			continue;
+		}
+		n = grid->cell_start[c]++;
+		grid->items[n] = i;
+		grid->ba[n] = t_array[i].ba;
+		grid->ca[n] = t_array[i].ca;
+	}
+	/* each start was moved to the next cell's start, shift them back */
+	for (c = ncells; c > 0; c--) {
+		grid->cell_start[c] = grid->cell_start[c - 1];
 	}
+	grid->cell_start[0] = 0;
+
+	shFree(cells);
+	return (SH_SUCCESS);
+}
+
+/************************************************************************
+ *
+ *
+ * ROUTINE: free_triangle_grid
+ *
+ * DESCRIPTION:
+ * Release the arrays of a grid filled by "build_triangle_grid".
+ *
+ * RETURN:
+ *    nothing
+ *
+ * </AUTO>
+ */
+
+static void free_triangle_grid(triangle_grid *grid /* I: grid to release */
+) {
+	free(grid->cell_start);
+	shFree(grid->items);
+	shFree(grid->ba);
+	shFree(grid->ca);
+	memset(grid, 0, sizeof(triangle_grid));
 }
 
 /************************************************************************
@@ -2034,6 +2216,10 @@ int *numtriangles /* I/O: number of triangles in the t_array */
  *
  *     sqrt[ (t1.ba - t2.ba)^2 + (t1.ca - t2.ca)^2 ] <= max_radius
  *
+ * The triangles of array B are looked up in "grid_B", a grid over
+ * the triangle space built by "build_triangle_grid" with cells at
+ * least "max_radius" wide.
+ *
  * Note that there may be more than one triangle from array A which
  * matches a particular triangle from array B!  That's okay --
  * we treat any 2 which satisfy the above equation as "matched".
@@ -2075,7 +2261,7 @@ int num_stars_B, /* I: number of stars in star_array_B  */
 s_triangle *t_array_A, /* I: array of triangles from star_array_A */
 int num_triangles_A, /* I: number of triangles in t_array_A */
 s_triangle *t_array_B, /* I: array of triangles from star_array_B */
-int num_triangles_B, /* I: number of triangles in t_array_B */
+const triangle_grid *grid_B, /* I: grid over the triangles of t_array_B */
 int nbright, /* I: consider at most this many stars */
 /*       from each array; also the size */
 /*       of the output "vote_matrix". */
@@ -2091,9 +2277,9 @@ double rotation_deg, /* I: desired relative angle of coord systems (deg) */
 double tolerance_deg /* I: allowed range of orientation angles (deg) */
 /*       if AT_MATCH_NOANGLE, any orientation is allowed */
 ) {
-	int i, j, start_index;
+	int i, j, p, c, gx, gy, x, y;
 	int **vote_matrix;
-	double ba_A, ba_B, ca_A, ca_B, ba_min, ba_max;
+	double ba_A, ba_B, ca_A, ca_B;
 	double rad2;
 	double ratio;
 	double actual_angle_deg;
@@ -2103,6 +2289,7 @@ double tolerance_deg /* I: allowed range of orientation angles (deg) */
 	g_assert(star_array_B != NULL);
 	g_assert(t_array_A != NULL);
 	g_assert(t_array_B != NULL);
+	g_assert(grid_B != NULL);
 	g_assert(nbright > 0);
 	if (min_scale != -1) {
 		g_assert((max_scale != -1) && (min_scale <= max_scale));
@@ -2121,25 +2308,19 @@ double tolerance_deg /* I: allowed range of orientation angles (deg) */
 	}
 
 	/*
-	 * now, the triangles in "t_array_A" have been sorted by their "ba"
-	 * values.  Therefore, we walk through the OTHER array, "t_array_B",
-	 * and for each triangle tri_B in it
-	 *
-	 *      1a. set  ba_min = tri_B.ba - max_radius
-	 *      1b. set  ba_max = tri_B.ba + max_radius
+	 * now, the triangles of "t_array_B" have been placed in a grid over
+	 * the (ba, ca) triangle space, with cells at least "max_radius"
+	 * wide.  Therefore, we walk through the OTHER array, "t_array_A",
+	 * and for each triangle tri_A in it
 	 *
-	 * We'll use these values to limit our selection from t_array_A.
-	 *
-	 *      2. find the first triangle in t_array_A which has
-	 *                     ba > ba_min
-	 *      3. starting there, step through t_array_A, calculating the
-	 *                     Euclidean distance between tri_B and
-	 *                     the current triangle from array A.
-	 *      4. stop stepping through t_array_A when we each a triangle
-	 *                     with ba > ba_max
+	 *      1. find the cell of the grid containing tri_A
+	 *      2. step through the triangles of array B in this cell and
+	 *                     the 8 cells around it, calculating the
+	 *                     Euclidean distance between tri_A and
+	 *                     each of them.
 	 */
 	rad2 = max_radius * max_radius;
-	for (j = 0; j < num_triangles_B; j++) {
+	for (i = 0; i < num_triangles_A; i++) {
 
 		/*
 		 * make sure that this triangle doesn't have a vertex with index
@@ -2150,94 +2331,87 @@ double tolerance_deg /* I: allowed range of orientation angles (deg) */
 		 *             num_stars_A > nbright
 		 * or
 		 *             num_stars_B > nbright
+		 *
+		 * or when the grid of B was built for more than nbright stars.
 		 */
-		tri = &(t_array_B[j]);
+		tri = &(t_array_A[i]);
 		if ((tri->a_index >= nbright) || (tri->b_index >= nbright)
 				|| (tri->c_index >= nbright)) {
 #ifdef DEBUG2
-			printf("make_vote_matrix: skipping B triangle %d\n", j);
+			printf("make_vote_matrix: skipping A triangle %d\n", i);
 #endif
 			continue;
 		}
 
 #ifdef DEBUG2
-		printf("make_vote_matrix: looking for matches to B %d\n", j);
+		printf("make_vote_matrix: looking for matches to A %d\n", i);
 #endif
-		ba_B = t_array_B[j].ba;
-		ca_B = t_array_B[j].ca;
-		ba_min = ba_B - max_radius;
-		ba_max = ba_B + max_radius;
-#ifdef DEBUG2
-		printf("   ba_min = %7.3f  ba_max = %7.3f\n", ba_min, ba_max);
-#endif
-
-		start_index = find_ba_triangle(t_array_A, num_triangles_A, ba_min);
-		for (i = start_index; i < num_triangles_A; i++) {
-
-			/*
-			 * again, skip any triangle which has a vertex with ID > nbright
-			 */
-			tri = &(t_array_A[i]);
-			if ((tri->a_index >= nbright) || (tri->b_index >= nbright)
-					|| (tri->c_index >= nbright)) {
-#ifdef DEBUG2
-				printf("make_vote_matrix: skipping A triangle %d\n", i);
-#endif
-				continue;
-			}
+		ba_A = t_array_A[i].ba;
+		ca_A = t_array_A[i].ca;
+		gx = MIN((int) (ba_A / grid_B->cell_size), grid_B->nx - 1);
+		gy = MIN((int) (ca_A / grid_B->cell_size), grid_B->ny - 1);
+
+		for (y = MAX(gy - 1, 0); y <= MIN(gy + 1, grid_B->ny - 1); y++) {
+			for (x = MAX(gx - 1, 0); x <= MIN(gx + 1, grid_B->nx - 1); x++) {
+				c = y * grid_B->nx + x;
+				for (p = grid_B->cell_start[c]; p < grid_B->cell_start[c + 1]; p++) {
+					ba_B = grid_B->ba[p];
+					ca_B = grid_B->ca[p];
+
+					if ((ba_A - ba_B) * (ba_A - ba_B)
+							+ (ca_A - ca_B) * (ca_A - ca_B) >= rad2) {
+						continue;
+					}
 
+					/* again, skip any triangle which has a vertex with ID > nbright */
+					j = grid_B->items[p];
+					tri = &(t_array_B[j]);
+					if ((tri->a_index >= nbright) || (tri->b_index >= nbright)
+							|| (tri->c_index >= nbright)) {
+						continue;
+					}
 #ifdef DEBUG2
-			printf("   looking at A %d\n", i);
+					printf("   looking at B %d\n", j);
 #endif
-			ba_A = t_array_A[i].ba;
-			ca_A = t_array_A[i].ca;
-
-			/* check to see if we can stop looking through A yet */
-			if (ba_A > ba_max) {
-				break;
-			}
 
-			if ((ba_A - ba_B) * (ba_A - ba_B) + (ca_A - ca_B) * (ca_A - ca_B)
-					< rad2) {
-
-				/*
-				 * check the ratio of lengths of side "a", and discard this
-				 * candidate if its outside the allowed range
-				 */
-				if (min_scale != -1) {
-					ratio = t_array_A[i].a_length / t_array_B[j].a_length;
-					if (ratio < min_scale || ratio > max_scale) {
-						continue;
+					/*
+					 * check the ratio of lengths of side "a", and discard this
+					 * candidate if its outside the allowed range
+					 */
+					if (min_scale != -1) {
+						ratio = t_array_A[i].a_length / t_array_B[j].a_length;
+						if (ratio < min_scale || ratio > max_scale) {
+							continue;
+						}
 					}
-				}
 
-				/*
-				 * check the relative orientations of the triangles.
-				 * If they don't match the desired rotation angle,
-				 * discard this match.
-				 */
-				if (rotation_deg != AT_MATCH_NOANGLE) {
-					if (is_desired_rotation(&(t_array_A[i]), &(t_array_B[j]),
-							rotation_deg, tolerance_deg, &actual_angle_deg)
-							== 0) {
-						continue;
+					/*
+					 * check the relative orientations of the triangles.
+					 * If they don't match the desired rotation angle,
+					 * discard this match.
+					 */
+					if (rotation_deg != AT_MATCH_NOANGLE) {
+						if (is_desired_rotation(&(t_array_A[i]), &(t_array_B[j]),
+								rotation_deg, tolerance_deg, &actual_angle_deg)
+								== 0) {
+							continue;
+						}
 					}
-				}
 
-				/* we have a (possible) match! */
+					/* we have a (possible) match! */
 #ifdef DEBUG2
-				ratio = t_array_A[i].a_length/t_array_B[j].a_length;
-				printf("   match!  A: (%6.3f, %6.3f)   B: (%6.3f, %6.3f)  ratio %9.4e  angle %9.4e\n",
-						ba_A, ca_A, ba_B, ca_B, ratio, actual_angle_deg);
+					ratio = t_array_A[i].a_length/t_array_B[j].a_length;
+					printf("   match!  A: (%6.3f, %6.3f)   B: (%6.3f, %6.3f)  ratio %9.4e  angle %9.4e\n",
+							ba_A, ca_A, ba_B, ca_B, ratio, actual_angle_deg);
 #endif
-				/*
-				 * increment the vote_matrix cell for each matching pair
-				 * of stars, one at each vertex
-				 */
-				vote_matrix[t_array_A[i].a_index][t_array_B[j].a_index]++;
-				vote_matrix[t_array_A[i].b_index][t_array_B[j].b_index]++;
-				vote_matrix[t_array_A[i].c_index][t_array_B[j].c_index]++;
-
+					/*
+					 * increment the vote_matrix cell for each matching pair
+					 * of stars, one at each vertex
+					 */
+					vote_matrix[t_array_A[i].a_index][t_array_B[j].a_index]++;
+					vote_matrix[t_array_A[i].b_index][t_array_B[j].b_index]++;
+					vote_matrix[t_array_A[i].c_index][t_array_B[j].c_index]++;
+				}
 			}
 		}
 	}
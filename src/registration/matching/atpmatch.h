@@ -216,15 +216,36 @@ typedef struct s_triangle {
 } s_triangle;
 
 
+   /*
+    * this holds a list of stars with its triangles, computed once to be
+    * matched against many other lists.  It is only read by atFindTrans,
+    * so it can be shared by several threads.
+    */
+typedef struct s_match_reference {
+   int num_stars;           /* number of stars in star_array */
+   s_star *star_array;      /* stars, sorted by magnitude */
+   int nbright;             /* triangles use at most this many stars */
+   double radius;           /* max radius in triangle-space of the index */
+   int num_triangles;       /* number of triangles, after pruning */
+   s_triangle *triangles;   /* triangles formed from the brightest stars */
+   struct triangle_grid *grid; /* spatial index over the triangles */
+} s_match_reference;
+
+
    /*
     * these functions are PUBLIC, and may be called by users
     */
 
 int atFindTrans(int numA, s_star *listA, int numB, s_star *listB,
-                double radius, int nbright, double min_scale, double max_scale,
+                const s_match_reference *refB, double radius, int nbright, double min_scale, double max_scale,
                 double rotation_deg, double tolerance_deg,
                 int max_iter, double halt_sigma, TRANS *trans);
 
+s_match_reference *atPrepareReference(int num, s_star *list, int nbright,
+                double radius);
+
+void atFreeReference(s_match_reference *ref);
+
 int atApplyTrans(int num, s_star *list, TRANS *trans);
 
 int atMatchLists(int numA, s_star *listA, int numB, s_star *listB,
@@ -121,7 +121,8 @@ static int prepare_to_recalc(int num_matched_A,
 		struct s_star *matched_list_B, struct s_star *star_list_A_copy,
 		TRANS *trans);
 
-int new_star_match(psf_star **s1, psf_star **s2, int n, int nobj_override,
+int new_star_match(psf_star **s1, psf_star **s2, const s_match_reference *ref2,
+		int n, int nobj_override,
 		double s_min, double s_max,
 		Homography *H, gboolean print_output, transformation_type type, s_star *out_list_A, s_star *out_list_B) {
 	int ret;
@@ -256,7 +257,7 @@ int new_star_match(psf_star **s1, psf_star **s2, int n, int nobj_override,
 	 * Now, as the has not given us an initial TRANS structure, we need
 	 * to find one ourselves.
 	 */
-	ret = atFindTrans(numA, star_list_A, numB, star_list_B, triangle_radius,
+	ret = atFindTrans(numA, star_list_A, numB, star_list_B, ref2, triangle_radius,
 			nobj, min_scale, max_scale, rot_angle, rot_tol, max_iter,
 			halt_sigma, trans);
 	if (ret != SH_SUCCESS) {
@@ -30,6 +30,7 @@
 
 #include "core/siril.h"
 #include "core/proto.h"
+#include "core/processing.h"
 #include "gui/callbacks.h"
 #include "gui/utils.h"
 #include "gui/image_display.h"
@@ -70,7 +71,7 @@ static char *tooltip_text[] = { N_("<b>One Star Registration</b>: This is the si
 		N_("<b>Image Pattern Alignment</b>: This is a simple registration by translation method "
 		"using cross correlation in the spatial domain. This method is fast and is used to register "
 		"planetary movies. It can also be used for some deep-sky images registration. "
-		"Shifts at pixel precision are saved in seq file."),
+		"Shifts at sub-pixel precision are saved in seq file."),
 		N_("<b>Enhanced Correlation Coefficient Maximization</b>: It is based on the enhanced correlation "
 		"coefficient maximization algorithm. This method is more complex and slower than Image Pattern Alignment "
 		"but no selection is required. It is good for moon surface images registration. Only translation is taken "
@@ -182,261 +183,471 @@ static void normalizeQualityData(struct registration_args *args, double q_min, d
 	}
 }
 
-/* Calculate shift in images to be aligned with the reference image, using
- * discrete Fourrier transform on a square selected area and matching the
- * phases.
- */
-int register_shift_dft(struct registration_args *args) {
-	fits fit_ref = { 0 };
-	unsigned int frame, size, sqsize, j;
-	fftwf_complex *ref, *in, *out, *convol;
-	fftwf_plan p, q;
-	int ret;
-	int abort = 0;
-	float nb_frames, cur_nb;
-	int ref_image;
+/* precision of the shifts of the DFT registration is 1 / DFT_UPSAMPLING pixel */
+#define DFT_UPSAMPLING 20
+/* number of points of the upsampled grid on each axis, covering 1.5 pixels
+ * around the peak of the correlation */
+#define DFT_REFINE_POINTS (3 * DFT_UPSAMPLING + 1)
+
+/* tables of the sub-pixel refinement, computed once for the size of the
+ * area: the kernels of the upsampled DFT for a peak at the origin, the half
+ * spectrum weights included for the columns, and the roots of unity that
+ * move them to the peak. Complex values are split in real and imaginary
+ * parts for the vectorized products */
+struct dft_refine_tables {
+	int size, half;
+	float *root_re, *root_im;	// size, exp(2i.pi.n / size)
+	float *kx_re, *kx_im;		// DFT_REFINE_POINTS x half, kernel on columns
+	float *ky_re, *ky_im;		// DFT_REFINE_POINTS x size, kernel on rows
+};
+
+/* data shared by the threads of the DFT registration. Planning is not
+ * thread-safe in FFTW, so each thread gets its plans and buffers created
+ * before the processing, the reference spectrum is only read.
+ * Images are real, so only half spectra of size x (size / 2 + 1) are used. */
+struct dft_align_data {
+	struct registration_args *regargs;
 	regdata *current_regdata;
-	double q_max = 0, q_min = DBL_MAX;
-	int q_index = -1;
+	unsigned int size, sqsize, spectrum_size;
+	int ref_image;
+	fftwf_complex *ref;	// half spectrum of the reference frame
+	int nb_threads;
+	float **real;		// per thread, image then correlation
+	fftwf_complex **spectrum, **cross;	// per thread half spectra
+	float **work;		// per thread, for the sub-pixel refinement
+	struct dft_refine_tables refine;
+	fftwf_plan *forward, *backward;	// per thread plans, real <-> spectrum
+	double q_min, q_max;
+	int q_index;
+};
 
-	/* the selection needs to be squared for the DFT */
-	assert(args->selection.w == args->selection.h);
-	size = args->selection.w;
-	sqsize = size * size;
+static fftwf_plan dft_align_make_plan(unsigned int size, float *real, fftwf_complex *spectrum,
+		int sign, unsigned int flags) {
+	if (sign == FFTW_FORWARD)
+		return fftwf_plan_dft_r2c_2d(size, size, real, spectrum, flags);
+	return fftwf_plan_dft_c2r_2d(size, size, spectrum, real, flags);
+}
 
-	if (args->process_all_frames)
-		nb_frames = (float) args->seq->number;
-	else
-		nb_frames = (float) args->seq->selnum;
+/* creates a plan using the wisdom, in memory or from the wisdom file, or
+ * measuring it otherwise. new_wisdom is set if the file should be updated */
+static fftwf_plan dft_align_plan(unsigned int size, float *real, fftwf_complex *spectrum,
+		int sign, unsigned int flags, const gchar *wisdom_file, gboolean *new_wisdom) {
+	fftwf_plan plan = dft_align_make_plan(size, real, spectrum, sign, FFTW_WISDOM_ONLY | flags);
+	if (!plan) {
+		// no wisdom available, load wisdom from file
+		fftwf_import_wisdom_from_filename(wisdom_file);
+		// test again for wisdom
+		plan = dft_align_make_plan(size, real, spectrum, sign, FFTW_WISDOM_ONLY | flags);
+		if (!plan) {
+			// build plan with FFTW_MEASURE
+			plan = dft_align_make_plan(size, real, spectrum, sign, FFTW_MEASURE | flags);
+			*new_wisdom = TRUE;
+		}
+	}
+	return plan;
+}
+
+static void dft_align_copy_image(fits *fit, float *dest, unsigned int sqsize) {
+	if (fit->type == DATA_USHORT) {
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+		for (unsigned int i = 0; i < sqsize; i++)
+			dest[i] = (float)fit->data[i];
+	} else {
+		memcpy(dest, fit->fdata, sqsize * sizeof(float));
+	}
+}
 
-	if (args->seq->regparam[args->layer]) {
+/* cross-power spectrum: dest = ref * conj(img) */
+static void dft_align_cross_power(const fftwf_complex *ref, const fftwf_complex *img,
+		fftwf_complex *dest, unsigned int n) {
+	const float *a = (const float *)ref, *b = (const float *)img;
+	float *c = (float *)dest;	// interleaved real and imaginary parts
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+	for (unsigned int i = 0; i < n; i++) {
+		float ar = a[2 * i], ai = a[2 * i + 1];
+		float br = b[2 * i], bi = b[2 * i + 1];
+		c[2 * i] = ar * br + ai * bi;
+		c[2 * i + 1] = ai * br - ar * bi;
+	}
+}
+
+/* index of the first maximum of the correlation, the maximum is found by a
+ * vectorized reduction before its first position */
+static unsigned int dft_align_find_peak(const float *correl, unsigned int sqsize) {
+	float maxi = correl[0];
+#ifdef _OPENMP
+#pragma omp simd reduction(max:maxi)
+#endif
+	for (unsigned int i = 1; i < sqsize; i++)
+		maxi = max(maxi, correl[i]);
+	unsigned int peak = 0;
+	while (peak < sqsize - 1 && correl[peak] != maxi)
+		peak++;
+	return peak;
+}
+
+static int dft_align_init_refine_tables(struct dft_refine_tables *tables, unsigned int size) {
+	const int half = size / 2 + 1, m = DFT_REFINE_POINTS;
+	const double step = 1.0 / DFT_UPSAMPLING, origin = -(m / 2) * step;
+	tables->size = size;
+	tables->half = half;
+	tables->root_re = malloc(2 * (size + m * half + m * size) * sizeof(float));
+	if (!tables->root_re) {
+		PRINT_ALLOC_ERR;
+		return 1;
+	}
+	tables->root_im = tables->root_re + size;
+	tables->kx_re = tables->root_im + size;
+	tables->kx_im = tables->kx_re + m * half;
+	tables->ky_re = tables->kx_im + m * half;
+	tables->ky_im = tables->ky_re + m * size;
+
+	for (int n = 0; n < size; n++) {
+		double phase = 2.0 * M_PI * n / size;
+		tables->root_re[n] = (float)cos(phase);
+		tables->root_im[n] = (float)sin(phase);
+	}
+	for (int j = 0; j < m; j++) {
+		double pos = origin + j * step;
+		for (int l = 0; l < half; l++) {
+			float weight = (l == 0 || 2 * l == size) ? 1.f : 2.f;
+			double phase = 2.0 * M_PI * l * pos / size;
+			tables->kx_re[j * half + l] = weight * (float)cos(phase);
+			tables->kx_im[j * half + l] = weight * (float)sin(phase);
+		}
+		for (int k = 0; k < size; k++) {
+			int freq = 2 * k < size ? k : k - (int)size;
+			double phase = 2.0 * M_PI * freq * pos / size;
+			tables->ky_re[j * size + k] = (float)cos(phase);
+			tables->ky_im[j * size + k] = (float)sin(phase);
+		}
+	}
+	return 0;
+}
+
+/* Refines the position of the correlation peak by computing the correlation
+ * on a grid upsampled by DFT_UPSAMPLING around it, directly from the
+ * cross-power spectrum with a matrix product DFT (Guizar-Sicairos, Thurman
+ * and Fienup, Optics Letters 33, 2008). The half spectrum of the real
+ * correlation counts twice, except the columns without a conjugate.
+ * The kernels of the tables are centred on the origin, the spectrum is
+ * multiplied by the roots of unity of the peak position instead, which only
+ * needs integer indices since the peak is on the pixel grid.
+ * work is 4 * (size / 2 + 1) + 2 * DFT_REFINE_POINTS * size floats. */
+static void dft_align_refine_peak(const struct dft_refine_tables *tables,
+		const fftwf_complex *cross, int peakx, int peaky, float *work, float *x, float *y) {
+	const int size = tables->size, half = tables->half, m = DFT_REFINE_POINTS;
+	const double step = 1.0 / DFT_UPSAMPLING, origin = -(m / 2) * step;
+	float *shift_re = work, *shift_im = shift_re + half;	// columns shift
+	float *row_re = shift_im + half, *row_im = row_re + half;	// shifted spectrum row
+	float *partial_re = row_im + half;	// m x size, sum on columns
+	float *partial_im = partial_re + m * size;
+
+	for (int l = 0, n = 0; l < half; l++) {
+		shift_re[l] = tables->root_re[n];
+		shift_im[l] = tables->root_im[n];
+		n += peakx;	// l * peakx modulo size
+		if (n >= size)
+			n -= size;
+	}
+
+	for (int k = 0, n = 0; k < size; k++) {
+		const float *row = (const float *)(cross + k * half);	// interleaved
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+		for (int l = 0; l < half; l++) {
+			float re = row[2 * l], im = row[2 * l + 1];
+			row_re[l] = re * shift_re[l] - im * shift_im[l];
+			row_im[l] = re * shift_im[l] + im * shift_re[l];
+		}
+		/* the rows shift, for frequency k or k - size, applies to the sums */
+		float yre = tables->root_re[n], yim = tables->root_im[n];
+		for (int j = 0; j < m; j++) {
+			const float *kre = tables->kx_re + j * half, *kim = tables->kx_im + j * half;
+			float sre = 0.f, sim = 0.f;
+#ifdef _OPENMP
+#pragma omp simd reduction(+:sre,sim)
+#endif
+			for (int l = 0; l < half; l++) {
+				sre += row_re[l] * kre[l] - row_im[l] * kim[l];
+				sim += row_re[l] * kim[l] + row_im[l] * kre[l];
+			}
+			partial_re[j * size + k] = sre * yre - sim * yim;
+			partial_im[j * size + k] = sre * yim + sim * yre;
+		}
+		n += peaky;	// k * peaky modulo size
+		if (n >= size)
+			n -= size;
+	}
+
+	float best = -FLT_MAX;
+	int best_i = m / 2, best_j = m / 2;
+	for (int i = 0; i < m; i++) {
+		const float *kre = tables->ky_re + i * size, *kim = tables->ky_im + i * size;
+		for (int j = 0; j < m; j++) {
+			const float *pre = partial_re + j * size, *pim = partial_im + j * size;
+			float value = 0.f;
+#ifdef _OPENMP
+#pragma omp simd reduction(+:value)
+#endif
+			for (int k = 0; k < size; k++)
+				value += pre[k] * kre[k] - pim[k] * kim[k];
+			if (value > best) {
+				best = value;
+				best_i = i;
+				best_j = j;
+			}
+		}
+	}
+	*x = (float)(peakx + origin + best_j * step);
+	*y = (float)(peaky + origin + best_i * step);
+}
+
+static int dft_align_prepare_hook(struct generic_seq_args *args) {
+	struct dft_align_data *ddata = args->user;
+	struct registration_args *regargs = ddata->regargs;
+	fits fit_ref = { 0 };
+	gboolean new_wisdom = FALSE;
+
+	if (args->seq->regparam[regargs->layer]) {
 		siril_log_message(
 				_("Recomputing already existing registration for this layer\n"));
-		current_regdata = args->seq->regparam[args->layer];
+		ddata->current_regdata = args->seq->regparam[regargs->layer];
 		/* we reset all values as we may register different images */
-		memset(current_regdata, 0, args->seq->number * sizeof(regdata));
+		memset(ddata->current_regdata, 0, args->seq->number * sizeof(regdata));
 	} else {
-		current_regdata = calloc(args->seq->number, sizeof(regdata));
-		if (current_regdata == NULL) {
+		ddata->current_regdata = calloc(args->seq->number, sizeof(regdata));
+		if (ddata->current_regdata == NULL) {
 			PRINT_ALLOC_ERR;
 			return -2;
 		}
-		args->seq->regparam[args->layer] = current_regdata;
+		args->seq->regparam[regargs->layer] = ddata->current_regdata;
 	}
 
 	/* loading reference frame */
-	ref_image = sequence_find_refimage(args->seq);
-
+	ddata->ref_image = sequence_find_refimage(args->seq);
 	set_progress_bar_data(
 			_("Register DFT: loading and processing reference frame"),
 			PROGRESS_NONE);
-	ret = seq_read_frame_part(args->seq, args->layer, ref_image, &fit_ref,
-			&args->selection, FALSE, -1);
-
-	if (ret) {
+	if (seq_read_frame_part(args->seq, regargs->layer, ddata->ref_image, &fit_ref,
+				&regargs->selection, FALSE, -1)) {
 		siril_log_message(
 				_("Register: could not load first image to register, aborting.\n"));
-		args->seq->regparam[args->layer] = NULL;
-		free(current_regdata);
 		clearfits(&fit_ref);
-		return ret;
+		return 1;
 	}
 
-	ref = fftwf_malloc(sizeof(fftwf_complex) * sqsize);
-	in = fftwf_malloc(sizeof(fftwf_complex) * sqsize);
-	out = fftwf_malloc(sizeof(fftwf_complex) * sqsize);
-	convol = fftwf_malloc(sizeof(fftwf_complex) * sqsize);
-
-	gchar* wisdomFile = g_build_filename(g_get_user_cache_dir(), "siril_fftw.wisdom", NULL);
-
-	// test for available wisdom
-	p = fftwf_plan_dft_2d(size, size, ref, out, FFTW_FORWARD, FFTW_WISDOM_ONLY);
-	if (!p) {
-		// no wisdom available, load wisdom from file
-		fftwf_import_wisdom_from_filename(wisdomFile);
-		// test again for wisdom
-		p = fftwf_plan_dft_2d(size, size, ref, out, FFTW_FORWARD, FFTW_WISDOM_ONLY);
-		if (!p) {
-			// build plan with FFTW_MEASURE
-			p = fftwf_plan_dft_2d(size, size, ref, out, FFTW_FORWARD, FFTW_MEASURE);
-			// save the wisdom
-			fftwf_export_wisdom_to_filename(wisdomFile);
-		}
+	ddata->nb_threads = args->max_thread > 0 ? args->max_thread : 1;
+	ddata->real = calloc(ddata->nb_threads, sizeof(float *));
+	ddata->spectrum = calloc(ddata->nb_threads, sizeof(fftwf_complex *));
+	ddata->cross = calloc(ddata->nb_threads, sizeof(fftwf_complex *));
+	ddata->work = calloc(ddata->nb_threads, sizeof(float *));
+	ddata->forward = calloc(ddata->nb_threads, sizeof(fftwf_plan));
+	ddata->backward = calloc(ddata->nb_threads, sizeof(fftwf_plan));
+	ddata->ref = fftwf_malloc(sizeof(fftwf_complex) * ddata->spectrum_size);
+	if (!ddata->real || !ddata->spectrum || !ddata->cross || !ddata->work ||
+			!ddata->forward || !ddata->backward || !ddata->ref) {
+		PRINT_ALLOC_ERR;
+		clearfits(&fit_ref);
+		return -2;
+	}
+	if (dft_align_init_refine_tables(&ddata->refine, ddata->size)) {
+		clearfits(&fit_ref);
+		return -2;
 	}
 
-	q = fftwf_plan_dft_2d(size, size, convol, out, FFTW_BACKWARD, FFTW_WISDOM_ONLY | FFTW_DESTROY_INPUT);
-	if (!q) {
-		// no wisdom available, load wisdom from file
-		fftwf_import_wisdom_from_filename(wisdomFile);
-		// test again for wisdom
-		q = fftwf_plan_dft_2d(size, size, convol, out, FFTW_BACKWARD, FFTW_WISDOM_ONLY | FFTW_DESTROY_INPUT);
-		if (!q) {
-			// build plan with FFTW_MEASURE
-			q = fftwf_plan_dft_2d(size, size, convol, out, FFTW_BACKWARD, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-			// save the wisdom
-			fftwf_export_wisdom_to_filename(wisdomFile);
+	size_t work_size = 4 * (ddata->size / 2 + 1) + 2 * DFT_REFINE_POINTS * ddata->size;
+	gchar *wisdom_file = g_build_filename(g_get_user_cache_dir(), "siril_fftw.wisdom", NULL);
+	for (int i = 0; i < ddata->nb_threads; i++) {
+		ddata->real[i] = fftwf_malloc(sizeof(float) * ddata->sqsize);
+		ddata->spectrum[i] = fftwf_malloc(sizeof(fftwf_complex) * ddata->spectrum_size);
+		ddata->cross[i] = fftwf_malloc(sizeof(fftwf_complex) * ddata->spectrum_size);
+		ddata->work[i] = malloc(sizeof(float) * work_size);
+		if (!ddata->real[i] || !ddata->spectrum[i] || !ddata->cross[i] || !ddata->work[i]) {
+			PRINT_ALLOC_ERR;
+			g_free(wisdom_file);
+			clearfits(&fit_ref);
+			return -2;
 		}
+		ddata->forward[i] = dft_align_plan(ddata->size, ddata->real[i], ddata->spectrum[i],
+				FFTW_FORWARD, 0, wisdom_file, &new_wisdom);
+		ddata->backward[i] = dft_align_plan(ddata->size, ddata->real[i], ddata->spectrum[i],
+				FFTW_BACKWARD, FFTW_DESTROY_INPUT, wisdom_file, &new_wisdom);
 	}
-	g_free(wisdomFile);
-	fftwf_free(out); // was needed to build the plan, can be freed now
-	fftwf_free(convol); // was needed to build the plan, can be freed now
+	if (new_wisdom)
+		fftwf_export_wisdom_to_filename(wisdom_file);
+	g_free(wisdom_file);
 
 	// copying image selection into the fftw data
-	if (fit_ref.type == DATA_USHORT) {
-		for (j = 0; j < sqsize; j++)
-			ref[j] = (float)fit_ref.data[j];
-	}
-	else if (fit_ref.type == DATA_FLOAT) {
-		for (j = 0; j < sqsize; j++)
-			ref[j] = fit_ref.fdata[j];
-	}
-
+	dft_align_copy_image(&fit_ref, ddata->real[0], ddata->sqsize);
+	ddata->current_regdata[ddata->ref_image].quality = QualityEstimate(&fit_ref, regargs->layer);
 	// We don't need fit_ref anymore, we can destroy it.
-	current_regdata[ref_image].quality = QualityEstimate(&fit_ref, args->layer);
 	clearfits(&fit_ref);
-	fftwf_execute_dft(p, ref, in); /* repeat as needed */
-
-	fftwf_free(ref); // not needed anymore
+	fftwf_execute(ddata->forward[0]);
+	memcpy(ddata->ref, ddata->spectrum[0], sizeof(fftwf_complex) * ddata->spectrum_size);
 
-	set_shifts(args->seq, ref_image, args->layer, 0.0, 0.0, FALSE);
+	set_shifts(args->seq, ddata->ref_image, regargs->layer, 0.0, 0.0, FALSE);
 
-	q_min = q_max = current_regdata[ref_image].quality;
-	q_index = ref_image;
-
-	cur_nb = 0.f;
+	ddata->q_min = ddata->q_max = ddata->current_regdata[ddata->ref_image].quality;
+	ddata->q_index = ddata->ref_image;
+	return 0;
+}
 
+static int dft_align_image_hook(struct generic_seq_args *args, int out_index, int in_index, fits *fit, rectangle *_) {
+	struct dft_align_data *ddata = args->user;
+	struct registration_args *regargs = ddata->regargs;
+	int thread = 0;
 #ifdef _OPENMP
-#pragma omp parallel for num_threads(com.max_thread) schedule(guided) \
-	if (args->seq->type == SEQ_SER || ((args->seq->type == SEQ_REGULAR || args->seq->type == SEQ_FITSEQ) && fits_is_reentrant()))
+	thread = omp_get_thread_num();
 #endif
-	for (frame = 0; frame < args->seq->number; ++frame) {
-		if (abort) continue;
-		if (args->run_in_thread && !get_thread_run()) {
-			abort = 1;
-			continue;
-		}
-		if (frame == ref_image) continue;
-		if (!args->process_all_frames && !args->seq->imgparam[frame].incl)
-			continue;
+	if (in_index == ddata->ref_image)
+		return 0;
 
-		fits fit = { 0 };
-		char tmpmsg[1024], tmpfilename[256];
+	// copying image selection into the fftw data
+	dft_align_copy_image(fit, ddata->real[thread], ddata->sqsize);
 
-		seq_get_image_filename(args->seq, frame, tmpfilename);
-		g_snprintf(tmpmsg, 1024, _("Register: processing image %s"), tmpfilename);
-		set_progress_bar_data(tmpmsg, PROGRESS_NONE);
-		int thread_id = -1;
+	double qual = QualityEstimate(fit, regargs->layer);
+	ddata->current_regdata[in_index].quality = qual;
+	// after this call, fit data is dead
 #ifdef _OPENMP
-		thread_id = omp_get_thread_num();
+	omp_set_lock(&args->lock);
 #endif
-		if (!seq_read_frame_part(args->seq, args->layer, frame, &fit,
-						&args->selection, FALSE, thread_id)) {
-			int x;
-			fftwf_complex *img = fftwf_malloc(sizeof(fftwf_complex) * sqsize);
-			fftwf_complex *out2 = fftwf_malloc(sizeof(fftwf_complex) * sqsize);
-
-			// copying image selection into the fftw data
-			if (fit.type == DATA_USHORT) {
-				for (x = 0; x < sqsize; x++)
-					img[x] = (float)fit.data[x];
-			}
-			if (fit.type == DATA_FLOAT) {
-				for (x = 0; x < sqsize; x++)
-					img[x] = fit.fdata[x];
-			}
-
-			current_regdata[frame].quality = QualityEstimate(&fit, args->layer);
-			// after this call, fit data is dead
-
+	if (qual > ddata->q_max) {
+		ddata->q_max = qual;
+		ddata->q_index = in_index;
+	}
+	ddata->q_min = min(ddata->q_min, qual);
 #ifdef _OPENMP
-#pragma omp critical
+	omp_unset_lock(&args->lock);
 #endif
-			{
-				double qual = current_regdata[frame].quality;
-				if (qual > q_max) {
-					q_max = qual;
-					q_index = frame;
-				}
-				q_min = min(q_min, qual);
-			}
-
-			fftwf_execute_dft(p, img, out2); /* repeat as needed */
 
-			fftwf_complex *convol2 = img; // reuse buffer
-
-			for (x = 0; x < sqsize; x++) {
-				convol2[x] = in[x] * conjf(out2[x]);
-			}
-
-			fftwf_execute_dft(q, convol2, out2); /* repeat as needed */
-
-			int shift = 0;
-			for (x = 1; x < sqsize; ++x) {
-				if (crealf(out2[x]) > crealf(out2[shift])) {
-					shift = x;
-					// break or get last value?
-				}
-			}
-			int shifty = shift / size;
-			int shiftx = shift % size;
-			if (shifty > size / 2) {
-				shifty -= size;
-			}
-			if (shiftx > size / 2) {
-				shiftx -= size;
-			}
-
-			set_shifts(args->seq, frame, args->layer, (float)shiftx, (float)shifty,
-					fit.top_down);
-
-			// We don't need fit anymore, we can destroy it.
-			clearfits(&fit);
+	fftwf_execute(ddata->forward[thread]);
+	dft_align_cross_power(ddata->ref, ddata->spectrum[thread], ddata->cross[thread],
+			ddata->spectrum_size);
+	/* the inverse transform destroys its input, the cross-power spectrum
+	 * is kept for the sub-pixel refinement */
+	memcpy(ddata->spectrum[thread], ddata->cross[thread],
+			sizeof(fftwf_complex) * ddata->spectrum_size);
+	fftwf_execute(ddata->backward[thread]);
+
+	unsigned int peak = dft_align_find_peak(ddata->real[thread], ddata->sqsize);
+	float shiftx, shifty;
+	dft_align_refine_peak(&ddata->refine, ddata->cross[thread], peak % ddata->size,
+			peak / ddata->size, ddata->work[thread], &shiftx, &shifty);
+	if (shifty > ddata->size / 2) {
+		shifty -= ddata->size;
+	}
+	if (shiftx > ddata->size / 2) {
+		shiftx -= ddata->size;
+	}
 
-			/* shiftx and shifty are the x and y values for translation that
-			 * would make this image aligned with the reference image.
-			 * WARNING: the y value is counted backwards, since the FITS is
-			 * stored down from up.
-			 */
+	/* shiftx and shifty are the x and y values for translation that
+	 * would make this image aligned with the reference image.
+	 * WARNING: the y value is counted backwards, since the FITS is
+	 * stored down from up.
+	 */
+	set_shifts(args->seq, in_index, regargs->layer, shiftx, shifty, fit->top_down);
 #ifdef DEBUG
-			fprintf(stderr,
-					"reg: frame %d, shiftx=%f shifty=%f quality=%g\n",
-					args->seq->imgparam[frame].filenum,
-					current_regdata[frame].shiftx, current_regdata[frame].shifty,
-					current_regdata[frame].quality);
-#endif
-#ifdef _OPENMP
-#pragma omp atomic
+	fprintf(stderr,
+			"reg: frame %d, shiftx=%f shifty=%f quality=%g\n",
+			args->seq->imgparam[in_index].filenum,
+			ddata->current_regdata[in_index].shiftx, ddata->current_regdata[in_index].shifty,
+			ddata->current_regdata[in_index].quality);
 #endif
-			cur_nb += 1.f;
-			set_progress_bar_data(NULL, cur_nb / nb_frames);
-			fftwf_free(img);
-			fftwf_free(out2);
-		} else {
-			//report_fits_error(ret, error_buffer);
-			args->seq->regparam[args->layer] = NULL;
-			free(current_regdata);
-			abort = ret = 1;
-			continue;
-		}
+	return 0;
+}
+
+static int dft_align_finalize_hook(struct generic_seq_args *args) {
+	struct dft_align_data *ddata = args->user;
+	struct registration_args *regargs = ddata->regargs;
+
+	for (int i = 0; i < ddata->nb_threads; i++) {
+		if (ddata->forward && ddata->forward[i])
+			fftwf_destroy_plan(ddata->forward[i]);
+		if (ddata->backward && ddata->backward[i])
+			fftwf_destroy_plan(ddata->backward[i]);
+		if (ddata->real && ddata->real[i])
+			fftwf_free(ddata->real[i]);
+		if (ddata->spectrum && ddata->spectrum[i])
+			fftwf_free(ddata->spectrum[i]);
+		if (ddata->cross && ddata->cross[i])
+			fftwf_free(ddata->cross[i]);
+		if (ddata->work)
+			free(ddata->work[i]);
 	}
+	free(ddata->forward);
+	free(ddata->backward);
+	free(ddata->real);
+	free(ddata->spectrum);
+	free(ddata->cross);
+	free(ddata->work);
+	free(ddata->refine.root_re);	// all tables
+	if (ddata->ref)
+		fftwf_free(ddata->ref);
 
-	fftwf_destroy_plan(p);
-	fftwf_destroy_plan(q);
-	fftwf_free(in);
-	if (!ret) {
-		if (args->x2upscale)
+	if (!args->retval) {
+		if (regargs->x2upscale)
 			args->seq->upscale_at_stacking = 2.0;
 		else
 			args->seq->upscale_at_stacking = 1.0;
-		normalizeQualityData(args, q_min, q_max);
+		normalizeQualityData(regargs, ddata->q_min, ddata->q_max);
 
 		siril_log_message(_("Registration finished.\n"));
-		siril_log_color_message(_("Best frame: #%d.\n"), "bold", q_index + 1);
+		siril_log_color_message(_("Best frame: #%d.\n"), "bold", ddata->q_index + 1);
 	} else {
-		free(args->seq->regparam[args->layer]);
-		args->seq->regparam[args->layer] = NULL;
+		free(args->seq->regparam[regargs->layer]);
+		args->seq->regparam[regargs->layer] = NULL;
 	}
-	return ret;
+	return 0;
+}
+
+/* Calculate shift in images to be aligned with the reference image, using
+ * discrete Fourrier transform on a square selected area and matching the
+ * phases. Shifts are refined to a fraction of pixel with an upsampled DFT
+ * around the correlation peak.
+ */
+int register_shift_dft(struct registration_args *regargs) {
+	/* the selection needs to be squared for the DFT */
+	assert(regargs->selection.w == regargs->selection.h);
+
+	struct generic_seq_args *args = create_default_seqargs(regargs->seq);
+	/* only the selection is read, memory is not a limit */
+	args->partial_image = TRUE;
+	memcpy(&args->area, &regargs->selection, sizeof(rectangle));
+	args->layer_for_partial = regargs->layer;
+	args->max_thread = com.max_thread;
+	if (!regargs->process_all_frames) {
+		args->filtering_criterion = seq_filter_included;
+		args->nb_filtered_images = regargs->seq->selnum;
+	}
+	args->prepare_hook = dft_align_prepare_hook;
+	args->image_hook = dft_align_image_hook;
+	args->finalize_hook = dft_align_finalize_hook;
+	args->description = _("Register DFT");
+	args->already_in_a_thread = TRUE;
+
+	struct dft_align_data *ddata = calloc(1, sizeof(struct dft_align_data));
+	if (!ddata) {
+		free(args);
+		return -1;
+	}
+	ddata->regargs = regargs;
+	ddata->size = regargs->selection.w;
+	ddata->sqsize = ddata->size * ddata->size;
+	ddata->spectrum_size = ddata->size * (ddata->size / 2 + 1);
+	args->user = ddata;
+
+	generic_sequence_worker(args);
+
+	int retval = args->retval;
+	free(ddata);
+	free(args);
+	return retval;
 }
 
 /* register images: calculate shift in images to be aligned with the reference image;
@@ -485,7 +696,6 @@ int register_shift_fwhm(struct registration_args *args) {
 
 	/* Second step: align image by aligning star coordinates together */
 	for (frame = 0; frame < args->seq->number; frame++) {
-		double tmp;
 		if (args->run_in_thread && !get_thread_run())
 			break;
 		if (!args->process_all_frames && !args->seq->imgparam[frame].incl)
@@ -499,10 +709,9 @@ int register_shift_fwhm(struct registration_args *args) {
 			fwhm_min = current_regdata[frame].fwhm;
 			fwhm_index = frame;
 		}
-		tmp = reference_xpos - current_regdata[frame].fwhm_data->xpos;
-		current_regdata[frame].shiftx = tmp;
-		tmp = current_regdata[frame].fwhm_data->ypos - reference_ypos;
-		current_regdata[frame].shifty = tmp;
+		set_shifts(args->seq, frame, args->layer,
+				reference_xpos - current_regdata[frame].fwhm_data->xpos,
+				current_regdata[frame].fwhm_data->ypos - reference_ypos, FALSE);
 
 		fprintf(stderr, "reg: file %d, shiftx=%f shifty=%f\n",
 				args->seq->imgparam[frame].filenum,
@@ -522,145 +731,165 @@ int register_shift_fwhm(struct registration_args *args) {
 	return 0;
 }
 
-int register_ecc(struct registration_args *args) {
-	int frame, ref_image, failed = 0;
-	float nb_frames, cur_nb;
+/* data shared by the threads of the ECC registration, the pyramid of the
+ * reference frame is only read */
+struct ecc_align_data {
+	struct registration_args *regargs;
 	regdata *current_regdata;
+	int ref_image;
+	ecc_pyramid *ref;
+	double q_min, q_max;
+	int q_index;
+	int failed;
+};
+
+static int ecc_align_prepare_hook(struct generic_seq_args *args) {
+	struct ecc_align_data *edata = args->user;
+	struct registration_args *regargs = edata->regargs;
 	fits ref = { 0 };
-	double q_max = 0, q_min = DBL_MAX;
-	int q_index = -1;
-	int abort = 0;
 
-	if (args->seq->regparam[args->layer]) {
-		current_regdata = args->seq->regparam[args->layer];
+	if (args->seq->regparam[regargs->layer]) {
+		edata->current_regdata = args->seq->regparam[regargs->layer];
 		/* we reset all values as we may register different images */
-		memset(current_regdata, 0, args->seq->number * sizeof(regdata));
+		memset(edata->current_regdata, 0, args->seq->number * sizeof(regdata));
 	} else {
-		current_regdata = calloc(args->seq->number, sizeof(regdata));
-		if (current_regdata == NULL) {
+		edata->current_regdata = calloc(args->seq->number, sizeof(regdata));
+		if (edata->current_regdata == NULL) {
 			PRINT_ALLOC_ERR;
 			return -2;
 		}
-		args->seq->regparam[args->layer] = current_regdata;
+		args->seq->regparam[regargs->layer] = edata->current_regdata;
 	}
 
-	if (args->process_all_frames)
-		nb_frames = (float)args->seq->number;
-	else nb_frames = (float)args->seq->selnum;
-
 	/* loading reference frame */
-	ref_image = sequence_find_refimage(args->seq);
-
-	if (seq_read_frame(args->seq, ref_image, &ref, FALSE, -1)) {
+	edata->ref_image = sequence_find_refimage(args->seq);
+	if (seq_read_frame_layer(args->seq, edata->ref_image, &ref, FALSE, regargs->layer, -1)) {
 		siril_log_message(_("Could not load reference image\n"));
-		args->seq->regparam[args->layer] = NULL;
-		free(current_regdata);
 		return 1;
 	}
-	current_regdata[ref_image].quality = QualityEstimate(&ref, args->layer);
-	/* we make sure to free data in the destroyed fit */
+	edata->ref = new_ecc_pyramid(&ref, regargs->layer);
+	if (!edata->ref) {
+		clearfits(&ref);
+		return 1;
+	}
+	/* QualityEstimate destroys the data, the pyramid has its own copy */
+	edata->current_regdata[edata->ref_image].quality = QualityEstimate(&ref, regargs->layer);
 	clearfits(&ref);
-	/* Ugly code: as QualityEstimate destroys fit we need to reload it */
-	seq_read_frame(args->seq, ref_image, &ref, FALSE, -1);
-	image_find_minmax(&ref);
-	q_min = q_max = current_regdata[ref_image].quality;
-	q_index = ref_image;
 
-	/* then we compare to other frames */
-	if (args->process_all_frames)
-		args->new_total = args->seq->number;
-	else args->new_total = args->seq->selnum;
+	edata->q_min = edata->q_max = edata->current_regdata[edata->ref_image].quality;
+	edata->q_index = edata->ref_image;
+	return 0;
+}
 
-	cur_nb = 0.f;
+static int ecc_align_image_hook(struct generic_seq_args *args, int out_index, int in_index, fits *fit, rectangle *_) {
+	struct ecc_align_data *edata = args->user;
+	struct registration_args *regargs = edata->regargs;
+	reg_ecc reg_param = { 0 };
+
+	if (in_index == edata->ref_image)
+		return 0;
+
+	set_shifts(args->seq, in_index, regargs->layer, 0.0, 0.0, FALSE);
+	if (findTransform(edata->ref, fit, regargs->layer, &reg_param)) {
+		siril_log_message(_("Cannot perform ECC alignment for frame %d\n"),
+				in_index + 1);
+		/* We exclude this frame */
+		args->seq->imgparam[in_index].incl = FALSE;
+		edata->current_regdata[in_index].quality = 0.0;
 #ifdef _OPENMP
-#pragma omp parallel for num_threads(com.max_thread) schedule(guided) \
-	if (args->seq->type == SEQ_SER || ((args->seq->type == SEQ_REGULAR || args->seq->type == SEQ_FITSEQ) && fits_is_reentrant()))
+#pragma omp atomic
 #endif
-	for (frame = 0; frame < args->seq->number; frame++) {
-		if (abort) continue;
-		if (args->run_in_thread && !get_thread_run()) {
-			abort = 1;
-			continue;
-		}
-		if (frame == ref_image) continue;
-		if (!args->process_all_frames && !args->seq->imgparam[frame].incl)
-			continue;
-
-		set_shifts(args->seq, frame, args->layer, 0.0, 0.0, FALSE);
-		fits im = { 0 };
-		char tmpmsg[1024], tmpfilename[256];
+		edata->failed++;
+		return 0;
+	}
 
-		seq_get_image_filename(args->seq, frame, tmpfilename);
-		g_snprintf(tmpmsg, 1024, _("Register: processing image %s"),
-				tmpfilename);
-		set_progress_bar_data(tmpmsg, PROGRESS_NONE);
-		int thread_id = -1;
+	double qual = QualityEstimate(fit, regargs->layer);
+	edata->current_regdata[in_index].quality = qual;
 #ifdef _OPENMP
-		thread_id = omp_get_thread_num();
+	omp_set_lock(&args->lock);
 #endif
-		if (!seq_read_frame(args->seq, frame, &im, FALSE, thread_id)) {
-			reg_ecc reg_param = { 0 };
-			image_find_minmax(&im);
-
-			if (findTransform(&ref, &im, args->layer, &reg_param)) {
-				siril_log_message(
-						_("Cannot perform ECC alignment for frame %d\n"),
-						frame + 1);
-				/* We exclude this frame */
-				args->seq->imgparam[frame].incl = FALSE;
-				current_regdata[frame].quality = 0.0;
-				args->seq->selnum--;
+	if (qual > edata->q_max) {
+		edata->q_max = qual;
+		edata->q_index = in_index;
+	}
+	edata->q_min = min(edata->q_min, qual);
 #ifdef _OPENMP
-#pragma omp atomic
+	omp_unset_lock(&args->lock);
 #endif
-				++failed;
-				clearfits(&im);
-				continue;
-			}
 
-			current_regdata[frame].quality = QualityEstimate(&im,
-					args->layer);
-#ifdef _OPENMP
-#pragma omp critical
-#endif
-			{
-				double qual = current_regdata[frame].quality;
-				if (qual > q_max) {
-					q_max = qual;
-					q_index = frame;
-				}
-				q_min = min(q_min, qual);
-			}
+	set_shifts(args->seq, in_index, regargs->layer, -reg_param.dx,
+			-reg_param.dy, fit->top_down);
+	return 0;
+}
 
-			set_shifts(args->seq, frame, args->layer, -reg_param.dx,
-					-reg_param.dy, im.top_down);
-#ifdef _OPENMP
-#pragma omp atomic
-#endif
-			cur_nb += 1.f;
-			set_progress_bar_data(NULL, cur_nb / nb_frames);
-			clearfits(&im);
+static int ecc_align_finalize_hook(struct generic_seq_args *args) {
+	struct ecc_align_data *edata = args->user;
+	struct registration_args *regargs = edata->regargs;
+
+	if (edata->ref)
+		free_ecc_pyramid(edata->ref);
+
+	if (!args->retval) {
+		if (regargs->x2upscale)
+			args->seq->upscale_at_stacking = 2.0;
+		else
+			args->seq->upscale_at_stacking = 1.0;
+		fix_selnum(args->seq, FALSE);
+		normalizeQualityData(regargs, edata->q_min, edata->q_max);
+
+		siril_log_message(_("Registration finished.\n"));
+		if (edata->failed) {
+			gchar *str = ngettext("%d file was ignored and excluded\n", "%d files were ignored and excluded\n", edata->failed);
+			str = g_strdup_printf(str, edata->failed);
+			siril_log_color_message(str, "red");
+			g_free(str);
 		}
+		siril_log_color_message(_("Best frame: #%d.\n"), "bold", edata->q_index + 1);
+	} else {
+		free(args->seq->regparam[regargs->layer]);
+		args->seq->regparam[regargs->layer] = NULL;
 	}
+	return 0;
+}
 
-	if (args->x2upscale)
-		args->seq->upscale_at_stacking = 2.0;
-	else
-		args->seq->upscale_at_stacking = 1.0;
+/* Calculate shift in images to be aligned with the reference image, by
+ * maximizing the enhanced correlation coefficient, coarse-to-fine on a
+ * pyramid of the images. Frames are processed in parallel.
+ */
+int register_ecc(struct registration_args *regargs) {
+	struct generic_seq_args *args = create_default_seqargs(regargs->seq);
+	/* frames are read entirely, the number of threads is limited by memory */
+	if (!regargs->process_all_frames) {
+		args->filtering_criterion = seq_filter_included;
+		args->nb_filtered_images = regargs->seq->selnum;
+	}
+	args->prepare_hook = ecc_align_prepare_hook;
+	args->image_hook = ecc_align_image_hook;
+	args->finalize_hook = ecc_align_finalize_hook;
+	args->description = _("Register ECC");
+	/* only the registration layer of CFA SER frames is demosaiced */
+	args->single_layer_for_full = TRUE;
+	args->layer_for_full = regargs->layer;
+	args->already_in_a_thread = TRUE;
+
+	struct ecc_align_data *edata = calloc(1, sizeof(struct ecc_align_data));
+	if (!edata) {
+		free(args);
+		return -1;
+	}
+	edata->regargs = regargs;
+	args->user = edata;
 
-	normalizeQualityData(args, q_min, q_max);
-	clearfits(&ref);
+	if (regargs->process_all_frames)
+		regargs->new_total = regargs->seq->number;
+	else regargs->new_total = regargs->seq->selnum;
 
-	siril_log_message(_("Registration finished.\n"));
-	if (failed) {
-		gchar *str = ngettext("%d file was ignored and excluded\n", "%d files were ignored and excluded\n", failed);
-		str = g_strdup_printf(str, failed);
-		siril_log_color_message(str, "red");
-		g_free(str);
-	}
-	siril_log_color_message(_("Best frame: #%d.\n"), "bold", q_index + 1);
+	generic_sequence_worker(args);
 
-	return 0;
+	int retval = args->retval;
+	free(edata);
+	free(args);
+	return retval;
 }
 
 void on_comboboxregmethod_changed(GtkComboBox *box, gpointer user_data) {
@@ -896,8 +1125,8 @@ void on_seqregister_button_clicked(GtkButton *button, gpointer user_data) {
 	struct registration_args *reg_args;
 	struct registration_method *method;
 	char *msg;
-	GtkToggleButton *regall, *follow, *matchSel, *no_translate, *x2upscale,
-			*cumul;
+	GtkToggleButton *regall, *follow, *matchSel, *no_translate, *no_output,
+			*x2upscale, *cumul;
 	GtkComboBox *cbbt_layers;
 	GtkComboBoxText *ComboBoxRegInter, *ComboBoxTransfo;
 	GtkSpinButton *minpairs;
@@ -935,6 +1164,7 @@ void on_seqregister_button_clicked(GtkButton *button, gpointer user_data) {
 	follow = GTK_TOGGLE_BUTTON(lookup_widget("followStarCheckButton"));
 	matchSel = GTK_TOGGLE_BUTTON(lookup_widget("checkStarSelect"));
 	no_translate = GTK_TOGGLE_BUTTON(lookup_widget("regTranslationOnly"));
+	no_output = GTK_TOGGLE_BUTTON(lookup_widget("regNoOutput"));
 	x2upscale = GTK_TOGGLE_BUTTON(lookup_widget("upscaleCheckButton"));
 	cbbt_layers = GTK_COMBO_BOX(lookup_widget("comboboxreglayer"));
 	ComboBoxRegInter = GTK_COMBO_BOX_TEXT(lookup_widget("ComboBoxRegInter"));
@@ -949,6 +1179,7 @@ void on_seqregister_button_clicked(GtkButton *button, gpointer user_data) {
 	reg_args->follow_star = gtk_toggle_button_get_active(follow);
 	reg_args->matchSelection = gtk_toggle_button_get_active(matchSel);
 	reg_args->translation_only = gtk_toggle_button_get_active(no_translate);
+	reg_args->no_output = gtk_toggle_button_get_active(no_output);
 	reg_args->x2upscale = gtk_toggle_button_get_active(x2upscale);
 	reg_args->cumul = gtk_toggle_button_get_active(cumul);
 	reg_args->prefix = gtk_entry_get_text(GTK_ENTRY(lookup_widget("regseqname_entry")));
@@ -956,6 +1187,14 @@ void on_seqregister_button_clicked(GtkButton *button, gpointer user_data) {
 	reg_args->type = gtk_combo_box_get_active(GTK_COMBO_BOX(ComboBoxTransfo));
 
 
+	if (reg_args->no_output && reg_args->x2upscale) {
+		msg = siril_log_color_message(_("Saving only the transformations is not compatible with the x2 up-scaling.\n"), "red");
+		siril_message_dialog(GTK_MESSAGE_WARNING, _("Warning"), msg);
+		free(reg_args);
+		unreserve_thread();
+		return;
+	}
+
 	/* We check that available disk space is enough when:
 	 * - activating the subpixel alignment, which requires generating a new
 	 *   sequence with bigger images
@@ -963,7 +1202,7 @@ void on_seqregister_button_clicked(GtkButton *button, gpointer user_data) {
 	 *   new sequence */
 	if (reg_args->x2upscale ||
 			(method->method_ptr == register_star_alignment &&
-			 !reg_args->translation_only)) {
+			 !reg_args->translation_only && !reg_args->no_output)) {
 		// first, remove the files that we are about to create
 		remove_prefixed_sequence_files(reg_args->seq, reg_args->prefix);
 
@@ -57,6 +57,7 @@ struct registration_args {
 
 	/* data for generated sequence, for star alignment registration */
 	gboolean translation_only;	// don't rotate images => no new sequence
+	gboolean no_output;		// only store the transformations => no new sequence
 	int new_total;                  // remaining images after registration
 	imgdata *imgparam;		// imgparam for the new sequence
 	regdata *regparam;		// regparam for the new sequence
@@ -104,6 +105,8 @@ struct star_align_data {
 	regdata *current_regdata;
 	psf_star **refstars;
 	int fitted_stars;
+	struct s_match_reference *ref_triangles;	// triangles of refstars, shared by threads
+	star_finder_params sf;	// star detection settings, with the fast PSF fit
 	BYTE *success;
 	point ref;
 };
@@ -112,4 +115,20 @@ regdata *star_align_get_current_regdata(struct registration_args *regargs);
 int star_align_prepare_results(struct generic_seq_args *args);
 int star_align_finalize_hook(struct generic_seq_args *args);
 
+
+/**** multi-point alignment and stacking, alignment_points.c ****/
+
+struct ap_stack_args {
+	sequence *seq;
+	int layer;		// layer used for the alignment
+	int box_size;		// size of the alignment boxes, power of 2
+	float min_brightness;	// boxes darker than this fraction of the maximum are ignored
+	double keep_percent;	// percentage of the best frames stacked for each box
+	gchar *output_filename;
+	gboolean output_overwrite;
+	int retval;
+};
+
+void ap_stack(struct ap_stack_args *args);
+
 #endif
@@ -33,6 +33,7 @@
 #include "gui/progress_and_log.h"
 #include "algos/sorting.h"
 #include "algos/statistics.h"
+#include "algos/warp.h"
 #include "stacking/stacking.h"
 #include "stacking/siril_fit_linear.h"
 
@@ -218,6 +219,51 @@ int stack_open_all_files(struct stacking_args *args, int *bitpix, int *naxis, lo
 	return ST_OK;
 }
 
+/* opens the images of all sessions of a multi-session stacking, each session
+ * being opened as a single sequence, and checks that they have the same
+ * dimensions and precision */
+static int stack_open_all_sessions(struct stacking_args *args, int *bitpix, int *naxis, long *naxes, GList **list_date, fits *fit) {
+	if (!args->sessions)
+		return stack_open_all_files(args, bitpix, naxis, naxes, list_date, fit);
+
+	for (int s = 0; s < args->nb_sessions; s++) {
+		struct stacking_args session_args = *args;
+		int first = args->session_first_frame[s];
+		int session_bitpix, session_naxis, retval;
+		long session_naxes[3] = { 0, 0, 1 };
+
+		session_args.seq = args->sessions[s];
+		session_args.sessions = NULL;
+		session_args.image_indices = args->image_indices + first;
+		session_args.nb_images_to_stack = args->session_first_frame[s + 1] - first;
+		if (s > 0)	// metadata are taken from the reference image only
+			session_args.ref_image = -1;
+		if ((retval = stack_open_all_files(&session_args, &session_bitpix,
+						&session_naxis, session_naxes, list_date, fit)))
+			return retval;
+		if (s == 0) {
+			*bitpix = session_bitpix;
+			*naxis = session_naxis;
+			memcpy(naxes, session_naxes, sizeof session_naxes);
+		} else if (session_bitpix != *bitpix || session_naxes[0] != naxes[0] ||
+				session_naxes[1] != naxes[1] || session_naxes[2] != naxes[2]) {
+			siril_log_color_message(_("Stacking error: sequence %s does not have the same image size or precision as %s\n"),
+					"red", args->sessions[s]->seqname, args->sessions[0]->seqname);
+			return ST_SEQUENCE_ERROR;
+		}
+	}
+	return ST_OK;
+}
+
+static gboolean stack_uses_sequence_type(struct stacking_args *args, sequence_type type) {
+	if (!args->sessions)
+		return args->seq->type == type;
+	for (int s = 0; s < args->nb_sessions; s++)
+		if (args->sessions[s]->type == type)
+			return TRUE;
+	return FALSE;
+}
+
 /* The number of blocks must be divisible by the number of channels or they won't be
  * nearly the same size. It must also be divisible by the number of threads, or possibly
  * be close to being when there are many. This favors memory over threads, but since they
@@ -319,11 +365,192 @@ int stack_compute_parallel_blocks(struct _image_block **blocksptr, long max_numb
 	return ST_OK;
 }
 
+/* master frame creation: subtracts the master bias or the offset level from
+ * the area of a frame that has just been read, area being in top-down rows
+ * like the read data while the bias is stored bottom-up. Values are clipped
+ * like the calibration of preprocess does */
+static void subtract_bias(struct stacking_args *args, int layer, void *buffer,
+		const rectangle *area, data_type itype) {
+	fits *bias = args->bias;
+	if (!bias && args->bias_level == 0.f)
+		return;
+
+	const int level = roundf_to_int(args->bias_level * USHRT_MAX_SINGLE);
+	for (int y = 0; y < area->h; y++) {
+		size_t start = (size_t)y * area->w;
+		size_t bias_start = bias ? (size_t)(bias->ry - 1 - area->y - y) * bias->rx + area->x : 0;
+		if (itype == DATA_FLOAT) {
+			float *row = (float *)buffer + start;
+			if (!bias) {
+				for (int x = 0; x < area->w; x++)
+					row[x] -= args->bias_level;
+			} else if (bias->type == DATA_FLOAT) {
+				const float *brow = bias->fpdata[layer] + bias_start;
+				for (int x = 0; x < area->w; x++) {
+					float v = row[x] - brow[x];
+					row[x] = v > 1.f ? 1.f : (v < -1.f ? 0.f : v);
+				}
+			} else {
+				const WORD *brow = bias->pdata[layer] + bias_start;
+				for (int x = 0; x < area->w; x++) {
+					float v = row[x] - brow[x] * INV_USHRT_MAX_SINGLE;
+					row[x] = v > 1.f ? 1.f : (v < -1.f ? 0.f : v);
+				}
+			}
+		} else {
+			WORD *row = (WORD *)buffer + start;
+			if (!bias) {
+				for (int x = 0; x < area->w; x++)
+					row[x] = truncate_to_WORD((int)row[x] - level);
+			} else if (bias->type == DATA_FLOAT) {
+				const float *brow = bias->fpdata[layer] + bias_start;
+				for (int x = 0; x < area->w; x++)
+					row[x] = truncate_to_WORD((int)row[x] - roundf_to_int(brow[x] * USHRT_MAX_SINGLE));
+			} else {
+				const WORD *brow = bias->pdata[layer] + bias_start;
+				for (int x = 0; x < area->w; x++)
+					row[x] = truncate_to_WORD((int)row[x] - (int)brow[x]);
+			}
+		}
+	}
+}
+
+/* reads the area of the image decimated by factor in buffer, each pixel being
+ * the average of factor x factor full resolution pixels read in src */
+static int read_binned_region(struct stacking_args *args, int frame, int layer, void *buffer,
+		const rectangle *area, int factor, data_type itype, void *src, int thread_id) {
+	rectangle full = { area->x * factor, area->y * factor, area->w * factor, area->h * factor };
+	int retval = seq_opened_read_region(stack_frame_seq(args, frame), layer,
+			args->image_indices[frame], src, &full, thread_id);
+	if (retval)
+		return retval;
+	subtract_bias(args, layer, src, &full, itype);
+
+	const float norm = 1.f / (factor * factor);
+	for (int y = 0; y < area->h; y++) {
+		for (int x = 0; x < area->w; x++) {
+			float sum = 0.f;
+			for (int j = 0; j < factor; j++) {
+				size_t idx = (size_t)(y * factor + j) * full.w + x * factor;
+				if (itype == DATA_FLOAT) {
+					for (int i = 0; i < factor; i++)
+						sum += ((float *)src)[idx + i];
+				} else {
+					for (int i = 0; i < factor; i++)
+						sum += ((WORD *)src)[idx + i];
+				}
+			}
+			if (itype == DATA_FLOAT)
+				((float *)buffer)[y * area->w + x] = sum * norm;
+			else	((WORD *)buffer)[y * area->w + x] = round_to_WORD(sum * norm);
+		}
+	}
+	return 0;
+}
+
+/* frames registered without output sequence have their transformation stored,
+ * they are warped when read, except for the binned preview that uses the
+ * shifts of their translation part */
+static gboolean frame_is_warped(struct stacking_args *args, int frame) {
+	return args->decimation <= 1 && args->reglayer >= 0 &&
+		seq_frame_needs_warp(stack_frame_seq(args, frame), args->reglayer,
+				args->image_indices[frame]);
+}
+
+/* reads the rows of the frame that are needed to compute the area of the block
+ * aligned on the reference frame, and warps them in the pix buffer of the
+ * frame. Reading is done in top-down order, like the transformation.
+ * warp_src is allocated for the source rows of the blocks, as counted in the
+ * memory limits; if a frame needs more, the block is warped in smaller strips */
+static int read_warped_block(struct stacking_args *args, int frame, int layer,
+		const rectangle *area, struct _data_block *data, long *naxes,
+		data_type itype, int thread_id) {
+	sequence *seq = stack_frame_seq(args, frame);
+	int ielem_size = itype == DATA_FLOAT ? sizeof(float) : sizeof(WORD);
+	size_t row_size = (size_t)naxes[0] * ielem_size;
+	Homography H;
+	warp_transform t;
+
+	seq_get_frame_transform(seq, args->reglayer, args->image_indices[frame], &H);
+	warp_init_transform(&t, &H, naxes[0], naxes[1], naxes[0], naxes[1], FALSE, TRUE);
+	int first_row = area->y, end_row = area->y + area->h;
+	while (first_row < end_row) {
+		int nb_rows = end_row - first_row, src_y0, src_h;
+		warp_source_rows(&t, WARP_DEFAULT_INTERPOLATION, first_row, nb_rows, &src_y0, &src_h);
+		while (nb_rows > 1 && (size_t)src_h * row_size > data->warp_src_size) {
+			nb_rows = (nb_rows + 1) / 2;
+			warp_source_rows(&t, WARP_DEFAULT_INTERPOLATION, first_row, nb_rows, &src_y0, &src_h);
+		}
+		if (src_h > 0) {
+			size_t size = (size_t)src_h * row_size;
+			if (size > data->warp_src_size) {
+				void *tmp = realloc(data->warp_src, size);
+				if (!tmp) {
+					PRINT_ALLOC_ERR;
+					return 1;
+				}
+				data->warp_src = tmp;
+				data->warp_src_size = size;
+			}
+			rectangle src_area = { 0, src_y0, naxes[0], src_h };
+			if (seq_opened_read_region(seq, layer, args->image_indices[frame],
+						data->warp_src, &src_area, thread_id))
+				return 1;
+			subtract_bias(args, layer, data->warp_src, &src_area, itype);
+		}
+		void *dest = (char *)data->pix[frame] + (size_t)(first_row - area->y) * row_size;
+		if (warp_rows(data->warp_src, itype, src_y0, src_h, &t,
+					WARP_DEFAULT_INTERPOLATION, first_row, nb_rows, dest))
+			return 1;
+		first_row += nb_rows;
+	}
+	return 0;
+}
+
+/* number of source rows needed to warp a block of height rows of any of the
+ * frames that have a stored transformation, 0 if there is none. The frames
+ * being close to the reference, this is estimated as slope * height + span,
+ * span being the source rows needed for a single row of the block, largest
+ * at the top or bottom of the image */
+static long stack_get_warp_source_rows(struct stacking_args *args, long *naxes,
+		long height, double *slope_out, long *span_out) {
+	double slope = 0.0;
+	long span = 0;
+	gboolean warped = FALSE;
+	for (int frame = 0; frame < args->nb_images_to_stack; frame++) {
+		if (!frame_is_warped(args, frame))
+			continue;
+		Homography H;
+		warp_transform t;
+		seq_get_frame_transform(stack_frame_seq(args, frame), args->reglayer,
+				args->image_indices[frame], &H);
+		warp_init_transform(&t, &H, naxes[0], naxes[1], naxes[0], naxes[1], FALSE, TRUE);
+		int rows[3] = { 0, naxes[1] / 2, naxes[1] - 1 };
+		for (int i = 0; i < 3; i++) {
+			int src_y0, src_h;
+			warp_source_rows(&t, WARP_DEFAULT_INTERPOLATION, rows[i], 1, &src_y0, &src_h);
+			span = max(span, src_h);
+		}
+		if (t.m[2][2] != 0.0)
+			slope = max(slope, fabs(t.m[1][1] / t.m[2][2]));
+		else slope = max(slope, 1.0);
+		warped = TRUE;
+	}
+	if (slope_out)
+		*slope_out = slope;
+	if (span_out)
+		*span_out = span;
+	if (!warped)
+		return 0;
+	return min(naxes[1], (long)ceil(slope * height) + span);
+}
+
 static void stack_read_block_data(struct stacking_args *args, int use_regdata,
 		struct _image_block *my_block, struct _data_block *data,
 		long *naxes, data_type itype, int thread_id) {
 
 	int ielem_size = itype == DATA_FLOAT ? sizeof(float) : sizeof(WORD);
+	int factor = args->decimation > 1 ? args->decimation : 1;
 	/* store the layer info to retrieve normalization coeffs*/
 	data->layer = (int)my_block->channel;
 	/* Read the block from all images, store them in pix[image] */
@@ -331,21 +558,34 @@ static void stack_read_block_data(struct stacking_args *args, int use_regdata,
 		gboolean clear = FALSE, readdata = TRUE;
 		long offset = 0;
 		/* area in C coordinates, starting with 0, not cfitsio coordinates. */
-		rectangle area = {0, my_block->start_row, naxes[0], my_block->height};
+		rectangle area = {0, my_block->start_row + args->band_start, naxes[0], my_block->height};
 
 		if (!get_thread_run()) {
 			return;
 		}
+		if (use_regdata && frame_is_warped(args, frame)) {
+			if (read_warped_block(args, frame, my_block->channel, &area, data,
+						naxes, itype, thread_id)) {
+#ifdef _OPENMP
+				int tid = omp_get_thread_num();
+				if (tid == 0)
+#endif
+					siril_log_color_message(_("Error reading one of the image areas\n"), "red");
+				break;
+			}
+			continue;
+		}
 		if (use_regdata && args->reglayer >= 0) {
 			/* Load registration data for current image and modify area.
 			 * Here, only the y shift is managed. If possible, the remaining part
 			 * of the original area is read, the rest is filled with zeros. The x
 			 * shift is managed in the main loop after the read. */
-			regdata *layerparam = args->seq->regparam[args->reglayer];
+			sequence *seq = stack_frame_seq(args, frame);
+			regdata *layerparam = seq->regparam[args->reglayer];
 			if (layerparam) {
 				int shifty = round_to_int(
 						layerparam[args->image_indices[frame]].shifty *
-						args->seq->upscale_at_stacking);
+						seq->upscale_at_stacking / factor);
 #ifdef STACK_DEBUG
 				fprintf(stdout, "shifty for image %d: %d\n", args->image_indices[frame], shifty);
 #endif
@@ -385,8 +625,16 @@ static void stack_read_block_data(struct stacking_args *args, int use_regdata,
 			if (itype == DATA_FLOAT)
 				buffer = ((float*)data->pix[frame])+offset;
 			else 	buffer = ((WORD *)data->pix[frame])+offset;
-			int retval = seq_opened_read_region(args->seq, my_block->channel,
-					args->image_indices[frame], buffer, &area, thread_id);
+			int retval;
+			if (factor > 1)
+				retval = read_binned_region(args, frame, my_block->channel,
+						buffer, &area, factor, itype, data->binned_src, thread_id);
+			else {
+				retval = seq_opened_read_region(stack_frame_seq(args, frame), my_block->channel,
+						args->image_indices[frame], buffer, &area, thread_id);
+				if (!retval)
+					subtract_bias(args, my_block->channel, buffer, &area, itype);
+			}
 			if (retval) {
 #ifdef _OPENMP
 				int tid = omp_get_thread_num();
@@ -409,7 +657,7 @@ static void normalize_to16bit(int bitpix, double *mean) {
 	}
 }
 
-static void norm_to_0_1_range(fits *fit) {
+void norm_to_0_1_range(fits *fit) {
 	float mini = fit->fdata[0];
 	float maxi = fit->fdata[0];
 	long n = fit->naxes[0] * fit->naxes[1] * fit->naxes[2];
@@ -434,6 +682,58 @@ static void norm_to_0_1_range(fits *fit) {
 	}
 }
 
+/* Widens one row of a 16-bit image to float in the [0, 1] range, applying the
+ * normalization coefficients of the image and its horizontal shift in the same
+ * pass. Pixels shifted from outside the image and null pixels are kept null so
+ * that the rejection ignores them, like in the non-fused path. */
+static void normalize_ushort_row_to_float(const WORD *in, float *out, long width,
+		int shiftx, normalization mode, double scale, double offset, double mul) {
+	long xstart = max(0, shiftx);
+	long xend = min(width, width + shiftx);
+	if (xend < xstart)
+		xend = xstart;
+	for (long x = 0; x < xstart; x++)
+		out[x] = 0.f;
+	for (long x = xend; x < width; x++)
+		out[x] = 0.f;
+
+	switch (mode) {
+		default:
+		case NO_NORM:
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+			for (long x = xstart; x < xend; x++)
+				out[x] = in[x - shiftx] * INV_USHRT_MAX_SINGLE;
+			break;
+		case ADDITIVE:
+		case ADDITIVE_SCALING:
+			{
+				const float fscale = (float)scale * INV_USHRT_MAX_SINGLE;
+				const float foffset = (float)offset * INV_USHRT_MAX_SINGLE;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+				for (long x = xstart; x < xend; x++) {
+					const WORD pixel = in[x - shiftx];
+					out[x] = pixel > 0 ? pixel * fscale - foffset : 0.f;
+				}
+			}
+			break;
+		case MULTIPLICATIVE:
+		case MULTIPLICATIVE_SCALING:
+			{
+				const float fmul = (float)(scale * mul) * INV_USHRT_MAX_SINGLE;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+				for (long x = xstart; x < xend; x++)
+					out[x] = in[x - shiftx] * fmul;
+			}
+			break;
+	}
+}
+
 /******************************* REJECTION STACKING ******************************
  * The functions below are those managing the rejection, the stacking code is
  * after and similar to median but takes into account the registration data and
@@ -793,13 +1093,17 @@ static int apply_rejection_ushort(struct _data_block *data, int nb_frames, struc
 	return N;
 }
 
+/* computes the mean of the stack after rejection. The sum of the weights of the
+ * pixels that were kept, which is the number of kept pixels when weighting is
+ * not used, is stored in weight_sum for the weight map. */
 static double mean_and_reject(struct stacking_args *args, struct _data_block *data,
-		int stack_size, data_type itype, guint64 crej[2]) {
+		int stack_size, data_type itype, guint64 crej[2], double *weight_sum) {
 	double mean;
 
 	int layer = data->layer;
 	if (itype == DATA_USHORT) {
 		int kept_pixels = apply_rejection_ushort(data, stack_size, args, crej);
+		*weight_sum = 0.0;
 		if (kept_pixels == 0)
 			mean = quickmedian(data->stack, stack_size);
 		else {
@@ -822,16 +1126,19 @@ static double mean_and_reject(struct stacking_args *args, struct _data_block *da
 					}
 				}
 				mean = sum / norm;
+				*weight_sum = norm;
 			} else {
 				gint64 sum = 0L;
 				for (int frame = 0; frame < kept_pixels; ++frame) {
 					sum += ((WORD *)data->stack)[frame];
 				}
 				mean = sum / (double)kept_pixels;
+				*weight_sum = (double)kept_pixels;
 			}
 		}
 	} else {
 		int kept_pixels = apply_rejection_float(data, stack_size, args, crej);
+		*weight_sum = 0.0;
 		if (kept_pixels == 0)
 			mean = quickmedian_float(data->stack, stack_size);
 		else {
@@ -853,12 +1160,14 @@ static double mean_and_reject(struct stacking_args *args, struct _data_block *da
 					}
 				}
 			mean = sum / norm;
+			*weight_sum = norm;
 			} else {
 				double sum = 0.0;
 				for (int frame = 0; frame < kept_pixels; ++frame) {
 					sum += ((float*)data->stack)[frame];
 				}
 				mean = sum / (double)kept_pixels;
+				*weight_sum = (double)kept_pixels;
 			}
 		}
 	}
@@ -878,6 +1187,10 @@ static int compute_weights(struct stacking_args *args) {
 	int nb_layers = args->seq->nb_layers;
 
 	args->weights = malloc(nb_layers * nb_frames * sizeof(double));
+	if (!args->weights) {
+		PRINT_ALLOC_ERR;
+		return ST_ALLOC_ERROR;
+	}
 	double *pweights[3];
 
 	for (int layer = 0; layer < nb_layers; ++layer) {
@@ -885,9 +1198,10 @@ static int compute_weights(struct stacking_args *args) {
 		pweights[layer] = args->weights + layer * nb_frames;
 		for (int i = 0; i < args->nb_images_to_stack; ++i) {
 			int idx = args->image_indices[i];
+			sequence *seq = stack_frame_seq(args, i);
 			pweights[layer][i] = 1.f /
 				(args->coeff.pscale[layer][i] * args->coeff.pscale[layer][i] *
-				 args->seq->stats[layer][idx]->bgnoise * args->seq->stats[layer][idx]->bgnoise);
+				 seq->stats[layer][idx]->bgnoise * seq->stats[layer][idx]->bgnoise);
 			norm += pweights[layer][i];
 		}
 		norm /= (double) nb_frames;
@@ -939,15 +1253,21 @@ static void compute_date_time_keywords(GList *list_date, fits *fit) {
 }
 
 /* How many rows fit in memory, based on image size, number and available memory.
+ * Each of the nb_threads threads also needs extra_bytes, plus extra_row_bytes
+ * for each row of its block.
  * It returns at most the total number of rows of the image (naxes[1] * naxes[2]) */
-static long stack_get_max_number_of_rows(long naxes[3], data_type type, int nb_images_to_stack) {
+static long stack_get_max_number_of_rows(long naxes[3], data_type type, int nb_images_to_stack,
+		int nb_threads, guint64 extra_row_bytes, guint64 extra_bytes) {
 	int max_memory = get_max_memory_in_MB();
 	long total_nb_rows = naxes[1] * naxes[2];
 
 	siril_log_message(_("Using %d MB memory maximum for stacking\n"), max_memory);
 	int elem_size = type == DATA_FLOAT ? sizeof(float) : sizeof(WORD);
-	guint64 number_of_rows = (guint64)max_memory * BYTES_IN_A_MB /
-		((guint64)naxes[0] * nb_images_to_stack * elem_size);
+	guint64 memory = (guint64)max_memory * BYTES_IN_A_MB;
+	if (memory <= extra_bytes * nb_threads)
+		return 0;
+	guint64 number_of_rows = (memory - extra_bytes * nb_threads) /
+		((guint64)naxes[0] * nb_images_to_stack * elem_size + extra_row_bytes);
 	// this is how many rows we can load in parallel from all images of the
 	// sequence and be under the limit defined in config in megabytes.
 	if (total_nb_rows < number_of_rows)
@@ -955,6 +1275,26 @@ static long stack_get_max_number_of_rows(long naxes[3], data_type type, int nb_i
 	return (long)number_of_rows;
 }
 
+/* The rejection and weight maps have the size of the result and are filled by
+ * the thread that stacks the corresponding block, so that no second pass over
+ * the input is required to locate rejected pixels. */
+static int stack_allocate_maps(struct stacking_args *args, long naxes[3]) {
+	size_t npixels = naxes[0] * naxes[1] * naxes[2];
+	if (args->create_rejmaps && args->type_of_rejection != NO_REJEC) {
+		if (new_fit_image(&args->rejmap_low, naxes[0], naxes[1], naxes[2], DATA_USHORT) ||
+				new_fit_image(&args->rejmap_high, naxes[0], naxes[1], naxes[2], DATA_USHORT))
+			return ST_ALLOC_ERROR;
+		memset(args->rejmap_low->data, 0, npixels * sizeof(WORD));
+		memset(args->rejmap_high->data, 0, npixels * sizeof(WORD));
+	}
+	if (args->create_weightmap) {
+		if (new_fit_image(&args->weightmap, naxes[0], naxes[1], naxes[2], DATA_FLOAT))
+			return ST_ALLOC_ERROR;
+		memset(args->weightmap->fdata, 0, npixels * sizeof(float));
+	}
+	return ST_OK;
+}
+
 static int stack_mean_or_median(struct stacking_args *args, gboolean is_mean) {
 	int bitpix, i, naxis, cur_nb = 0, retval = ST_OK, pool_size = 1;
 	long naxes[3];
@@ -964,8 +1304,9 @@ static int stack_mean_or_median(struct stacking_args *args, gboolean is_mean) {
 	fits ref = { 0 }; // reference image, used to get metadata back
 	// data for mean/rej only
 	guint64 irej[3][2] = {{0,0}, {0,0}, {0,0}};
-	regdata *layerparam = NULL;
+	int *shiftx = NULL;	// horizontal shift of each frame, from registration data
 	gboolean use_regdata = is_mean;
+	int factor = args->decimation > 1 ? args->decimation : 1;	// preview binning
 
 
 	int nb_frames = args->nb_images_to_stack; // number of frames actually used
@@ -978,21 +1319,34 @@ static int stack_mean_or_median(struct stacking_args *args, gboolean is_mean) {
 		siril_log_message(_("The Generalized Extreme Studentized Deviate Test needs at least three frames for stacking. Aborting.\n"));
 		return ST_GENERIC_ERROR;
 	}
-	g_assert(nb_frames <= args->seq->number);
+	g_assert(args->sessions || nb_frames <= args->seq->number);
 
 	if (use_regdata) {
 		if (args->reglayer < 0) {
 			siril_log_message(_("No registration layer passed, ignoring registration data!\n"));
 			use_regdata = FALSE;
+		} else {
+			shiftx = calloc(nb_frames, sizeof(int));
+			if (!shiftx) {
+				PRINT_ALLOC_ERR;
+				return ST_ALLOC_ERROR;
+			}
+			for (int frame = 0; frame < nb_frames; frame++) {
+				sequence *seq = stack_frame_seq(args, frame);
+				regdata *layerparam = seq->regparam[args->reglayer];
+				if (layerparam && !frame_is_warped(args, frame))
+					shiftx[frame] = round_to_int(
+							layerparam[args->image_indices[frame]].shiftx *
+							seq->upscale_at_stacking / factor);
+			}
 		}
-		else layerparam = args->seq->regparam[args->reglayer];
 	}
 
 	set_progress_bar_data(NULL, PROGRESS_RESET);
 
 	/* first loop: open all fits files and check they are of same size */
 	GList *list_date = NULL;
-	if ((retval = stack_open_all_files(args, &bitpix, &naxis, naxes, &list_date, &ref))) {
+	if ((retval = stack_open_all_sessions(args, &bitpix, &naxis, naxes, &list_date, &ref))) {
 		goto free_and_close;
 	}
 
@@ -1011,27 +1365,72 @@ static int stack_mean_or_median(struct stacking_args *args, gboolean is_mean) {
 		siril_log_message(_("Processing the sequence as RGB\n"));
 		naxes[2] = 3;
 	}
+	if (args->bias && memcmp(args->bias->naxes, naxes, sizeof args->bias->naxes)) {
+		siril_log_color_message(_("The master bias does not have the size of the images of the sequence\n"), "red");
+		retval = ST_GENERIC_ERROR;
+		goto free_and_close;
+	}
 	fprintf(stdout, "image size: %ldx%ld, %ld layers\n", naxes[0], naxes[1], naxes[2]);
+	if (factor > 1) {
+		/* from now on, the images are seen binned */
+		naxes[0] /= factor;
+		naxes[1] /= factor;
+		if (naxes[0] < 1 || naxes[1] < 1) {
+			siril_log_color_message(_("Images are too small to be binned %dx%d\n"), "red", factor, factor);
+			retval = ST_GENERIC_ERROR;
+			goto free_and_close;
+		}
+		siril_log_message(_("Preview stacking of images binned %dx%d (%ldx%ld)\n"),
+				factor, factor, naxes[0], naxes[1]);
+	}
+
+	/* size of the result, only the band of rows if one is given */
+	long out_naxes[3] = { naxes[0], naxes[1], naxes[2] };
+	if (args->band_height > 0) {
+		if (args->band_start < 0 || args->band_start + args->band_height > naxes[1]) {
+			siril_log_color_message(_("Rejection stack error: rows %d to %d are outside the image\n"), "red",
+					args->band_start, args->band_start + args->band_height - 1);
+			retval = ST_GENERIC_ERROR;
+			goto free_and_close;
+		}
+		out_naxes[1] = args->band_height;
+		siril_log_message(_("Stacking only rows %d to %d\n"), args->band_start,
+				args->band_start + args->band_height - 1);
+	} else {
+		args->band_start = 0;
+	}
 
 	/* initialize result image */
 	fits *fptr = &fit;
-	if ((retval = new_fit_image(&fptr, naxes[0], naxes[1], naxes[2],
+	if ((retval = new_fit_image(&fptr, out_naxes[0], out_naxes[1], out_naxes[2],
 					args->use_32bit_output ? DATA_FLOAT : DATA_USHORT))) {
 		goto free_and_close;
 	}
 	copy_fits_metadata(&ref, fptr);
 	clearfits(&ref);
+	if (factor > 1) {
+		fit.binning_x *= factor;
+		fit.binning_y *= factor;
+		fit.pixel_size_x *= factor;
+		fit.pixel_size_y *= factor;
+	}
 	if (!args->use_32bit_output && (args->output_norm || fit.orig_bitpix != BYTE_IMG)) {
 		fit.bitpix = USHORT_IMG;
 		if (args->output_norm)
 			fit.orig_bitpix = USHORT_IMG;
 	}
+	if (is_mean && (retval = stack_allocate_maps(args, out_naxes))) {
+		PRINT_ALLOC_ERR;
+		goto free_and_close;
+	}
 
 	/* manage threads */
 	int nb_threads;
 #ifdef _OPENMP
 	nb_threads = com.max_thread;
-	if (nb_threads > 1 && (args->seq->type == SEQ_REGULAR || args->seq->type == SEQ_FITSEQ)) {
+	gboolean uses_fits = stack_uses_sequence_type(args, SEQ_REGULAR) ||
+		stack_uses_sequence_type(args, SEQ_FITSEQ);
+	if (nb_threads > 1 && uses_fits) {
 		if (fits_is_reentrant()) {
 			fprintf(stdout, "cfitsio was compiled with multi-thread support,"
 					" stacking will be executed by several cores\n");
@@ -1043,7 +1442,7 @@ static int stack_mean_or_median(struct stacking_args *args, gboolean is_mean) {
 		}
 	}
 #ifdef HAVE_FFMS2
-	if (args->seq->type == SEQ_AVI) {
+	if (stack_uses_sequence_type(args, SEQ_AVI)) {
 		siril_log_color_message(_("Stacking a film will work only on one core and will be slower than if you convert it to SER\n"), "salmon");
 		nb_threads = 1;
 	}
@@ -1056,9 +1455,39 @@ static int stack_mean_or_median(struct stacking_args *args, gboolean is_mean) {
 	long largest_block_height;
 	int nb_blocks;
 	data_type itype = get_data_type(bitpix);
-	long max_number_of_rows = stack_get_max_number_of_rows(naxes, itype, args->nb_images_to_stack);
+	/* 16-bit images stacked to a 32-bit result are read as 16-bit, but they are
+	 * normalized while being widened to float and the stack is processed in
+	 * float, avoiding the rounding to 16-bit of normalized values */
+	gboolean widen_to_float = itype == DATA_USHORT && args->use_32bit_output;
+	data_type stype = widen_to_float ? DATA_FLOAT : itype;	// type of the stack
+	int ielem_size = itype == DATA_FLOAT ? sizeof(float) : sizeof(WORD);
+	/* frames with a stored transformation are warped from the source rows
+	 * of the block, read in a buffer of each thread */
+	double warp_slope = 0.0;
+	long warp_span = 0;
+	if (use_regdata)
+		stack_get_warp_source_rows(args, naxes, 1, &warp_slope, &warp_span);
+	guint64 extra_row_bytes = (guint64)ceil(warp_slope * naxes[0] * ielem_size);
+	guint64 extra_bytes = (guint64)warp_span * naxes[0] * ielem_size;
+	/* the frames are read with their type, 16-bit stacked in float are
+	 * widened one row of all frames at a time in a buffer of each thread */
+	if (widen_to_float)
+		extra_bytes += (guint64)nb_frames * naxes[0] * sizeof(float);
+	/* the binned preview reads the full resolution rows of its blocks */
+	if (factor > 1)
+		extra_row_bytes += (guint64)naxes[0] * factor * factor * ielem_size;
+	long max_number_of_rows = stack_get_max_number_of_rows(out_naxes, itype, args->nb_images_to_stack,
+			nb_threads, extra_row_bytes, extra_bytes);
+	if (max_number_of_rows < nb_threads) {
+		if (max_number_of_rows < 1) {
+			siril_log_color_message(_("Not enough memory to stack these images\n"), "red");
+			retval = ST_ALLOC_ERROR;
+			goto free_and_close;
+		}
+		nb_threads = max_number_of_rows;
+	}
 	/* Compute parallel processing data: the data blocks, later distributed to threads */
-	if ((retval = stack_compute_parallel_blocks(&blocks, max_number_of_rows, naxes, nb_threads,
+	if ((retval = stack_compute_parallel_blocks(&blocks, max_number_of_rows, out_naxes, nb_threads,
 					&largest_block_height, &nb_blocks))) {
 		goto free_and_close;
 	}
@@ -1073,19 +1502,24 @@ static int stack_mean_or_median(struct stacking_args *args, gboolean is_mean) {
 #endif
 	size_t npixels_in_block = largest_block_height * naxes[0];
 	g_assert(npixels_in_block > 0);
-	int ielem_size = itype == DATA_FLOAT ? sizeof(float) : sizeof(WORD);
+	int selem_size = stype == DATA_FLOAT ? sizeof(float) : sizeof(WORD);
+	long warp_src_rows = use_regdata ?
+		stack_get_warp_source_rows(args, naxes, largest_block_height, NULL, NULL) : 0;
 
 	fprintf(stdout, "allocating data for %d threads (each %'lu MB)\n", pool_size,
 			(unsigned long)(nb_frames * npixels_in_block * ielem_size) / BYTES_IN_A_MB);
 	data_pool = calloc(pool_size, sizeof(struct _data_block));
-	size_t bufferSize = ielem_size * nb_frames * (npixels_in_block + 1ul) + 4ul; // buffer for tmp and stack, added 4 byte for alignment
+	size_t stack_offset = ielem_size * nb_frames * npixels_in_block;
+	if (stack_offset % sizeof(float)) // align stack
+		stack_offset += sizeof(float) - stack_offset % sizeof(float);
+	size_t bufferSize = stack_offset + selem_size * nb_frames + 4ul; // buffer for tmp and stack, added 4 byte for alignment
 	if (is_mean) {
 		bufferSize += nb_frames * sizeof(int); // for rejected
-		bufferSize += ielem_size * nb_frames; // for o_stack
+		bufferSize += selem_size * nb_frames; // for o_stack
 		if (args->type_of_rejection == WINSORIZED) {
-			bufferSize += ielem_size * nb_frames; // for w_frame
+			bufferSize += selem_size * nb_frames; // for w_frame
 		} else if (args->type_of_rejection == GESDT) {
-			bufferSize += ielem_size * nb_frames; // for w_frame
+			bufferSize += selem_size * nb_frames; // for w_frame
 			bufferSize += sizeof(float) * (int) floor(nb_frames * args->sig[0]); //and GCritical
 		} else if (args->type_of_rejection == LINEARFIT) {
 			bufferSize += 2 * sizeof(float) * nb_frames; // for xc and yc
@@ -1094,7 +1528,17 @@ static int stack_mean_or_median(struct stacking_args *args, gboolean is_mean) {
 	for (i = 0; i < pool_size; i++) {
 		data_pool[i].pix = malloc(nb_frames * sizeof(void *));
 		data_pool[i].tmp = malloc(bufferSize);
-		if (!data_pool[i].pix || !data_pool[i].tmp) {
+		if (widen_to_float)
+			data_pool[i].frows = malloc(nb_frames * naxes[0] * sizeof(float));
+		if (factor > 1)
+			data_pool[i].binned_src = malloc(npixels_in_block * factor * factor * ielem_size);
+		if (warp_src_rows > 0) {
+			data_pool[i].warp_src_size = warp_src_rows * naxes[0] * ielem_size;
+			data_pool[i].warp_src = malloc(data_pool[i].warp_src_size);
+		}
+		if (!data_pool[i].pix || !data_pool[i].tmp || (widen_to_float && !data_pool[i].frows) ||
+				(factor > 1 && !data_pool[i].binned_src) ||
+				(warp_src_rows > 0 && !data_pool[i].warp_src)) {
 			PRINT_ALLOC_ERR;
 			gchar *available = g_format_size_full(get_available_memory(), G_FORMAT_SIZE_IEC_UNITS);
 			fprintf(stderr, "Cannot allocate %zu (free memory: %s)\n", bufferSize / BYTES_IN_A_MB, available);
@@ -1104,10 +1548,9 @@ static int stack_mean_or_median(struct stacking_args *args, gboolean is_mean) {
 			retval = ST_ALLOC_ERROR;
 			goto free_and_close;
 		}
-		data_pool[i].stack = (void*) ((char*) data_pool[i].tmp
-				+ nb_frames * npixels_in_block * ielem_size);
+		data_pool[i].stack = (void*) ((char*) data_pool[i].tmp + stack_offset);
 		if (is_mean) {
-			size_t offset = (size_t)ielem_size * nb_frames * (npixels_in_block + 1);
+			size_t offset = stack_offset + (size_t)selem_size * nb_frames;
 			int temp = offset % sizeof(int);
 			if (temp > 0) { // align buffer
 				offset += sizeof(int) - temp;
@@ -1116,9 +1559,9 @@ static int stack_mean_or_median(struct stacking_args *args, gboolean is_mean) {
 			data_pool[i].o_stack = (void*)((char*)data_pool[i].rejected + sizeof(int) * nb_frames);
 
 			if (args->type_of_rejection == WINSORIZED) {
-				data_pool[i].w_stack = (void*)((char*)data_pool[i].o_stack + ielem_size * nb_frames);
+				data_pool[i].w_stack = (void*)((char*)data_pool[i].o_stack + selem_size * nb_frames);
 			} else if (args->type_of_rejection == GESDT) {
-				data_pool[i].w_stack = (void*)((char*)data_pool[i].o_stack + ielem_size * nb_frames);
+				data_pool[i].w_stack = (void*)((char*)data_pool[i].o_stack + selem_size * nb_frames);
 				int max_outliers = (int) floor(nb_frames * args->sig[0]);
 				args->critical_value = malloc(max_outliers * sizeof(float));
 				for (int j = 0, size = nb_frames; j < max_outliers; j++, size--) {
@@ -1128,7 +1571,7 @@ static int stack_mean_or_median(struct stacking_args *args, gboolean is_mean) {
 					args->critical_value[j] = numerator / denominator;
 				}
 			} else if (args->type_of_rejection == LINEARFIT) {
-				data_pool[i].xf = (float (*)) ((char*)data_pool[i].o_stack + ielem_size * nb_frames);
+				data_pool[i].xf = (float (*)) ((char*)data_pool[i].o_stack + selem_size * nb_frames);
 				data_pool[i].yf = data_pool[i].xf + nb_frames;
 				// precalculate some stuff
 				data_pool[i].m_x = (nb_frames - 1) * 0.5f;
@@ -1150,7 +1593,7 @@ static int stack_mean_or_median(struct stacking_args *args, gboolean is_mean) {
 		}
 	}
 
-	if (itype == DATA_USHORT) {
+	if (stype == DATA_USHORT) {
 		args->sd_calculator = nb_frames < 65536 ? siril_stats_ushort_sd_32 : siril_stats_ushort_sd_64;
 		args->mad_calculator = siril_stats_ushort_mad;
 	}
@@ -1168,10 +1611,10 @@ static int stack_mean_or_median(struct stacking_args *args, gboolean is_mean) {
 	if (is_mean)
 		set_progress_bar_data(_("Rejection stacking in progress..."), PROGRESS_RESET);
 	else	set_progress_bar_data(_("Median stacking in progress..."), PROGRESS_RESET);
-	double total = (double)(naxes[2] * naxes[1] + 2); // for progress bar
+	double total = (double)(out_naxes[2] * out_naxes[1] + 2); // for progress bar
 
 #ifdef _OPENMP
-#pragma omp parallel for num_threads(nb_threads) private(i) schedule(dynamic) if (nb_threads > 1 && (args->seq->type == SEQ_SER || fits_is_reentrant()))
+#pragma omp parallel for num_threads(nb_threads) private(i) schedule(dynamic) if (nb_threads > 1 && (!uses_fits || fits_is_reentrant()))
 #endif
 	for (i = 0; i < nb_blocks; i++)
 	{
@@ -1214,7 +1657,7 @@ static int stack_mean_or_median(struct stacking_args *args, gboolean is_mean) {
 			/* index of the pixel in the result image
 			 * we read line y, but we need to store it at
 			 * ry - y - 1 to not have the image mirrored. */
-			size_t pdata_idx = (naxes[1] - (my_block->start_row + y) - 1) * naxes[0];
+			size_t pdata_idx = (out_naxes[1] - (my_block->start_row + y) - 1) * naxes[0];
 			/* index of the line in the read data, data->pix[frame] */
 			size_t line_idx = y * naxes[0];
 			guint64 crej[2] = {0, 0};
@@ -1233,20 +1676,36 @@ static int stack_mean_or_median(struct stacking_args *args, gboolean is_mean) {
 			if (!(cur_nb % 16))	// every 16 iterations
 				set_progress_bar_data(NULL, (double)cur_nb/total);
 
+			if (widen_to_float) {
+				/* normalize and convert the row of all images at once,
+				 * the stack is then simply gathered from the float rows */
+				for (int frame = 0; frame < nb_frames; ++frame) {
+					double scale = 1.0, offset = 0.0, mul = 1.0;
+					if (args->normalize != NO_NORM) {
+						scale = args->coeff.pscale[layer][frame];
+						offset = args->coeff.poffset[layer][frame];
+						mul = args->coeff.pmul[layer][frame];
+					}
+					normalize_ushort_row_to_float((WORD *)data->pix[frame] + line_idx,
+							data->frows + frame * naxes[0], naxes[0],
+							use_regdata ? shiftx[frame] : 0,
+							args->normalize, scale, offset, mul);
+				}
+			}
+
 			for (x = 0; x < naxes[0]; ++x) {
+				if (widen_to_float) {
+					float *fstack = (float *)data->stack;
+					for (int frame = 0; frame < nb_frames; ++frame)
+						fstack[frame] = data->frows[frame * naxes[0] + x];
+				}
 				/* copy all images pixel values in the same row array `stack'
 				 * to optimize caching and improve readability */
-				for (int frame = 0; frame < nb_frames; ++frame) {
+				else for (int frame = 0; frame < nb_frames; ++frame) {
 					int pix_idx = line_idx + x;
 					if (use_regdata) {
-						int shiftx = 0;
-						if (layerparam) {
-							shiftx = round_to_int(
-									layerparam[args->image_indices[frame]].shiftx *
-									args->seq->upscale_at_stacking);
-						}
-
-						if (shiftx && (x - shiftx >= naxes[0] || x - shiftx < 0)) {
+						int dx = shiftx[frame];
+						if (dx && (x - dx >= naxes[0] || x - dx < 0)) {
 							/* outside bounds, images are black. We could
 							 * also set the background value instead, if available */
 							if (itype == DATA_FLOAT)
@@ -1255,7 +1714,7 @@ static int stack_mean_or_median(struct stacking_args *args, gboolean is_mean) {
 							continue;
 						}
 
-						pix_idx -= shiftx;
+						pix_idx -= dx;
 					}
 
 					WORD pixel = 0; float fpixel = 0.f;
@@ -1311,15 +1770,23 @@ static int stack_mean_or_median(struct stacking_args *args, gboolean is_mean) {
 
 				double result; // resulting pixel value, either mean or median
 				if (is_mean) {
-					result = mean_and_reject(args, data, nb_frames, itype, crej);
+					guint64 prev_rej[2] = { crej[0], crej[1] };
+					double weight_sum;
+					result = mean_and_reject(args, data, nb_frames, stype, crej, &weight_sum);
+					if (args->rejmap_low) {
+						args->rejmap_low->pdata[my_block->channel][pdata_idx] = (WORD)min(crej[0] - prev_rej[0], (guint64)USHRT_MAX);
+						args->rejmap_high->pdata[my_block->channel][pdata_idx] = (WORD)min(crej[1] - prev_rej[1], (guint64)USHRT_MAX);
+					}
+					if (args->weightmap)
+						args->weightmap->fpdata[my_block->channel][pdata_idx] = (float)weight_sum;
 				} else {
-					if (itype == DATA_USHORT)
+					if (stype == DATA_USHORT)
 						result = quickmedian(data->stack, nb_frames);
 					else 	result = quickmedian_float(data->stack, nb_frames);
 				}
 
 				if (args->use_32bit_output) {
-					if (itype == DATA_USHORT)
+					if (stype == DATA_USHORT)
 						fit.fpdata[my_block->channel][pdata_idx] = min(double_ushort_to_float_range(result), 1.f);
 					else	fit.fpdata[my_block->channel][pdata_idx] = min((float)result, 1.f);
 				} else {
@@ -1360,14 +1827,31 @@ static int stack_mean_or_median(struct stacking_args *args, gboolean is_mean) {
 		goto free_and_close;
 
 	set_progress_bar_data(_("Finalizing stacking..."), (double)cur_nb/total);
+	double nb_tot = (double) out_naxes[0] * (double) out_naxes[1] * (double) nb_frames;
+	/* kept for the merge of the statistics of distributed bands */
+	memcpy(args->rejected, irej, sizeof irej);
+	args->nb_rejection_tested = nb_tot;
 	if (is_mean) {
-		double nb_tot = (double) naxes[0] * (double) naxes[1] * (double) nb_frames;
 		for (long channel = 0; channel < naxes[2]; channel++) {
 			siril_log_message(_("Pixel rejection in channel #%d: %.3lf%% - %.3lf%%\n"),
 					channel, (double) irej[channel][0] / nb_tot * 100.0,
 					(double) irej[channel][1] / nb_tot * 100.0);
 		}
 	}
+	if (factor > 1) {
+		/* the noise is reduced by the square root of the number of kept
+		 * pixels, estimated from the rejection on binned images, which
+		 * underestimates it a bit as binning dilutes outliers. The median
+		 * has an efficiency of 2/pi compared to the mean. */
+		for (long channel = 0; channel < naxes[2]; channel++) {
+			double kept = nb_frames;
+			if (is_mean)
+				kept *= 1.0 - (double)(irej[channel][0] + irej[channel][1]) / nb_tot;
+			else kept *= 2.0 / M_PI;
+			siril_log_message(_("Estimated full resolution SNR gain in channel #%d: %.2f\n"),
+					channel, sqrt(kept));
+		}
+	}
 
 	/* copy result to gfit if success */
 	clearfits(&gfit);
@@ -1378,7 +1862,8 @@ static int stack_mean_or_median(struct stacking_args *args, gboolean is_mean) {
 		for (i = 0; i < fit.naxes[2]; i++)
 			gfit.fpdata[i] = fit.fpdata[i];
 
-		if (args->output_norm) {
+		/* a band is normalized with the others when they are merged */
+		if (args->output_norm && args->band_height <= 0) {
 			norm_to_0_1_range(&gfit);
 		}
 	} else {
@@ -1392,13 +1877,16 @@ static int stack_mean_or_median(struct stacking_args *args, gboolean is_mean) {
 free_and_close:
 	fprintf(stdout, "free and close (%d)\n", retval);
 	for (i = 0; i < nb_frames; ++i) {
-		seq_close_image(args->seq, args->image_indices[i]);
+		seq_close_image(stack_frame_seq(args, i), args->image_indices[i]);
 	}
 
 	if (data_pool) {
 		for (i=0; i<pool_size; i++) {
 			if (data_pool[i].pix) free(data_pool[i].pix);
 			if (data_pool[i].tmp) free(data_pool[i].tmp);
+			if (data_pool[i].frows) free(data_pool[i].frows);
+			if (data_pool[i].binned_src) free(data_pool[i].binned_src);
+			if (data_pool[i].warp_src) free(data_pool[i].warp_src);
 		}
 		free(data_pool);
 	}
@@ -1411,10 +1899,12 @@ free_and_close:
 	}
 
 	if (args->weights) free(args->weights);
+	if (shiftx) free(shiftx);
 	if (retval) {
 		/* if retval is set, gfit has not been modified */
 		if (fit.data) free(fit.data);
 		if (fit.fdata) free(fit.fdata);
+		free_stacking_maps(args);
 		if (is_mean)
 			set_progress_bar_data(_("Rejection stacking failed. Check the log."), PROGRESS_RESET);
 		else	set_progress_bar_data(_("Median stacking failed. Check the log."), PROGRESS_RESET);
@@ -35,7 +35,12 @@ int do_normalization(struct stacking_args *args) {
 		return args->retval;
 	}
 
-	if (args->seq->needs_saving)	// if we had to compute new stats
+	if (args->sessions) {
+		for (int s = 0; s < args->nb_sessions; s++)
+			if (args->sessions[s]->needs_saving)
+				writeseqfile(args->sessions[s]);
+	}
+	else if (args->seq->needs_saving)	// if we had to compute new stats
 		writeseqfile(args->seq);
 
 	return ST_OK;
@@ -48,25 +53,27 @@ static int _compute_normalization_for_image(struct stacking_args *args, int i, i
 	imstats *stat = NULL;
 	gboolean fit_is_open = FALSE;
 	fits fit = { 0 };
+	sequence *seq = stack_frame_seq(args, i);
 
 
-	for (int layer = 0; layer < args->seq->nb_layers; ++layer) {
+	for (int layer = 0; layer < seq->nb_layers; ++layer) {
 		// try with no fit passed: fails if data is needed because data is not cached
-		if (!(stat = statistics(args->seq, args->image_indices[i], NULL, layer, NULL, STATS_NORM, multithread))) {
+		if (!(stat = statistics(seq, args->image_indices[i], NULL, layer, NULL, STATS_NORM, multithread))) {
 			if (!(fit_is_open)) {
 				// read frames as float, it's faster to compute stats
-				if (seq_read_frame(args->seq, args->image_indices[i], &fit, TRUE, thread_id)) {
+				if (seq_read_frame(seq, args->image_indices[i], &fit, TRUE, thread_id)) {
 					return ST_SEQUENCE_ERROR;
 				}
 				fit_is_open = TRUE; // to avoid opening fit more than once if RGB
 			}
 			// retry with the fit to compute it
-			if (!(stat = statistics(args->seq, args->image_indices[i], &fit, layer, NULL, STATS_NORM, multithread)))
+			if (!(stat = statistics(seq, args->image_indices[i], &fit, layer, NULL, STATS_NORM, multithread)))
 				return ST_GENERIC_ERROR;
 		}
 
 		double sc = stat->scale;
-		double loc = stat->location;
+		/* frames of a master are calibrated by the bias when read */
+		double loc = stat->location - args->bias_location[layer];
 
 		switch (mode) {
 		default:
@@ -96,7 +103,7 @@ static int _compute_normalization_for_image(struct stacking_args *args, int i, i
 			break;
 		}
 	}
-	if (fit_is_open && args->seq->type != SEQ_INTERNAL)
+	if (fit_is_open && seq->type != SEQ_INTERNAL)
 		clearfits(&fit);
 	free_stats(stat);
 	return ST_OK;
@@ -134,6 +141,29 @@ static int normalization_get_max_number_of_threads(sequence *seq) {
 	return nb_threads;
 }
 
+/* the statistics of the frames are computed on the raw images, the location of
+ * the bias subtracted while stacking is expressed in their range */
+static int compute_bias_location(struct stacking_args *args) {
+	int nb_layers = args->seq->nb_layers;
+	double frame_norm = get_data_type(args->seq->bitpix) == DATA_FLOAT ? 1.0 :
+		(args->seq->bitpix == BYTE_IMG ? UCHAR_MAX_DOUBLE : USHRT_MAX_DOUBLE);
+
+	for (int layer = 0; layer < nb_layers; ++layer) {
+		if (!args->bias) {
+			args->bias_location[layer] = args->bias_level * frame_norm;
+			continue;
+		}
+		imstats *stat = statistics(NULL, -1, args->bias, layer, NULL, STATS_BASIC, TRUE);
+		if (!stat) {
+			siril_log_message(_("Error: statistics computation failed.\n"));
+			return 1;
+		}
+		args->bias_location[layer] = stat->median / stat->normValue * frame_norm;
+		free_stats(stat);
+	}
+	return 0;
+}
+
 static int compute_normalization(struct stacking_args *args) {
 	int i, ref_image_filtred_idx = -1, retval = 0, cur_nb = 1;
 	double *scale0, *mul0, *offset0;	// for reference frame
@@ -158,6 +188,8 @@ static int compute_normalization(struct stacking_args *args) {
 
 	if (args->normalize == NO_NORM)	// should never happen here
 		return 0;
+	if ((args->bias || args->bias_level != 0.f) && compute_bias_location(args))
+		return ST_GENERIC_ERROR;
 
 	scale0 = malloc(nb_layers * sizeof(double));
 	mul0 = malloc(nb_layers * sizeof(double));
@@ -169,7 +201,7 @@ static int compute_normalization(struct stacking_args *args) {
 
 	// first, find the index of the ref image in the filtered image list
 	ref_image_filtred_idx = find_refimage_in_indices(args->image_indices,
-			args->nb_images_to_stack, args->ref_image);
+			stack_nb_frames_of_first_session(args), args->ref_image);
 	if (ref_image_filtred_idx == -1) {
 		siril_log_color_message(_("The reference image is not in the selected set of images. "
 				"Please choose another reference image.\n"), "red");
@@ -191,8 +223,13 @@ static int compute_normalization(struct stacking_args *args) {
 	}
 
 	/* We empty the cache if needed (force to recompute) */
-	if (args->force_norm)
-		clear_stats(args->seq, args->reglayer);
+	if (args->force_norm) {
+		if (args->sessions) {
+			for (int s = 0; s < args->nb_sessions; s++)
+				clear_stats(args->sessions[s], args->reglayer);
+		}
+		else clear_stats(args->seq, args->reglayer);
+	}
 
 	// compute for the first image to have scale0 mul0 and offset0 for each layer
 
@@ -211,9 +248,15 @@ static int compute_normalization(struct stacking_args *args) {
 
 	set_progress_bar_data(NULL, 1.0 / (double)args->nb_images_to_stack);
 
+	gboolean can_read_in_parallel = TRUE;
+	for (int s = 0; s < (args->sessions ? args->nb_sessions : 1); s++) {
+		sequence *seq = args->sessions ? args->sessions[s] : args->seq;
+		can_read_in_parallel = can_read_in_parallel && (seq->type == SEQ_SER ||
+				((seq->type == SEQ_REGULAR || seq->type == SEQ_FITSEQ) && fits_is_reentrant()));
+	}
+
 #ifdef _OPENMP
-#pragma omp parallel for num_threads(nb_threads) private(i) schedule(guided) \
-	if (args->seq->type == SEQ_SER || ((args->seq->type == SEQ_REGULAR || args->seq->type == SEQ_FITSEQ) && fits_is_reentrant()))
+#pragma omp parallel for num_threads(nb_threads) private(i) schedule(guided) if (can_read_in_parallel)
 #endif
 
 	for (i = 0; i < args->nb_images_to_stack; ++i) {
@@ -0,0 +1,361 @@
+/*
+ * This file is part of Siril, an astronomy image processor.
+ * Copyright (C) 2005-2011 Francois Meyer (dulle at free.fr)
+ * Copyright (C) 2012-2021 team free-astro (see more in AUTHORS file)
+ * Reference site is https://free-astro.org/index.php/Siril
+ *
+ * Siril is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Siril is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Siril. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Distributed stacking: the image is split in horizontal bands, each band is
+ * stacked by a siril-cli process running the same stack command restricted to
+ * the band with the -band option. On machines with several NUMA nodes, the
+ * workers are bound to a node with numactl, so that the memory they read the
+ * images into is local to the cores that stack them. Bands are exchanged
+ * through files in a temporary directory and merged in this process. */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "core/siril.h"
+#include "core/proto.h"
+#include "core/processing.h"
+#include "core/siril_log.h"
+#include "io/image_format_fits.h"
+#include "gui/progress_and_log.h"
+#include "stacking.h"
+
+#define STACK_WORKER_PROGRAM "siril-cli"
+#define MAX_NUMA_NODES 64
+
+struct stack_worker {
+	GSubprocess *process;
+	gchar *result;		// file where the band is saved by the worker
+	int band_start, band_height;
+};
+
+/* fills nodes with the identifiers of the online NUMA nodes of the machine,
+ * returns their number or 0 if this information is not available */
+static int get_numa_nodes(int *nodes, int max_nodes) {
+	gchar *content = NULL;
+	int nb = 0;
+	if (!g_file_get_contents("/sys/devices/system/node/online", &content, NULL, NULL))
+		return 0;
+	/* list of ranges, like 0-1,4 */
+	gchar **ranges = g_strsplit(g_strstrip(content), ",", -1);
+	for (int i = 0; ranges[i]; i++) {
+		int first, last;
+		int n = sscanf(ranges[i], "%d-%d", &first, &last);
+		if (n < 1)
+			continue;
+		if (n == 1)
+			last = first;
+		for (int node = first; node <= last && nb < max_nodes; node++)
+			nodes[nb++] = node;
+	}
+	g_strfreev(ranges);
+	g_free(content);
+	return nb;
+}
+
+/* the siril-cli installed with this executable, or the one in the path */
+static gchar *find_worker_program() {
+	gchar *path = NULL;
+	gchar *self = g_file_read_link("/proc/self/exe", NULL);
+	if (self) {
+		gchar *dir = g_path_get_dirname(self);
+		path = g_build_filename(dir, STACK_WORKER_PROGRAM, NULL);
+		g_free(dir);
+		g_free(self);
+		if (!g_file_test(path, G_FILE_TEST_IS_EXECUTABLE)) {
+			g_free(path);
+			path = NULL;
+		}
+	}
+	if (!path)
+		path = g_find_program_in_path(STACK_WORKER_PROGRAM);
+	return path;
+}
+
+static GSubprocess *start_worker(GSubprocessLauncher *launcher, const gchar *program,
+		const gchar *numactl, int node, const gchar *script) {
+	GError *error = NULL;
+	GPtrArray *argv = g_ptr_array_new_with_free_func(g_free);
+	if (numactl) {
+		g_ptr_array_add(argv, g_strdup(numactl));
+		g_ptr_array_add(argv, g_strdup_printf("--cpunodebind=%d", node));
+		g_ptr_array_add(argv, g_strdup_printf("--membind=%d", node));
+	}
+	g_ptr_array_add(argv, g_strdup(program));
+	g_ptr_array_add(argv, g_strdup("-d"));
+	g_ptr_array_add(argv, g_strdup(com.wd));
+	g_ptr_array_add(argv, g_strdup("-s"));
+	g_ptr_array_add(argv, g_strdup(script));
+	g_ptr_array_add(argv, NULL);
+
+	GSubprocess *process = g_subprocess_launcher_spawnv(launcher,
+			(const gchar * const *) argv->pdata, &error);
+	if (!process) {
+		siril_log_color_message(_("Could not start the stacking worker: %s\n"), "red", error->message);
+		g_clear_error(&error);
+	}
+	g_ptr_array_free(argv, TRUE);
+	return process;
+}
+
+/* reads a band saved by a worker and copies it in dest, allocated with the
+ * size of the full image from the first band */
+static int merge_band(fits **dest, gboolean first, const char *filename,
+		int band_start, int band_height, int height) {
+	fits band = { 0 };
+	if (readfits(filename, &band, NULL, FALSE)) {
+		siril_log_color_message(_("Could not read the band stacked in %s\n"), "red", filename);
+		return 1;
+	}
+	if (band.ry != band_height) {
+		siril_log_color_message(_("The band stacked in %s does not have the expected size\n"), "red", filename);
+		clearfits(&band);
+		return 1;
+	}
+	if (first) {
+		if (new_fit_image(dest, band.rx, height, band.naxes[2], band.type)) {
+			clearfits(&band);
+			return 1;
+		}
+		copy_fits_metadata(&band, *dest);
+		(*dest)->bitpix = band.bitpix;
+		(*dest)->orig_bitpix = band.orig_bitpix;
+		(*dest)->expstart = band.expstart;
+		(*dest)->expend = band.expend;
+	} else if ((*dest)->type != band.type || (*dest)->rx != band.rx ||
+			(*dest)->naxes[2] != band.naxes[2]) {
+		siril_log_color_message(_("The band stacked in %s does not have the expected format\n"), "red", filename);
+		clearfits(&band);
+		return 1;
+	}
+
+	/* the result is stored bottom-up: the first row read, band_start, is the
+	 * last one of the band */
+	size_t offset = (size_t)(height - band_start - band_height) * band.rx;
+	size_t npixels = (size_t)band_height * band.rx;
+	for (int layer = 0; layer < band.naxes[2]; layer++) {
+		if (band.type == DATA_FLOAT)
+			memcpy((*dest)->fpdata[layer] + offset, band.fpdata[layer], npixels * sizeof(float));
+		else	memcpy((*dest)->pdata[layer] + offset, band.pdata[layer], npixels * sizeof(WORD));
+	}
+	clearfits(&band);
+	return 0;
+}
+
+static int merge_map(struct stack_worker *workers, int nb_workers, int height,
+		fits **map, const char *suffix) {
+	for (int k = 0; k < nb_workers; k++) {
+		gchar *filename = get_stacking_map_filename(workers[k].result, suffix);
+		int retval = merge_band(map, k == 0, filename, workers[k].band_start,
+				workers[k].band_height, height);
+		g_free(filename);
+		if (retval)
+			return 1;
+	}
+	return 0;
+}
+
+/* sums the rejected pixel counts of the bands and logs them like the
+ * stacking of the whole image would */
+static void log_rejection_counts(struct stack_worker *workers, int nb_workers) {
+	guint64 rejected[3][2] = {{0,0}, {0,0}, {0,0}};
+	double nb_tot = 0.0;
+	for (int k = 0; k < nb_workers; k++) {
+		if (read_rejection_counts(workers[k].result, rejected, &nb_tot)) {
+			siril_log_message(_("Rejection statistics of the band %d are not available\n"), k);
+			return;
+		}
+	}
+	if (nb_tot <= 0.0)
+		return;
+	for (int channel = 0; channel < gfit.naxes[2] && channel < 3; channel++) {
+		siril_log_message(_("Pixel rejection in channel #%d: %.3lf%% - %.3lf%%\n"),
+				channel, (double) rejected[channel][0] / nb_tot * 100.0,
+				(double) rejected[channel][1] / nb_tot * 100.0);
+	}
+}
+
+static void remove_directory_files(const gchar *path) {
+	GDir *dir = g_dir_open(path, 0, NULL);
+	if (dir) {
+		const gchar *file;
+		while ((file = g_dir_read_name(dir)) != NULL) {
+			gchar *filename = g_build_filename(path, file, NULL);
+			g_unlink(filename);
+			g_free(filename);
+		}
+		g_dir_close(dir);
+	}
+	g_rmdir(path);
+}
+
+/* Stacks the sequence with args->nb_workers siril-cli processes, each
+ * running args->worker_command on a band of the image. The normalization
+ * has already been computed and saved in the sequence file, so the workers
+ * only read it. The result is put in gfit, maps in args. */
+int stack_with_workers(struct stacking_args *args) {
+	int nb_workers = args->nb_workers, height = args->seq->ry;
+	int retval = ST_OK, nodes[MAX_NUMA_NODES];
+	GError *error = NULL;
+
+	if (args->method != stack_mean_with_rejection && args->method != stack_median) {
+		siril_log_color_message(_("Only median and average stacking can be distributed\n"), "red");
+		return ST_GENERIC_ERROR;
+	}
+	if (nb_workers > height)
+		nb_workers = height;
+
+	gchar *program = find_worker_program();
+	if (!program) {
+		siril_log_color_message(_("Could not find %s to run the stacking workers\n"), "red", STACK_WORKER_PROGRAM);
+		return ST_GENERIC_ERROR;
+	}
+	gchar *tmpdir = g_dir_make_tmp("siril_stack_XXXXXX", &error);
+	if (!tmpdir) {
+		siril_log_color_message(_("Could not create the directory for the stacking workers: %s\n"), "red", error->message);
+		g_clear_error(&error);
+		g_free(program);
+		return ST_GENERIC_ERROR;
+	}
+
+	/* bind workers to NUMA nodes in turn if the machine has several */
+	int nb_nodes = get_numa_nodes(nodes, MAX_NUMA_NODES);
+	gchar *numactl = nb_nodes > 1 ? g_find_program_in_path("numactl") : NULL;
+	if (nb_nodes > 1 && !numactl)
+		siril_log_message(_("numactl was not found, stacking workers will not be bound to NUMA nodes\n"));
+	/* a worker bound to its own node uses all its cores, otherwise share them */
+	gchar *setcpu = NULL;
+	if (!numactl || nb_workers > nb_nodes)
+		setcpu = g_strdup_printf("setcpu %d\n", max(1, com.max_thread / nb_workers));
+	/* each worker computes its number of rows from the memory of the
+	 * machine, they have to share it */
+	char ratio[G_ASCII_DTOSTR_BUF_SIZE];
+	g_ascii_formatd(ratio, sizeof ratio, "%g",
+			max(0.05, com.pref.stack.memory_ratio / nb_workers));
+
+	siril_log_message(_("Stacking with %d worker processes\n"), nb_workers);
+	struct stack_worker *workers = calloc(nb_workers, sizeof(struct stack_worker));
+	GSubprocessLauncher *launcher = g_subprocess_launcher_new(G_SUBPROCESS_FLAGS_NONE);
+	int row = 0;
+	for (int k = 0; k < nb_workers; k++) {
+		struct stack_worker *worker = workers + k;
+		worker->band_start = row;
+		worker->band_height = height / nb_workers + (k < height % nb_workers ? 1 : 0);
+		row += worker->band_height;
+
+		gchar *name = g_strdup_printf("band_%d%s", k, com.pref.ext);
+		worker->result = g_build_filename(tmpdir, name, NULL);
+		g_free(name);
+		name = g_strdup_printf("band_%d.ssf", k);
+		gchar *script = g_build_filename(tmpdir, name, NULL);
+		g_free(name);
+		gchar *content = g_strdup_printf("requires %s\n%ssetmem %s\n%s -band=%d,%d \"-out=%s\"\n",
+				PACKAGE_VERSION, setcpu ? setcpu : "", ratio, args->worker_command,
+				worker->band_start, worker->band_height, worker->result);
+		if (!g_file_set_contents(script, content, -1, &error)) {
+			siril_log_color_message(_("Could not write the stacking worker script: %s\n"), "red", error->message);
+			g_clear_error(&error);
+		} else {
+			worker->process = start_worker(launcher, program, numactl,
+					numactl ? nodes[k % nb_nodes] : 0, script);
+		}
+		g_free(content);
+		g_free(script);
+		if (!worker->process) {
+			retval = ST_GENERIC_ERROR;
+			break;
+		}
+	}
+	g_object_unref(launcher);
+
+	/* wait for all workers, a process has no identifier once it exited */
+	set_progress_bar_data(_("Distributed stacking in progress..."), PROGRESS_RESET);
+	int nb_running;
+	do {
+		nb_running = 0;
+		for (int k = 0; k < nb_workers; k++) {
+			if (!workers[k].process || !g_subprocess_get_identifier(workers[k].process))
+				continue;
+			if (retval || !get_thread_run())
+				g_subprocess_force_exit(workers[k].process);
+			nb_running++;
+		}
+		if (!get_thread_run())
+			retval = ST_GENERIC_ERROR;
+		set_progress_bar_data(NULL, (double)(nb_workers - nb_running) / nb_workers);
+		if (nb_running)
+			g_usleep(200000);
+	} while (nb_running);
+
+	for (int k = 0; k < nb_workers && !retval; k++) {
+		g_subprocess_wait(workers[k].process, NULL, NULL);
+		if (!g_subprocess_get_successful(workers[k].process)) {
+			siril_log_color_message(_("Stacking worker %d failed\n"), "red", k);
+			retval = ST_GENERIC_ERROR;
+		}
+	}
+
+	if (!retval) {
+		set_progress_bar_data(_("Merging stacked bands..."), PROGRESS_PULSATE);
+		fits *result = &gfit;
+		for (int k = 0; k < nb_workers && !retval; k++) {
+			if (merge_band(&result, k == 0, workers[k].result,
+						workers[k].band_start, workers[k].band_height, height))
+				retval = ST_GENERIC_ERROR;
+		}
+		/* output normalization of 32-bit results works on the whole image */
+		if (!retval && args->output_norm && gfit.type == DATA_FLOAT)
+			norm_to_0_1_range(&gfit);
+
+		if (!retval && args->method == stack_mean_with_rejection)
+			log_rejection_counts(workers, nb_workers);
+
+		if (!retval && args->create_rejmaps && args->type_of_rejection != NO_REJEC &&
+				(merge_map(workers, nb_workers, height, &args->rejmap_low, "low_rejmap") ||
+				 merge_map(workers, nb_workers, height, &args->rejmap_high, "high_rejmap")))
+			retval = ST_GENERIC_ERROR;
+		if (!retval && args->create_weightmap &&
+				merge_map(workers, nb_workers, height, &args->weightmap, "weightmap"))
+			retval = ST_GENERIC_ERROR;
+		if (retval)
+			free_stacking_maps(args);
+	}
+
+	for (int k = 0; k < nb_workers; k++) {
+		if (workers[k].process)
+			g_object_unref(workers[k].process);
+		g_free(workers[k].result);
+	}
+	free(workers);
+	remove_directory_files(tmpdir);
+	g_free(tmpdir);
+	g_free(numactl);
+	g_free(setcpu);
+	g_free(program);
+	set_progress_bar_data(NULL, PROGRESS_DONE);
+	return retval;
+}
@@ -160,7 +160,9 @@ void main_stack(struct stacking_args *args) {
 	if (upscale_sequence(args)) // does nothing if args->seq->upscale_at_stacking <= 1.05
 		return;
 	// 3. stack
-	args->retval = args->method(args);
+	if (args->nb_workers > 1)
+		args->retval = stack_with_workers(args);
+	else args->retval = args->method(args);
 }
 
 /* the function that runs the thread. */
@@ -351,6 +353,127 @@ static void _show_bgnoise(gpointer p) {
 	start_in_new_thread(noise, args);
 }
 
+/* the sequence from which the frame of the stack is read */
+sequence *stack_frame_seq(struct stacking_args *args, int frame) {
+	if (!args->sessions)
+		return args->seq;
+	int s = 0;
+	while (s < args->nb_sessions - 1 && frame >= args->session_first_frame[s + 1])
+		s++;
+	return args->sessions[s];
+}
+
+/* the reference image belongs to the first session, it has to be looked for
+ * in its frames only since image indices of other sessions can be the same */
+int stack_nb_frames_of_first_session(struct stacking_args *args) {
+	if (!args->sessions)
+		return args->nb_images_to_stack;
+	return args->session_first_frame[1];
+}
+
+/* name of the map file of type suffix for the stacking result file */
+gchar *get_stacking_map_filename(const char *result_filename, const char *suffix) {
+	char *basename = remove_ext_from_filename(result_filename);
+	gchar *filename = g_strdup_printf("%s_%s%s", basename, suffix, com.pref.ext);
+	free(basename);
+	return filename;
+}
+
+static int save_one_map(fits *map, const char *result_filename, const char *suffix) {
+	if (!map)
+		return 0;
+	gchar *filename = get_stacking_map_filename(result_filename, suffix);
+	int retval = savefits(filename, map);
+	if (retval)
+		siril_log_color_message(_("Could not save the map %s\n"), "red", filename);
+	else siril_log_message(_("Map saved as %s\n"), filename);
+	g_free(filename);
+	return retval;
+}
+
+/* saves the rejection and weight maps computed during the stacking, next to
+ * the result file, with a suffix indicating their content */
+int save_stacking_maps(struct stacking_args *args, const char *result_filename) {
+	if (!args->rejmap_low && !args->weightmap)
+		return 0;
+	int retval = save_one_map(args->rejmap_low, result_filename, "low_rejmap");
+	retval |= save_one_map(args->rejmap_high, result_filename, "high_rejmap");
+	retval |= save_one_map(args->weightmap, result_filename, "weightmap");
+	return retval;
+}
+
+static gchar *get_rejection_counts_filename(const char *result_filename) {
+	char *basename = remove_ext_from_filename(result_filename);
+	gchar *filename = g_strdup_printf("%s_rejstats.txt", basename);
+	free(basename);
+	return filename;
+}
+
+/* saves the rejected pixel counts of a band next to it, one line per channel,
+ * for the process that merges the bands to report them */
+int save_rejection_counts(struct stacking_args *args, const char *result_filename) {
+	GString *content = g_string_new(NULL);
+	/* the sequence may already be freed, the result is in gfit */
+	for (int channel = 0; channel < gfit.naxes[2] && channel < 3; channel++)
+		g_string_append_printf(content, "%d %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %.0f\n",
+				channel, args->rejected[channel][0], args->rejected[channel][1],
+				args->nb_rejection_tested);
+	gchar *filename = get_rejection_counts_filename(result_filename);
+	GError *error = NULL;
+	int retval = 0;
+	if (!g_file_set_contents(filename, content->str, content->len, &error)) {
+		siril_log_color_message(_("Could not save the rejection statistics: %s\n"), "red", error->message);
+		g_clear_error(&error);
+		retval = 1;
+	}
+	g_free(filename);
+	g_string_free(content, TRUE);
+	return retval;
+}
+
+/* adds the rejected pixel counts saved with a band to rejected and nb_tested */
+int read_rejection_counts(const char *result_filename, guint64 rejected[3][2], double *nb_tested) {
+	gchar *filename = get_rejection_counts_filename(result_filename);
+	gchar *content = NULL;
+	int retval = 1;
+	if (g_file_get_contents(filename, &content, NULL, NULL)) {
+		gchar **lines = g_strsplit(content, "\n", -1);
+		for (int i = 0; lines[i]; i++) {
+			int channel;
+			guint64 low, high;
+			double tested;
+			if (sscanf(lines[i], "%d %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %lf",
+						&channel, &low, &high, &tested) != 4 ||
+					channel < 0 || channel > 2)
+				continue;
+			rejected[channel][0] += low;
+			rejected[channel][1] += high;
+			/* all channels are tested on the same number of pixels */
+			if (channel == 0)
+				*nb_tested += tested;
+			retval = 0;
+		}
+		g_strfreev(lines);
+		g_free(content);
+	}
+	g_free(filename);
+	return retval;
+}
+
+static void free_one_map(fits **map) {
+	if (*map) {
+		clearfits(*map);
+		free(*map);
+		*map = NULL;
+	}
+}
+
+void free_stacking_maps(struct stacking_args *args) {
+	free_one_map(&args->rejmap_low);
+	free_one_map(&args->rejmap_high);
+	free_one_map(&args->weightmap);
+}
+
 void clean_end_stacking(struct stacking_args *args) {
 	if (!args->retval)
 		_show_summary(args);
@@ -414,6 +537,9 @@ static gboolean end_stacking(gpointer p) {
 					com.uniq->fileexist = FALSE;
 				}
 			}
+			save_stacking_maps(args, args->output_filename);
+			if (args->band_height > 0 && args->method == stack_mean_with_rejection)
+				save_rejection_counts(args, args->output_filename);
 			display_filename();
 			set_precision_switch(); // set precision on screen
 		}
@@ -894,5 +1020,6 @@ static void stacking_args_deep_free(struct stacking_args *args) {
 	free(args->image_indices);
 	free(args->description);
 	free(args->critical_value);
+	free_stacking_maps(args);
 	free(args);
 }
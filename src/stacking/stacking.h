@@ -93,6 +93,35 @@ struct stacking_args {
 	gboolean apply_weight;			/* enable weights */
 	double *weights; 				/* computed weights for each (layer,image)*/
 
+	gboolean create_rejmaps;	/* output low and high rejection count maps */
+	gboolean create_weightmap;	/* output the effective weight map */
+	fits *rejmap_low, *rejmap_high;	/* rejection counts per pixel, filled while stacking */
+	fits *weightmap;		/* sum of the weights of kept pixels, filled while stacking */
+
+	/* multi-session stacking: images of several sequences registered on the
+	 * same reference frame are stacked in a single pass. seq is sessions[0],
+	 * frames of session s are image_indices[session_first_frame[s]] up to
+	 * image_indices[session_first_frame[s + 1] - 1] of sessions[s]. */
+	sequence **sessions;	/* NULL when stacking a single sequence */
+	int nb_sessions;
+	int *session_first_frame;	/* nb_sessions + 1 elements */
+
+	/* distributed stacking: the image is split in horizontal bands, each
+	 * stacked by a siril-cli worker process, results are merged after */
+	int nb_workers;		/* 0 or 1: stack in this process */
+	gchar *worker_command;	/* stack command run by the workers, without -out */
+	int band_start, band_height;	/* if band_height > 0, only stack these rows (reading coordinates) */
+	guint64 rejected[3][2];	/* low and high rejected pixels per channel, saved with bands */
+	double nb_rejection_tested;	/* number of pixels the counts above refer to */
+
+	int decimation;		/* preview: stack frames binned by this factor if > 1 */
+
+	/* master frame creation: the master bias, or the offset level if bias is
+	 * NULL, is subtracted from the frames while they are read */
+	fits *bias;
+	float bias_level;	/* in [0, 1], 0 for none */
+	double bias_location[3];	/* location of the bias, for normalization */
+
 	float (*sd_calculator)(const WORD *, const int); // internal, for ushort
 	float (*mad_calculator)(const WORD *, const size_t, const double, gboolean) ; // internal, for ushort
 };
@@ -112,6 +141,17 @@ struct stacking_configuration {
 	float f_fwhm, f_fwhm_p, f_wfwhm, f_wfwhm_p, f_round, f_round_p, f_quality, f_quality_p; // on if >0
 	gboolean filter_included;
 	gboolean apply_weight;
+	gboolean create_rejmaps;
+	gboolean create_weightmap;
+	gchar **seqfiles;	/* for multi-session stacking, NULL-terminated */
+	int nb_seqfiles;
+	int nb_workers;
+	gchar *worker_options;	/* stacking options passed to the workers */
+	int band_start, band_height;
+	int decimation;
+	gboolean calibrate;	/* -bias= is allowed, for makemaster */
+	fits *bias;
+	float bias_level;
 };
 
 
@@ -137,6 +177,13 @@ int stack_addmin(struct stacking_args *args);
 
 void main_stack(struct stacking_args *args);
 void clean_end_stacking(struct stacking_args *args);
+int save_stacking_maps(struct stacking_args *args, const char *result_filename);
+int save_rejection_counts(struct stacking_args *args, const char *result_filename);
+int read_rejection_counts(const char *result_filename, guint64 rejected[3][2], double *nb_tested);
+gchar *get_stacking_map_filename(const char *result_filename, const char *suffix);
+sequence *stack_frame_seq(struct stacking_args *args, int frame);
+int stack_nb_frames_of_first_session(struct stacking_args *args);
+void free_stacking_maps(struct stacking_args *args);
 
 void get_sequence_filtering_from_gui(seq_image_filter *filtering_criterion,
 		double *filtering_parameter);
@@ -169,11 +216,20 @@ struct _data_block {
 	void *w_stack;	// stack for the winsorized rejection
 	void *o_stack;  // original unordered stack
 	float *xf, *yf, m_x, m_dx2;// data for the linear fit rejection
+	float *frows;	// one row of the block for all images, normalized and widened to float
+	void *binned_src;	// full resolution rows read for one image of a binned block
+	void *warp_src;		// source rows read for one image with a stored transformation
+	size_t warp_src_size;	// allocated size of warp_src, for the source rows of the largest block
 	int layer;	// to identify layer for normalization
 };
 
 int stack_open_all_files(struct stacking_args *args, int *bitpix, int *naxis, long *naxes, GList **date_time, fits *fit);
 int find_refimage_in_indices(int *indices, int nb, int ref);
+void norm_to_0_1_range(fits *fit);
+
+	/* distributed stacking, stack_workers.c */
+
+int stack_with_workers(struct stacking_args *args);
 
 	/* up-scaling functions */
 
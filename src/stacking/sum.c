@@ -27,6 +27,7 @@
 #include "io/sequence.h"
 #include "io/ser.h"
 #include "io/image_format_fits.h"
+#include "algos/warp.h"
 #include "stacking.h"
 #include "gui/progress_and_log.h"
 
@@ -88,7 +89,14 @@ static int sum_stacking_image_hook(struct generic_seq_args *args, int o, int i,
 #endif
 	ssdata->exposure += fit->exposure;
 	
-	if (ssdata->reglayer != -1 && args->seq->regparam[ssdata->reglayer]) {
+	if (ssdata->reglayer != -1 && seq_frame_needs_warp(args->seq, ssdata->reglayer, i)) {
+		Homography H;
+		seq_get_frame_transform(args->seq, ssdata->reglayer, i, &H);
+		if (warp_image(fit, fit->rx, fit->ry, &H, FALSE, WARP_DEFAULT_INTERPOLATION))
+			return ST_GENERIC_ERROR;
+		shiftx = 0;
+		shifty = 0;
+	} else if (ssdata->reglayer != -1 && args->seq->regparam[ssdata->reglayer]) {
 		shiftx = round_to_int(args->seq->regparam[ssdata->reglayer][i].shiftx * (float)args->seq->upscale_at_stacking);
 		shifty = round_to_int(args->seq->regparam[ssdata->reglayer][i].shifty * (float)args->seq->upscale_at_stacking);
 	} else {
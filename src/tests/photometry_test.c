@@ -212,5 +212,25 @@ void test_photometry_ushort() {
 	free_psf(psf);
 }
 
+/* the fast fit has no angle, only the position is expected to match the
+ * full minimization, on a window centred on the star */
+void test_psf_fast() {
+	float window[60 * 60];
+	for (int i = 0; i < 60; i++)
+		for (int j = 0; j < 60; j++)
+			window[i * 60 + j] = star[(i + 25) * WIDTH + j + 22];
+	psf_star *psf = psf_fast_minimisation(window, 60, 60, BG);
+
+	cr_assert(psf, "fast psf failed");
+	cr_expect_float_eq(psf->x0 + 22, 51.77f, 1e-2);
+	cr_expect_float_eq(psf->y0 + 25, 54.74f, 1e-2);
+	cr_expect_float_eq(psf->fwhmx, 8.00f, 1e-2);
+	cr_expect_float_eq(psf->fwhmy, 7.34f, 1e-2);
+	cr_expect_float_eq(psf->A, 0.329f, 1e-3);
+
+	free_psf(psf);
+}
+
 Test(science, psf_float) { test_photometry_float(); }
 Test(science, psf_ushort) { test_photometry_ushort(); }
+Test(science, psf_fast) { test_psf_fast(); }
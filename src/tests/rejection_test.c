@@ -21,6 +21,7 @@
 #include <criterion/criterion.h>
 #include <gsl/gsl_statistics_float.h>
 #include <gsl/gsl_cdf.h>
+#include <glib/gstdio.h>
 
 #include "core/siril.h"
 #include "stacking/rejection_float.c"
@@ -87,3 +88,44 @@ void test_GESDT_float() {
 }
 
 Test(science, psf_float) { test_GESDT_float(); }
+
+/* the rejection counts saved by the workers for their band are summed by the
+ * process merging the bands */
+void test_band_rejection_counts() {
+	struct stacking_args args = { 0 };
+	guint64 rejected[3][2] = {{0,0}, {0,0}, {0,0}};
+	double nb_tested = 0.0;
+	gchar *band[2];
+
+	gfit.naxes[2] = 3;
+	for (int k = 0; k < 2; k++) {
+		gchar *name = g_strdup_printf("siril_test_band%d.fit", k);
+		band[k] = g_build_filename(g_get_tmp_dir(), name, NULL);
+		g_free(name);
+		for (int channel = 0; channel < 3; channel++) {
+			args.rejected[channel][0] = 10 * (k + 1) + channel;
+			args.rejected[channel][1] = 100 * (k + 1) + channel;
+		}
+		args.nb_rejection_tested = 1000.0 * (k + 1);
+		cr_expect_eq(save_rejection_counts(&args, band[k]), 0);
+	}
+
+	for (int k = 0; k < 2; k++)
+		cr_expect_eq(read_rejection_counts(band[k], rejected, &nb_tested), 0);
+	for (int channel = 0; channel < 3; channel++) {
+		cr_expect_eq(rejected[channel][0], 30 + 2 * channel);
+		cr_expect_eq(rejected[channel][1], 300 + 2 * channel);
+	}
+	cr_expect_float_eq(nb_tested, 3000.0, 1e-6);
+
+	for (int k = 0; k < 2; k++) {
+		gchar *base = g_strndup(band[k], strlen(band[k]) - 4);
+		gchar *stats = g_strdup_printf("%s_rejstats.txt", base);
+		g_unlink(stats);
+		g_free(stats);
+		g_free(base);
+		g_free(band[k]);
+	}
+}
+
+Test(stacking, band_rejection_counts) { test_band_rejection_counts(); }